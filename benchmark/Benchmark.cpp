@@ -0,0 +1,770 @@
+/**
+ * @file      Benchmark.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Headless benchmark of the CPU solvers: needs no Kinect, no window and no GLUT.
+ *
+ * Every configuration of a sweep over grid sizes, user counts and boundary densities runs
+ * the simulation steps of fluidWall (bounds from a silhouette mask, splashes at the top
+ * of the silhouettes, solver update) and reports the median and 95th percentile time of
+ * each stage in nanoseconds per cell per step, so builds and kernels can be compared.
+ *
+ * The silhouettes are synthetic people swaying in front of the wall, sized to cover the
+ * requested fraction of the grid, or the frames of a recording made with the 'r' key of
+ * fluidWall (see KinectRecorder), in which case the boundary density is what was recorded.
+ *
+ * With -quality, the benchmark instead measures what the advection schemes cost and how 
+ * much they blur: a disc of density is carried once around a solid body rotation, and 
+ * the difference to the starting disc is reported next to the advection time.
+ *
+ * With -tiles, it checks that two tiles joined by a HaloLink simulate what one solver of
+ * both their widths does, and fails if the densities differ by more than TILE_TOLERANCE.
+ * With -activity, it checks that the activity tracking of FluidSolverMultiUser diffuses a
+ * point source like a solver that works on every tile.
+ *
+ * The measured steps must not allocate: once the warm-up steps have sized every buffer,
+ * the solvers only reuse them. Every configuration counts the heap allocations of its 
+ * measured steps (see AllocationCounter), and the benchmark fails if any were made.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "FluidSolver.h"
+#include "FluidSolverMultiUser.h"
+#include "KinectRecording.h"
+#include "Profiler.h"
+#include "AllocationCounter.h"
+#include "HaloExchange.h"
+#include "Threading.h"
+
+using namespace std;
+
+const static int   GRID_SIZES[]       = { 64, 128, 256 };
+const static int   USER_COUNTS[]      = { 0, 2, 4, 7, 13 };	//0 runs FluidSolver; user 0 is implicit, so 1 - 12 people
+const static float BOUND_DENSITIES[]  = { 0.0f, 0.1f, 0.3f };	//fraction of the cells covered by silhouettes
+const static int   WARMUP_STEPS       = 20;
+const static int   DEFAULT_STEPS      = 200;
+const static int   REPLAY_DEPTH       = 3000;	//depth threshold of recorded frames, fluidWall's INIT_DEPTH
+const static int   SPLASH_SPACING     = 4;		//columns between splashes along the top of a silhouette
+const static float SPLASH_DENSITY     = 20.0f;	//fluidWall's source
+const static int   QUALITY_GRID_SIZES[] = { 64, 96, 128, 192 };
+const static float PI                 = 3.14159265f;
+const static int   TILE_WIDTH         = 32;		//two tiles side by side make the reference grid
+const static int   TILE_HEIGHT        = 48;
+const static int   TILE_STEPS         = 60;
+const static int   TILE_TIMEOUT       = 50;		//milliseconds, as fluidWall's TILE_HALO_TIMEOUT
+const static int   TILE_SKEW          = 100;	//steps one link is ahead in the late start test
+const static int   TILE_UDP_PORT      = 47001;
+const static float TILE_TOLERANCE     = 0.001f;	//largest L1 difference relative to the mass
+const static int   ACTIVITY_STEPS     = 40;
+const static float ACTIVITY_DIFFUSION[] = { 0.0005f, 0.005f };
+
+const static ProfileStage REPORTED_STAGES[] = {
+	PROFILE_BOUNDS, PROFILE_EMIT_SPLASHES, PROFILE_SOLVER_UPDATE,
+	PROFILE_DIFFUSE, PROFILE_ADVECT, PROFILE_PROJECT
+};
+
+#define COUNT_OF(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+struct Options {
+	int         steps;
+	const char* replayPath;
+	const char* csvPath;
+	bool        scalar;     //reference kernels instead of the fastest instruction set
+	bool        multigrid;  //multigrid pressure solver instead of relaxation
+	bool        maccormack; //MacCormack advection instead of semi-Lagrangian
+	bool        vorticity;  //vorticity confinement and buoyancy in the forcing stage
+	bool        quality;    //run the advection quality test instead of the sweep
+	bool        tiles;      //run the tile halo test instead of the sweep
+	bool        activity;   //run the activity tracking test instead of the sweep
+	FluidSolverMultiUser::DensityStorage storage;	//number format of the user channels
+};
+
+/**
+ * Source of the silhouette of every step: an N x N mask (non zero is a boundary) and the
+ * user number of every pixel.
+ */
+class SilhouetteSource
+{
+public:
+	virtual ~SilhouetteSource(void) {}
+	virtual void next(vector<unsigned char>& mask, vector<unsigned char>& users) = 0;
+};
+
+
+
+/**
+ * People as upright ellipses swaying sideways. One person per user besides the implicit 
+ * user 0, one for the single color solver. The ellipses get wide enough to cover the requested fraction of the grid.
+ */
+class SyntheticSilhouettes : public SilhouetteSource
+{
+public:
+	SyntheticSilhouettes(int N, int nPeople, float density) : N_(N), nPeople_(nPeople), step_(0)
+	{
+		height_ = 0.6f * N;
+		width_  = density * N * N / (nPeople * PI / 4.0f * height_);
+		if (width_ > (float)N / nPeople)
+			width_ = (float)N / nPeople;
+	}
+
+	void next(vector<unsigned char>& mask, vector<unsigned char>& users)
+	{
+		fill(mask.begin(), mask.end(), 0);
+		fill(users.begin(), users.end(), 0);
+		if (width_ < 1.0f)
+			return;
+
+		float a = width_ / 2.0f, b = height_ / 2.0f;
+		for (int k = 0; k < nPeople_; k++) {
+			float cx = (k + 0.5f) * N_ / nPeople_ + sinf(0.05f * step_ + k) * 0.05f * N_;
+			float cy = b + sinf(0.08f * step_ + 2.0f * k) * 0.02f * N_;
+
+			int x0 = max(0, (int)(cx - a)), x1 = min(N_ - 1, (int)(cx + a));
+			int y0 = max(0, (int)(cy - b)), y1 = min(N_ - 1, (int)(cy + b));
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					float dx = (x - cx) / a, dy = (y - cy) / b;
+					if (dx * dx + dy * dy <= 1.0f) {
+						mask [x + N_ * y] = 255;
+						users[x + N_ * y] = (unsigned char)(k + 1);
+					}
+				}
+			}
+		}
+		step_++;
+	}
+
+private:
+	int   N_, nPeople_, step_;
+	float width_, height_;
+};
+
+
+
+/**
+ * Frames of a recording, sampled down to the grid and mirrored like KinectController does.
+ */
+class RecordedSilhouettes : public SilhouetteSource
+{
+public:
+	RecordedSilhouettes(KinectPlayback& playback, int N) : playback_(playback), N_(N)
+	{
+		depth_.resize(playback.getCols() * playback.getRows());
+		labels_.resize(depth_.size());
+	}
+
+	void next(vector<unsigned char>& mask, vector<unsigned char>& users)
+	{
+		int cols = playback_.getCols(), rows = playback_.getRows();
+		playback_.read(&depth_[0], &labels_[0]);
+
+		for (int y = 0; y < N_; y++) {
+			const unsigned short* depthRow = &depth_ [((N_ - 1 - y) * rows / N_) * cols];
+			const unsigned short* labelRow = &labels_[((N_ - 1 - y) * rows / N_) * cols];
+			for (int x = 0; x < N_; x++) {
+				int sx    = cols - 1 - x * cols / N_;
+				int depth = depthRow[sx];
+				bool isSilhouette = depth > 0 && depth < REPLAY_DEPTH;
+				mask [x + N_ * y] = isSilhouette ? 255 : 0;
+				users[x + N_ * y] = isSilhouette ? (unsigned char)min((int)labelRow[sx], 255) : 0;
+			}
+		}
+	}
+
+private:
+	KinectPlayback&        playback_;
+	int                    N_;
+	vector<unsigned short> depth_, labels_;
+};
+
+
+
+/**
+ * Adds a splash above the top edge of the silhouette every SPLASH_SPACING columns, 
+ * like the optical flow splashes of fluidWall. Returns the number of splashes.
+ */
+static int buildSplashes(const vector<unsigned char>& mask, const vector<unsigned char>& users,
+						 int N, int nUsers, int step, vector<FluidSolver::Splat>& splats)
+{
+	splats.clear();
+	for (int x = (step % SPLASH_SPACING); x < N; x += SPLASH_SPACING) {
+		for (int y = N - 1; y > 0; y--) {
+			if (mask[x + N * y] == 0 && mask[x + N * (y - 1)] != 0) {
+				//fluidWall uses the label as the density channel; labels beyond the last
+				//user wrap around to user 1, never to the implicit user 0
+				int user = users[x + N * (y - 1)];
+				if (nUsers > 1 && user > 0)
+					user = 1 + (user - 1) % (nUsers - 1);
+				else
+					user = 1;
+				FluidSolver::Splat splat = { x + 1, y + 1, 3, 0.3f * sinf(0.1f * x + step), 
+											 0.8f, SPLASH_DENSITY, user };
+				splats.push_back(splat);
+				break;
+			}
+		}
+	}
+	return (int)splats.size();
+}
+
+
+
+/**
+ * Runs one configuration and prints (and optionally writes) its stage times. The bounds 
+ * column is the measured fraction of bound cells, so it also describes replays. Returns the
+ * number of heap allocations made during the measured steps.
+ */
+static long runConfiguration(const Options& options, int N, int nUsers, SilhouetteSource& silhouettes,
+							 FILE* csv)
+{
+	FluidSolver* solver;
+	if (nUsers > 0) {
+		FluidSolverMultiUser* userSolver = new FluidSolverMultiUser(nUsers, N, 0.1f, 0.0f, 0.0f);
+		userSolver->setDensityStorage(options.storage);
+		solver = userSolver;
+	}
+	else
+		solver = new FluidSolver(N, 0.1f, 0.0f, 0.0f);
+	solver->reset();	//the fields are not cleared by the constructor
+	solver->setLinearSolver(FluidSolver::RED_BLACK_GAUSS_SEIDEL);
+	if (options.scalar)
+		solver->setInstructionSet(INSTRUCTIONS_SCALAR);
+	if (options.multigrid)
+		solver->setPressureSolver(FluidSolver::PRESSURE_MULTIGRID);
+	if (options.maccormack)
+		solver->setAdvectionScheme(FluidSolver::ADVECT_MACCORMACK);
+	if (options.vorticity) {
+		solver->setVorticityConfinement(1.0f);
+		solver->setBuoyancy(0.2f);
+	}
+
+	vector<unsigned char>      mask(N * N), users(N * N);
+	vector<FluidSolver::Splat> splats(N / SPLASH_SPACING + 1);	//one per splash column at most
+	long long                  boundCells = 0;
+	Profiler&                  profiler   = getProfiler();
+	long                       allocationStart = 0;
+
+	for (int step = 0; step < WARMUP_STEPS + options.steps; step++) {
+		if (step == WARMUP_STEPS) {
+			profiler.clear();
+			allocationStart = getThreadAllocationCount();
+		}
+
+		silhouettes.next(mask, users);
+		{
+			ScopedTimer timer(PROFILE_BOUNDS);
+			solver->setBoundsFromMask(&mask[0], N, N, N);
+		}
+		{
+			ScopedTimer timer(PROFILE_EMIT_SPLASHES);
+			int nSplats = buildSplashes(mask, users, N, nUsers, step, splats);
+			if (nSplats > 0)
+				solver->addSplats(&splats[0], nSplats);
+		}
+		{
+			ScopedTimer timer(PROFILE_SOLVER_UPDATE);
+			solver->update();
+		}
+		profiler.commit(PROFILE_SIMULATION);
+
+		if (step >= WARMUP_STEPS)
+			for (int c = 0; c < N * N; c++)
+				boundCells += mask[c] != 0;
+	}
+	long allocations = getThreadAllocationCount() - allocationStart;
+
+	float coverage = (float)boundCells / ((float)N * N * options.steps);
+	printf("%-8s %4d %5d %8.3f", nUsers > 0 ? "multi" : "single", N, nUsers, coverage);
+
+	for (int s = 0; s < COUNT_OF(REPORTED_STAGES); s++) {
+		float p50, p95, p99;
+		if (!profiler.getPercentiles(REPORTED_STAGES[s], p50, p95, p99)) {
+			printf(" %10s", "-");
+			continue;
+		}
+
+		//milliseconds per step to nanoseconds per cell per step
+		float toNanoseconds = 1.0e6f / ((float)N * N);
+		printf(" %10.2f", p50 * toNanoseconds);
+		if (csv)
+			fprintf(csv, "%s,%d,%d,%.4f,%s,%.4f,%.4f\n", nUsers > 0 ? "multi" : "single", N, nUsers,
+					coverage, Profiler::getStageName(REPORTED_STAGES[s]),
+					p50 * toNanoseconds, p95 * toNanoseconds);
+	}
+	printf(" %11ld\n", allocations);
+	fflush(stdout);
+
+	delete solver;
+	return allocations;
+}
+
+
+
+/**
+ * Solver with direct access to its fields, so a known density can be advected through a 
+ * fixed velocity field without the projection and the other steps of update().
+ */
+class AdvectionProbe : public FluidSolver
+{
+public:
+	AdvectionProbe(int N, float dt) : FluidSolver(N, dt, 0.0f, 0.0f) {}
+
+	/**
+	 * Sets up a solid body rotation about the grid center, one turn per unit of time, and
+	 * a disc of density 1 between the center and the top wall. Returns the density.
+	 */
+	vector<float> setup()
+	{
+		reset();
+		for (int j = 1; j <= height_; j++)
+			for (int i = 1; i <= width_; i++) {
+				float x = (i - 0.5f) / width_, y = (j - 0.5f) / height_;
+				int   cell = i + (width_ + 2) * j;
+				u_[cell] = -2.0f * PI * (y - 0.5f);
+				v_[cell] =  2.0f * PI * (x - 0.5f);
+
+				float dx = x - 0.5f, dy = y - 0.75f;
+				dens_[cell] = (dx * dx + dy * dy < 0.15f * 0.15f) ? 1.0f : 0.0f;
+			}
+		return vector<float>(dens_, dens_ + getSize());
+	}
+
+	void step()
+	{
+		copy(dens_, dens_ + getSize(), dens_prev_);
+		advect(0, dens_, dens_prev_, u_, v_);
+	}
+
+	/**
+	 * Compares the density with the one returned by setup(): the summed absolute 
+	 * difference relative to the initial mass, and the largest density left.
+	 */
+	void measure(const vector<float>& initial, float& error, float& peak)
+	{
+		double difference = 0.0, mass = 0.0;
+		peak = 0.0f;
+		for (int j = 1; j <= height_; j++)
+			for (int i = 1; i <= width_; i++) {
+				int cell = i + (width_ + 2) * j;
+				difference += fabs(dens_[cell] - initial[cell]);
+				mass       += initial[cell];
+				peak        = max(peak, dens_[cell]);
+			}
+		error = (float)(difference / mass);
+	}
+};
+
+
+
+/**
+ * Carries the disc of AdvectionProbe once around the rotation with both advection 
+ * schemes at several grid sizes. Every grid takes 2N steps, so the fastest cells move 
+ * about 1.6 cells per step on all of them.
+ */
+static void runQuality(const Options& options, FILE* csv)
+{
+	static const FluidSolver::AdvectionScheme schemes[] = { 
+		FluidSolver::ADVECT_SEMI_LAGRANGIAN, FluidSolver::ADVECT_MACCORMACK };
+	static const char* schemeNames[] = { "semi-lagrangian", "maccormack" };
+	Profiler& profiler = getProfiler();
+
+	printf("%-16s %4s %6s %12s %10s %8s\n", "advection", "N", "steps", "ns/cell/step", "L1 error", "peak");
+	for (int g = 0; g < COUNT_OF(QUALITY_GRID_SIZES); g++) {
+		int N     = QUALITY_GRID_SIZES[g];
+		int steps = 2 * N;
+
+		for (int k = 0; k < COUNT_OF(schemes); k++) {
+			AdvectionProbe probe(N, 1.0f / steps);
+			probe.setLinearSolver(FluidSolver::RED_BLACK_GAUSS_SEIDEL);
+			if (options.scalar)
+				probe.setInstructionSet(INSTRUCTIONS_SCALAR);
+			probe.setAdvectionScheme(schemes[k]);
+
+			vector<float> initial = probe.setup();
+			profiler.clear();
+			for (int s = 0; s < steps; s++) {
+				probe.step();
+				profiler.commit(PROFILE_SIMULATION);
+			}
+
+			float error, peak, p50, p95, p99;
+			probe.measure(initial, error, peak);
+			profiler.getPercentiles(PROFILE_ADVECT, p50, p95, p99);
+			float toNanoseconds = 1.0e6f / ((float)N * N);
+
+			printf("%-16s %4d %6d %12.2f %10.4f %8.4f\n", schemeNames[k], N, steps, 
+				   p50 * toNanoseconds, error, peak);
+			if (csv)
+				fprintf(csv, "%s,%d,%d,%.4f,%.6f,%.6f\n", schemeNames[k], N, steps, 
+						p50 * toNanoseconds, error, peak);
+			fflush(stdout);
+		}
+	}
+}
+
+
+
+/**
+ * One tile of runTiles(): its solver, the left edge in cells of the reference grid, and
+ * whether the density goes to user 1 of a FluidSolverMultiUser.
+ */
+struct TileRun
+{
+	FluidSolver* solver;
+	int          left;
+	bool         isMultiUser;
+};
+
+static FluidSolver* createTileSolver(int width, bool isMultiUser)
+{
+	FluidSolver* solver;
+	if (isMultiUser)
+		solver = new FluidSolverMultiUser(3, width, TILE_HEIGHT, 0.1f, 0.0001f, 0.0f);
+	else
+		solver = new FluidSolver(width, TILE_HEIGHT, 0.1f, 0.0001f, 0.0f);
+	solver->reset();	//the fields are not cleared by the constructor
+	solver->setLinearSolver(FluidSolver::RED_BLACK_GAUSS_SEIDEL);
+	return solver;
+}
+
+static float getTileDensity(const TileRun& tile, int i, int j)
+{
+	if (tile.isMultiUser)
+		return ((FluidSolverMultiUser*)tile.solver)->getDensityAt(1, i, j);
+	return tile.solver->getDensityAt(i, j);
+}
+
+/**
+ * Runs TILE_STEPS steps of a jet that starts in the left tile and crosses into the right 
+ * one. The jet moves about a cell per step, the most a one cell halo carries exactly.
+ */
+static void runTile(void* argument)
+{
+	TileRun& tile = *(TileRun*)argument;
+	const int jetX = 20 - tile.left;
+	for (int step = 0; step < TILE_STEPS; step++) {
+		if (jetX >= 1 && jetX <= tile.solver->getWidth())
+			for (int j = 20; j < 28; j++) {
+				tile.solver->addHorzVelocityAt(jetX, j, 1.0f);
+				if (tile.isMultiUser)
+					((FluidSolverMultiUser*)tile.solver)->addDensityAt(1, jetX, j, 3.0f);
+				else
+					tile.solver->addDensityAt(jetX, j, 3.0f);
+			}
+		tile.solver->update();
+	}
+}
+
+/**
+ * Compares two linked TILE_WIDTH wide tiles, each stepped by its own thread, with one 
+ * solver twice as wide: over a LocalHaloLink, over one whose left end starts TILE_SKEW 
+ * steps ahead, and over UDP on the loopback interface, for both solver classes.
+ * @return   number of comparisons that differ by more than TILE_TOLERANCE
+ */
+static int runTiles()
+{
+	static const char* linkNames[] = { "local", "late start", "udp" };
+	int failures = 0;
+
+	printf("%-8s %-12s %10s %8s\n", "solver", "link", "L1 diff", "stale");
+	for (int m = 0; m < 2; m++) {
+		bool isMultiUser = m == 1;
+
+		TileRun whole = { createTileSolver(2 * TILE_WIDTH, isMultiUser), 0, isMultiUser };
+		runTile(&whole);
+
+		for (int l = 0; l < COUNT_OF(linkNames); l++) {
+			HaloLink *leftLink, *rightLink;
+			if (l == 2) {
+				UdpHaloLink* left  = new UdpHaloLink(TILE_UDP_PORT, "127.0.0.1", TILE_UDP_PORT + 1, TILE_TIMEOUT);
+				UdpHaloLink* right = new UdpHaloLink(TILE_UDP_PORT + 1, "127.0.0.1", TILE_UDP_PORT, TILE_TIMEOUT);
+				if (!left->isOpen() || !right->isOpen()) {
+					printf("%-8s %-12s %10s %8s\n", isMultiUser ? "multi" : "single", linkNames[l], "-", "-");
+					delete left;
+					delete right;
+					continue;
+				}
+				leftLink  = left;
+				rightLink = right;
+			}
+			else {
+				LocalHaloLink* left  = new LocalHaloLink(TILE_TIMEOUT);
+				LocalHaloLink* right = new LocalHaloLink(TILE_TIMEOUT);
+				left->connect(right);
+				leftLink  = left;
+				rightLink = right;
+			}
+			if (l == 1)
+				for (int k = 0; k < TILE_SKEW; k++)
+					leftLink->beginStep();
+
+			TileRun tiles[2] = { 
+				{ createTileSolver(TILE_WIDTH, isMultiUser), 0,          isMultiUser },
+				{ createTileSolver(TILE_WIDTH, isMultiUser), TILE_WIDTH, isMultiUser } };
+			tiles[0].solver->setEdgeLink(EDGE_RIGHT, leftLink);
+			tiles[1].solver->setEdgeLink(EDGE_LEFT,  rightLink);
+			for (int t = 0; t < 2; t++)
+				tiles[t].solver->setWallWidth(2 * TILE_WIDTH);
+
+			Thread threads[2];
+			for (int t = 0; t < 2; t++)
+				threads[t].start(runTile, &tiles[t]);
+			for (int t = 0; t < 2; t++)
+				threads[t].join();
+
+			double difference = 0.0, mass = 0.0;
+			for (int j = 1; j <= TILE_HEIGHT; j++)
+				for (int i = 1; i <= 2 * TILE_WIDTH; i++) {
+					const TileRun& tile = tiles[i > TILE_WIDTH];
+					float density = getTileDensity(whole, i, j);
+					difference += fabs(getTileDensity(tile, i - tile.left, j) - density);
+					mass       += density;
+				}
+			float error = (float)(difference / mass);
+			if (error > TILE_TOLERANCE)
+				failures++;
+
+			printf("%-8s %-12s %10.5f %8d%s\n", isMultiUser ? "multi" : "single", linkNames[l], error,
+				   leftLink->getStaleCount() + rightLink->getStaleCount(), error > TILE_TOLERANCE ? "  FAILED" : "");
+			fflush(stdout);
+
+			for (int t = 0; t < 2; t++)
+				delete tiles[t].solver;
+			delete leftLink;
+			delete rightLink;
+		}
+		delete whole.solver;
+	}
+	return failures;
+}
+
+
+
+/**
+ * Multi user solver that can mark every tile active, so it works like one without 
+ * activity tracking.
+ */
+class ActivityProbe : public FluidSolverMultiUser
+{
+public:
+	ActivityProbe(int N, float diff) : FluidSolverMultiUser(2, N, 0.1f, diff, 0.0f) {}
+
+	void activateAllTiles()
+	{
+		activeTiles_.assign(activeTiles_.size(), 1);
+	}
+};
+
+/**
+ * Diffuses a point source with both relaxation schemes, once with activity tracking and 
+ * once with every tile active, and compares the densities after every step. The source 
+ * sits in a corner tile so the density has to reach tiles that start inactive. Nothing
+ * fades below ACTIVE_DENSITY in these steps, so the tracked solver has to work on every
+ * cell the diffusion reaches and both must agree exactly.
+ * @return   number of runs that differ
+ */
+static int runActivity()
+{
+	static const FluidSolver::LinearSolverType solvers[] = { 
+		FluidSolver::RED_BLACK_GAUSS_SEIDEL, FluidSolver::GAUSS_SEIDEL };
+	static const char* solverNames[] = { "red-black", "gauss-seidel" };
+	const int N = 64;
+	int failures = 0;
+
+	printf("%-14s %10s %14s\n", "relaxation", "diffusion", "max difference");
+	for (int k = 0; k < COUNT_OF(solvers); k++)
+		for (int d = 0; d < COUNT_OF(ACTIVITY_DIFFUSION); d++) {
+			ActivityProbe tracked(N, ACTIVITY_DIFFUSION[d]), untracked(N, ACTIVITY_DIFFUSION[d]);
+			tracked.setLinearSolver(solvers[k]);
+			untracked.setLinearSolver(solvers[k]);
+			tracked.addDensityAt(1, 8, 8, 100.0f);
+			untracked.addDensityAt(1, 8, 8, 100.0f);
+
+			float difference = 0.0f;
+			for (int step = 0; step < ACTIVITY_STEPS; step++) {
+				untracked.activateAllTiles();
+				tracked.update();
+				untracked.update();
+				for (int j = 1; j <= N; j++)
+					for (int i = 1; i <= N; i++)
+						difference = max(difference, fabsf(tracked.getDensityAt(1, i, j) - untracked.getDensityAt(1, i, j)));
+			}
+			if (difference > 0.0f)
+				failures++;
+
+			printf("%-14s %10.4f %14.3g%s\n", solverNames[k], ACTIVITY_DIFFUSION[d], difference,
+				   difference > 0.0f ? "  FAILED" : "");
+			fflush(stdout);
+		}
+	return failures;
+}
+
+
+
+static void printUsage(const char* program)
+{
+	fprintf(stderr, "usage : %s [-steps n] [-replay recording] [-csv file] [-scalar] [-multigrid] [-maccormack] [-vorticity] [-half]\n", program);
+	fprintf(stderr, "    or: %s -quality [-csv file] [-scalar]\n", program);
+	fprintf(stderr, "    or: %s -tiles\n", program);
+	fprintf(stderr, "    or: %s -activity\n", program);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t -steps n    : measured steps per configuration (default %d, at most %d)\n", 
+			DEFAULT_STEPS, Profiler::PROFILE_HISTORY);
+	fprintf(stderr, "\t -replay     : take the silhouettes from a fluidWall recording\n");
+	fprintf(stderr, "\t -csv        : also write every stage time to a CSV file\n");
+	fprintf(stderr, "\t -scalar     : use the reference solver kernels\n");
+	fprintf(stderr, "\t -multigrid  : use the multigrid pressure solver\n");
+	fprintf(stderr, "\t -maccormack : use MacCormack advection\n");
+	fprintf(stderr, "\t -vorticity  : add vorticity confinement and buoyancy (fluidWall's 'n' and 'h' keys)\n");
+	fprintf(stderr, "\t -half       : store the user densities as 16 bit floats\n");
+	fprintf(stderr, "\t -quality    : compare cost and blur of the advection schemes\n");
+	fprintf(stderr, "\t -tiles      : check that linked tiles match one solver as wide as both\n");
+	fprintf(stderr, "\t -activity   : check that activity tracking does not change the diffusion\n");
+}
+
+
+
+int main(int argc, char** argv)
+{
+	Options options = { DEFAULT_STEPS, NULL, NULL, false, false, false, false, false, false, false,
+						FluidSolverMultiUser::DENSITY_FLOAT };
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "-steps") == 0 && a + 1 < argc)
+			options.steps = atoi(argv[++a]);
+		else if (strcmp(argv[a], "-replay") == 0 && a + 1 < argc)
+			options.replayPath = argv[++a];
+		else if (strcmp(argv[a], "-csv") == 0 && a + 1 < argc)
+			options.csvPath = argv[++a];
+		else if (strcmp(argv[a], "-scalar") == 0)
+			options.scalar = true;
+		else if (strcmp(argv[a], "-multigrid") == 0)
+			options.multigrid = true;
+		else if (strcmp(argv[a], "-maccormack") == 0)
+			options.maccormack = true;
+		else if (strcmp(argv[a], "-vorticity") == 0)
+			options.vorticity = true;
+		else if (strcmp(argv[a], "-half") == 0)
+			options.storage = FluidSolverMultiUser::DENSITY_HALF;
+		else if (strcmp(argv[a], "-quality") == 0)
+			options.quality = true;
+		else if (strcmp(argv[a], "-tiles") == 0)
+			options.tiles = true;
+		else if (strcmp(argv[a], "-activity") == 0)
+			options.activity = true;
+		else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.tiles) {
+		printf("Fluid Wall tiles, two %dx%d tiles against one %dx%d solver\n", 
+			   TILE_WIDTH, TILE_HEIGHT, 2 * TILE_WIDTH, TILE_HEIGHT);
+		int failures = runTiles();
+		if (failures > 0) {
+			fprintf(stderr, "ERROR: %d tile runs differ from the single solver by more than %.2f%%\n",
+					failures, 100.0f * TILE_TOLERANCE);
+			return 1;
+		}
+		return 0;
+	}
+
+	if (options.activity) {
+		printf("Fluid Wall activity tracking, diffusion of a point source\n");
+		int failures = runActivity();
+		if (failures > 0) {
+			fprintf(stderr, "ERROR: %d runs differ from the untracked solver\n", failures);
+			return 1;
+		}
+		return 0;
+	}
+
+	//every measured step has to stay in the profiler history for the percentiles
+	options.steps = max(1, min(options.steps, (int)Profiler::PROFILE_HISTORY));
+
+	KinectPlayback playback;
+	if (options.replayPath && !playback.open(options.replayPath)) {
+		fprintf(stderr, "Could not open recording %s\n", options.replayPath);
+		return 1;
+	}
+
+	FILE* csv = NULL;
+	if (options.csvPath) {
+		csv = fopen(options.csvPath, "w");
+		if (!csv) {
+			fprintf(stderr, "Could not open %s\n", options.csvPath);
+			return 1;
+		}
+		if (options.quality)
+			fprintf(csv, "advection,N,steps,ns_per_cell_p50,l1_error,peak\n");
+		else
+			fprintf(csv, "solver,N,users,bounds,stage,ns_per_cell_p50,ns_per_cell_p95\n");
+	}
+
+	if (options.quality) {
+		printf("Fluid Wall advection quality, one turn of a solid body rotation, %s kernels\n",
+			   options.scalar ? "scalar" : "fastest");
+		runQuality(options, csv);
+		if (csv)
+			fclose(csv);
+		return 0;
+	}
+
+	printf("Fluid Wall solver benchmark, %d steps per configuration, %s kernels, %s pressure solver, %s advection%s\n",
+		   options.steps, options.scalar ? "scalar" : "fastest", options.multigrid ? "multigrid" : "relaxation",
+		   options.maccormack ? "MacCormack" : "semi-Lagrangian", options.vorticity ? ", vorticity confinement" : "");
+	printf("Silhouettes: %s\n", options.replayPath ? options.replayPath : "synthetic");
+	printf("Median ns / cell / step\n");
+	printf("%-8s %4s %5s %8s", "solver", "N", "users", "bounds");
+	for (int s = 0; s < COUNT_OF(REPORTED_STAGES); s++)
+		printf(" %10.10s", Profiler::getStageName(REPORTED_STAGES[s]));
+	printf(" %11s\n", "allocations");
+
+	long allocations = 0;
+	for (int g = 0; g < COUNT_OF(GRID_SIZES); g++) {
+		int N = GRID_SIZES[g];
+		for (int u = 0; u < COUNT_OF(USER_COUNTS); u++) {
+			int nUsers = USER_COUNTS[u];
+			if (options.replayPath) {
+				RecordedSilhouettes silhouettes(playback, N);
+				allocations += runConfiguration(options, N, nUsers, silhouettes, csv);
+				continue;
+			}
+			for (int d = 0; d < COUNT_OF(BOUND_DENSITIES); d++) {
+				SyntheticSilhouettes silhouettes(N, max(nUsers - 1, 1), BOUND_DENSITIES[d]);
+				allocations += runConfiguration(options, N, nUsers, silhouettes, csv);
+			}
+		}
+	}
+
+	if (csv)
+		fclose(csv);
+
+	if (allocations > 0) {
+		fprintf(stderr, "ERROR: the measured steps made %ld heap allocations, the steady state must not allocate\n", 
+				allocations);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file      AllocationCounter.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "AllocationCounter.h"
+#include <stdlib.h>
+#include <new>
+
+#ifdef _MSC_VER
+	#define THREAD_LOCAL __declspec(thread)
+#else
+	#define THREAD_LOCAL __thread
+#endif
+
+//exception specifications of the replaced operators, which C++11 spells differently
+#if __cplusplus >= 201103L
+	#define THROWS_BAD_ALLOC
+	#define THROWS_NOTHING   noexcept
+#else
+	#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+	#define THROWS_NOTHING   throw()
+#endif
+
+static THREAD_LOCAL long threadAllocations = 0;
+
+
+
+long getThreadAllocationCount()
+{
+	return threadAllocations;
+}
+
+
+
+void countAllocation()
+{
+	threadAllocations++;
+}
+
+
+
+static void* allocate(size_t size)
+{
+	threadAllocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+
+
+void* operator new(size_t size) THROWS_BAD_ALLOC
+{
+	return allocate(size);
+}
+
+
+
+void* operator new[](size_t size) THROWS_BAD_ALLOC
+{
+	return allocate(size);
+}
+
+
+
+void* operator new(size_t size, const std::nothrow_t&) THROWS_NOTHING
+{
+	threadAllocations++;
+	return malloc(size ? size : 1);
+}
+
+
+
+void* operator new[](size_t size, const std::nothrow_t&) THROWS_NOTHING
+{
+	threadAllocations++;
+	return malloc(size ? size : 1);
+}
+
+
+
+void operator delete(void* p) THROWS_NOTHING
+{
+	free(p);
+}
+
+
+
+void operator delete[](void* p) THROWS_NOTHING
+{
+	free(p);
+}
+
+
+
+void operator delete(void* p, const std::nothrow_t&) THROWS_NOTHING
+{
+	free(p);
+}
+
+
+
+void operator delete[](void* p, const std::nothrow_t&) THROWS_NOTHING
+{
+	free(p);
+}
+
+
+
+//C++14 compilers call the sized forms, whose default versions would not pair with the 
+//malloc above
+#if __cplusplus >= 201103L
+void operator delete(void* p, size_t) THROWS_NOTHING
+{
+	free(p);
+}
+
+
+
+void operator delete[](void* p, size_t) THROWS_NOTHING
+{
+	free(p);
+}
+#endif
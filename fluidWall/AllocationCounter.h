@@ -0,0 +1,64 @@
+/**
+ * @file      AllocationCounter.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+/**
+ * Counts heap allocations per thread, to check that a frame loop has reached a steady 
+ * state in which it only reuses its buffers.
+ *
+ * Linking AllocationCounter.cpp replaces the global operator new and new[] of the program,
+ * so every allocation of C++ code in the program is counted, including std containers. 
+ * Raw allocations that bypass operator new, like the aligned block of FieldArena, call 
+ * countAllocation() themselves. Libraries in their own DLLs with their own heap, OpenCV's
+ * Mat buffers for example, are not seen.
+ *
+ * The counts are per thread, so the pipeline threads can each check their own frames.
+ */
+
+/**
+ * Returns the number of allocations the calling thread has made so far.
+ */
+long getThreadAllocationCount();
+
+/**
+ * Adds an allocation that did not go through operator new to the calling thread's count.
+ */
+void countAllocation();
+
+/**
+ * Counts the allocations the calling thread makes during the lifetime of the object, 
+ * e.g. one frame.
+ */
+class AllocationScope
+{
+public:
+	AllocationScope(void) : start_(getThreadAllocationCount()) {}
+
+	/**
+	 * Returns the allocations made since the scope was created.
+	 */
+	long getCount() const { return getThreadAllocationCount() - start_; }
+
+private:
+	long start_;
+};
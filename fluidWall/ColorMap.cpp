@@ -0,0 +1,177 @@
+/**
+ * @file      ColorMap.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ColorMap.h"
+#include <string.h>
+#include <emmintrin.h>
+
+
+
+/**
+ * Converts a color channel on [0, 1] to a byte, clamping values outside the range.
+ */
+static inline unsigned char toByte(float value)
+{
+	if (value <= 0.0f) return 0;
+	if (value >= 1.0f) return 255;
+	return (unsigned char)(value * 255.0f + 0.5f);
+}
+
+
+
+/**
+ * Converts a color channel on [0, 255] to a byte, clamping values outside the range.
+ */
+static inline unsigned char scaledToByte(float value)
+{
+	if (value <= 0.0f)   return 0;
+	if (value >= 255.0f) return 255;
+	return (unsigned char)(value + 0.5f);
+}
+
+
+
+static void mixUsersScalar(const float* densities, int count, int nChannels, int nColors,
+						   const float* palette, unsigned char* rgba)
+{
+	for (int c = 0; c < count; c++, densities += nChannels, rgba += 4) {
+		float R = 0.0f, G = 0.0f, B = 0.0f;
+		for (int n = 0; n < nColors; n++) {
+			R += palette[4*n + 0] * densities[n];
+			G += palette[4*n + 1] * densities[n];
+			B += palette[4*n + 2] * densities[n];
+		}
+		rgba[0] = scaledToByte(R);
+		rgba[1] = scaledToByte(G);
+		rgba[2] = scaledToByte(B);
+		rgba[3] = 255;
+	}
+}
+
+
+
+static void mixUsersSSE2(const float* densities, int count, int nChannels, int nColors,
+						 const float* palette, unsigned char* rgba)
+{
+	//lanes are R, G, B, A; the palette has 0 in the alpha lane
+	const __m128 opaque = _mm_set_ps(255.0f, 0.0f, 0.0f, 0.0f);
+
+	for (int c = 0; c < count; c++, densities += nChannels, rgba += 4) {
+		__m128 color = opaque;
+		for (int n = 0; n < nColors; n++)
+			color = _mm_add_ps(color, _mm_mul_ps(_mm_set1_ps(densities[n]), _mm_loadu_ps(palette + 4*n)));
+
+		//the saturating packs clamp every channel to [0, 255]
+		__m128i channels = _mm_cvtps_epi32(color);
+		channels = _mm_packs_epi32(channels, channels);
+		channels = _mm_packus_epi16(channels, channels);
+
+		int texel = _mm_cvtsi128_si32(channels);
+		memcpy(rgba, &texel, 4);
+	}
+}
+
+
+
+ColorMap::ColorMap(void)
+{
+	ramp_.assign(4 * COLOR_MAP_SIZE, 0);
+	rampScale_     = 0.0f;
+	paletteSource_ = NULL;
+	setInstructionSet(detectInstructionSet());
+}
+
+
+
+void ColorMap::setRamp(const float (*rgb)[3], float maxValue)
+{
+	for (int k = 0; k < COLOR_MAP_SIZE; k++) {
+		ramp_[4*k + 0] = toByte(rgb[k][0]);
+		ramp_[4*k + 1] = toByte(rgb[k][1]);
+		ramp_[4*k + 2] = toByte(rgb[k][2]);
+		ramp_[4*k + 3] = 255;
+	}
+	rampScale_ = maxValue > 0.0f ? (COLOR_MAP_SIZE - 1) / maxValue : 0.0f;
+}
+
+
+
+void ColorMap::mapValues(const float* values, int count, unsigned char* rgba)
+{
+	const unsigned char* ramp = &ramp_[0];
+
+	for (int c = 0; c < count; c++, rgba += 4) {
+		float position = values[c] * rampScale_ + 0.5f;
+		int   k        = position <= 0.0f ? 0 :
+						 (position >= COLOR_MAP_SIZE - 1 ? COLOR_MAP_SIZE - 1 : (int)position);
+		memcpy(rgba, ramp + 4*k, 4);
+	}
+}
+
+
+
+void ColorMap::setPalette(const float (*rgb)[3], int nUsers)
+{
+	if (rgb == paletteSource_ && (int)palette_.size() == 4 * nUsers)
+		return;
+
+	paletteSource_ = rgb;
+	palette_.resize(4 * nUsers);
+	for (int n = 0; n < nUsers; n++) {
+		palette_[4*n + 0] = 255.0f * rgb[n][0];
+		palette_[4*n + 1] = 255.0f * rgb[n][1];
+		palette_[4*n + 2] = 255.0f * rgb[n][2];
+		palette_[4*n + 3] = 0.0f;
+	}
+}
+
+
+
+void ColorMap::mixUsers(const float* densities, int count, int nChannels, unsigned char* rgba)
+{
+	int nColors = (int)palette_.size() / 4;
+	if (nColors > nChannels)
+		nColors = nChannels;
+	if (nColors == 0) {
+		mixUsersScalar(densities, count, nChannels, 0, NULL, rgba);
+		return;
+	}
+
+	if (instructionSet_ == INSTRUCTIONS_SCALAR)
+		mixUsersScalar(densities, count, nChannels, nColors, &palette_[0], rgba);
+	else
+		mixUsersSSE2(densities, count, nChannels, nColors, &palette_[0], rgba);
+}
+
+
+
+void ColorMap::setInstructionSet(InstructionSet instructionSet)
+{
+	instructionSet_ = (instructionSet == INSTRUCTIONS_SCALAR || detectInstructionSet() == INSTRUCTIONS_SCALAR)
+					? INSTRUCTIONS_SCALAR : INSTRUCTIONS_SSE2;
+}
+
+
+
+InstructionSet ColorMap::getInstructionSet()
+{
+	return instructionSet_;
+}
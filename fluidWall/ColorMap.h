@@ -0,0 +1,96 @@
+/**
+ * @file      ColorMap.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+#include <vector>
+#include "FluidKernels.h"
+
+using namespace std;
+
+/**
+ * Turns density values into RGBA8 texels.
+ *
+ * A single density maps through a precomputed ramp: a lookup table of COLOR_MAP_SIZE colors
+ * spread evenly over [0, maxValue]. Values outside the range take the end colors.
+ *
+ * Several user densities, interleaved per cell like FluidSolverMultiUser stores them, are
+ * mixed with a palette: each channel of a texel is the sum over all users of density times
+ * the user's color. The SSE2 kernel mixes the four channels of a texel in one register.
+ * Mixed channels are clamped to [0, 1] and every texel is opaque.
+ */
+class ColorMap
+{
+public:
+	const static int COLOR_MAP_SIZE = 1024;
+
+	ColorMap(void);
+
+	/**
+	 * Precomputes the ramp used by mapValues().
+	 *
+	 * @param rgb       COLOR_MAP_SIZE colors, entry k is the color of value
+	 *                  k * maxValue / (COLOR_MAP_SIZE - 1). Channels are clamped to [0, 1].
+	 * @param maxValue  value of the last entry
+	 */
+	void setRamp(const float (*rgb)[3], float maxValue);
+
+	/**
+	 * Maps a row of values through the ramp.
+	 *
+	 * @param values   count values
+	 * @param count    number of texels to write
+	 * @param rgba     receives count texels
+	 */
+	void mapValues(const float* values, int count, unsigned char* rgba);
+
+	/**
+	 * Sets the colors used by mixUsers(). Does nothing if the palette is unchanged, so it
+	 * can be called every frame.
+	 *
+	 * @param rgb      one color per user
+	 * @param nUsers   number of colors
+	 */
+	void setPalette(const float (*rgb)[3], int nUsers);
+
+	/**
+	 * Mixes a row of interleaved user densities with the palette.
+	 *
+	 * @param densities  count * nChannels values, channel n of cell c at c * nChannels + n
+	 * @param count      number of cells and texels
+	 * @param nChannels  users per cell; users without a palette color are ignored
+	 * @param rgba       receives count texels
+	 */
+	void mixUsers(const float* densities, int count, int nChannels, unsigned char* rgba);
+
+	/**
+	 * Selects the kernel used by mixUsers(). The constructor picks SSE2 when the CPU has it;
+	 * INSTRUCTIONS_SCALAR selects the reference implementation. AVX uses the SSE2 kernel.
+	 */
+	void           setInstructionSet(InstructionSet instructionSet);
+	InstructionSet getInstructionSet();
+
+private:
+	vector<unsigned char> ramp_;           // COLOR_MAP_SIZE RGBA8 texels
+	float                 rampScale_;      // value to ramp index
+	vector<float>         palette_;        // R, G, B, 0 per user, scaled to [0, 255]
+	const float         (*paletteSource_)[3];
+	InstructionSet        instructionSet_;
+};
@@ -0,0 +1,170 @@
+/**
+ * @file      FieldArena.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "FieldArena.h"
+#include "AllocationCounter.h"
+#include <stdlib.h>
+#include <iostream>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+
+
+static char* alignedAlloc(size_t bytes)
+{
+	countAllocation();
+#ifdef _MSC_VER
+	return (char*) _aligned_malloc(bytes, FieldArena::FIELD_ALIGNMENT);
+#else
+	void* p = NULL;
+	if (posix_memalign(&p, FieldArena::FIELD_ALIGNMENT, bytes) != 0)
+		return NULL;
+	return (char*) p;
+#endif
+}
+
+
+
+static void alignedFree(char* p)
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+
+
+FieldArena::FieldArena(void)
+{
+	block_    = NULL;
+	capacity_ = 0;
+	used_     = 0;
+}
+
+
+
+FieldArena::~FieldArena(void)
+{
+	if (block_) alignedFree(block_);
+}
+
+
+
+size_t FieldArena::getPaddedSize(size_t bytes)
+{
+	return (bytes + FIELD_ALIGNMENT - 1) / FIELD_ALIGNMENT * FIELD_ALIGNMENT;
+}
+
+
+
+void FieldArena::layout(size_t bytes)
+{
+	used_ = 0;
+	if (bytes <= capacity_)
+		return;
+
+	if (block_) alignedFree(block_);
+	block_    = alignedAlloc(bytes);
+	capacity_ = block_ ? bytes : 0;
+	if (!block_)
+		cout << "FieldArena: could not allocate " << bytes << " bytes" << endl;
+}
+
+
+
+void FieldArena::freeBlock()
+{
+	if (block_) alignedFree(block_);
+	block_    = NULL;
+	capacity_ = 0;
+	used_     = 0;
+}
+
+
+
+float* FieldArena::allocateFloats(size_t count)
+{
+	return (float*) allocate(count * sizeof(float));
+}
+
+
+
+bool* FieldArena::allocateBools(size_t count)
+{
+	return (bool*) allocate(count * sizeof(bool));
+}
+
+
+
+unsigned char* FieldArena::allocateBytes(size_t count)
+{
+	return (unsigned char*) allocate(count);
+}
+
+
+
+size_t FieldArena::getMark()
+{
+	return used_;
+}
+
+
+
+void FieldArena::release(size_t mark)
+{
+	if (mark < used_)
+		used_ = mark;
+}
+
+
+
+size_t FieldArena::getCapacity()
+{
+	return capacity_;
+}
+
+
+
+size_t FieldArena::getUsed()
+{
+	return used_;
+}
+
+
+
+void* FieldArena::allocate(size_t bytes)
+{
+	size_t padded = getPaddedSize(bytes);
+	if (used_ + padded > capacity_) {
+		cout << "FieldArena: layout of " << capacity_ << " bytes has no room for "
+			 << bytes << " more" << endl;
+		return NULL;
+	}
+
+	void* p = block_ + used_;
+	used_  += padded;
+	return p;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file      FieldArena.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+#include <stddef.h>
+
+/**
+ * Owns the field buffers of a solver in one aligned block of memory.
+ *
+ * Buffers are handed out in order by allocate*() and all live until the next layout() or the
+ * destruction of the arena, so solvers can swap their buffer pointers freely without ever
+ * freeing one. Every buffer starts on a FIELD_ALIGNMENT byte boundary, which is enough
+ * for aligned SSE2/AVX loads and keeps buffers used by different threads off shared
+ * cache lines.
+ *
+ * layout() only reallocates when the block has to grow, so switching grid sizes back and
+ * forth settles on the largest block after the first round.
+ */
+class FieldArena
+{
+public:
+	const static size_t FIELD_ALIGNMENT = 64;
+
+	FieldArena(void);
+	~FieldArena(void);
+
+	/**
+	 * Returns the number of bytes a buffer takes in the arena, including padding.
+	 *
+	 * @param bytes - requested size of the buffer
+	 */
+	static size_t getPaddedSize(size_t bytes);
+
+	/**
+	 * Releases all buffers and makes sure the block can hold the given number of bytes.
+	 * Buffers handed out before are invalid afterwards.
+	 *
+	 * @param bytes - total size of the buffers that will be allocated, each padded
+	 *                with getPaddedSize()
+	 */
+	void layout(size_t bytes);
+
+	/**
+	 * Frees the block, e.g. while its solver is idle. Buffers handed out before are 
+	 * invalid afterwards; the next layout() allocates a new block.
+	 */
+	void freeBlock();
+
+	/**
+	 * Hands out the next buffer. The contents are undefined.
+	 *
+	 * @param count - number of elements
+	 * @return      - aligned buffer, or NULL if the layout has no room left
+	 */
+	float*         allocateFloats(size_t count);
+	bool*          allocateBools(size_t count);
+	unsigned char* allocateBytes(size_t count);
+
+	/**
+	 * Scratch buffers: remember the current position with getMark(), allocate temporary
+	 * buffers, then hand them back with release(mark). The layout has to include room
+	 * for them.
+	 */
+	size_t getMark();
+	void   release(size_t mark);
+
+	/**
+	 * Accessors: return the size of the block and the number of bytes handed out.
+	 */
+	size_t getCapacity();
+	size_t getUsed();
+
+private:
+	char*  block_;
+	size_t capacity_;
+	size_t used_;
+
+	void* allocate(size_t bytes);
+
+	//buffers are owned by exactly one arena
+	FieldArena(const FieldArena&);
+	FieldArena& operator=(const FieldArena&);
+};
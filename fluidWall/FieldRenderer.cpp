@@ -0,0 +1,254 @@
+/**
+ * @file      FieldRenderer.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "FieldRenderer.h"
+#include <GL/freeglut_ext.h>
+#include <string.h>
+
+//OpenGL 1.2+ tokens that the Windows OpenGL 1.1 headers do not define
+#ifndef APIENTRY
+	#define APIENTRY
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+	#define GL_CLAMP_TO_EDGE       0x812F
+#endif
+#ifndef GL_ARRAY_BUFFER
+	#define GL_ARRAY_BUFFER        0x8892
+	#define GL_STREAM_DRAW         0x88E0
+#endif
+
+typedef void (APIENTRY *GenBuffersFunc)   (GLsizei n, GLuint* buffers);
+typedef void (APIENTRY *DeleteBuffersFunc)(GLsizei n, const GLuint* buffers);
+typedef void (APIENTRY *BindBufferFunc)   (GLenum target, GLuint buffer);
+typedef void (APIENTRY *BufferDataFunc)   (GLenum target, ptrdiff_t size, const void* data, GLenum usage);
+typedef void (APIENTRY *BufferSubDataFunc)(GLenum target, ptrdiff_t offset, ptrdiff_t size, const void* data);
+
+/**
+ * Buffer object entry points loaded at runtime, opengl32.lib only exports OpenGL 1.1.
+ */
+static struct
+{
+	bool              loaded;
+	GenBuffersFunc    GenBuffers;
+	DeleteBuffersFunc DeleteBuffers;
+	BindBufferFunc    BindBuffer;
+	BufferDataFunc    BufferData;
+	BufferSubDataFunc BufferSubData;
+} gl;
+
+
+
+/**
+ * Looks up an entry point under its core and ARB names.
+ */
+static GLUTproc getProc(const char* name)
+{
+	char fullName[64];
+
+	strcpy(fullName, name);
+	GLUTproc proc = glutGetProcAddress(fullName);
+	if (proc)
+		return proc;
+
+	strcat(fullName, "ARB");
+	return glutGetProcAddress(fullName);
+}
+
+#define LOAD_GL(type, name) gl.name = (type)getProc("gl" #name); if (!gl.name) return false;
+
+static bool loadBufferFunctions()
+{
+	if (gl.loaded)
+		return true;
+
+	LOAD_GL(GenBuffersFunc,    GenBuffers);
+	LOAD_GL(DeleteBuffersFunc, DeleteBuffers);
+	LOAD_GL(BindBufferFunc,    BindBuffer);
+	LOAD_GL(BufferDataFunc,    BufferData);
+	LOAD_GL(BufferSubDataFunc, BufferSubData);
+
+	gl.loaded = true;
+	return true;
+}
+
+
+
+/**
+ * Returns the smallest power of two that is at least n.
+ */
+static int nextPowerOfTwo(int n)
+{
+	int p = 1;
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+
+
+FieldRenderer::FieldRenderer(void)
+{
+	for (int l = 0; l < LAYER_COUNT; l++) {
+		textures_[l]      = 0;
+		textureWidth_[l]  = 0;
+		textureHeight_[l] = 0;
+	}
+	lineBuffer_      = 0;
+	lineBufferBytes_ = 0;
+	checkedBuffers_  = false;
+}
+
+
+
+FieldRenderer::~FieldRenderer(void)
+{
+	//the context may already be gone, GL objects are released with release()
+}
+
+
+
+void FieldRenderer::drawImage(Layer layer, const unsigned char* rgba, int cols, int rows,
+							  float left, float bottom, float right, float top, float inset, bool smooth)
+{
+	if (cols <= 0 || rows <= 0)
+		return;
+
+	prepareTexture(layer, cols, rows);
+
+	glBindTexture(GL_TEXTURE_2D, textures_[layer]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cols, rows, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+	GLint filter = smooth ? GL_LINEAR : GL_NEAREST;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+
+	//only the lower left cols x rows texels of the texture hold the image
+	float s0 = inset / textureWidth_[layer],  s1 = (cols - inset) / textureWidth_[layer];
+	float t0 = inset / textureHeight_[layer], t1 = (rows - inset) / textureHeight_[layer];
+
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glEnable(GL_ALPHA_TEST);
+	glAlphaFunc(GL_GEQUAL, 0.5f);
+
+	glBegin(GL_QUADS);
+		glTexCoord2f(s0, t0); glVertex2f(left,  bottom);
+		glTexCoord2f(s1, t0); glVertex2f(right, bottom);
+		glTexCoord2f(s1, t1); glVertex2f(right, top);
+		glTexCoord2f(s0, t1); glVertex2f(left,  top);
+	glEnd();
+
+	glDisable(GL_ALPHA_TEST);
+	glDisable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+
+
+void FieldRenderer::drawVelocity(const float* u, const float* v, int width, int height)
+{
+	int   rowWidth = width + 2;
+	float hx       = 1.0f / width;
+	float hy       = 1.0f / height;
+	float vScale   = (float)width / height;
+
+	lineVertices_.resize(4 * width * height);
+	float* vertex = &lineVertices_[0];
+	for (int j = 1; j <= height; j++) {
+		float y = (j - 0.5f) * hy;
+		for (int i = 1; i <= width; i++) {
+			float x    = (i - 0.5f) * hx;
+			int   cell = i + rowWidth * j;
+			vertex[0] = x;
+			vertex[1] = y;
+			vertex[2] = x + u[cell];
+			vertex[3] = y + v[cell] * vScale;
+			vertex += 4;
+		}
+	}
+
+	if (!checkedBuffers_) {
+		checkedBuffers_ = true;
+		if (loadBufferFunctions())
+			gl.GenBuffers(1, &lineBuffer_);
+	}
+
+	size_t       bytes    = lineVertices_.size() * sizeof(float);
+	const float* pointer  = &lineVertices_[0];
+	if (lineBuffer_) {
+		gl.BindBuffer(GL_ARRAY_BUFFER, lineBuffer_);
+		if (bytes != lineBufferBytes_) {
+			gl.BufferData(GL_ARRAY_BUFFER, bytes, pointer, GL_STREAM_DRAW);
+			lineBufferBytes_ = bytes;
+		}
+		else
+			gl.BufferSubData(GL_ARRAY_BUFFER, 0, bytes, pointer);
+		pointer = NULL;  // offset into the bound buffer
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, pointer);
+	glDrawArrays(GL_LINES, 0, 2 * width * height);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	if (lineBuffer_)
+		gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+
+void FieldRenderer::release()
+{
+	for (int l = 0; l < LAYER_COUNT; l++) {
+		if (textures_[l])
+			glDeleteTextures(1, &textures_[l]);
+		textures_[l]      = 0;
+		textureWidth_[l]  = 0;
+		textureHeight_[l] = 0;
+	}
+
+	if (lineBuffer_)
+		gl.DeleteBuffers(1, &lineBuffer_);
+	lineBuffer_      = 0;
+	lineBufferBytes_ = 0;
+	checkedBuffers_  = false;
+}
+
+
+
+void FieldRenderer::prepareTexture(Layer layer, int cols, int rows)
+{
+	if (textures_[layer] && cols <= textureWidth_[layer] && rows <= textureHeight_[layer])
+		return;
+
+	if (!textures_[layer])
+		glGenTextures(1, &textures_[layer]);
+
+	textureWidth_[layer]  = nextPowerOfTwo(cols > textureWidth_[layer]  ? cols : textureWidth_[layer]);
+	textureHeight_[layer] = nextPowerOfTwo(rows > textureHeight_[layer] ? rows : textureHeight_[layer]);
+
+	glBindTexture(GL_TEXTURE_2D, textures_[layer]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, textureWidth_[layer], textureHeight_[layer], 0,
+				 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+}
@@ -0,0 +1,99 @@
+/**
+ * @file      FieldRenderer.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+#include <vector>
+#include <GL/glut.h>
+
+using namespace std;
+
+/**
+ * Draws simulation fields with a handful of OpenGL calls per frame instead of one call
+ * per cell vertex.
+ *
+ * Color images are uploaded with glTexSubImage2D into one texture per layer and drawn as
+ * a single textured quad. Textures are allocated at power of two sizes, so they only grow
+ * and work on OpenGL 1.1 drivers without non power of two support. Velocity lines are
+ * drawn with one glDrawArrays call from a vertex buffer object that is kept between
+ * frames, or from a client side vertex array when the driver has no VBO support.
+ *
+ * GL objects are created on first use in the current context; call release() before that
+ * context is destroyed.
+ */
+class FieldRenderer
+{
+public:
+	enum Layer { LAYER_DENSITY, LAYER_BOUNDS, LAYER_USERS, LAYER_COUNT };
+
+	FieldRenderer(void);
+	~FieldRenderer(void);
+
+	/**
+	 * Uploads an RGBA8 image into the texture of a layer and draws it as one quad.
+	 * Texels with an alpha below one half are not drawn.
+	 *
+	 * @param layer   texture to use, keeps its size between frames
+	 * @param rgba    cols * rows texels of 4 bytes, bottom row first
+	 * @param cols    image width in texels
+	 * @param rows    image height in texels
+	 * @param left, bottom, right, top   corners of the quad in window coordinates
+	 * @param inset   texels cut off each side of the image. 0.5 puts the quad corners on
+	 *                the centers of the corner texels.
+	 * @param smooth  bilinear filtering if true, nearest texel if false
+	 */
+	void drawImage(Layer layer, const unsigned char* rgba, int cols, int rows,
+				   float left, float bottom, float right, float top, float inset, bool smooth);
+
+	/**
+	 * Draws one line per cell from the cell center along the cell velocity, in the current
+	 * color. Cell (i, j) is centered at ((i - 0.5) / width, (j - 0.5) / height). Velocities
+	 * are in grid widths, so vertical ones are stretched to match on a non-square grid.
+	 *
+	 * @param u       horizontal velocities in IX order, width+2 cells per row
+	 * @param v       vertical velocities in IX order
+	 * @param width   cells per row without the border cells
+	 * @param height  rows without the border cells
+	 */
+	void drawVelocity(const float* u, const float* v, int width, int height);
+
+	/**
+	 * Deletes all GL objects. They are recreated on the next draw.
+	 */
+	void release();
+
+private:
+	GLuint textures_[LAYER_COUNT];
+	int    textureWidth_[LAYER_COUNT];
+	int    textureHeight_[LAYER_COUNT];
+
+	GLuint        lineBuffer_;       // 0 when the driver has no VBO support
+	size_t        lineBufferBytes_;  // size of the lineBuffer_ data store
+	bool          checkedBuffers_;   // VBO entry points have been looked up
+	vector<float> lineVertices_;     // x, y pairs, two vertices per cell
+
+	/**
+	 * Makes sure the layer's texture can hold cols * rows texels.
+	 */
+	void prepareTexture(Layer layer, int cols, int rows);
+
+	FieldRenderer(const FieldRenderer&);
+	FieldRenderer& operator=(const FieldRenderer&);
+};
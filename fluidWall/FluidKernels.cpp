@@ -0,0 +1,1037 @@
+/**
+ * @file      FluidKernels.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "FluidKernels.h"
+#include "HalfFloat.h"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+	#define TARGET_AVX
+	#define TARGET_F16C
+#else
+	#include <cpuid.h>
+	#define TARGET_AVX __attribute__((target("avx")))
+	#define TARGET_F16C __attribute__((target("avx,f16c")))
+#endif
+
+using namespace std;
+
+#define VERIFY_WIDTH  37 //odd sizes so that the scalar tails of the vector kernels are checked too
+#define VERIFY_HEIGHT 23
+#define CURL_EPSILON  1e-5f //keeps the normalization of a flat curl gradient finite
+
+
+
+/*
+  ----------------------------------------------------------------------
+   scalar reference kernels
+  ----------------------------------------------------------------------
+*/
+
+static void addSourceScalar(float* x, const float* s, float dt, int size)
+{
+	for (int i = 0; i < size; i++)
+		x[i] += dt * s[i];
+}
+
+
+
+static void relaxRowScalar(float* x, const float* x0, int rowWidth, int first, int N, float a, float invC)
+{
+	for (int i = first; i <= N; i += 2)
+		x[i] = (x0[i] + a*(x[i-1] + x[i+1] + x[i-rowWidth] + x[i+rowWidth])) * invC;
+}
+
+
+
+/**
+ * Backtraces a single cell (i, j). Shared by the scalar kernel and the vector kernel tails.
+ */
+static inline void advectCell(float* d, const float* d0, const float* u, const float* v, int i, int j, 
+							  int width, int height, float dt0)
+{
+	const int rowWidth = width + 2;
+	int idx = i + rowWidth * j;
+
+	// calculate new coordinates based on existing velocity grids
+	float x = i - dt0 * u[idx];
+	float y = j - dt0 * v[idx];
+
+	//limit coordinates to fall within the grid
+	if (x < 0.5f)          x = 0.5f;
+	if (x > width + 0.5f)  x = width + 0.5f;
+	if (y < 0.5f)          y = 0.5f;
+	if (y > height + 0.5f) y = height + 0.5f;
+	int i0 = (int)x;
+	int j0 = (int)y;
+
+	float s1 = x - i0, s0 = 1 - s1;
+	float t1 = y - j0, t0 = 1 - t1;
+
+	int k = i0 + rowWidth * j0;
+	d[idx] = s0 * (t0 * d0[k] + t1 * d0[k + rowWidth]) +
+			 s1 * (t0 * d0[k + 1] + t1 * d0[k + rowWidth + 1]);
+}
+
+
+
+static void advectRowScalar(float* d, const float* d0, const float* u, const float* v, int j, int width, int height, float dt0)
+{
+	for (int i = 1; i <= width; i++)
+		advectCell(d, d0, u, v, i, j, width, height, dt0);
+}
+
+
+
+static void curlRowScalar(float* curl, const float* u, const float* v, int j, int width)
+{
+	const int rowWidth = width + 2;
+	for (int i = 1; i <= width; i++) {
+		int idx = i + rowWidth * j;
+		curl[i] = (v[idx + 1] - v[idx - 1]) - (u[idx + rowWidth] - u[idx - rowWidth]);
+	}
+	curl[0]         = curl[1];
+	curl[width + 1] = curl[width];
+}
+
+
+
+/**
+ * Forces of a single cell (i, j). Shared by the scalar kernel and the vector kernel tails.
+ */
+static inline void addForcesCell(float* u, float* v, const float* u0, const float* v0, const float* below,
+								 const float* curl, const float* above, const float* density, int i, int j,
+								 int width, float halfConfinement, float buoyancy, float dt)
+{
+	int idx = i + (width + 2) * j;
+
+	//gradient of the curl magnitude, normalized, times the curl
+	float gx  = fabsf(curl[i + 1]) - fabsf(curl[i - 1]);
+	float gy  = fabsf(above[i]) - fabsf(below[i]);
+	float len = sqrtf(gx * gx + gy * gy) + CURL_EPSILON;
+	float k   = halfConfinement * curl[i] / len;
+
+	float fx = k * gy;
+	float fy = density ? buoyancy * density[idx] - k * gx : -k * gx;
+	u[idx] += dt * (u0[idx] + fx);
+	v[idx] += dt * (v0[idx] + fy);
+}
+
+
+
+static void addForcesRowScalar(float* u, float* v, const float* u0, const float* v0, const float* below, 
+							   const float* curl, const float* above, const float* density, int j, int width,
+							   float confinement, float buoyancy, float dt)
+{
+	for (int i = 1; i <= width; i++)
+		addForcesCell(u, v, u0, v0, below, curl, above, density, i, j, width, 0.5f * confinement, buoyancy, dt);
+}
+
+
+
+/**
+ * Half kernels. The scalar ones convert with HalfFloat.h.
+ */
+static void loadHalvesScalar(const unsigned short* from, int count, float* to)
+{
+	for (int i = 0; i < count; i++)
+		to[i] = halfToFloat(from[i]);
+}
+
+
+
+static void storeHalvesScalar(const float* from, int count, unsigned short* to)
+{
+	for (int i = 0; i < count; i++)
+		to[i] = floatToHalf(from[i]);
+}
+
+
+
+static void addHalvesScalar(unsigned short* x, const unsigned short* s, int count)
+{
+	for (int i = 0; i < count; i++)
+		x[i] = floatToHalf(halfToFloat(x[i]) + halfToFloat(s[i]));
+}
+
+
+
+static void relaxHalvesScalar(unsigned short* x, const unsigned short* x0, int cell, int right, int up,
+							  const int* channels, int count, float a, float invC)
+{
+	for (int n = 0; n < count; n++) {
+		int k = cell + channels[n];
+		float sum = halfToFloat(x[k-right]) + halfToFloat(x[k+right]) + halfToFloat(x[k-up]) + halfToFloat(x[k+up]);
+		x[k] = floatToHalf((halfToFloat(x0[k]) + a*sum) * invC);
+	}
+}
+
+
+
+static void blendHalvesScalar(unsigned short* out, const unsigned short* const* corners, const float* weights,
+							  const int* channels, int count, float threshold, unsigned char* active)
+{
+	const float s0 = weights[0], s1 = weights[1], t0 = weights[2], t1 = weights[3];
+	for (int c = 0; c < count; c++) {
+		int   n     = channels[c];
+		float value = s0 * (t0 * halfToFloat(corners[0][n]) + t1 * halfToFloat(corners[1][n])) + 
+					  s1 * (t0 * halfToFloat(corners[2][n]) + t1 * halfToFloat(corners[3][n]));
+		out[n] = floatToHalf(value);
+		if (fabs(value) > threshold)
+			active[n] = 1;
+	}
+}
+
+
+
+static void correctHalvesScalar(unsigned short* out, const unsigned short* here, const unsigned short* start,
+								const unsigned short* const* corners, const float* weights, 
+								const unsigned short* const* limits, const int* channels, int count, 
+								float threshold, unsigned char* active)
+{
+	const float s0 = weights[0], s1 = weights[1], t0 = weights[2], t1 = weights[3];
+	for (int c = 0; c < count; c++) {
+		int   n     = channels[c];
+		float back  = s0 * (t0 * halfToFloat(corners[0][n]) + t1 * halfToFloat(corners[1][n])) + 
+					  s1 * (t0 * halfToFloat(corners[2][n]) + t1 * halfToFloat(corners[3][n]));
+		float value = halfToFloat(here[n]) + 0.5f * (halfToFloat(start[n]) - back);
+
+		float l0 = halfToFloat(limits[0][n]), l1 = halfToFloat(limits[1][n]);
+		float l2 = halfToFloat(limits[2][n]), l3 = halfToFloat(limits[3][n]);
+		float lo = min(min(l0, l1), min(l2, l3));
+		float hi = max(max(l0, l1), max(l2, l3));
+		value = value < lo ? lo : (value > hi ? hi : value);
+
+		out[n] = floatToHalf(value);
+		if (fabs(value) > threshold)
+			active[n] = 1;
+	}
+}
+
+
+
+/*
+  ----------------------------------------------------------------------
+   SSE2 kernels (4 cells at a time)
+  ----------------------------------------------------------------------
+*/
+
+static void addSourceSSE2(float* x, const float* s, float dt, int size)
+{
+	__m128 vdt = _mm_set1_ps(dt);
+	int i = 0;
+	for (; i + 4 <= size; i += 4)
+		_mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(vdt, _mm_loadu_ps(s + i))));
+	for (; i < size; i++)
+		x[i] += dt * s[i];
+}
+
+
+
+static void relaxRowSSE2(float* x, const float* x0, int rowWidth, int first, int N, float a, float invC)
+{
+	//the stencil is computed for every cell, then only cells of this color are kept. Their
+	//neighbors all have the other color, so that matches the scalar result exactly.
+	const __m128 va    = _mm_set1_ps(a);
+	const __m128 vinvC = _mm_set1_ps(invC);
+	const __m128 keep  = (first == 1) ? _mm_castsi128_ps(_mm_set_epi32(0, -1, 0, -1))
+	                                  : _mm_castsi128_ps(_mm_set_epi32(-1, 0, -1, 0));
+	//the left neighbors of the next block are loaded before this block is stored, a load that
+	//overlaps a store in flight would stall on store forwarding
+	int i = 1;
+	__m128 left = _mm_loadu_ps(x);
+	for (; i + 3 <= N; i += 4) {
+		__m128 old     = _mm_loadu_ps(x + i);
+		__m128 sum     = _mm_add_ps(_mm_add_ps(_mm_add_ps(left, _mm_loadu_ps(x + i + 1)),
+		                                       _mm_loadu_ps(x + i - rowWidth)), _mm_loadu_ps(x + i + rowWidth));
+		__m128 relaxed = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(x0 + i), _mm_mul_ps(va, sum)), vinvC);
+		left = _mm_loadu_ps(x + i + 3);
+		_mm_storeu_ps(x + i, _mm_or_ps(_mm_and_ps(keep, relaxed), _mm_andnot_ps(keep, old)));
+	}
+	//i - 1 is a multiple of 4, so the color of i is still that of 1
+	relaxRowScalar(x, x0, rowWidth, (first == 1) ? i : i + 1, N, a, invC);
+}
+
+
+
+static void advectRowSSE2(float* d, const float* d0, const float* u, const float* v, int j, int width, int height, float dt0)
+{
+	const int    rowWidth = width + 2;
+	const __m128 vdt0     = _mm_set1_ps(dt0);
+	const __m128 lo       = _mm_set1_ps(0.5f);
+	const __m128 hiX      = _mm_set1_ps(width + 0.5f);
+	const __m128 hiY      = _mm_set1_ps(height + 0.5f);
+	const __m128 one      = _mm_set1_ps(1.0f);
+	const __m128 vwidth   = _mm_set1_ps((float)rowWidth);
+	const __m128 lanes    = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 vj       = _mm_set1_ps((float)j);
+	int k[4];
+
+	int i = 1;
+	for (; i + 3 <= width; i += 4) {
+		int idx = i + rowWidth * j;
+
+		__m128 x = _mm_sub_ps(_mm_add_ps(_mm_set1_ps((float)i), lanes), _mm_mul_ps(vdt0, _mm_loadu_ps(u + idx)));
+		__m128 y = _mm_sub_ps(vj, _mm_mul_ps(vdt0, _mm_loadu_ps(v + idx)));
+		x = _mm_min_ps(_mm_max_ps(x, lo), hiX);
+		y = _mm_min_ps(_mm_max_ps(y, lo), hiY);
+
+		//coordinates are positive, so truncation is floor
+		__m128 i0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+		__m128 j0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+		__m128 s1 = _mm_sub_ps(x, i0), s0 = _mm_sub_ps(one, s1);
+		__m128 t1 = _mm_sub_ps(y, j0), t0 = _mm_sub_ps(one, t1);
+
+		//cell index fits exactly in a float for any grid we can allocate
+		_mm_storeu_si128((__m128i*)k, _mm_cvttps_epi32(_mm_add_ps(i0, _mm_mul_ps(vwidth, j0))));
+
+		__m128 d00 = _mm_set_ps(d0[k[3]],                d0[k[2]],                d0[k[1]],                d0[k[0]]);
+		__m128 d01 = _mm_set_ps(d0[k[3] + rowWidth],     d0[k[2] + rowWidth],     d0[k[1] + rowWidth],     d0[k[0] + rowWidth]);
+		__m128 d10 = _mm_set_ps(d0[k[3] + 1],            d0[k[2] + 1],            d0[k[1] + 1],            d0[k[0] + 1]);
+		__m128 d11 = _mm_set_ps(d0[k[3] + rowWidth + 1], d0[k[2] + rowWidth + 1], d0[k[1] + rowWidth + 1], d0[k[0] + rowWidth + 1]);
+
+		__m128 left  = _mm_add_ps(_mm_mul_ps(t0, d00), _mm_mul_ps(t1, d01));
+		__m128 right = _mm_add_ps(_mm_mul_ps(t0, d10), _mm_mul_ps(t1, d11));
+		_mm_storeu_ps(d + idx, _mm_add_ps(_mm_mul_ps(s0, left), _mm_mul_ps(s1, right)));
+	}
+
+	for (; i <= width; i++)
+		advectCell(d, d0, u, v, i, j, width, height, dt0);
+}
+
+
+
+static void curlRowSSE2(float* curl, const float* u, const float* v, int j, int width)
+{
+	const int rowWidth = width + 2;
+	int i = 1;
+	for (; i + 3 <= width; i += 4) {
+		int idx = i + rowWidth * j;
+		__m128 dv = _mm_sub_ps(_mm_loadu_ps(v + idx + 1), _mm_loadu_ps(v + idx - 1));
+		__m128 du = _mm_sub_ps(_mm_loadu_ps(u + idx + rowWidth), _mm_loadu_ps(u + idx - rowWidth));
+		_mm_storeu_ps(curl + i, _mm_sub_ps(dv, du));
+	}
+	for (; i <= width; i++) {
+		int idx = i + rowWidth * j;
+		curl[i] = (v[idx + 1] - v[idx - 1]) - (u[idx + rowWidth] - u[idx - rowWidth]);
+	}
+	curl[0]         = curl[1];
+	curl[width + 1] = curl[width];
+}
+
+
+
+static void addForcesRowSSE2(float* u, float* v, const float* u0, const float* v0, const float* below,
+							 const float* curl, const float* above, const float* density, int j, int width,
+							 float confinement, float buoyancy, float dt)
+{
+	const int    rowWidth = width + 2;
+	const float  halfConfinement = 0.5f * confinement;
+	const __m128 absMask  = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128 vhalf    = _mm_set1_ps(halfConfinement);
+	const __m128 vbuoy    = _mm_set1_ps(buoyancy);
+	const __m128 vdt      = _mm_set1_ps(dt);
+	const __m128 epsilon  = _mm_set1_ps(CURL_EPSILON);
+
+	int i = 1;
+	for (; i + 3 <= width; i += 4) {
+		int idx = i + rowWidth * j;
+
+		__m128 c   = _mm_loadu_ps(curl + i);
+		__m128 gx  = _mm_sub_ps(_mm_and_ps(absMask, _mm_loadu_ps(curl + i + 1)), _mm_and_ps(absMask, _mm_loadu_ps(curl + i - 1)));
+		__m128 gy  = _mm_sub_ps(_mm_and_ps(absMask, _mm_loadu_ps(above + i)), _mm_and_ps(absMask, _mm_loadu_ps(below + i)));
+		__m128 len = _mm_add_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy))), epsilon);
+		__m128 k   = _mm_div_ps(_mm_mul_ps(vhalf, c), len);
+
+		__m128 fx = _mm_mul_ps(k, gy);
+		__m128 fy = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(k, gx));
+		if (density)
+			fy = _mm_sub_ps(_mm_mul_ps(vbuoy, _mm_loadu_ps(density + idx)), _mm_mul_ps(k, gx));
+
+		_mm_storeu_ps(u + idx, _mm_add_ps(_mm_loadu_ps(u + idx), _mm_mul_ps(vdt, _mm_add_ps(_mm_loadu_ps(u0 + idx), fx))));
+		_mm_storeu_ps(v + idx, _mm_add_ps(_mm_loadu_ps(v + idx), _mm_mul_ps(vdt, _mm_add_ps(_mm_loadu_ps(v0 + idx), fy))));
+	}
+
+	for (; i <= width; i++)
+		addForcesCell(u, v, u0, v0, below, curl, above, density, i, j, width, halfConfinement, buoyancy, dt);
+}
+
+
+
+/*
+  ----------------------------------------------------------------------
+   AVX kernels (8 cells at a time). Gathers are done with scalar loads,
+   gather instructions need AVX2.
+  ----------------------------------------------------------------------
+*/
+
+TARGET_AVX static void addSourceAVX(float* x, const float* s, float dt, int size)
+{
+	__m256 vdt = _mm256_set1_ps(dt);
+	int i = 0;
+	for (; i + 8 <= size; i += 8)
+		_mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(vdt, _mm256_loadu_ps(s + i))));
+	for (; i < size; i++)
+		x[i] += dt * s[i];
+	_mm256_zeroupper();
+}
+
+
+
+TARGET_AVX static void relaxRowAVX(float* x, const float* x0, int rowWidth, int first, int N, float a, float invC)
+{
+	const __m256 va    = _mm256_set1_ps(a);
+	const __m256 vinvC = _mm256_set1_ps(invC);
+	int i = 1;
+	__m256 left = _mm256_loadu_ps(x);
+	for (; i + 7 <= N; i += 8) {
+		__m256 old     = _mm256_loadu_ps(x + i);
+		__m256 sum     = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(left, _mm256_loadu_ps(x + i + 1)),
+		                                             _mm256_loadu_ps(x + i - rowWidth)), _mm256_loadu_ps(x + i + rowWidth));
+		__m256 relaxed = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(x0 + i), _mm256_mul_ps(va, sum)), vinvC);
+		left = _mm256_loadu_ps(x + i + 7);
+
+		//keep lanes 0, 2, 4, 6 (first == 1) or 1, 3, 5, 7 (first == 2)
+		if (first == 1)
+			_mm256_storeu_ps(x + i, _mm256_blend_ps(relaxed, old, 0xAA));
+		else
+			_mm256_storeu_ps(x + i, _mm256_blend_ps(relaxed, old, 0x55));
+	}
+	_mm256_zeroupper();
+	relaxRowScalar(x, x0, rowWidth, (first == 1) ? i : i + 1, N, a, invC);
+}
+
+
+
+TARGET_AVX static void advectRowAVX(float* d, const float* d0, const float* u, const float* v, int j, int width, int height, float dt0)
+{
+	const int    rowWidth = width + 2;
+	const __m256 vdt0     = _mm256_set1_ps(dt0);
+	const __m256 lo       = _mm256_set1_ps(0.5f);
+	const __m256 hiX      = _mm256_set1_ps(width + 0.5f);
+	const __m256 hiY      = _mm256_set1_ps(height + 0.5f);
+	const __m256 one      = _mm256_set1_ps(1.0f);
+	const __m256 vwidth   = _mm256_set1_ps((float)rowWidth);
+	const __m256 lanes    = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+	const __m256 vj       = _mm256_set1_ps((float)j);
+	int k[8];
+	float g00[8], g01[8], g10[8], g11[8];
+
+	int i = 1;
+	for (; i + 7 <= width; i += 8) {
+		int idx = i + rowWidth * j;
+
+		__m256 x = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)i), lanes), _mm256_mul_ps(vdt0, _mm256_loadu_ps(u + idx)));
+		__m256 y = _mm256_sub_ps(vj, _mm256_mul_ps(vdt0, _mm256_loadu_ps(v + idx)));
+		x = _mm256_min_ps(_mm256_max_ps(x, lo), hiX);
+		y = _mm256_min_ps(_mm256_max_ps(y, lo), hiY);
+
+		__m256 i0 = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(x));
+		__m256 j0 = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(y));
+		__m256 s1 = _mm256_sub_ps(x, i0), s0 = _mm256_sub_ps(one, s1);
+		__m256 t1 = _mm256_sub_ps(y, j0), t0 = _mm256_sub_ps(one, t1);
+
+		_mm256_storeu_si256((__m256i*)k, _mm256_cvttps_epi32(_mm256_add_ps(i0, _mm256_mul_ps(vwidth, j0))));
+		for (int l = 0; l < 8; l++) {
+			g00[l] = d0[k[l]];
+			g01[l] = d0[k[l] + rowWidth];
+			g10[l] = d0[k[l] + 1];
+			g11[l] = d0[k[l] + rowWidth + 1];
+		}
+
+		__m256 left  = _mm256_add_ps(_mm256_mul_ps(t0, _mm256_loadu_ps(g00)), _mm256_mul_ps(t1, _mm256_loadu_ps(g01)));
+		__m256 right = _mm256_add_ps(_mm256_mul_ps(t0, _mm256_loadu_ps(g10)), _mm256_mul_ps(t1, _mm256_loadu_ps(g11)));
+		_mm256_storeu_ps(d + idx, _mm256_add_ps(_mm256_mul_ps(s0, left), _mm256_mul_ps(s1, right)));
+	}
+	_mm256_zeroupper();
+
+	for (; i <= width; i++)
+		advectCell(d, d0, u, v, i, j, width, height, dt0);
+}
+
+
+
+TARGET_AVX static void curlRowAVX(float* curl, const float* u, const float* v, int j, int width)
+{
+	const int rowWidth = width + 2;
+	int i = 1;
+	for (; i + 7 <= width; i += 8) {
+		int idx = i + rowWidth * j;
+		__m256 dv = _mm256_sub_ps(_mm256_loadu_ps(v + idx + 1), _mm256_loadu_ps(v + idx - 1));
+		__m256 du = _mm256_sub_ps(_mm256_loadu_ps(u + idx + rowWidth), _mm256_loadu_ps(u + idx - rowWidth));
+		_mm256_storeu_ps(curl + i, _mm256_sub_ps(dv, du));
+	}
+	_mm256_zeroupper();
+
+	for (; i <= width; i++) {
+		int idx = i + rowWidth * j;
+		curl[i] = (v[idx + 1] - v[idx - 1]) - (u[idx + rowWidth] - u[idx - rowWidth]);
+	}
+	curl[0]         = curl[1];
+	curl[width + 1] = curl[width];
+}
+
+
+
+TARGET_AVX static void addForcesRowAVX(float* u, float* v, const float* u0, const float* v0, const float* below,
+									   const float* curl, const float* above, const float* density, int j, int width,
+									   float confinement, float buoyancy, float dt)
+{
+	const int    rowWidth = width + 2;
+	const float  halfConfinement = 0.5f * confinement;
+	const __m256 absMask  = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	const __m256 vhalf    = _mm256_set1_ps(halfConfinement);
+	const __m256 vbuoy    = _mm256_set1_ps(buoyancy);
+	const __m256 vdt      = _mm256_set1_ps(dt);
+	const __m256 epsilon  = _mm256_set1_ps(CURL_EPSILON);
+
+	int i = 1;
+	for (; i + 7 <= width; i += 8) {
+		int idx = i + rowWidth * j;
+
+		__m256 c   = _mm256_loadu_ps(curl + i);
+		__m256 gx  = _mm256_sub_ps(_mm256_and_ps(absMask, _mm256_loadu_ps(curl + i + 1)), _mm256_and_ps(absMask, _mm256_loadu_ps(curl + i - 1)));
+		__m256 gy  = _mm256_sub_ps(_mm256_and_ps(absMask, _mm256_loadu_ps(above + i)), _mm256_and_ps(absMask, _mm256_loadu_ps(below + i)));
+		__m256 len = _mm256_add_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(gx, gx), _mm256_mul_ps(gy, gy))), epsilon);
+		__m256 k   = _mm256_div_ps(_mm256_mul_ps(vhalf, c), len);
+
+		__m256 fx = _mm256_mul_ps(k, gy);
+		__m256 fy = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(k, gx));
+		if (density)
+			fy = _mm256_sub_ps(_mm256_mul_ps(vbuoy, _mm256_loadu_ps(density + idx)), _mm256_mul_ps(k, gx));
+
+		_mm256_storeu_ps(u + idx, _mm256_add_ps(_mm256_loadu_ps(u + idx), _mm256_mul_ps(vdt, _mm256_add_ps(_mm256_loadu_ps(u0 + idx), fx))));
+		_mm256_storeu_ps(v + idx, _mm256_add_ps(_mm256_loadu_ps(v + idx), _mm256_mul_ps(vdt, _mm256_add_ps(_mm256_loadu_ps(v0 + idx), fy))));
+	}
+	_mm256_zeroupper();
+
+	for (; i <= width; i++)
+		addForcesCell(u, v, u0, v0, below, curl, above, density, i, j, width, halfConfinement, buoyancy, dt);
+}
+
+
+
+/*
+  ----------------------------------------------------------------------
+   F16C half kernels, 8 values at a time. The per cell kernels take 8
+   channels at a time while the list starts with channels 0, 1, 2, ...,
+   which it does wherever all users need work; the rest of a list is
+   converted one value at a time.
+  ----------------------------------------------------------------------
+*/
+
+TARGET_F16C static inline float loadHalfF16C(unsigned short half)
+{
+	return _mm_cvtss_f32(_mm_cvtph_ps(_mm_cvtsi32_si128(half)));
+}
+
+
+
+TARGET_F16C static inline unsigned short storeHalfF16C(float value)
+{
+	//rounding mode 0 is to nearest even, like floatToHalf()
+	return (unsigned short)_mm_cvtsi128_si32(_mm_cvtps_ph(_mm_set_ss(value), 0));
+}
+
+
+
+TARGET_F16C static inline __m256 load8HalvesF16C(const unsigned short* from)
+{
+	return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)from));
+}
+
+
+
+TARGET_F16C static inline void store8HalvesF16C(__m256 values, unsigned short* to)
+{
+	_mm_storeu_si128((__m128i*)to, _mm256_cvtps_ph(values, 0));
+}
+
+
+
+/**
+ * Returns the number of channels at the front of a list that are 0, 1, 2, ..., rounded 
+ * down to a multiple of 8. Lists are sorted, so channel 7 at index 7 means 0 - 7.
+ */
+static inline int getContiguousChannels(const int* channels, int count)
+{
+	int n = 0;
+	while (n + 8 <= count && channels[n + 7] == n + 7)
+		n += 8;
+	return n;
+}
+
+
+
+/**
+ * Sets active[n + b] for the lanes b of values with a magnitude above threshold.
+ */
+TARGET_F16C static inline void mark8ActiveF16C(__m256 values, __m256 threshold, unsigned char* active)
+{
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	int bits = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_and_ps(values, absMask), threshold, _CMP_GT_OQ));
+	for (int b = 0; bits; b++, bits >>= 1)
+		if (bits & 1)
+			active[b] = 1;
+}
+
+
+
+TARGET_F16C static void loadHalvesF16C(const unsigned short* from, int count, float* to)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(to + i, load8HalvesF16C(from + i));
+	for (; i < count; i++)
+		to[i] = loadHalfF16C(from[i]);
+	_mm256_zeroupper();
+}
+
+
+
+TARGET_F16C static void storeHalvesF16C(const float* from, int count, unsigned short* to)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+		store8HalvesF16C(_mm256_loadu_ps(from + i), to + i);
+	for (; i < count; i++)
+		to[i] = storeHalfF16C(from[i]);
+	_mm256_zeroupper();
+}
+
+
+
+TARGET_F16C static void addHalvesF16C(unsigned short* x, const unsigned short* s, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+		store8HalvesF16C(_mm256_add_ps(load8HalvesF16C(x + i), load8HalvesF16C(s + i)), x + i);
+	for (; i < count; i++)
+		x[i] = storeHalfF16C(loadHalfF16C(x[i]) + loadHalfF16C(s[i]));
+	_mm256_zeroupper();
+}
+
+
+
+TARGET_F16C static void relaxHalvesF16C(unsigned short* x, const unsigned short* x0, int cell, int right, int up,
+										const int* channels, int count, float a, float invC)
+{
+	//the channels of a cell do not depend on each other, so they relax in any order
+	const __m256 va    = _mm256_set1_ps(a);
+	const __m256 vinvC = _mm256_set1_ps(invC);
+	const int    block = getContiguousChannels(channels, count);
+	int n = 0;
+	for (; n < block; n += 8) {
+		int    k   = cell + n;
+		__m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(load8HalvesF16C(x + k - right), load8HalvesF16C(x + k + right)),
+		                                         load8HalvesF16C(x + k - up)), load8HalvesF16C(x + k + up));
+		store8HalvesF16C(_mm256_mul_ps(_mm256_add_ps(load8HalvesF16C(x0 + k), _mm256_mul_ps(va, sum)), vinvC), x + k);
+	}
+	for (; n < count; n++) {
+		int k = cell + channels[n];
+		float sum = loadHalfF16C(x[k-right]) + loadHalfF16C(x[k+right]) + loadHalfF16C(x[k-up]) + loadHalfF16C(x[k+up]);
+		x[k] = storeHalfF16C((loadHalfF16C(x0[k]) + a*sum) * invC);
+	}
+	_mm256_zeroupper();
+}
+
+
+
+TARGET_F16C static void blendHalvesF16C(unsigned short* out, const unsigned short* const* corners, const float* weights,
+										const int* channels, int count, float threshold, unsigned char* active)
+{
+	const float  s0 = weights[0], s1 = weights[1], t0 = weights[2], t1 = weights[3];
+	const __m256 vs0 = _mm256_set1_ps(s0), vs1 = _mm256_set1_ps(s1);
+	const __m256 vt0 = _mm256_set1_ps(t0), vt1 = _mm256_set1_ps(t1);
+	const __m256 vthreshold = _mm256_set1_ps(threshold);
+	const int    block = getContiguousChannels(channels, count);
+	int c = 0;
+	for (; c < block; c += 8) {
+		__m256 left  = _mm256_add_ps(_mm256_mul_ps(vt0, load8HalvesF16C(corners[0] + c)), _mm256_mul_ps(vt1, load8HalvesF16C(corners[1] + c)));
+		__m256 right = _mm256_add_ps(_mm256_mul_ps(vt0, load8HalvesF16C(corners[2] + c)), _mm256_mul_ps(vt1, load8HalvesF16C(corners[3] + c)));
+		__m256 value = _mm256_add_ps(_mm256_mul_ps(vs0, left), _mm256_mul_ps(vs1, right));
+		store8HalvesF16C(value, out + c);
+		mark8ActiveF16C(value, vthreshold, active + c);
+	}
+	for (; c < count; c++) {
+		int   n     = channels[c];
+		float value = s0 * (t0 * loadHalfF16C(corners[0][n]) + t1 * loadHalfF16C(corners[1][n])) + 
+					  s1 * (t0 * loadHalfF16C(corners[2][n]) + t1 * loadHalfF16C(corners[3][n]));
+		out[n] = storeHalfF16C(value);
+		if (fabs(value) > threshold)
+			active[n] = 1;
+	}
+	_mm256_zeroupper();
+}
+
+
+
+TARGET_F16C static void correctHalvesF16C(unsigned short* out, const unsigned short* here, const unsigned short* start,
+										  const unsigned short* const* corners, const float* weights, 
+										  const unsigned short* const* limits, const int* channels, int count, 
+										  float threshold, unsigned char* active)
+{
+	const float  s0 = weights[0], s1 = weights[1], t0 = weights[2], t1 = weights[3];
+	const __m256 vs0 = _mm256_set1_ps(s0), vs1 = _mm256_set1_ps(s1);
+	const __m256 vt0 = _mm256_set1_ps(t0), vt1 = _mm256_set1_ps(t1);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 vthreshold = _mm256_set1_ps(threshold);
+	const int    block = getContiguousChannels(channels, count);
+	int c = 0;
+	for (; c < block; c += 8) {
+		__m256 left  = _mm256_add_ps(_mm256_mul_ps(vt0, load8HalvesF16C(corners[0] + c)), _mm256_mul_ps(vt1, load8HalvesF16C(corners[1] + c)));
+		__m256 right = _mm256_add_ps(_mm256_mul_ps(vt0, load8HalvesF16C(corners[2] + c)), _mm256_mul_ps(vt1, load8HalvesF16C(corners[3] + c)));
+		__m256 back  = _mm256_add_ps(_mm256_mul_ps(vs0, left), _mm256_mul_ps(vs1, right));
+		__m256 value = _mm256_add_ps(load8HalvesF16C(here + c), _mm256_mul_ps(half, _mm256_sub_ps(load8HalvesF16C(start + c), back)));
+
+		__m256 l0 = load8HalvesF16C(limits[0] + c), l1 = load8HalvesF16C(limits[1] + c);
+		__m256 l2 = load8HalvesF16C(limits[2] + c), l3 = load8HalvesF16C(limits[3] + c);
+		__m256 lo = _mm256_min_ps(_mm256_min_ps(l0, l1), _mm256_min_ps(l2, l3));
+		__m256 hi = _mm256_max_ps(_mm256_max_ps(l0, l1), _mm256_max_ps(l2, l3));
+		value = _mm256_max_ps(lo, _mm256_min_ps(hi, value));
+
+		store8HalvesF16C(value, out + c);
+		mark8ActiveF16C(value, vthreshold, active + c);
+	}
+	for (; c < count; c++) {
+		int   n     = channels[c];
+		float back  = s0 * (t0 * loadHalfF16C(corners[0][n]) + t1 * loadHalfF16C(corners[1][n])) + 
+					  s1 * (t0 * loadHalfF16C(corners[2][n]) + t1 * loadHalfF16C(corners[3][n]));
+		float value = loadHalfF16C(here[n]) + 0.5f * (loadHalfF16C(start[n]) - back);
+
+		float l0 = loadHalfF16C(limits[0][n]), l1 = loadHalfF16C(limits[1][n]);
+		float l2 = loadHalfF16C(limits[2][n]), l3 = loadHalfF16C(limits[3][n]);
+		float lo = min(min(l0, l1), min(l2, l3));
+		float hi = max(max(l0, l1), max(l2, l3));
+		value = value < lo ? lo : (value > hi ? hi : value);
+
+		out[n] = storeHalfF16C(value);
+		if (fabs(value) > threshold)
+			active[n] = 1;
+	}
+	_mm256_zeroupper();
+}
+
+
+
+/*
+  ----------------------------------------------------------------------
+   detection and selection
+  ----------------------------------------------------------------------
+*/
+
+InstructionSet detectInstructionSet()
+{
+	unsigned int ecx, edx;
+
+	#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		ecx = (unsigned int)info[2];
+		edx = (unsigned int)info[3];
+	#else
+		unsigned int eax, ebx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			return INSTRUCTIONS_SCALAR;
+	#endif
+
+	bool hasSSE2    = (edx & (1 << 26)) != 0;
+	bool hasOSXSAVE = (ecx & (1 << 27)) != 0;
+	bool hasAVX     = (ecx & (1 << 28)) != 0;
+	bool hasF16C    = (ecx & (1 << 29)) != 0;
+
+	//AVX also needs the OS to save the upper halves of the ymm registers
+	if (hasAVX && hasOSXSAVE) {
+		#if defined(_MSC_VER)
+			unsigned long long xcr0 = _xgetbv(0);
+		#else
+			unsigned int xcrLo, xcrHi;
+			__asm__ ("xgetbv" : "=a"(xcrLo), "=d"(xcrHi) : "c"(0));
+			unsigned long long xcr0 = ((unsigned long long)xcrHi << 32) | xcrLo;
+		#endif
+		if ((xcr0 & 6) == 6)
+			return hasF16C ? INSTRUCTIONS_F16C : INSTRUCTIONS_AVX;
+	}
+
+	return hasSSE2 ? INSTRUCTIONS_SSE2 : INSTRUCTIONS_SCALAR;
+}
+
+
+
+FluidKernels getFluidKernels(InstructionSet instructionSet)
+{
+	FluidKernels kernels;
+	kernels.instructionSet = instructionSet;
+
+	switch (instructionSet)
+	{
+		case INSTRUCTIONS_F16C:
+		case INSTRUCTIONS_AVX:
+			kernels.addSource    = addSourceAVX;
+			kernels.relaxRow     = relaxRowAVX;
+			kernels.advectRow    = advectRowAVX;
+			kernels.curlRow      = curlRowAVX;
+			kernels.addForcesRow = addForcesRowAVX;
+			break;
+		case INSTRUCTIONS_SSE2:
+			kernels.addSource    = addSourceSSE2;
+			kernels.relaxRow     = relaxRowSSE2;
+			kernels.advectRow    = advectRowSSE2;
+			kernels.curlRow      = curlRowSSE2;
+			kernels.addForcesRow = addForcesRowSSE2;
+			break;
+		default:
+			kernels.instructionSet = INSTRUCTIONS_SCALAR;
+			kernels.addSource    = addSourceScalar;
+			kernels.relaxRow     = relaxRowScalar;
+			kernels.advectRow    = advectRowScalar;
+			kernels.curlRow      = curlRowScalar;
+			kernels.addForcesRow = addForcesRowScalar;
+			break;
+	}
+
+	if (instructionSet == INSTRUCTIONS_F16C) {
+		kernels.loadHalves    = loadHalvesF16C;
+		kernels.storeHalves   = storeHalvesF16C;
+		kernels.addHalves     = addHalvesF16C;
+		kernels.relaxHalves   = relaxHalvesF16C;
+		kernels.blendHalves   = blendHalvesF16C;
+		kernels.correctHalves = correctHalvesF16C;
+	}
+	else {
+		kernels.loadHalves    = loadHalvesScalar;
+		kernels.storeHalves   = storeHalvesScalar;
+		kernels.addHalves     = addHalvesScalar;
+		kernels.relaxHalves   = relaxHalvesScalar;
+		kernels.blendHalves   = blendHalvesScalar;
+		kernels.correctHalves = correctHalvesScalar;
+	}
+	return kernels;
+}
+
+
+
+/**
+ * Returns true if every value of a is within tolerance of b, relative to the size of b
+ * (or absolute for values smaller than one).
+ */
+static bool isWithinTolerance(const vector<float>& a, const vector<float>& b, float tolerance)
+{
+	for (int i = 0; i < (int)a.size(); i++) {
+		float scale = fabs(b[i]) > 1.0f ? fabs(b[i]) : 1.0f;
+		if (!(fabs(a[i] - b[i]) <= tolerance * scale))
+			return false;
+	}
+	return true;
+}
+
+
+
+/**
+ * Returns true if two arrays of halves hold the same values within tolerance.
+ */
+static bool isWithinTolerance(const vector<unsigned short>& a, const vector<unsigned short>& b, float tolerance)
+{
+	vector<float> fa(a.size()), fb(b.size());
+	loadHalvesScalar(&a[0], (int)a.size(), &fa[0]);
+	loadHalvesScalar(&b[0], (int)b.size(), &fb[0]);
+	return isWithinTolerance(fa, fb, tolerance);
+}
+
+
+
+/**
+ * The half part of verifyFluidKernels(), on a field of three interleaved channels.
+ */
+static bool verifyHalfKernels(const FluidKernels& kernels, const FluidKernels& reference, float tolerance,
+							  int nChannels, const int* channels, int count)
+{
+	const int right     = nChannels;
+	const int up        = (VERIFY_WIDTH + 2) * nChannels;
+	const int size      = (VERIFY_WIDTH + 2) * (VERIFY_HEIGHT + 2) * nChannels;
+
+	//densities of a few units, with a subnormal and an overflow among them for the conversions
+	vector<float> values(size), weights(size);
+	unsigned int seed = 54321;
+	for (int i = 0; i < size; i++) {
+		seed = seed * 1103515245u + 12345u; values[i]  = ((seed >> 8) & 0xFFFF) / 16384.0f - 1.0f;
+		seed = seed * 1103515245u + 12345u; weights[i] = ((seed >> 8) & 0xFFFF) / 65535.0f;
+	}
+	values[0] = 1e-6f;
+	values[1] = 70000.0f;
+
+	vector<unsigned short> expected(size), actual(size);
+	reference.storeHalves(&values[0], size, &expected[0]);
+	kernels.storeHalves(&values[0], size, &actual[0]);
+	if (actual != expected)
+		return false;
+
+	//conversions are exact, and the overflow is infinite in both
+	vector<float> expectedFloats(size), actualFloats(size);
+	reference.loadHalves(&expected[0], size, &expectedFloats[0]);
+	kernels.loadHalves(&expected[0], size, &actualFloats[0]);
+	if (actualFloats != expectedFloats)
+		return false;
+
+	//the field is its own source, shifted by one value
+	expected[1] = floatToHalf(1.0f);
+	const vector<unsigned short> field(expected);
+	actual = expected;
+	reference.addHalves(&expected[0], &field[1], size - 1);
+	kernels.addHalves(&actual[0], &field[1], size - 1);
+	if (!isWithinTolerance(actual, expected, tolerance))
+		return false;
+
+	expected = actual = field;
+	for (int j = 1; j <= VERIFY_HEIGHT; j++)
+		for (int i = 1; i <= VERIFY_WIDTH; i++) {
+			int cell = (i + (VERIFY_WIDTH + 2) * j) * nChannels;
+			reference.relaxHalves(&expected[0], &field[0], cell, right, up, channels, count, 1.0f, 0.25f);
+			kernels.relaxHalves(&actual[0], &field[0], cell, right, up, channels, count, 1.0f, 0.25f);
+		}
+	if (!isWithinTolerance(actual, expected, tolerance))
+		return false;
+
+	//blend and correct every interior cell from its upper right neighbors
+	vector<unsigned short> expectedCorrected(size, 0), actualCorrected(size, 0);
+	vector<unsigned char>  expectedActive(nChannels, 0), actualActive(nChannels, 0);
+	expected.assign(size, 0);
+	actual.assign(size, 0);
+	for (int j = 1; j <= VERIFY_HEIGHT; j++)
+		for (int i = 1; i <= VERIFY_WIDTH; i++) {
+			int cell = (i + (VERIFY_WIDTH + 2) * j) * nChannels;
+			const unsigned short* corners[] = { &field[cell], &field[cell + up], &field[cell + right], &field[cell + up + right] };
+			float w[] = { weights[cell], 1.0f - weights[cell], weights[cell + 1], 1.0f - weights[cell + 1] };
+
+			reference.blendHalves(&expected[cell], corners, w, channels, count, 0.5f, &expectedActive[0]);
+			kernels.blendHalves(&actual[cell], corners, w, channels, count, 0.5f, &actualActive[0]);
+			reference.correctHalves(&expectedCorrected[cell], &field[cell], &field[cell + 1], corners, w, corners, 
+									channels, count, 0.5f, &expectedActive[0]);
+			kernels.correctHalves(&actualCorrected[cell], &field[cell], &field[cell + 1], corners, w, corners, 
+								  channels, count, 0.5f, &actualActive[0]);
+		}
+	return isWithinTolerance(actual, expected, tolerance) && 
+		   isWithinTolerance(actualCorrected, expectedCorrected, tolerance) && actualActive == expectedActive;
+}
+
+
+
+bool verifyFluidKernels(const FluidKernels& kernels, float tolerance)
+{
+	const int N        = VERIFY_WIDTH;
+	const int rows     = VERIFY_HEIGHT;
+	const int rowWidth = N + 2;
+	const int size     = rowWidth * (rows + 2);
+	FluidKernels reference = getFluidKernels(INSTRUCTIONS_SCALAR);
+
+	//deterministic pseudo random fields; velocities large enough to hit the clamps
+	vector<float> s(size), u(size), v(size);
+	unsigned int seed = 12345;
+	for (int i = 0; i < size; i++) {
+		seed = seed * 1103515245u + 12345u; s[i] = ((seed >> 8) & 0xFFFF) / 65535.0f;
+		seed = seed * 1103515245u + 12345u; u[i] = ((seed >> 8) & 0xFFFF) / 65535.0f - 0.5f;
+		seed = seed * 1103515245u + 12345u; v[i] = ((seed >> 8) & 0xFFFF) / 65535.0f - 0.5f;
+	}
+
+	vector<float> expected(u), actual(u);
+	reference.addSource(&expected[0], &s[0], 0.1f, size);
+	kernels.addSource(&actual[0], &s[0], 0.1f, size);
+	if (!isWithinTolerance(actual, expected, tolerance))
+		return false;
+
+	expected = actual = v;
+	for (int color = 0; color < 2; color++)
+		for (int j = 1; j <= rows; j++) {
+			int first = 1 + ((1 + j + color) & 1);
+			reference.relaxRow(&expected[j * rowWidth], &s[j * rowWidth], rowWidth, first, N, 1.0f, 0.25f);
+			kernels.relaxRow(&actual[j * rowWidth], &s[j * rowWidth], rowWidth, first, N, 1.0f, 0.25f);
+		}
+	if (!isWithinTolerance(actual, expected, tolerance))
+		return false;
+
+	expected.assign(size, 0.0f);
+	actual.assign(size, 0.0f);
+	for (int j = 1; j <= rows; j++) {
+		reference.advectRow(&expected[0], &s[0], &u[0], &v[0], j, N, rows, 0.1f * N);
+		kernels.advectRow(&actual[0], &s[0], &u[0], &v[0], j, N, rows, 0.1f * N);
+	}
+	if (!isWithinTolerance(actual, expected, tolerance))
+		return false;
+
+	//curl of every row; the forces of both sets are then computed from the reference curl
+	vector<float> expectedCurl(size, 0.0f), actualCurl(size, 0.0f);
+	for (int j = 1; j <= rows; j++) {
+		reference.curlRow(&expectedCurl[j * rowWidth], &u[0], &v[0], j, N);
+		kernels.curlRow(&actualCurl[j * rowWidth], &u[0], &v[0], j, N);
+	}
+	if (!isWithinTolerance(actualCurl, expectedCurl, tolerance))
+		return false;
+
+	expected = actual = u;
+	vector<float> expectedV(v), actualV(v);
+	for (int j = 1; j <= rows; j++) {
+		const float* curl = &expectedCurl[j * rowWidth];
+		reference.addForcesRow(&expected[0], &expectedV[0], &s[0], &u[0], curl - rowWidth, curl, curl + rowWidth,
+							   &s[0], j, N, 0.5f, 0.2f, 0.1f);
+		kernels.addForcesRow(&actual[0], &actualV[0], &s[0], &u[0], curl - rowWidth, curl, curl + rowWidth,
+							 &s[0], j, N, 0.5f, 0.2f, 0.1f);
+	}
+	if (!isWithinTolerance(actual, expected, tolerance) || !isWithinTolerance(actualV, expectedV, tolerance))
+		return false;
+
+	//a list with a gap, like a tile with one idle user, and one with a run of 8 users first
+	const int fewChannels[]  = { 0, 2 };
+	const int manyChannels[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 11 };
+	return verifyHalfKernels(kernels, reference, tolerance, 3, fewChannels, 2) &&
+		   verifyHalfKernels(kernels, reference, tolerance, 12, manyChannels, 11);
+}
+
+
+
+FluidKernels selectFluidKernels()
+{
+	int instructionSet = detectInstructionSet();
+
+	for (; instructionSet > INSTRUCTIONS_SCALAR; instructionSet--) {
+		FluidKernels kernels = getFluidKernels((InstructionSet)instructionSet);
+		if (verifyFluidKernels(kernels, KERNEL_TOLERANCE))
+			return kernels;
+	}
+	return getFluidKernels(INSTRUCTIONS_SCALAR);
+}
+
+
+
+const char* getInstructionSetName(InstructionSet instructionSet)
+{
+	switch (instructionSet)
+	{
+		case INSTRUCTIONS_F16C: return "AVX+F16C";
+		case INSTRUCTIONS_AVX:  return "AVX";
+		case INSTRUCTIONS_SSE2: return "SSE2";
+		default:                return "scalar";
+	}
+}
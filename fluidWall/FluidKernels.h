@@ -0,0 +1,218 @@
+/**
+ * @file      FluidKernels.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * Inner loops of the FluidSolver in scalar, SSE2 and AVX versions. The scalar versions are
+ * the reference implementation; the vector versions are selected at runtime depending on
+ * what the CPU supports.
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+/**
+ * Instruction sets the kernels are available for, from slowest to fastest. INSTRUCTIONS_F16C
+ * is AVX with the half precision conversions, which only the half kernels use.
+ */
+enum InstructionSet { INSTRUCTIONS_SCALAR, INSTRUCTIONS_SSE2, INSTRUCTIONS_AVX, INSTRUCTIONS_F16C };
+
+/**
+ * Largest relative difference allowed between a vector kernel and the scalar reference
+ * before the vector kernel is rejected.
+ */
+const static float KERNEL_TOLERANCE = 1e-5f;
+
+/**
+ * Table of kernel functions for one instruction set. Arrays are laid out like the
+ * FluidSolver arrays: (width+2)*(height+2) cells, row-major in j, including buffer cells.
+ *
+ * The half kernels work on the interleaved user channels of FluidSolverMultiUser stored as 
+ * halves (see HalfFloat.h), and compute in floats. Without F16C they convert in integer 
+ * code, which gives the same bits.
+ */
+struct FluidKernels
+{
+	InstructionSet instructionSet;
+
+	/**
+	 * x[i] += dt * s[i] for the whole array.
+	 *
+	 * @param x    - array that values will be added to
+	 * @param s    - array representing how much value to add
+	 * @param dt   - timestep
+	 * @param size - number of cells, including buffer cells
+	 */
+	void (*addSource)(float* x, const float* s, float dt, int size);
+
+	/**
+	 * Relaxes one color of one row for red-black Gauss-Seidel:
+	 * x[i] = (x0[i] + a * (sum of 4 neighbors)) * invC for i = first, first + 2, ... <= N.
+	 *
+	 * @param x        - pointer to cell (0, j) of the solution
+	 * @param x0       - pointer to cell (0, j) of the initial solution
+	 * @param rowWidth - cells per row, including buffer cells (width + 2)
+	 * @param first    - first cell of the color in this row (1 or 2)
+	 * @param N        - cells per row, without buffer cells (width)
+	 * @param a        - coefficient of relaxation per cell
+	 * @param invC     - reciprocal of the stencil denominator
+	 */
+	void (*relaxRow)(float* x, const float* x0, int rowWidth, int first, int N, float a, float invC);
+
+	/**
+	 * Semi-Lagrangian backtrace of cells (1..width, j) with bilinear blending.
+	 *
+	 * @param d      - final density or velocity array
+	 * @param d0     - initial density or velocity array
+	 * @param u      - horizontal velocity array
+	 * @param v      - vertical velocity array
+	 * @param j      - row to advect
+	 * @param width  - cells per row, without buffer cells
+	 * @param height - rows, without buffer cells
+	 * @param dt0    - timestep times cells per unit length
+	 */
+	void (*advectRow)(float* d, const float* d0, const float* u, const float* v, int j, int width, int height, float dt0);
+
+	/**
+	 * Curl of the velocity at cells (1..width, j), as the velocity difference across two 
+	 * cells: curl[i] = (v(i+1, j) - v(i-1, j)) - (u(i, j+1) - u(i, j-1)). Entries 0 and
+	 * width+1 repeat their neighbors, so the gradient of the curl is one sided at the sides.
+	 *
+	 * @param curl   - row of width + 2 values that receives the curl
+	 * @param u      - horizontal velocity array
+	 * @param v      - vertical velocity array
+	 * @param j      - row
+	 * @param width  - cells per row, without buffer cells
+	 */
+	void (*curlRow)(float* curl, const float* u, const float* v, int j, int width);
+
+	/**
+	 * Adds the velocity sources, vorticity confinement and buoyancy of cells (1..width, j)
+	 * to the velocity in one pass: u += dt * (u0 + fx), v += dt * (v0 + fy) with
+	 * (fx, fy) = confinement / 2 * curl * (Ny, -Nx) + (0, buoyancy * density), where N is 
+	 * the normalized gradient of |curl|, pointing towards the center of the eddy.
+	 *
+	 * @param u, v        - velocity arrays, updated in place
+	 * @param u0, v0      - velocity added this timestep
+	 * @param below       - curl of row j - 1 (see curlRow)
+	 * @param curl        - curl of row j
+	 * @param above       - curl of row j + 1
+	 * @param density     - density array that buoyancy acts on, NULL for none
+	 * @param j           - row
+	 * @param width       - cells per row, without buffer cells
+	 * @param confinement - vorticity confinement strength, 0 for none
+	 * @param buoyancy    - upward acceleration per unit of density
+	 * @param dt          - timestep
+	 */
+	void (*addForcesRow)(float* u, float* v, const float* u0, const float* v0, const float* below,
+						 const float* curl, const float* above, const float* density, int j, int width,
+						 float confinement, float buoyancy, float dt);
+
+	/**
+	 * Converts count halves to floats, or count floats to the nearest halves.
+	 */
+	void (*loadHalves)(const unsigned short* from, int count, float* to);
+	void (*storeHalves)(const float* from, int count, unsigned short* to);
+
+	/**
+	 * x[i] += s[i] for count halves.
+	 */
+	void (*addHalves)(unsigned short* x, const unsigned short* s, int count);
+
+	/**
+	 * Relaxes the listed channels of one cell of interleaved halves: 
+	 * x[k] = (x0[k] + a * (x[k-right] + x[k+right] + x[k-up] + x[k+up])) * invC 
+	 * for k = cell + channels[n].
+	 *
+	 * @param x, x0    - solution and initial solution
+	 * @param cell     - first channel of the cell
+	 * @param right    - offset of the next cell in the row, in values
+	 * @param up       - offset of the next cell in the column, in values
+	 * @param channels - channels to relax
+	 * @param count    - number of channels
+	 * @param a        - coefficient of relaxation per cell
+	 * @param invC     - reciprocal of the stencil denominator
+	 */
+	void (*relaxHalves)(unsigned short* x, const unsigned short* x0, int cell, int right, int up,
+						const int* channels, int count, float a, float invC);
+
+	/**
+	 * Bilinear blend of the listed channels of four cells of interleaved halves:
+	 * out[n] = s0 * (t0 * c00[n] + t1 * c01[n]) + s1 * (t0 * c10[n] + t1 * c11[n]).
+	 *
+	 * @param out       - first channel of the cell that receives the blend
+	 * @param corners   - first channels of the cells (i0, j0), (i0, j0+1), (i0+1, j0), (i0+1, j0+1)
+	 * @param weights   - s0, s1, t0, t1
+	 * @param channels  - channels to blend
+	 * @param count     - number of channels
+	 * @param threshold - active[n] is set to 1 for results of a larger magnitude
+	 * @param active    - one flag per channel
+	 */
+	void (*blendHalves)(unsigned short* out, const unsigned short* const* corners, const float* weights,
+						const int* channels, int count, float threshold, unsigned char* active);
+
+	/**
+	 * MacCormack correction of the listed channels of one cell of interleaved halves: 
+	 * out[n] = here[n] + (start[n] - blend of corners) / 2, clamped to the range of limits.
+	 *
+	 * @param out       - first channel of the corrected cell
+	 * @param here      - first channel of the cell in the semi-Lagrangian result
+	 * @param start     - first channel of the cell before advection
+	 * @param corners   - corners of the forward trace into the semi-Lagrangian result, see blendHalves
+	 * @param weights   - s0, s1, t0, t1 of the forward trace
+	 * @param limits    - corners of the backtrace into the field before advection
+	 * @param channels  - channels to correct
+	 * @param count     - number of channels
+	 * @param threshold - active[n] is set to 1 for results of a larger magnitude
+	 * @param active    - one flag per channel
+	 */
+	void (*correctHalves)(unsigned short* out, const unsigned short* here, const unsigned short* start,
+						  const unsigned short* const* corners, const float* weights, 
+						  const unsigned short* const* limits, const int* channels, int count, 
+						  float threshold, unsigned char* active);
+};
+
+/**
+ * Returns the fastest instruction set that both the CPU and the OS support.
+ */
+InstructionSet detectInstructionSet();
+
+/**
+ * Returns the kernels for an instruction set.
+ */
+FluidKernels getFluidKernels(InstructionSet instructionSet);
+
+/**
+ * Runs a set of kernels and the scalar reference on the same random data and compares
+ * the results.
+ *
+ * @param kernels   - kernels to check
+ * @param tolerance - largest relative difference allowed
+ * @return          - true if every result is within tolerance of the scalar reference
+ */
+bool verifyFluidKernels(const FluidKernels& kernels, float tolerance);
+
+/**
+ * Returns the kernels for the fastest instruction set that is supported and passes
+ * verifyFluidKernels() with KERNEL_TOLERANCE.
+ */
+FluidKernels selectFluidKernels();
+
+/**
+ * Returns a readable name for an instruction set.
+ */
+const char* getInstructionSetName(InstructionSet instructionSet);
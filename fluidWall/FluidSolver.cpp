@@ -20,73 +20,184 @@
  */
 
 #include "FluidSolver.h"
+#include "Profiler.h"
+#include "HalfFloat.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
+#include <algorithm>
 
 
-#define ROW_WIDTH N_+2
+#define ROW_WIDTH width_+2
 #define IX(i,j) ((i)+(ROW_WIDTH)*(j))
-#define FOR_EACH_CELL for (i=1 ; i<=N_ ; i++) { for (j=1 ; j<=N_ ; j++) {
+//walk j (rows) in the outer loop so the inner loop follows memory order of IX(i,j)
+#define FOR_EACH_CELL for (j=1 ; j<=height_ ; j++) { for (i=1 ; i<=width_ ; i++) {
 #define END_FOR }}
 #define SWAP(x0,x) { float* tmp=x0; x0=x; x=tmp; }
 
+#define LINEAR_SOLVE_ITERATIONS 20
+#define MIN_PARALLEL_N          32  //grids with fewer rows than this are not worth waking up worker threads
+
+
+
+/**
+ * Stores field values into a snapshot, as floats or as halves.
+ */
+static inline void storeValues(const float* from, int count, float* to)
+{
+	copy(from, from + count, to);
+}
+
+static inline void storeValues(const float* from, int count, unsigned short* to)
+{
+	for (int k = 0; k < count; k++)
+		to[k] = floatToHalf(from[k]);
+}
+
+static inline float loadValue(float value)          { return value; }
+static inline float loadValue(unsigned short value) { return halfToFloat(value); }
+
+
+
+/**
+ * Moves field values towards snapshot values: to += weight * (from - to).
+ */
+template <class T>
+static void blendValues(const T* from, int count, float weight, float* to)
+{
+	for (int k = 0; k < count; k++)
+		to[k] += weight * (loadValue(from[k]) - to[k]);
+}
+
 
 
 FluidSolver::FluidSolver(void)
 {
-	FluidSolver(128, 0.1f, 0.00f, 0.0f);
+	init(128, 128, 0.1f, 0.00f, 0.0f);
+	allocateFields();
 }
 
 
 
 FluidSolver::FluidSolver(int N, float dt, float diff, float visc)
 {
-	N_      = N;
-	dt_     = dt;
-	diff_   = diff;
-	visc_   = visc;
+	init(N, N, dt, diff, visc);
+	allocateFields();
+}
 
-	int size = getSize();
 
-	u_			= (float *) malloc(size * sizeof(float));
-	v_			= (float *) malloc(size * sizeof(float));
-	u_prev_		= (float *) malloc(size * sizeof(float));
-	v_prev_		= (float *) malloc(size * sizeof(float));
-	dens_		= (float *) malloc(size * sizeof(float));	
-	dens_prev_	= (float *) malloc(size * sizeof(float));
-	bounds_	    = (bool  *) malloc(size * sizeof(bool) ); 
 
+FluidSolver::FluidSolver(int width, int height, float dt, float diff, float visc)
+{
+	init(width, height, dt, diff, visc);
+	allocateFields();
+}
+
+
+
+FluidSolver::FluidSolver(int width, int height, float dt, float diff, float visc, bool layoutFields)
+{
+	init(width, height, dt, diff, visc);
+	if(layoutFields)
+		allocateFields();
 }
 
 
 
 FluidSolver::~FluidSolver(void)
 {
-	if ( u_ ) free ( u_ );
-	if ( v_ ) free ( v_ );
-	if ( u_prev_ ) free ( u_prev_ );
-	if ( v_prev_ ) free ( v_prev_ );
-	if ( dens_ ) free ( dens_ );
-	if ( bounds_ ) free ( bounds_ );
-	if ( dens_prev_ ) free ( dens_prev_ );
+	//the field buffers are released with arena_
+	delete multigrid_;
 }
 
 
 
 void FluidSolver::reset()
 {
+	ensureFields();
 	for (int i=0 ; i < getSize() ; i++) {
 		u_[i] = v_[i] = u_prev_[i] = v_prev_[i] = dens_[i] = dens_prev_[i] = 0.0f;
 		bounds_[i] = false;
 	}
+	clearBoundBits();
+}
+
+
+
+void FluidSolver::resize(int width, int height)
+{
+	if(width == width_ && height == height_)
+		return;
+
+	//a released solver has nothing to resample, the next reset() lays out the new size
+	if(fieldsReleased_) {
+		width_  = width;
+		height_ = height;
+		return;
+	}
+
+	//laying out the arena again invalidates every field, so keep what has to survive
+	int oldWidth  = width_;
+	int oldHeight = height_;
+	int oldSize   = getSize();
+	vector<float> oldU(u_, u_ + oldSize);
+	vector<float> oldV(v_, v_ + oldSize);
+	vector<float> oldDens(dens_, dens_ + oldSize);
+	vector<bool>  oldBounds(bounds_, bounds_ + oldSize);
+
+	width_  = width;
+	height_ = height;
+	allocateFields();
+
+	//velocities are in grid widths per unit time, so they carry over without rescaling
+	resampleField(&oldU[0],    oldWidth, oldHeight, u_,    width_, height_, 1);
+	resampleField(&oldV[0],    oldWidth, oldHeight, v_,    width_, height_, 1);
+	resampleField(&oldDens[0], oldWidth, oldHeight, dens_, width_, height_, 1);
+
+	int i, j;
+	for (i = 0; i < getSize(); i++) {
+		u_prev_[i] = v_prev_[i] = dens_prev_[i] = 0.0f;
+		bounds_[i] = false;
+	}
+	FOR_EACH_CELL
+		int oldX = 1 + (i - 1) * oldWidth / width_;
+		int oldY = 1 + (j - 1) * oldHeight / height_;
+		writeBound(IX(i,j), oldBounds[oldX + (oldWidth + 2) * oldY]);
+	END_FOR
+
+	setBounds(1, u_);
+	setBounds(2, v_);
+	setBounds(0, dens_);
+
+	//coarse levels depend on the grid size
+	if(multigrid_) {
+		delete multigrid_;
+		multigrid_ = new MultigridSolver(width_, height_);
+	}
+}
+
+
+
+int FluidSolver::getWidth()
+{
+	return width_;
+}
+
+
+
+int FluidSolver::getHeight()
+{
+	return height_;
 }
 
 
 
 void FluidSolver::update()
 {
+	beginHaloExchange();
 	computeDensityStep(dens_, dens_prev_, u_, v_);
-	computeVelocityStep(u_, v_, u_prev_, v_prev_);
+	computeVelocityStep(u_, v_, u_prev_, v_prev_, dens_);
+	endHaloExchange();
 
 	//reset u_prev_, v_prev_, and dens_prev
 	for (int i=0 ; i < getSize() ; i++) 
@@ -121,10 +232,89 @@ void FluidSolver::addDensityAt(int x, int y, float value)
 
 
 
+void FluidSolver::addSplats(const Splat* splats, int count)
+{
+	for (int n = 0; n < count; n++) {
+		const Splat& s = splats[n];
+		if (s.radius < 1)
+			continue;
+
+		int xMin = max(s.centerX - s.radius, 1), xMax = min(s.centerX + s.radius, width_);
+		int yMin = max(s.centerY - s.radius, 1), yMax = min(s.centerY + s.radius, height_);
+		if (xMin > xMax || yMin > yMax)
+			continue;
+
+		float invRadius = 1.0f / s.radius;
+		for (int y = yMin; y <= yMax; y++) {
+			float vscalar = fabs((float)(y - s.centerY)) * invRadius;
+			float vertVel = s.v * vscalar;
+			int   cell    = IX(0, y);
+			for (int x = xMin; x <= xMax; x++) {
+				u_prev_[cell + x] += s.u * fabs((float)(x - s.centerX)) * invRadius;
+				v_prev_[cell + x] += vertVel;
+			}
+		}
+
+		addSplatDensity(s, xMin, xMax, yMin, yMax);
+	}
+}
+
+
+
+void FluidSolver::addSplatDensity(const Splat& s, int xMin, int xMax, int yMin, int yMax)
+{
+	float invRadius = 1.0f / s.radius;
+	for (int y = yMin; y <= yMax; y++) {
+		float vscalar = fabs((float)(y - s.centerY)) * invRadius;
+		int   cell    = IX(0, y);
+		for (int x = xMin; x <= xMax; x++) {
+			float uscalar = fabs((float)(x - s.centerX)) * invRadius;
+			dens_prev_[cell + x] += s.density * (uscalar + vscalar) * 0.5f;
+		}
+	}
+}
+
+
+
 void FluidSolver::setBoundAt(int x, int y, bool isBound)
 {
 	if(isValidCoordinate(x, y))
-		bounds_[IX(x,y)] = isBound;
+		writeBound(IX(x,y), isBound);
+}
+
+
+
+void FluidSolver::setBoundsFromMask(const unsigned char* mask, size_t step, int cols, int rows,
+									int offsetX, int offsetY)
+{
+	//clip the mask to cells 1..N once instead of testing every pixel
+	int xBegin = max(0, -offsetX), xEnd = min(cols, width_ - offsetX);
+	int yBegin = max(0, -offsetY), yEnd = min(rows, height_ - offsetY);
+
+	for (int y = yBegin; y < yEnd; y++) {
+		const unsigned char* row  = mask + y * step;
+		int                  cell = IX(1 + offsetX, y + 1 + offsetY);
+		for (int x = xBegin; x < xEnd; x++)
+			writeBound(cell + x, row[x] > 0);
+	}
+}
+
+
+
+void FluidSolver::addVelocityFromFlow(const float* flow, size_t step, int cols, int rows, float scale,
+									  int offsetX, int offsetY)
+{
+	int xBegin = max(0, -offsetX), xEnd = min(cols, width_ - offsetX);
+	int yBegin = max(0, -offsetY), yEnd = min(rows, height_ - offsetY);
+
+	for (int y = yBegin; y < yEnd; y++) {
+		const float* row  = (const float*)((const char*)flow + y * step);
+		int          cell = IX(1 + offsetX, y + 1 + offsetY);
+		for (int x = xBegin; x < xEnd; x++) {
+			u_prev_[cell + x] += scale * row[2 * x];
+			v_prev_[cell + x] += scale * row[2 * x + 1];
+		}
+	}
 }
 
 
@@ -158,18 +348,486 @@ float FluidSolver::getHorzVelocityAt(int x, int y)
 
 
 
+void FluidSolver::setLinearSolver(LinearSolverType type)
+{
+	linearSolver_ = type;
+}
+
+
+
+FluidSolver::LinearSolverType FluidSolver::getLinearSolver()
+{
+	return linearSolver_;
+}
+
+
+
+void FluidSolver::setSolverIterations(int iterations)
+{
+	solverIterations_ = max(iterations, 1);
+}
+
+
+
+int FluidSolver::getSolverIterations()
+{
+	return solverIterations_;
+}
+
+
+
+void FluidSolver::setInstructionSet(InstructionSet instructionSet)
+{
+	//never go beyond what the CPU supports
+	if(instructionSet > detectInstructionSet())
+		instructionSet = detectInstructionSet();
+	kernels_ = getFluidKernels(instructionSet);
+}
+
+
+
+InstructionSet FluidSolver::getInstructionSet()
+{
+	return kernels_.instructionSet;
+}
+
+
+
+void FluidSolver::setPressureSolver(PressureSolverType type, float tolerance, int maxIterations)
+{
+	pressureSolver_        = type;
+	pressureTolerance_     = tolerance;
+	pressureMaxIterations_ = maxIterations;
+
+	//coarse levels are only built once a multigrid solve is requested
+	if(type == PRESSURE_MULTIGRID && !multigrid_ && !fieldsReleased_) {
+		multigrid_        = new MultigridSolver(width_, height_);
+		multigridChanged_ = true;
+	}
+}
+
+
+
+FluidSolver::PressureSolverType FluidSolver::getPressureSolver()
+{
+	return pressureSolver_;
+}
+
+
+
+int FluidSolver::getPressureIterations()
+{
+	return pressureIterations_;
+}
+
+
+
+float FluidSolver::getPressureResidual()
+{
+	return pressureResidual_;
+}
+
+
+
+void FluidSolver::setAdvectionScheme(AdvectionScheme scheme)
+{
+	advectionScheme_ = scheme;
+}
+
+
+
+FluidSolver::AdvectionScheme FluidSolver::getAdvectionScheme()
+{
+	return advectionScheme_;
+}
+
+
+
+void FluidSolver::setVorticityConfinement(float strength)
+{
+	vorticityConfinement_ = max(strength, 0.0f);
+}
+
+
+
+float FluidSolver::getVorticityConfinement()
+{
+	return vorticityConfinement_;
+}
+
+
+
+void FluidSolver::setBuoyancy(float buoyancy)
+{
+	buoyancy_ = buoyancy;
+}
+
+
+
+float FluidSolver::getBuoyancy()
+{
+	return buoyancy_;
+}
+
+
+
+void FluidSolver::saveSnapshot(Snapshot& snapshot, bool halfPrecision)
+{
+	if(fieldsReleased_)
+		return;
+
+	int    channels;
+	float* density = getSnapshotDensity(channels);
+	int    size    = getSize();
+
+	snapshot.width           = width_;
+	snapshot.height          = height_;
+	snapshot.densityChannels = channels;
+	snapshot.isHalfPrecision = halfPrecision;
+
+	size_t count = (size_t)size * (2 + channels);
+	if(halfPrecision) {
+		snapshot.values.clear();
+		snapshot.halfValues.resize(count);
+		unsigned short* out = &snapshot.halfValues[0];
+		storeValues(u_,      size,            out);
+		storeValues(v_,      size,            out + size);
+		storeValues(density, size * channels, out + 2 * size);
+	}
+	else {
+		snapshot.halfValues.clear();
+		snapshot.values.resize(count);
+		float* out = &snapshot.values[0];
+		storeValues(u_,      size,            out);
+		storeValues(v_,      size,            out + size);
+		storeValues(density, size * channels, out + 2 * size);
+	}
+	endSnapshotDensity(false);
+}
+
+
+
+void FluidSolver::restoreSnapshot(const Snapshot& snapshot, float weight)
+{
+	if(snapshot.isEmpty())
+		return;
+
+	//the fields of a released solver are laid out and cleared first
+	if(fieldsReleased_)
+		reset();
+
+	int    channels;
+	float* density   = getSnapshotDensity(channels);
+	size_t fieldSize = (size_t)(snapshot.width + 2) * (snapshot.height + 2);
+
+	restoreSnapshotField(snapshot, 0,         1, weight, u_);
+	restoreSnapshotField(snapshot, fieldSize, 1, weight, v_);
+	bool withDensity = (snapshot.densityChannels == channels);
+	if(withDensity)
+		restoreSnapshotField(snapshot, 2 * fieldSize, channels, weight, density);
+	endSnapshotDensity(withDensity);
+
+	finishRestore();
+}
+
+
+
+void FluidSolver::releaseFields()
+{
+	if(fieldsReleased_)
+		return;
+
+	arena_.freeBlock();
+	u_ = v_ = u_prev_ = v_prev_ = dens_ = dens_prev_ = backtrace_ = NULL;
+	bounds_ = NULL;
+
+	//clear() keeps the capacity, swapping with an empty vector gives it back
+	vector<unsigned int>().swap(boundBits_);
+	vector<BoundEdge>().swap(boundEdges_);
+	vector<BoundCorner>().swap(boundCorners_);
+	vector<float>().swap(curlRows_);
+	vector<float>().swap(haloSend_);
+	vector<float>().swap(haloReceive_);
+
+	delete multigrid_;
+	multigrid_ = NULL;
+
+	fieldsReleased_ = true;
+}
+
+
+
+bool FluidSolver::hasFields()
+{
+	return !fieldsReleased_;
+}
+
+
+
 ///protected functions
 int FluidSolver::getSize()
 {
-	return (ROW_WIDTH) * (ROW_WIDTH);
+	return (ROW_WIDTH) * (height_ + 2);
+}
+
+
+
+void FluidSolver::init(int width, int height, float dt, float diff, float visc)
+{
+	width_  = width;
+	height_ = height;
+	dt_     = dt;
+	diff_   = diff;
+	visc_   = visc;
+
+	linearSolver_    = GAUSS_SEIDEL;
+	solverIterations_ = LINEAR_SOLVE_ITERATIONS;
+	kernels_         = selectFluidKernels();
+	advectionScheme_ = ADVECT_SEMI_LAGRANGIAN;
+
+	vorticityConfinement_ = 0.0f;
+	buoyancy_             = 0.0f;
+
+	pressureSolver_        = PRESSURE_RELAXATION;
+	pressureTolerance_     = 1e-2f;
+	pressureMaxIterations_ = 1;
+	pressureIterations_    = 0;
+	pressureResidual_      = 0.0f;
+	multigrid_             = NULL;
+
+	wallWidth_ = 0;
+	for (int e = 0; e < EDGE_COUNT; e++)
+		edgeLinks_[e] = NULL;
+	exchangingHalos_ = false;
+
+	fieldsReleased_ = false;
+}
+
+
+
+size_t FluidSolver::getFieldBytes()
+{
+	size_t floatField = FieldArena::getPaddedSize(getSize() * sizeof(float));
+	size_t boolField  = FieldArena::getPaddedSize(getSize() * sizeof(bool));
+	return 7 * floatField + boolField;
+}
+
+
+
+void FluidSolver::allocateFields()
+{
+	int size = getSize();
+
+	arena_.layout(getFieldBytes());
+	u_			= arena_.allocateFloats(size);
+	v_			= arena_.allocateFloats(size);
+	u_prev_		= arena_.allocateFloats(size);
+	v_prev_		= arena_.allocateFloats(size);
+	dens_		= arena_.allocateFloats(size);
+	dens_prev_	= arena_.allocateFloats(size);
+	backtrace_	= arena_.allocateFloats(size);
+	bounds_	    = arena_.allocateBools(size);
+
+	rowWords_ = (ROW_WIDTH + 31) / 32;
+	boundBits_.assign(rowWords_ * (height_ + 2), 0);
+	//room for every cell in the bound lists, so a growing silhouette does not reallocate them
+	boundEdges_.reserve(width_ * height_);
+	boundCorners_.reserve(width_ * height_);
+	boundsChanged_    = true;
+	multigridChanged_ = true;
+
+	curlRows_.assign(3 * (ROW_WIDTH), 0.0f);
+}
+
+
+
+void FluidSolver::ensureFields()
+{
+	if(!fieldsReleased_)
+		return;
+
+	fieldsReleased_ = false;
+	allocateFields();
+	if(pressureSolver_ == PRESSURE_MULTIGRID)
+		multigrid_ = new MultigridSolver(width_, height_);
+}
+
+
+
+float* FluidSolver::getSnapshotDensity(int& channels)
+{
+	channels = 1;
+	return dens_;
+}
+
+
+
+void FluidSolver::endSnapshotDensity(bool)
+{
+}
+
+
+
+void FluidSolver::finishRestore()
+{
+	setBounds(1, u_);
+	setBounds(2, v_);
+	setBounds(0, dens_);
+}
+
+
+
+void FluidSolver::restoreSnapshotField(const Snapshot& snapshot, size_t offset, int channels, 
+									   float weight, float* field)
+{
+	int count = (snapshot.width + 2) * (snapshot.height + 2) * channels;
+	if(snapshot.width == width_ && snapshot.height == height_) {
+		if(snapshot.isHalfPrecision)
+			blendValues(&snapshot.halfValues[offset], count, weight, field);
+		else
+			blendValues(&snapshot.values[offset], count, weight, field);
+		return;
+	}
+
+	//another grid size: decode, resample onto this grid, then blend like above
+	vector<float> from(count);
+	if(snapshot.isHalfPrecision) {
+		for (int k = 0; k < count; k++)
+			from[k] = halfToFloat(snapshot.halfValues[offset + k]);
+	}
+	else
+		copy(snapshot.values.begin() + offset, snapshot.values.begin() + offset + count, from.begin());
+
+	//buffer cells keep the field's values, finishRestore() sets them
+	vector<float> to(field, field + getSize() * channels);
+	resampleField(&from[0], snapshot.width, snapshot.height, &to[0], width_, height_, channels);
+	blendValues(&to[0], (int)to.size(), weight, field);
+}
+
+
+
+void FluidSolver::resampleField(const float* from, int fromWidth, int fromHeight,
+								float* to, int toWidth, int toHeight, int channels)
+{
+	const int fromRow = (fromWidth + 2) * channels;
+	const int toRow   = (toWidth + 2) * channels;
+
+	//cell centers of both grids cover the same area; blend the four nearest old cells
+	for (int j = 1; j <= toHeight; j++) {
+		float y = 0.5f + (j - 0.5f) * fromHeight / toHeight;
+		if (y < 1.0f)       y = 1.0f;
+		if (y > fromHeight) y = (float)fromHeight;
+		int   j0 = (int)y;
+		int   j1 = j0 < fromHeight ? j0 + 1 : j0;
+		float t1 = y - j0, t0 = 1.0f - t1;
+
+		for (int i = 1; i <= toWidth; i++) {
+			float x = 0.5f + (i - 0.5f) * fromWidth / toWidth;
+			if (x < 1.0f)      x = 1.0f;
+			if (x > fromWidth) x = (float)fromWidth;
+			int   i0 = (int)x;
+			int   i1 = i0 < fromWidth ? i0 + 1 : i0;
+			float s1 = x - i0, s0 = 1.0f - s1;
+
+			const float* c00 = from + j0 * fromRow + i0 * channels;
+			const float* c10 = from + j0 * fromRow + i1 * channels;
+			const float* c01 = from + j1 * fromRow + i0 * channels;
+			const float* c11 = from + j1 * fromRow + i1 * channels;
+			float*       out = to + j * toRow + i * channels;
+			for (int n = 0; n < channels; n++)
+				out[n] = s0 * (t0 * c00[n] + t1 * c01[n]) + s1 * (t0 * c10[n] + t1 * c11[n]);
+		}
+	}
+}
+
+
+
+void FluidSolver::writeBound(int cell, bool isBound)
+{
+	if(bounds_[cell] == isBound)
+		return;
+
+	bounds_[cell] = isBound;
+	unsigned int bit = 1u << (cell % (ROW_WIDTH) % 32);
+	unsigned int& word = boundBits_[(cell / (ROW_WIDTH)) * rowWords_ + cell % (ROW_WIDTH) / 32];
+	word = isBound ? (word | bit) : (word & ~bit);
+	boundsChanged_    = true;
+	multigridChanged_ = true;
+}
+
+
+
+void FluidSolver::clearBoundBits()
+{
+	boundBits_.assign(boundBits_.size(), 0);
+	boundsChanged_    = true;
+	multigridChanged_ = true;
+}
+
+
+
+void FluidSolver::updateBoundLists()
+{
+	int i, j;
+
+	boundEdges_.clear();
+	boundCorners_.clear();
+
+	//same visiting order as the original full grid passes, so setBounds() writes the cells
+	//in the same order. Spans of 32 cells are skipped when neither they, their neighbors 
+	//to the left and right, nor the rows above and below hold a bound.
+	for (j = 1; j <= height_; j++) {
+		for (int w = 0; w < rowWords_; w++) {
+			unsigned int any = 0;
+			for (int row = j - 1; row <= j + 1; row++)
+				for (int k = max(w - 1, 0); k <= min(w + 1, rowWords_ - 1); k++)
+					any |= boundBits_[row * rowWords_ + k];
+			if(!any)
+				continue;
+
+			for (i = max(32 * w, 1); i <= min(32 * w + 31, width_); i++) {
+				int  cell    = IX(i,j);
+				bool isBound = bounds_[cell];
+
+				//edge rule: a bound cell copies its open neighbors, an open cell is copied 
+				//into its bound neighbors
+				unsigned char flags = 0;
+				if(isBound)                              flags |= BOUND_CELL;
+				if(bounds_[IX(i,j+1)] != isBound)        flags |= BOUND_EDGE_UP;
+				if(bounds_[IX(i+1,j)] != isBound)        flags |= BOUND_EDGE_RIGHT;
+				if(flags) {
+					BoundEdge edge = { cell, flags };
+					boundEdges_.push_back(edge);
+				}
+
+				if(!isBound)
+					continue;
+
+				//corner rule, first match in the same order as before
+				BoundCorner corner = { cell, -1, -1 };
+				if(bounds_[IX(i+1, j)] && bounds_[IX(i, j+1)] && !bounds_[IX(i+1, j+1)])
+					{ corner.a = IX(i+1, j); corner.b = IX(i, j+1); }
+				else if(bounds_[IX(i+1, j)] && bounds_[IX(i, j-1)] && !bounds_[IX(i+1, j-1)])
+					{ corner.a = IX(i+1, j); corner.b = IX(i, j-1); }
+				else if(bounds_[IX(i-1, j)] && bounds_[IX(i, j-1)] && !bounds_[IX(i-1, j-1)])
+					{ corner.a = IX(i-1, j); corner.b = IX(i, j-1); }
+				else if(bounds_[IX(i-1, j)] && bounds_[IX(i, j+1)] && !bounds_[IX(i-1, j+1)])
+					{ corner.a = IX(i-1, j); corner.b = IX(i, j+1); }
+				if(corner.a >= 0)
+					boundCorners_.push_back(corner);
+			}
+		}
+	}
+
+	boundsChanged_ = false;
 }
 
 
 
 bool FluidSolver::isValidCoordinate(int x, int y)
 {
-	bool xIsValid = (x >= 1) && (x <= N_);
-	bool yIsValid = (y >= 1) && (y <= N_);
+	bool xIsValid = (x >= 1) && (x <= width_);
+	bool yIsValid = (y >= 1) && (y <= height_);
 
 	if(xIsValid && yIsValid)
 		return true;
@@ -181,86 +839,104 @@ bool FluidSolver::isValidCoordinate(int x, int y)
 
 void FluidSolver::addSource(float* x, float* s)
 {
-	int i;
-	for (i=0 ; i<getSize() ; i++) 
-		x[i] += dt_*s[i];
+	kernels_.addSource(x, s, dt_, getSize());
+}
+
+
+
+void FluidSolver::addForces(float* u, float* v, float* u0, float* v0, const float* density)
+{
+	float* below = &curlRows_[0];
+	float* curl  = below + (ROW_WIDTH);
+	float* above = curl  + (ROW_WIDTH);
+
+	//the rows outside the grid repeat the first and the last row
+	kernels_.curlRow(curl, u, v, 1, width_);
+	copy(curl, curl + (ROW_WIDTH), below);
+
+	for (int j = 1; j <= height_; j++) {
+		if(j < height_)
+			kernels_.curlRow(above, u, v, j + 1, width_);
+		else
+			copy(curl, curl + (ROW_WIDTH), above);
+
+		kernels_.addForcesRow(u, v, u0, v0, below, curl, above, density, j, width_, 
+							  vorticityConfinement_, buoyancy_, dt_);
+
+		float* oldBelow = below;
+		below = curl;
+		curl  = above;
+		above = oldBelow;
+	}
 }
 
 
 
 void FluidSolver::setBounds(int boundsFlag, float* x)
 {
-	int i, j;
+	int i;
 
 	//free slip boundary edges
-	for ( i=1 ; i<=N_; i++ ) {
+	for ( i=1 ; i<=height_; i++ ) {
 		//reverse velocity component on vertical walls (u)
-		x[IX(0  ,i)]  = boundsFlag==1 ? -x[IX(1,i)] : x[IX(1,i)];
-		x[IX(N_+1,i)] = boundsFlag==1 ? -x[IX(N_,i)] : x[IX(N_,i)];
-		
+		x[IX(0  ,i)]      = boundsFlag==1 ? -x[IX(1,i)] : x[IX(1,i)];
+		x[IX(width_+1,i)] = boundsFlag==1 ? -x[IX(width_,i)] : x[IX(width_,i)];
+	}
+	for ( i=1 ; i<=width_; i++ ) {
 		//reverse velocity component on horizontal (top and bottom) walls (v)
-		x[IX(i,0  )]  = boundsFlag==2 ? -x[IX(i,1)] : x[IX(i,1)];
-		x[IX(i,N_+1)] = boundsFlag==2 ? -x[IX(i,N_)] : x[IX(i,N_)];
+		x[IX(i,0  )]       = boundsFlag==2 ? -x[IX(i,1)] : x[IX(i,1)];
+		x[IX(i,height_+1)] = boundsFlag==2 ? -x[IX(i,height_)] : x[IX(i,height_)];
 	}
+
+	//sides joined to another tile take its cells instead
+	exchangeHalos(x, 1);
 	
-	FOR_EACH_CELL
-		//detect bounds changes for each cell and reverse velocity components
-		//set current value to a negative average of surrounding values
-		if(bounds_[IX(i,j)]) {
-			//set current value to a negative average of surrounding values
-			x[IX(i,j)] = 0;
+	if(boundsChanged_)
+		updateBoundLists();
+
+	//detect bounds changes for each cell and reverse velocity components
+	const int up = ROW_WIDTH;
+	for (size_t n = 0; n < boundEdges_.size(); n++) {
+		const int           c     = boundEdges_[n].cell;
+		const unsigned char flags = boundEdges_[n].flags;
+
+		if(flags & BOUND_CELL) {
+			x[c] = 0;
 
 			//vertical (v)
 			//if bounds are about to turn off, velocity component of off cell becomes positive.
-			if(!bounds_[IX(i,j+1)]) 
-				x[IX(i,j)] = boundsFlag==2 ? -x[IX(i,j+1)] : x[IX(i,j+1)]; 
+			if(flags & BOUND_EDGE_UP)
+				x[c] = boundsFlag==2 ? -x[c+up] : x[c+up];
 
 			//horizontal (u)
 			//if bounds change from on to off, velocity component of off cell becomes positive.
-			if(!bounds_[IX(i+1,j)]) 
-				x[IX(i,j)] = boundsFlag==1 ? -x[IX(i+1,j)] : x[IX(i+1,j)]; 
+			if(flags & BOUND_EDGE_RIGHT)
+				x[c] = boundsFlag==1 ? -x[c+1] : x[c+1];
 		}
 		else {
 			//vertical (v)
 			//if bounds change from off to on, velocity component of off cell becomes negative.
-			if(bounds_[IX(i,j+1)]) 
-				x[IX(i,j+1)] = boundsFlag==2 ? -x[IX(i,j)] : x[IX(i,j)];
-			
+			if(flags & BOUND_EDGE_UP)
+				x[c+up] = boundsFlag==2 ? -x[c] : x[c];
+
 			//horizontal (u)
 			//if bounds change from off to on, velocity component of off cell becomes negative.
-			if( bounds_[IX(i+1,j)]) 
-				x[IX(i+1,j)] = boundsFlag==1 ? -x[IX(i,j)] : x[IX(i,j)]; 
-			
+			if(flags & BOUND_EDGE_RIGHT)
+				x[c+1] = boundsFlag==1 ? -x[c] : x[c];
 		}
-	END_FOR
+	}
 
 	//handle corner conditions of objects
-	FOR_EACH_CELL
-		// X = cell in question | 0 = open cell | * = closed cell (with a boundary)
-
-		// * 0
-		// X *
-		if(bounds_[IX(i,j)] && bounds_[IX(i+1, j)] && bounds_[IX(i, j+1)] && !bounds_[IX(i+1, j+1)])
-			x[IX(i, j)] = 0.5 *(x[IX(i+1, j)] + x[IX(i, j+1)]);
-		// X * 
-		// * 0
-		else if(bounds_[IX(i,j)] && bounds_[IX(i+1, j)] && bounds_[IX(i, j-1)] && !bounds_[IX(i+1, j-1)])
-			x[IX(i, j)] = 0.5 *(x[IX(i+1, j)] + x[IX(i, j-1)]);
-		// * X 
-		// 0 *
-		else if(bounds_[IX(i,j)] && bounds_[IX(i-1, j)] && bounds_[IX(i, j-1)] && !bounds_[IX(i-1, j-1)])
-			x[IX(i, j)] = 0.5 *(x[IX(i-1, j)] + x[IX(i, j-1)]);
-		// 0 * 
-		// * X
-		else if(bounds_[IX(i,j)] && bounds_[IX(i-1, j)] && bounds_[IX(i, j+1)] && !bounds_[IX(i-1, j+1)])
-			x[IX(i, j)] = 0.5 *(x[IX(i-1, j)] + x[IX(i, j+1)]);
-	END_FOR
+	for (size_t n = 0; n < boundCorners_.size(); n++) {
+		const BoundCorner& corner = boundCorners_[n];
+		x[corner.cell] = 0.5 *(x[corner.a] + x[corner.b]);
+	}
 
 	//corner conditions
-	x[IX(0,      0     )] = 0.5f * (x[IX(1,  0   )] + x[IX(0,      1 )]);
-	x[IX(0,      N_ + 1)] = 0.5f * (x[IX(1,  N_+1)] + x[IX(0,      N_)]);
-	x[IX(N_ + 1, 0     )] = 0.5f * (x[IX(N_, 0   )] + x[IX(N_ + 1, 1 )]);
-	x[IX(N_ + 1, N_ + 1)] = 0.5f * (x[IX(N_, N_+1)] + x[IX(N_ + 1, N_)]);
+	x[IX(0,          0          )] = 0.5f * (x[IX(1,      0       )] + x[IX(0,          1      )]);
+	x[IX(0,          height_ + 1)] = 0.5f * (x[IX(1,      height_+1)] + x[IX(0,          height_)]);
+	x[IX(width_ + 1, 0          )] = 0.5f * (x[IX(width_, 0       )] + x[IX(width_ + 1, 1      )]);
+	x[IX(width_ + 1, height_ + 1)] = 0.5f * (x[IX(width_, height_+1)] + x[IX(width_ + 1, height_)]);
 }
 
 
@@ -269,8 +945,13 @@ void FluidSolver::linearSolve( int boundsFlag, float* x, float* x0, float a, flo
 {
 	int i, j, k;
 
-	//use 20 iterations of Gauss-Sidel to find a convergence of values
-	for ( k=0 ; k<20 ; k++ ) {
+	if(linearSolver_ == RED_BLACK_GAUSS_SEIDEL) {
+		linearSolveRedBlack(boundsFlag, x, x0, a, c, solverIterations_);
+		return;
+	}
+
+	//use solverIterations_ (20 by default) iterations of Gauss-Sidel to find a convergence of values
+	for ( k=0 ; k<solverIterations_ ; k++ ) {
 		FOR_EACH_CELL
 			//exchange values with neighbors
 			x[IX(i,j)] = (x0[IX(i,j)] + a*(x[IX(i-1,j)] + x[IX(i+1,j)] + x[IX(i,j-1)] + x[IX(i,j+1)])) / c;
@@ -283,9 +964,47 @@ void FluidSolver::linearSolve( int boundsFlag, float* x, float* x0, float a, flo
 
 
 
+void FluidSolver::linearSolveRedBlack( int boundsFlag, float* x, float* x0, float a, float c, int iterations)
+{
+	const int   rowWidth = ROW_WIDTH;
+	const float invC     = 1.0f / c;
+
+	//one parallel region for all iterations; threads only meet at the barriers 
+	//between colors and around setBounds
+	#pragma omp parallel if(height_ >= MIN_PARALLEL_N)
+	{
+		for (int k = 0; k < iterations; k++) {
+			for (int color = 0; color < 2; color++) {
+
+				//rows are handed out in contiguous blocks, one block per thread
+				#pragma omp for schedule(static)
+				for (int j = 1; j <= height_; j++) {
+					//first cell in this row with (i + j) % 2 == color
+					int first = 1 + ((1 + j + color) & 1);
+					kernels_.relaxRow(x + j * rowWidth, x0 + j * rowWidth, rowWidth, first, width_, a, invC);
+				}
+
+				//the second color reads the first one's new values across a tile edge too
+				if (color == 0 && exchangingHalos_) {
+					#pragma omp single
+					exchangeHalos(x, 1);
+				}
+			}
+
+			// factor in boundary conditions with each solution iteration
+			#pragma omp single
+			setBounds(boundsFlag, x);
+		}
+	}
+}
+
+
+
 void FluidSolver::diffuse (int boundsFlag, float* x, float* x0)
 {
-	float diffusionPerCell = dt_ * diff_ * N_ * N_;
+	ScopedTimer timer(PROFILE_DIFFUSE);
+	//the grid is one unit wide and cells are square, so width_ cells make up a unit length
+	float diffusionPerCell = dt_ * diff_ * getCellsPerUnit() * getCellsPerUnit();
 	linearSolve ( boundsFlag, x, x0, diffusionPerCell, 1+4*diffusionPerCell);
 }
 
@@ -294,56 +1013,69 @@ void FluidSolver::diffuse (int boundsFlag, float* x, float* x0)
 void FluidSolver::advect (int boundsFlag, float* d, float* d0, 
 						  float* u, float* v)
 {
-	int i, j;
-	int i0; //new x cell coordinate based on velocity grid
-	int j0; //new y cell coordinate based on velocity grid
-	int i1; //x + 1 cell next to new cell coordinate
-	int j1; //y + 1 cell next to new cell coordinate
-	float x, y, s0, t0, s1, t1, dt0;
+	ScopedTimer timer(PROFILE_ADVECT);
 
-	//initial time differential = dt * number of cells in a row
-	dt0 = dt_ * N_;
+	//initial time differential = dt * number of cells per unit of length
+	const float dt0 = dt_ * getCellsPerUnit();
 
-	//back trace density and velocity values from the center of each cell
-	FOR_EACH_CELL
+	//back trace density and velocity values from the center of each cell. Rows only read
+	//d0, u and v, so they can be traced independently.
+	#pragma omp parallel for schedule(static) if(height_ >= MIN_PARALLEL_N)
+	for (int j = 1; j <= height_; j++)
+		kernels_.advectRow(d, d0, u, v, j, width_, height_, dt0);
 
-		// calculate new coordinates based on existing velocity grids
-		x = i - dt0 * u[IX(i,j)]; 
-		y = j - dt0 * v[IX(i,j)];
-		
-		//limit x coordinate to fall within the grid 
-		if (x < 0.5f)      x = 0.5f; 
-		if (x > N_ + 0.5f) x = N_ + 0.5f; 
-		i0 = (int)x; 
-		i1 = i0 + 1;
-		
-		//limit y coordinate to fall within the grid
-		if (y < 0.5f)      y = 0.5f; 
-		if (y > N_ + 0.5f) y = N_ + 0.5f; 
-		j0 = (int)y; 
-		j1 = j0 + 1;
+	if(advectionScheme_ == ADVECT_MACCORMACK) {
+		//trace the result forward again; the difference to d0 is twice the error of one trace
+		setBounds(boundsFlag, d);
 
-		s1 = x - i0; //difference between calculated x position and limited x position
-		s0 = 1 - s1; //calculate relative x distance from center of this cell
+		#pragma omp parallel for schedule(static) if(height_ >= MIN_PARALLEL_N)
+		for (int j = 1; j <= height_; j++)
+			kernels_.advectRow(backtrace_, d, u, v, j, width_, height_, -dt0);
+
+		#pragma omp parallel for schedule(static) if(height_ >= MIN_PARALLEL_N)
+		for (int j = 1; j <= height_; j++)
+			correctMacCormackRow(d, d0, backtrace_, u, v, j, dt0);
+	}
 
-		t1 = y - j0;  
-		t0 = 1 - t1;
-		
-		//blend several values from the velocity grid together, based on where in the cell 
-		//the new coordinate valls
-		d[IX(i,j)] = s0 * (t0 * d0[IX(i0,j0)] + t1 * d0[IX(i0,j1)]) +
-					 s1 * (t0 * d0[IX(i1,j0)] + t1 * d0[IX(i1,j1)]);
-	END_FOR
 	setBounds(boundsFlag, d);
 }
 
 
 
+void FluidSolver::correctMacCormackRow(float* d, const float* d0, const float* back, 
+									   const float* u, const float* v, int j, float dt0)
+{
+	const int rowWidth = ROW_WIDTH;
+
+	for (int i = 1; i <= width_; i++) {
+		int cell = IX(i,j);
+
+		//same backtrace as the first pass, to find the cells it blended
+		float x = i - dt0 * u[cell];
+		float y = j - dt0 * v[cell];
+		if (x < 0.5f)           x = 0.5f;
+		if (x > width_ + 0.5f)  x = width_ + 0.5f;
+		if (y < 0.5f)           y = 0.5f;
+		if (y > height_ + 0.5f) y = height_ + 0.5f;
+		const float* c00 = d0 + (int)x + rowWidth * (int)y;
+
+		float lo = min(min(c00[0], c00[1]), min(c00[rowWidth], c00[rowWidth + 1]));
+		float hi = max(max(c00[0], c00[1]), max(c00[rowWidth], c00[rowWidth + 1]));
+
+		//the limiter keeps the correction from creating new extrema, which would ring
+		float value = d[cell] + 0.5f * (d0[cell] - back[cell]);
+		d[cell] = value < lo ? lo : (value > hi ? hi : value);
+	}
+}
+
+
+
 void FluidSolver::project( float* u, float* v, float* p, float* div)
 {
+	ScopedTimer timer(PROFILE_PROJECT);
 	int i, j;
 
-	float h = 1.0 / N_; //calculate unit length of each cell relative to the whole grid.
+	float h = 1.0 / getCellsPerUnit(); //calculate unit length of each cell relative to the whole grid.
 
 	FOR_EACH_CELL
 		//calculate initial solution to gradient field based on the difference in velocities of
@@ -358,12 +1090,17 @@ void FluidSolver::project( float* u, float* v, float* p, float* div)
 	setBounds(0, p);
 
 	// calculate gradient (height) field
-	linearSolve (0, p, div, 1, 4);
+	if(pressureSolver_ == PRESSURE_MULTIGRID && !hasEdgeLinks())
+		solvePressureMultigrid (p, div);
+	else {
+		linearSolve (0, p, div, 1, 4);
+		pressureIterations_ += solverIterations_;
+	}
 
 	FOR_EACH_CELL
 		//subtract gradient field from current velocities
-		u[IX(i, j)] -= 0.5f * N_ * (p[IX(i + 1, j)] - p[IX(i - 1, j)]);
-		v[IX(i, j)] -= 0.5f * N_ * (p[IX(i, j + 1)] - p[IX(i, j - 1)]);
+		u[IX(i, j)] -= 0.5f * getCellsPerUnit() * (p[IX(i + 1, j)] - p[IX(i - 1, j)]);
+		v[IX(i, j)] -= 0.5f * getCellsPerUnit() * (p[IX(i, j + 1)] - p[IX(i, j - 1)]);
 	END_FOR
 
 	//set boundaries for velocity
@@ -373,6 +1110,20 @@ void FluidSolver::project( float* u, float* v, float* p, float* div)
 
 
 
+void FluidSolver::solvePressureMultigrid( float* p, float* div)
+{
+	//both projections of an update share the coarse levels
+	if(multigridChanged_) {
+		multigrid_->restrictBounds(bounds_);
+		multigridChanged_ = false;
+	}
+
+	pressureIterations_ += multigrid_->solve(p, div, pressureTolerance_, pressureMaxIterations_);
+	pressureResidual_    = multigrid_->getResidual();
+}
+
+
+
 void FluidSolver::computeDensityStep( float* x, float* x0, float* u, float* v )
 {
 	addSource (x, x0);
@@ -384,10 +1135,16 @@ void FluidSolver::computeDensityStep( float* x, float* x0, float* u, float* v )
 
 
 
-void FluidSolver::computeVelocityStep (float* u, float* v, float* u0, float* v0)
+void FluidSolver::computeVelocityStep (float* u, float* v, float* u0, float* v0, const float* density)
 {
-	addSource(u, u0); 
-	addSource(v, v0);
+	pressureIterations_ = 0;
+
+	if(vorticityConfinement_ > 0.0f || (buoyancy_ != 0.0f && density))
+		addForces(u, v, u0, v0, buoyancy_ != 0.0f ? density : NULL);
+	else {
+		addSource(u, u0); 
+		addSource(v, v0);
+	}
 	//diffuse horizontal 
 	SWAP(u0, u); 
 	diffuse(1, u, u0);
@@ -404,3 +1161,103 @@ void FluidSolver::computeVelocityStep (float* u, float* v, float* u0, float* v0)
 	advect(2, v, v0, u0, v0);
 	project(u, v, u0, v0);
 }
+
+
+
+void FluidSolver::setEdgeLink(TileEdge edge, HaloLink* link)
+{
+	edgeLinks_[edge] = link;
+}
+
+
+
+HaloLink* FluidSolver::getEdgeLink(TileEdge edge)
+{
+	return edgeLinks_[edge];
+}
+
+
+
+void FluidSolver::setWallWidth(int cells)
+{
+	wallWidth_ = cells;
+}
+
+
+
+int FluidSolver::getWallWidth()
+{
+	return wallWidth_;
+}
+
+
+
+bool FluidSolver::hasEdgeLinks()
+{
+	for (int e = 0; e < EDGE_COUNT; e++)
+		if (edgeLinks_[e])
+			return true;
+	return false;
+}
+
+
+
+void FluidSolver::beginHaloExchange()
+{
+	exchangingHalos_ = hasEdgeLinks();
+	for (int e = 0; e < EDGE_COUNT; e++)
+		if (edgeLinks_[e])
+			edgeLinks_[e]->beginStep();
+}
+
+
+
+void FluidSolver::endHaloExchange()
+{
+	exchangingHalos_ = false;
+}
+
+
+
+void FluidSolver::getHaloCells(TileEdge edge, int& inner, int& ghost, int& stride, int& length)
+{
+	bool vertical = (edge == EDGE_LEFT || edge == EDGE_RIGHT);
+	length = vertical ? height_ : width_;
+	switch (edge) {
+		case EDGE_LEFT:   inner = IX(1, 1);       ghost = IX(0, 1);          stride = ROW_WIDTH; break;
+		case EDGE_RIGHT:  inner = IX(width_, 1);  ghost = IX(width_ + 1, 1); stride = ROW_WIDTH; break;
+		case EDGE_BOTTOM: inner = IX(1, 1);       ghost = IX(1, 0);          stride = 1;         break;
+		default:          inner = IX(1, height_); ghost = IX(1, height_ + 1); stride = 1;        break;
+	}
+}
+
+
+
+void FluidSolver::exchangeHalos(float* x, int channels)
+{
+	if (!exchangingHalos_)
+		return;
+
+	for (int e = 0; e < EDGE_COUNT; e++) {
+		if (!edgeLinks_[e])
+			continue;
+
+		int inner, ghost, stride, length;
+		getHaloCells((TileEdge)e, inner, ghost, stride, length);
+
+		int count = length * channels;
+		haloSend_.resize(count);
+		haloReceive_.resize(count);
+		//the ghost cells keep the wall's values if the neighbor has never answered
+		for (int k = 0; k < length; k++)
+			for (int n = 0; n < channels; n++) {
+				haloSend_   [k * channels + n] = x[(inner + k * stride) * channels + n];
+				haloReceive_[k * channels + n] = x[(ghost + k * stride) * channels + n];
+			}
+
+		edgeLinks_[e]->exchange(&haloSend_[0], &haloReceive_[0], count);
+		for (int k = 0; k < length; k++)
+			for (int n = 0; n < channels; n++)
+				x[(ghost + k * stride) * channels + n] = haloReceive_[k * channels + n];
+	}
+}
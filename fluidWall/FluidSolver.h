@@ -21,6 +21,10 @@
 
 #pragma once
 #include <vector>
+#include "MultigridSolver.h"
+#include "FluidKernels.h"
+#include "FieldArena.h"
+#include "HaloExchange.h"
 
 using namespace std;
 
@@ -51,7 +55,18 @@ public:
 	 * @param visc   Viscosity coefficient
 	 */
 	FluidSolver(int N, float dt, float diff, float visc);
-	~FluidSolver(void);
+
+	/**
+	 * Parameter constructor for rectangular grids. Cells stay square: the grid is one unit
+	 * wide, so diffusion and velocities are relative to the width.
+	 * @param width  Number of cells per row of the fluid simulation grid
+	 * @param height Number of rows of the fluid simulation grid
+	 * @param dt     Timestep size
+	 * @param diff   Diffusion coefficient
+	 * @param visc   Viscosity coefficient
+	 */
+	FluidSolver(int width, int height, float dt, float diff, float visc);
+	virtual ~FluidSolver(void);
 
 	/**
 	 * Adds vertical velocity values at a particular coordinate. 
@@ -101,7 +116,58 @@ public:
 	 * @param y       y-coordinate, valid values: 1 - N
 	 * @param isBound boolean true/false
 	 */
-	void setBoundAt(int x, int y, bool isBound);
+	virtual void setBoundAt(int x, int y, bool isBound);
+
+	/**
+	 * Sets the bounds of a block of cells from an 8 bit mask in one pass, e.g. the data of
+	 * a CV_8UC1 cv::Mat. Any pixel greater than zero is a boundary. Pixel (x, y) maps to 
+	 * cell (x + 1 + offsetX, y + 1 + offsetY); pixels outside the grid are ignored.
+	 *
+	 * @param mask    pointer to pixel (0, 0)
+	 * @param step    bytes per mask row
+	 * @param cols    mask width in pixels
+	 * @param rows    mask height in pixels
+	 * @param offsetX horizontal cell offset of the mask
+	 * @param offsetY vertical cell offset of the mask
+	 */
+	virtual void setBoundsFromMask(const unsigned char* mask, size_t step, int cols, int rows,
+								   int offsetX = 0, int offsetY = 0);
+
+	/**
+	 * Adds a block of velocities in one pass from interleaved (u, v) float pairs, e.g. the 
+	 * data of a CV_32FC2 optical flow cv::Mat. Pixel (x, y) maps to cell 
+	 * (x + 1 + offsetX, y + 1 + offsetY); pixels outside the grid are ignored.
+	 *
+	 * @param flow    pointer to the pair of pixel (0, 0)
+	 * @param step    bytes per flow row
+	 * @param cols    flow width in pixels
+	 * @param rows    flow height in pixels
+	 * @param scale   factor applied to every velocity
+	 * @param offsetX horizontal cell offset of the flow
+	 * @param offsetY vertical cell offset of the flow
+	 */
+	void addVelocityFromFlow(const float* flow, size_t step, int cols, int rows, float scale,
+							 int offsetX = 0, int offsetY = 0);
+
+	/**
+	 * A square source of velocity and density, e.g. a splash emitter. A cell (x, y) within
+	 * radius cells of the center receives u * |x - centerX| / radius horizontal velocity, 
+	 * v * |y - centerY| / radius vertical velocity and density times the mean of both factors.
+	 */
+	struct Splat {
+		int   centerX, centerY, radius;
+		float u, v, density;
+		int   userNo;  // density channel, only used by solvers with several users
+	};
+
+	/**
+	 * Adds a batch of splats in one pass. Each splat is clipped to cells 1 - N once, 
+	 * instead of testing every cell it covers.
+	 *
+	 * @param splats  pointer to the first splat
+	 * @param count   number of splats
+	 */
+	void addSplats(const Splat* splats, int count);
 
 	/**
 	 * Accesor: returns boundary value at given cell.
@@ -110,7 +176,7 @@ public:
 	 * @param y       y-coordinate, valid values: 1 - N
 	 * @return        boolean indicating boundary condition. 
 	 */
-	bool isBoundAt(int x, int y);
+	virtual bool isBoundAt(int x, int y);
 
 	/**
 	 * Accessor: returns density value at a particular coordinate. Valid indicies range 
@@ -120,7 +186,7 @@ public:
 	 * @param y y-coordinate, valid values: 1 - N
 	 * @return  Density value at coordinate.
 	 */
-	float getDensityAt(int x, int y);
+	virtual float getDensityAt(int x, int y);
 
 
 	/**
@@ -132,7 +198,7 @@ public:
 	 * @param y y-coordinate, valid values: 1 - N
 	 * @return  Vertical velocity value at coordinate.
 	 */
-	float getVertVelocityAt(int x, int y);
+	virtual float getVertVelocityAt(int x, int y);
 
 
 	/**
@@ -144,7 +210,7 @@ public:
 	 * @param y y-coordinate, valid values: 1 - N
 	 * @return  Horizontal  velocity value at coordinate.
 	 */
-	float getHorzVelocityAt(int x, int y);
+	virtual float getHorzVelocityAt(int x, int y);
 
 
 	/**
@@ -152,28 +218,425 @@ public:
 	 * Also resets u_prev, v_prev, and dens_prev.
 	 *
 	 */
-	void update(); 
+	virtual void update(); 
 
 
 	/**
 	 * Resets all public array values to zero.
 	 */
-	void reset();
+	virtual void reset();
+
+
+	/**
+	 * Changes the grid resolution without restarting the simulation. The fields are laid 
+	 * out again in the arena (which only grows its block when it has to) and velocity, 
+	 * density and bounds are resampled onto the new grid; pending sources are dropped.
+	 * Any pointers or sizes taken from the solver before are invalid afterwards.
+	 *
+	 * @param width  New number of cells per row
+	 * @param height New number of rows
+	 */
+	virtual void resize(int width, int height);
+
+
+	/**
+	 * Accessors: return the number of cells per row and the number of rows, without 
+	 * buffer cells.
+	 */
+	int getWidth();
+	int getHeight();
+
+
+	/**
+	 * Relaxation schemes available to linearSolve().
+	 *
+	 * GAUSS_SEIDEL              - original single threaded lexicographic sweep.
+	 * RED_BLACK_GAUSS_SEIDEL    - checkerboard ordered sweep. All cells of one color only 
+	 *                             depend on cells of the other color, so rows of each half 
+	 *                             sweep are split across worker threads (OpenMP).
+	 */
+	enum LinearSolverType { GAUSS_SEIDEL, RED_BLACK_GAUSS_SEIDEL };
+
+
+	/**
+	 * Selects the relaxation scheme used by diffuse() and project().
+	 *
+	 * @param type   Relaxation scheme to use for subsequent updates.
+	 */
+	void setLinearSolver(LinearSolverType type);
+
+
+	/**
+	 * Accessor: returns the relaxation scheme currently used by linearSolve().
+	 */
+	LinearSolverType getLinearSolver();
+
+
+	/**
+	 * Sets the number of relaxation sweeps per linearSolve() call, used by diffuse() and by
+	 * project() with PRESSURE_RELAXATION. Fewer sweeps are cheaper but leave more of the 
+	 * divergence in the velocity field. The default is 20.
+	 *
+	 * @param iterations   Sweeps per solve, at least 1.
+	 */
+	void setSolverIterations(int iterations);
+
+
+	/**
+	 * Accessor: returns the number of relaxation sweeps per linearSolve() call.
+	 */
+	int getSolverIterations();
+
+
+	/**
+	 * Selects the instruction set used by the addSource, forcing, advect and red-black 
+	 * relaxation kernels. The constructor picks the fastest verified set; INSTRUCTIONS_SCALAR selects 
+	 * the reference implementation. Requests beyond what the CPU supports are lowered.
+	 *
+	 * @param instructionSet   Instruction set to use for subsequent updates.
+	 */
+	void setInstructionSet(InstructionSet instructionSet);
+
+
+	/**
+	 * Accessor: returns the instruction set currently used by the solver kernels.
+	 */
+	InstructionSet getInstructionSet();
+
+
+	/**
+	 * Pressure solvers available to project().
+	 *
+	 * PRESSURE_RELAXATION - fixed number of linearSolve() sweeps (the original behavior).
+	 * PRESSURE_MULTIGRID  - geometric multigrid V-cycles, repeated until the residual drops
+	 *                       below the tolerance or the iteration budget is used up.
+	 */
+	enum PressureSolverType { PRESSURE_RELAXATION, PRESSURE_MULTIGRID };
+
+
+	/**
+	 * Selects the solver used for the pressure equation in project().
+	 *
+	 * @param type          Pressure solver to use for subsequent updates.
+	 * @param tolerance     Multigrid only: stop once the largest residual is this fraction 
+	 *                      of the largest divergence value.
+	 * @param maxIterations Multigrid only: maximum number of V-cycles per project() call.
+	 *                      One V-cycle costs about as much as the 20 relaxation sweeps, 
+	 *                      and up to twice that in updates that rebuild the coarse levels 
+	 *                      for new bounds. Starting from the last solution it leaves a 
+	 *                      residual of a few percent.
+	 */
+	void setPressureSolver(PressureSolverType type, float tolerance = 1e-2f, int maxIterations = 1);
+
+
+	/**
+	 * Accessor: returns the pressure solver currently used by project().
+	 */
+	PressureSolverType getPressureSolver();
+
+
+	/**
+	 * Accessor: returns the number of pressure iterations used by the last update(), summed 
+	 * over both projections. Counts V-cycles for PRESSURE_MULTIGRID and relaxation sweeps 
+	 * for PRESSURE_RELAXATION.
+	 */
+	int getPressureIterations();
+
+
+	/**
+	 * Accessor: returns the largest residual left by the last multigrid pressure solve, 
+	 * relative to the largest divergence value (0 when there was no divergence to remove).
+	 */
+	float getPressureResidual();
+
+
+	/**
+	 * Advection schemes available to advect().
+	 *
+	 * ADVECT_SEMI_LAGRANGIAN - one bilinear backtrace per cell (the original behavior). First 
+	 *                          order; smooths sharp features a little every step.
+	 * ADVECT_MACCORMACK      - the backtraced result is traced forward again and half of the 
+	 *                          difference to the initial values is added back, clamped to the 
+	 *                          cells the backtrace blended. Second order where the field is 
+	 *                          smooth; costs about two more advection passes.
+	 */
+	enum AdvectionScheme { ADVECT_SEMI_LAGRANGIAN, ADVECT_MACCORMACK };
+
+
+	/**
+	 * Selects the scheme used to advect density and velocity.
+	 *
+	 * @param scheme   Advection scheme to use for subsequent updates.
+	 */
+	void setAdvectionScheme(AdvectionScheme scheme);
+
+
+	/**
+	 * Accessor: returns the advection scheme currently used by advect().
+	 */
+	AdvectionScheme getAdvectionScheme();
+
+
+	/**
+	 * Sets the strength of vorticity confinement, which puts back the small eddies that the
+	 * solver's numerical dissipation smooths away by pushing the velocity around the centers
+	 * of the eddies. Livelier fluid at lower resolutions, without over-driving the sources.
+	 * About 0.5 - 2 looks natural; the default 0 turns it off. The GPU solver ignores it.
+	 *
+	 * @param strength   confinement strength, in cell sizes of force per unit of curl
+	 */
+	void setVorticityConfinement(float strength);
+	float getVorticityConfinement();
+
+
+	/**
+	 * Sets the upward acceleration per unit of density, so dense fluid rises (negative 
+	 * values make it sink). Only the single color solver has one density to lift; the 
+	 * multi user and GPU solvers ignore it. The default is 0.
+	 *
+	 * @param buoyancy   acceleration in units of length per second squared per density
+	 */
+	void setBuoyancy(float buoyancy);
+	float getBuoyancy();
+
+
+	/**
+	 * Joins a side of the grid to a neighboring tile of a larger wall. During update(), every
+	 * setBounds() on that side sends the cells next to it to the neighbor and takes the 
+	 * neighbor's cells as ghost cells instead of the wall's mirror values, for velocity, 
+	 * density and pressure alike. The tiles of a wall must share the length of their common
+	 * edges, and run the same solver settings and update() calls, see HaloLink.
+	 *
+	 * The halo is one cell wide: fluid moving faster than one cell per step across a tile
+	 * edge is clamped like at a wall. While a side is linked, PRESSURE_MULTIGRID falls back
+	 * to the relaxation solver, whose sweeps exchange their halos. The GPU solver ignores
+	 * links.
+	 *
+	 * @param edge   side of the grid
+	 * @param link   connection to the neighbor, or NULL to make the side a wall again. The
+	 *               solver does not take ownership.
+	 */
+	void setEdgeLink(TileEdge edge, HaloLink* link);
+
+
+	/**
+	 * Accessor: returns the link of a side, NULL for a wall.
+	 */
+	HaloLink* getEdgeLink(TileEdge edge);
+
+
+	/**
+	 * Makes the grid a tile of a wall that is the given number of cells wide. Velocities,
+	 * diffusion and pressure are scaled by the cell size of the whole wall instead of this
+	 * grid, so fluid moves and spreads at the same speed on every tile.
+	 *
+	 * @param cells   width of the whole wall in cells, 0 for this grid alone
+	 */
+	void setWallWidth(int cells);
+	int  getWallWidth();
+
+
+	/**
+	 * Compact copy of the fluid of a solver: velocity and density of every cell, including 
+	 * the buffer cells, in 32 or 16 bit floats. Field after field in the solver's own cell 
+	 * order, so saving and restoring at the same grid size is a straight copy. Bounds and 
+	 * pending sources are not part of it.
+	 */
+	struct Snapshot {
+		int                    width, height;
+		int                    densityChannels;	// density values per cell
+		bool                   isHalfPrecision;
+		vector<float>          values;	// u, v, then the densities, if !isHalfPrecision
+		vector<unsigned short> halfValues;	// the same as halves, if isHalfPrecision
+
+		Snapshot(void) : width(0), height(0), densityChannels(0), isHalfPrecision(false) {}
+		bool isEmpty() const { return width == 0; }
+	};
+
+
+	/**
+	 * Saves the velocity and density into a snapshot. The snapshot's buffers are reused, so
+	 * saving into the same snapshot again does not allocate.
+	 *
+	 * @param snapshot       receives the state
+	 * @param halfPrecision  store 16 bit floats, half the size, about 3 significant digits
+	 */
+	void saveSnapshot(Snapshot& snapshot, bool halfPrecision = false);
+
+
+	/**
+	 * Blends a snapshot into the velocity and density: field += weight * (snapshot - field).
+	 * A weight of 1 restores the snapshot, smaller weights cross-fade to it. Snapshots of 
+	 * another grid size are resampled. Density is only taken from snapshots with the same
+	 * number of density channels, so a snapshot of another kind of solver only hands over
+	 * its velocity. A solver whose fields were released is reset first.
+	 *
+	 * @param snapshot  state to restore
+	 * @param weight    share of the snapshot, 0 - 1
+	 */
+	void restoreSnapshot(const Snapshot& snapshot, float weight = 1.0f);
+
+
+	/**
+	 * Frees the fields of an idle solver, e.g. the one of the modes that are not running.
+	 * Settings, links and the grid size are kept, and resize() only records the new size.
+	 * Nothing else may be called until reset() or restoreSnapshot() lays the fields out
+	 * again.
+	 */
+	virtual void releaseFields();
+
+
+	/**
+	 * Accessor: returns false between releaseFields() and the next reset() or 
+	 * restoreSnapshot().
+	 */
+	bool hasFields();
 
 protected:
+	FieldArena arena_;  // owns every field buffer below
+
 	float* u_;
 	float* v_;
 	float* u_prev_;
 	float* v_prev_;
 	float* dens_;
 	float* dens_prev_;
+	float* backtrace_;  // scratch of the MacCormack correction
 	bool*  bounds_;
 
-	int   N_;
+	//bounds_ packed 32 cells per word, rowWords_ words per row of ROW_WIDTH cells. Only 
+	//written through writeBound() so the two stay in sync.
+	vector<unsigned int> boundBits_;
+	int                  rowWords_;
+	bool                 boundsChanged_;  // boundEdges_ and boundCorners_ are out of date
+	bool                 multigridChanged_; // the coarse levels of multigrid_ are out of date
+
+	/**
+	 * Cells setBounds() has to visit, rebuilt by updateBoundLists() after the bounds change.
+	 * An edge cell is either a bound cell (BOUND_CELL), which takes the value of its open 
+	 * neighbors, or an open cell whose value is copied into its bound neighbors. 
+	 * BOUND_EDGE_UP and BOUND_EDGE_RIGHT mark the neighbors that differ from the cell.
+	 * A corner cell takes the average of cells a and b.
+	 */
+	enum BoundEdgeFlags { BOUND_CELL = 1, BOUND_EDGE_UP = 2, BOUND_EDGE_RIGHT = 4 };
+	struct BoundEdge   { int cell; unsigned char flags; };
+	struct BoundCorner { int cell, a, b; };
+	vector<BoundEdge>   boundEdges_;
+	vector<BoundCorner> boundCorners_;
+
+	int   width_;
+	int   height_;
 	float dt_;
 	float diff_;
 	float visc_;
 
+	LinearSolverType linearSolver_;
+	int              solverIterations_;
+	FluidKernels     kernels_;
+	AdvectionScheme  advectionScheme_;
+
+	float         vorticityConfinement_;
+	float         buoyancy_;
+	vector<float> curlRows_;	// three rows of curl, rolled over the grid by addForces()
+
+	PressureSolverType pressureSolver_;
+	float              pressureTolerance_;
+	int                pressureMaxIterations_;
+	int                pressureIterations_;
+	float              pressureResidual_;
+	MultigridSolver*   multigrid_;
+
+	int           wallWidth_;	// 0 unless the grid is a tile of a wider wall
+	HaloLink*     edgeLinks_[EDGE_COUNT];
+	bool          exchangingHalos_;	// inside update(), when both tiles make the same calls
+	vector<float> haloSend_, haloReceive_;
+
+	bool fieldsReleased_;	// see releaseFields()
+
+
+
+	/**
+	 * Like the public constructor, but leaves arena_ empty unless layoutFields is set.
+	 * A subclass whose getFieldBytes() depends on its own members passes false and
+	 * calls allocateFields() once they are set, since virtual calls in this constructor 
+	 * do not reach it yet.
+	 */
+	FluidSolver(int width, int height, float dt, float diff, float visc, bool layoutFields);
+
+
+
+	/**
+	 * Sets the parameters, but leaves the fields to allocateFields(). Shared by the constructors.
+	 */
+	void init(int width, int height, float dt, float diff, float visc);
+
+
+
+	/**
+	 * Returns the number of bytes arena_ needs for all fields at the current grid size.
+	 * Subclasses with more fields add theirs.
+	 */
+	virtual size_t getFieldBytes();
+
+
+
+	/**
+	 * Lays out arena_ for the current grid size and points the field pointers into it.
+	 * Subclasses with more fields call this first, then take theirs from arena_. The
+	 * contents of all fields are undefined afterwards.
+	 */
+	virtual void allocateFields();
+
+
+
+	/**
+	 * Lays the fields out again after releaseFields(); does nothing if they are there. The 
+	 * contents of the fields are undefined afterwards, like after allocateFields().
+	 */
+	void ensureFields();
+
+
+
+	/**
+	 * Returns the density field saved in snapshots and its values per cell. Subclasses with
+	 * other density fields return theirs.
+	 *
+	 * @param channels - receives the number of interleaved values per cell
+	 */
+	virtual float* getSnapshotDensity(int& channels);
+
+
+
+	/**
+	 * Called when saveSnapshot() or restoreSnapshot() is done with getSnapshotDensity(),
+	 * for subclasses that return a converted copy.
+	 *
+	 * @param isChanged - true if restoreSnapshot() changed the density
+	 */
+	virtual void endSnapshotDensity(bool isChanged);
+
+
+
+	/**
+	 * Called after restoreSnapshot() changed the fields, to set their buffer cells. 
+	 * Subclasses with other density fields set theirs, too.
+	 */
+	virtual void finishRestore();
+
+
+
+	/**
+	 * Blends one field of a snapshot into a field of this solver, see restoreSnapshot().
+	 *
+	 * @param snapshot - snapshot to read
+	 * @param offset   - index of the field's first value in the snapshot
+	 * @param channels - interleaved values per cell
+	 * @param weight   - share of the snapshot, 0 - 1
+	 * @param field    - field to change
+	 */
+	void restoreSnapshotField(const Snapshot& snapshot, size_t offset, int channels, 
+							  float weight, float* field);
+
 
 
 	/**
@@ -186,7 +649,7 @@ protected:
 
 	/**
 	 * Tests to see whether a coordinate is inside the valid range of fluid computation
-	 * cells. (1 - N)
+	 * cells. (1 - width, 1 - height)
 	 * @param x - y-coordinate
 	 * @param y - y-coordinate to test
 	 * @return True if the coordinate pair is within the valid range, false if not.
@@ -195,6 +658,19 @@ protected:
 
 
 
+	/**
+	 * Bilinearly resamples the interior cells of a field onto a grid of another size.
+	 * Buffer cells of the result are left for setBounds().
+	 *
+	 * @param from, fromWidth, fromHeight - source field and its size without buffer cells
+	 * @param to, toWidth, toHeight       - destination field and its size
+	 * @param channels                    - interleaved values per cell
+	 */
+	static void resampleField(const float* from, int fromWidth, int fromHeight,
+							  float* to, int toWidth, int toHeight, int channels);
+
+
+
 	/** 
 	 * Adds values to a matrix array, scaling the values by the timestep.
 	 * @param x - reference to a float matrix array that values will be added to
@@ -204,6 +680,20 @@ protected:
 
 
 
+	/**
+	 * Adds the velocity sources to the velocity together with vorticity confinement and
+	 * buoyancy, in one sweep over the rows. The curl is computed one row ahead into 
+	 * curlRows_, before that row's velocity changes, so all forces come from the velocity
+	 * of the start of the step.
+	 *
+	 * @param u, v     - velocity, updated in place
+	 * @param u0, v0   - velocity added this timestep
+	 * @param density  - density that buoyancy lifts, NULL for none
+	 */
+	void addForces(float* u, float* v, float* u0, float* v0, const float* density);
+
+
+
 	/**
 	 * Sets the boundaries the fluid will collide with. The horizontal component of the velocity should 
 	 * be zero on the vertical walls, while the vertical component of 
@@ -218,6 +708,91 @@ protected:
 
 
 
+	/**
+	 * Returns the number of cells per unit of length (the width of the wall), the scale of 
+	 * the velocities.
+	 */
+	float getCellsPerUnit() { return (float)(wallWidth_ > 0 ? wallWidth_ : width_); }
+
+
+
+	/**
+	 * Returns true if any side of the grid is linked to a neighboring tile.
+	 */
+	bool hasEdgeLinks();
+
+
+
+	/**
+	 * Start and end of the halo exchanges of one update(). Outside of them, linked sides 
+	 * act as walls, e.g. while resize() sets the bounds of the resampled fields.
+	 */
+	void beginHaloExchange();
+	void endHaloExchange();
+
+
+
+	/**
+	 * Replaces the ghost cells of the linked sides of a field with the neighbors' cells.
+	 * Does nothing outside of beginHaloExchange() / endHaloExchange().
+	 *
+	 * @param x          field in IX order
+	 * @param channels   values per cell, interleaved
+	 */
+	void exchangeHalos(float* x, int channels);
+
+
+
+	/**
+	 * Returns the cells exchanged along one side of the grid.
+	 *
+	 * @param edge   - side of the grid
+	 * @param inner  - receives the first interior cell sent to the neighbor
+	 * @param ghost  - receives the first ghost cell taken from the neighbor
+	 * @param stride - receives the step from one cell of the side to the next
+	 * @param length - receives the number of cells along the side
+	 */
+	void getHaloCells(TileEdge edge, int& inner, int& ghost, int& stride, int& length);
+
+
+
+	/**
+	 * Adds the density of one splat to the clipped block of cells xMin - xMax, yMin - yMax
+	 * (inclusive). Subclasses with more density fields put it into theirs.
+	 *
+	 * @param splat   - splat to add
+	 * @param xMin, xMax, yMin, yMax - cells covered by the splat, within 1 - N
+	 */
+	virtual void addSplatDensity(const Splat& splat, int xMin, int xMax, int yMin, int yMax);
+
+
+
+	/**
+	 * Sets bounds_ at one cell and keeps boundBits_ in sync. Marks the boundary lists out of 
+	 * date only if the value changed, so re-sending an unchanged silhouette costs nothing.
+	 *
+	 * @param cell    - index into bounds_, IX(x, y)
+	 * @param isBound - new value
+	 */
+	void writeBound(int cell, bool isBound);
+
+
+
+	/**
+	 * Clears boundBits_ after bounds_ was cleared as a whole.
+	 */
+	void clearBoundBits();
+
+
+
+	/**
+	 * Rebuilds boundEdges_ and boundCorners_ from the bounds, skipping spans of boundBits_ 
+	 * that hold no bound.
+	 */
+	void updateBoundLists();
+
+
+
 	/**
 	 * Use Gauss-Seidel relaxation on elements in the matrix to work backwards in time 
 	 * to find the or velocities densities we started with.
@@ -232,6 +807,32 @@ protected:
 
 
 
+	/**
+	 * Red-black variant of linearSolve(). Each iteration relaxes the "red" cells ((i+j) even)
+	 * and then the "black" cells ((i+j) odd). Rows are walked in memory order and each half 
+	 * sweep is shared between worker threads.
+	 *
+	 * @param b  - boundary condition flag
+	 * @param x  - pointer to an array containing final solution values
+	 * @param x0 - pointer to an array containing a guess of the initial solution
+	 * @param a  - coefficient of relaxation per cell (dt * diffusion rate * total number of cells)
+	 * @param c  - divide out least common denominator from fraction addition
+	 */
+	void linearSolveRedBlack ( int boundsFlag, float* x, float* x0, float a, float c, int iterations);
+
+
+
+	/**
+	 * Solves the pressure equation of project() with multigrid V-cycles (see MultigridSolver).
+	 * Boundary cells are treated as zero flux walls for the pressure.
+	 *
+	 * @param p	   - pointer to a matrix array containing projected solution
+	 * @param div  - pointer to a matrix array containing divergence values
+	 */
+	void solvePressureMultigrid (float* p, float* div);
+
+
+
 	/**
 	 * Diffuse density values among surrounding cells
 	 * 
@@ -254,6 +855,23 @@ protected:
 	 * @param v    - pointer to a matrix array containing vertical velocity components
 	 */
 	void advect (int boundsFlag, float* d, float* d0, float* u, float* v);
+
+
+
+	/**
+	 * Second pass of MacCormack advection for the cells (1..width, j): adds half the error
+	 * measured by the forward trace to d and clamps the result to the four cells of d0 that 
+	 * the backtrace of the cell blended.
+	 *
+	 * @param d    - semi-Lagrangian result, corrected in place
+	 * @param d0   - initial density or velocity values
+	 * @param back - d traced forward again
+	 * @param u, v - velocity the fields were advected with
+	 * @param j    - row to correct
+	 * @param dt0  - timestep times cells per unit length
+	 */
+	void correctMacCormackRow (float* d, const float* d0, const float* back, 
+							   const float* u, const float* v, int j, float dt0);
 	
 
 
@@ -290,7 +908,8 @@ protected:
 	 *				 this timestep.
 	 * @param u0   - pointer to a matrix array containing y components of velocity to be added
 	 *				 this timestep.
+	 * @param density - density that buoyancy lifts, NULL for none
 	 */
-	void computeVelocityStep (float* u, float* v, float* u0, float* v0);
+	void computeVelocityStep (float* u, float* v, float* u0, float* v0, const float* density = NULL);
 };
 
@@ -20,30 +20,202 @@
  */
 
 #include "FluidSolverMultiUser.h"
+#include "Profiler.h"
+#include "HalfFloat.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
 
-#define ROW_WIDTH N_+2
+#define ROW_WIDTH width_+2
 #define IX(i,j) ((i)+(ROW_WIDTH)*(j))
-#define FOR_EACH_CELL for (i=1 ; i<=N_ ; i++) { for (j=1 ; j<=N_ ; j++) {
+#define UX(i,j) (IX(i,j)*nChannels_) //first stored channel of cell (i,j), the one of user 1
+#define FOR_EACH_CELL for (j=1 ; j<=height_ ; j++) { for (i=1 ; i<=width_ ; i++) {
 #define END_FOR }}
-#define SWAP(x0,x) { float* tmp=x0; x0=x; x=tmp; }
-#define SWAP2D(x0,x) {float ** tmp=x0; x0=x; x=tmp;}
+
+#define MIN_PARALLEL_N          32    //grids with fewer rows than this are not worth waking up worker threads
+#define TILE_SIZE               16    //cells per side of an activity tile
+#define ACTIVE_DENSITY          1e-4f //tiles whose density stays below this are skipped and cleared
+
+
+
+/**
+ * Converts one stored density to a float and back. Halves round to the nearest value 
+ * they can hold. The loops over many values use the half kernels instead.
+ */
+static inline float loadDensity(float value)          { return value; }
+static inline float loadDensity(unsigned short value) { return halfToFloat(value); }
+
+static inline void storeDensity(float value, float& to)          { to = value; }
+static inline void storeDensity(float value, unsigned short& to) { to = floatToHalf(value); }
+
+
+
+/**
+ * Expands the stored channels of count cells to all users, user 0 in front.
+ */
+static void decodeUsers(const FluidKernels&, const float* from, int count, int nUsers, float* to)
+{
+	for (int c = 0; c < count; c++, from += nUsers - 1, to += nUsers)
+		memcpy(to + 1, from, (nUsers - 1) * sizeof(float));
+}
+
+static void decodeUsers(const FluidKernels& kernels, const unsigned short* from, int count, int nUsers, float* to)
+{
+	for (int c = 0; c < count; c++, from += nUsers - 1, to += nUsers)
+		kernels.loadHalves(from, nUsers - 1, to + 1);
+}
+
+
+
+/**
+ * Stores all but user 0 of count cells of all users.
+ */
+static void encodeUsers(const FluidKernels&, const float* from, int count, int nUsers, float* to)
+{
+	for (int c = 0; c < count; c++, from += nUsers, to += nUsers - 1)
+		memcpy(to, from + 1, (nUsers - 1) * sizeof(float));
+}
+
+static void encodeUsers(const FluidKernels& kernels, const float* from, int count, int nUsers, unsigned short* to)
+{
+	for (int c = 0; c < count; c++, from += nUsers, to += nUsers - 1)
+		kernels.storeHalves(from + 1, nUsers - 1, to);
+}
+
+
+
+/**
+ * Fills in user 0 of count cells expanded by decodeUsers(): what the others leave.
+ */
+static void fillImplicitUser(int count, int nUsers, float* to)
+{
+	for (int c = 0; c < count; c++, to += nUsers) {
+		float others = 0.0f;
+		for (int n = 1; n < nUsers; n++)
+			others += to[n];
+		to[0] = others < 1.0f ? 1.0f - others : 0.0f;
+	}
+}
+
+
+
+/**
+ * Copies all user channels of one cell into another cell.
+ */
+template <class T>
+static inline void copyChannels(T* x, int dst, int src, int nChannels)
+{
+	for (int n = 0; n < nChannels; n++)
+		x[dst + n] = x[src + n];
+}
+
+
+
+/**
+ * Relaxes the listed user channels of one cell. Neighbor offsets are in values. Halves
+ * go through FluidKernels::relaxHalves().
+ */
+static inline void relaxChannels(const FluidKernels&, float* x, const float* x0, int cell, int right, int up, 
+								 const int* channels, int nChannels, float a, float invC)
+{
+	for (int n = 0; n < nChannels; n++) {
+		int k = cell + channels[n];
+		x[k] = (x0[k] + a*(x[k-right] + x[k+right] + x[k-up] + x[k+up])) * invC;
+	}
+}
+
+static inline void relaxChannels(const FluidKernels& kernels, unsigned short* x, const unsigned short* x0, int cell, 
+								 int right, int up, const int* channels, int nChannels, float a, float invC)
+{
+	kernels.relaxHalves(x, x0, cell, right, up, channels, nChannels, a, invC);
+}
+
+
+
+/**
+ * Bilinear blend of the listed user channels of four cells, see FluidKernels::blendHalves().
+ */
+static inline void blendChannels(const FluidKernels&, float* out, const float* const* corners, const float* weights,
+								 const int* channels, int nChannels, unsigned char* active)
+{
+	const float s0 = weights[0], s1 = weights[1], t0 = weights[2], t1 = weights[3];
+	for (int c = 0; c < nChannels; c++) {
+		int   n     = channels[c];
+		float value = s0 * (t0 * corners[0][n] + t1 * corners[1][n]) + 
+					  s1 * (t0 * corners[2][n] + t1 * corners[3][n]);
+		out[n] = value;
+		if (fabs(value) > ACTIVE_DENSITY)
+			active[n] = 1;
+	}
+}
+
+static inline void blendChannels(const FluidKernels& kernels, unsigned short* out, const unsigned short* const* corners, 
+								 const float* weights, const int* channels, int nChannels, unsigned char* active)
+{
+	kernels.blendHalves(out, corners, weights, channels, nChannels, ACTIVE_DENSITY, active);
+}
+
+
+
+/**
+ * MacCormack correction of the listed user channels of one cell, see 
+ * FluidKernels::correctHalves().
+ */
+static inline void correctChannels(const FluidKernels&, float* out, const float* here, const float* start,
+								   const float* const* corners, const float* weights, const float* const* limits,
+								   const int* channels, int nChannels, unsigned char* active)
+{
+	const float s0 = weights[0], s1 = weights[1], t0 = weights[2], t1 = weights[3];
+	for (int c = 0; c < nChannels; c++) {
+		int   n     = channels[c];
+		float back  = s0 * (t0 * corners[0][n] + t1 * corners[1][n]) + 
+					  s1 * (t0 * corners[2][n] + t1 * corners[3][n]);
+		float value = here[n] + 0.5f * (start[n] - back);
+
+		float lo = min(min(limits[0][n], limits[1][n]), min(limits[2][n], limits[3][n]));
+		float hi = max(max(limits[0][n], limits[1][n]), max(limits[2][n], limits[3][n]));
+		value = value < lo ? lo : (value > hi ? hi : value);
+
+		out[n] = value;
+		if (fabs(value) > ACTIVE_DENSITY)
+			active[n] = 1;
+	}
+}
+
+static inline void correctChannels(const FluidKernels& kernels, unsigned short* out, const unsigned short* here, 
+								   const unsigned short* start, const unsigned short* const* corners, 
+								   const float* weights, const unsigned short* const* limits,
+								   const int* channels, int nChannels, unsigned char* active)
+{
+	kernels.correctHalves(out, here, start, corners, weights, limits, channels, nChannels, ACTIVE_DENSITY, active);
+}
+
+
 
 ////// public methods
 FluidSolverMultiUser::FluidSolverMultiUser(int nUsers, int N, float dt, float diff, float visc) :
-	FluidSolver(N, dt, diff, visc)
+	FluidSolver(N, N, dt, diff, visc, false)
 {
-	nUsers_ = nUsers;
-	int size = getSize();
+	nUsers_    = nUsers;
+	nChannels_ = max(nUsers - 1, 0);
+	storage_   = DENSITY_FLOAT;
+
+	//the base constructor left the arena to us, the user fields need nUsers_
+	allocateFields();
+	reset();
+}
 
-	userDensity_      = new float*[nUsers_];
-	userDensity_prev_ = new float*[nUsers_];
 
 
-	for(int i = 0; i < nUsers_; i++) {
-		userDensity_[i]      = new float[size];
-		userDensity_prev_[i] = new float[size];
-	}
+FluidSolverMultiUser::FluidSolverMultiUser(int nUsers, int width, int height, float dt, float diff, float visc) :
+	FluidSolver(width, height, dt, diff, visc, false)
+{
+	nUsers_    = nUsers;
+	nChannels_ = max(nUsers - 1, 0);
+	storage_   = DENSITY_FLOAT;
 
+	//the base constructor left the arena to us, the user fields need nUsers_
+	allocateFields();
 	reset();
 }
 
@@ -51,30 +223,94 @@ FluidSolverMultiUser::FluidSolverMultiUser(int nUsers, int N, float dt, float di
 
 FluidSolverMultiUser::~FluidSolverMultiUser(void)
 {
+	//the user densities are released with arena_
 }
 
 
 
 void FluidSolverMultiUser::addDensityAt(int userNo, int x, int y, float value)
 {
-	if(isValidCoordinate(x, y))
-		userDensity_prev_[userNo][IX(x,y)] += value * dt_;
+	if(userNo >= 1 && userNo < nUsers_ && isValidCoordinate(x, y)) {
+		int index = UX(x,y) + userNo - 1;
+		storeUserDensity(userDensity_prev_, index, loadUserDensity(userDensity_prev_, index) + value * getSourceScale());
+		activeTiles_[getTileIndex(x, y) * nChannels_ + userNo - 1] = 1;
+	}
+}
+
+
+
+void FluidSolverMultiUser::addSplatDensity(const Splat& s, int xMin, int xMax, int yMin, int yMax)
+{
+	if (s.userNo < 1 || s.userNo >= nUsers_)
+		return;
+
+	float invRadius = 1.0f / s.radius;
+	float amount    = s.density * getSourceScale() * 0.5f;
+	for (int y = yMin; y <= yMax; y++) {
+		float vscalar = fabs((float)(y - s.centerY)) * invRadius;
+		int   channel = UX(0, y) + s.userNo - 1;
+		for (int x = xMin; x <= xMax; x++) {
+			float uscalar = fabs((float)(x - s.centerX)) * invRadius;
+			int   index   = channel + x * nChannels_;
+			storeUserDensity(userDensity_prev_, index, 
+							 loadUserDensity(userDensity_prev_, index) + amount * (uscalar + vscalar));
+		}
+	}
+
+	int tileMinX = (xMin - 1) / TILE_SIZE, tileMaxX = (xMax - 1) / TILE_SIZE;
+	int tileMinY = (yMin - 1) / TILE_SIZE, tileMaxY = (yMax - 1) / TILE_SIZE;
+	for (int ty = tileMinY; ty <= tileMaxY; ty++)
+		for (int tx = tileMinX; tx <= tileMaxX; tx++)
+			activeTiles_[(tx + tilesPerRow_ * ty) * nChannels_ + s.userNo - 1] = 1;
+}
+
+
+
+void FluidSolverMultiUser::getUserDensities(int x, int y, int count, float* densities)
+{
+	int first = UX(x, y);
+	if (storage_ == DENSITY_HALF)
+		decodeUsers(kernels_, (const unsigned short*)userDensity_ + first, count, nUsers_, densities);
+	else
+		decodeUsers(kernels_, (const float*)userDensity_ + first, count, nUsers_, densities);
+	fillImplicitUser(count, nUsers_, densities);
+}
+
+
+
+int FluidSolverMultiUser::getActiveTileCount(int userNo)
+{
+	if (userNo < 1 || userNo >= nUsers_)
+		return 0;
+
+	int count = 0;
+	for (int t = 0; t < (int)tileChannelCounts_.size(); t++)
+		count += activeTiles_[t * nChannels_ + userNo - 1];
+	return count;
 }
 
 
 
 float FluidSolverMultiUser::getDensityAt(int userNo, int x, int y)
 {
-	return userDensity_[userNo][IX(x,y)];
+	if (userNo > 0)
+		return loadUserDensity(userDensity_, UX(x,y) + userNo - 1);
+
+	//user 0 fills what the others leave
+	float others = 0.0f;
+	for (int n = 0; n < nChannels_; n++)
+		others += loadUserDensity(userDensity_, UX(x,y) + n);
+	return others < 1.0f ? 1.0f - others : 0.0f;
 }
 
 
 
 void FluidSolverMultiUser::update()
 {
-	for(int i = 0; i < nUsers_; i++)
-		computeDensityStep(userDensity_[i], userDensity_prev_[i], u_, v_);
+	beginHaloExchange();
+	computeUserDensityStep(u_, v_);
 	computeVelocityStep(u_, v_, u_prev_, v_prev_);
+	endHaloExchange();
 
 	//reset u_prev_, v_prev_, and dens_prev
 	for(int i = 0; i < getSize(); i++) { 
@@ -84,26 +320,636 @@ void FluidSolverMultiUser::update()
 	resetUserDensities(userDensity_prev_);	
 }
 
+void FluidSolverMultiUser::resize(int width, int height)
+{
+	if(width == width_ && height == height_)
+		return;
+
+	if(!hasFields() || nChannels_ == 0) {
+		FluidSolver::resize(width, height);
+		return;
+	}
+
+	//the base class lays the arena out again, which invalidates the user channels too
+	int oldWidth  = width_;
+	int oldHeight = height_;
+	vector<float> oldUsers(getSize() * nChannels_);
+	decodeUserDensities(userDensity_, (int)oldUsers.size(), &oldUsers[0]);
+
+	FluidSolver::resize(width, height);
+
+	vector<float> users(getSize() * nChannels_, 0.0f);
+	resampleField(&oldUsers[0], oldWidth, oldHeight, &users[0], width_, height_, nChannels_);
+	encodeUserDensities(&users[0], (int)users.size(), userDensity_);
+	setUserBounds(userDensity_);
+	resetUserDensities(userDensity_prev_);
+
+	//the next advect finds out which tiles still hold density
+	activeTiles_.assign(activeTiles_.size(), 1);
+}
+
+
+
 void FluidSolverMultiUser::reset()
 {
+	ensureFields();
 	for(int i = 0 ; i < getSize(); i++) {
 		u_[i] = v_[i] = u_prev_[i] = v_prev_[i] = 0.0f;
 		bounds_[i] = false;
 	}
+	clearBoundBits();
 
 	resetUserDensities(userDensity_);
 	resetUserDensities(userDensity_prev_);
+
+	//only the implicit background user has density, and it costs nothing
+	activeTiles_.assign(activeTiles_.size(), 0);
+}
+
+
+
+void FluidSolverMultiUser::releaseFields()
+{
+	FluidSolver::releaseFields();
+	userDensity_ = userDensity_prev_ = userDensity_next_ = NULL;
+
+	vector<unsigned char>().swap(activeTiles_);
+	vector<unsigned char>().swap(dilatedTiles_);
+	vector<int>().swap(tileChannels_);
+	vector<int>().swap(tileChannelCounts_);
+	vector<float>().swap(snapshotDensity_);
+}
+
+
+
+void FluidSolverMultiUser::setDensityStorage(DensityStorage storage)
+{
+	if(storage == storage_)
+		return;
+
+	if(!hasFields()) {
+		storage_ = storage;
+		return;
+	}
+
+	//the arena only grows, so free it and carry the fluid over like a mode switch does
+	Snapshot     snapshot;
+	vector<bool> bounds(bounds_, bounds_ + getSize());
+	saveSnapshot(snapshot);
+	releaseFields();
+
+	storage_ = storage;
+	restoreSnapshot(snapshot);
+	for (int k = 0; k < getSize(); k++)
+		writeBound(k, bounds[k]);
+}
+
+
+
+FluidSolverMultiUser::DensityStorage FluidSolverMultiUser::getDensityStorage()
+{
+	return storage_;
 }
 
 
 ////// protected methods
-void FluidSolverMultiUser::resetUserDensities(float** userDensity)
-{
-	for(int i = 0; i < nUsers_; i++)
-		for(int j = 0; j < getSize(); j++) {
-			if(i == 0) //the user "no user" (0) has full weight
-				userDensity[i][j] = 1.0f;
-			else
-				userDensity[i][j] = 0.0f;
+size_t FluidSolverMultiUser::getFieldBytes()
+{
+	size_t userField = FieldArena::getPaddedSize(getSize() * nChannels_ * getDensityBytes());
+	return FluidSolver::getFieldBytes() + 3 * userField;
+}
+
+
+
+void FluidSolverMultiUser::allocateFields()
+{
+	FluidSolver::allocateFields();
+
+	//channels of a cell are next to each other, so one backtrace serves every user
+	size_t userBytes  = getSize() * nChannels_ * getDensityBytes();
+	userDensity_      = arena_.allocateBytes(userBytes);
+	userDensity_prev_ = arena_.allocateBytes(userBytes);
+	userDensity_next_ = arena_.allocateBytes(userBytes);
+
+	tilesPerRow_ = (width_  + TILE_SIZE - 1) / TILE_SIZE;
+	tileRows_    = (height_ + TILE_SIZE - 1) / TILE_SIZE;
+	int nTiles   = tilesPerRow_ * tileRows_;
+	activeTiles_.assign(nTiles * nChannels_, 0);
+	dilatedTiles_.assign(nTiles * nChannels_, 0);
+	tileChannels_.assign(nTiles * nChannels_, 0);
+	tileChannelCounts_.assign(nTiles, 0);
+}
+
+
+
+float FluidSolverMultiUser::getSourceScale()
+{
+	return storage_ == DENSITY_HALF ? dt_ * dt_ : dt_;
+}
+
+
+
+int FluidSolverMultiUser::getDensityBytes()
+{
+	return storage_ == DENSITY_HALF ? sizeof(unsigned short) : sizeof(float);
+}
+
+
+
+float* FluidSolverMultiUser::getSnapshotDensity(int& channels)
+{
+	channels = nUsers_;
+	snapshotDensity_.resize(getSize() * nUsers_);
+	getUserDensities(0, 0, getSize(), &snapshotDensity_[0]);
+	return &snapshotDensity_[0];
+}
+
+
+
+void FluidSolverMultiUser::endSnapshotDensity(bool isChanged)
+{
+	//user 0 follows from the others, whatever the snapshot held for it
+	if(isChanged) {
+		const float* from = &snapshotDensity_[0];
+		if (storage_ == DENSITY_HALF)
+			encodeUsers(kernels_, from, getSize(), nUsers_, (unsigned short*)userDensity_);
+		else
+			encodeUsers(kernels_, from, getSize(), nUsers_, (float*)userDensity_);
+	}
+	vector<float>().swap(snapshotDensity_);
+}
+
+
+
+void FluidSolverMultiUser::finishRestore()
+{
+	setBounds(1, u_);
+	setBounds(2, v_);
+	setUserBounds(userDensity_);
+
+	//the next advect finds out which tiles hold density
+	activeTiles_.assign(activeTiles_.size(), 1);
+}
+
+
+
+void FluidSolverMultiUser::decodeUserDensities(const unsigned char* from, int count, float* to)
+{
+	if (storage_ == DENSITY_HALF)
+		kernels_.loadHalves((const unsigned short*)from, count, to);
+	else
+		memcpy(to, from, count * sizeof(float));
+}
+
+
+
+void FluidSolverMultiUser::encodeUserDensities(const float* from, int count, unsigned char* to)
+{
+	if (storage_ == DENSITY_HALF)
+		kernels_.storeHalves(from, count, (unsigned short*)to);
+	else
+		memcpy(to, from, count * sizeof(float));
+}
+
+
+
+float FluidSolverMultiUser::loadUserDensity(const unsigned char* field, int index)
+{
+	if (storage_ == DENSITY_HALF)
+		return loadDensity(((const unsigned short*)field)[index]);
+	return ((const float*)field)[index];
+}
+
+
+
+void FluidSolverMultiUser::storeUserDensity(unsigned char* field, int index, float value)
+{
+	if (storage_ == DENSITY_HALF)
+		storeDensity(value, ((unsigned short*)field)[index]);
+	else
+		((float*)field)[index] = value;
+}
+
+
+
+void FluidSolverMultiUser::resetUserDensities(unsigned char* userDensity)
+{
+	//all bits clear is 0 in every storage format
+	memset(userDensity, 0, getSize() * nChannels_ * getDensityBytes());
+}
+
+
+
+void FluidSolverMultiUser::setUserBounds(unsigned char* x)
+{
+	if (storage_ == DENSITY_HALF)
+		setUserBounds<unsigned short>((unsigned short*)x);
+	else
+		setUserBounds<float>((float*)x);
+}
+
+
+
+template <class T>
+void FluidSolverMultiUser::setUserBounds(T* x)
+{
+	int i;
+
+	//boundary edges mirror the nearest cell
+	for ( i=1 ; i<=height_; i++ ) {
+		copyChannels(x, UX(0,        i), UX(1,     i), nChannels_);
+		copyChannels(x, UX(width_+1, i), UX(width_,i), nChannels_);
+	}
+	for ( i=1 ; i<=width_; i++ ) {
+		copyChannels(x, UX(i,         0), UX(i,       1), nChannels_);
+		copyChannels(x, UX(i, height_+1), UX(i,height_), nChannels_);
+	}
+
+	//sides joined to another tile take its cells instead
+	exchangeUserHalos(x);
+
+	if(boundsChanged_)
+		updateBoundLists();
+
+	//same order of updates as FluidSolver::setBounds(0, x), for all channels at once
+	const int up = ROW_WIDTH;
+	for (size_t e = 0; e < boundEdges_.size(); e++) {
+		const int           c     = boundEdges_[e].cell;
+		const unsigned char flags = boundEdges_[e].flags;
+
+		if(flags & BOUND_CELL) {
+			for (int n = 0; n < nChannels_; n++)
+				x[c * nChannels_ + n] = T();
+
+			if(flags & BOUND_EDGE_UP)
+				copyChannels(x, c * nChannels_, (c + up) * nChannels_, nChannels_);
+			if(flags & BOUND_EDGE_RIGHT)
+				copyChannels(x, c * nChannels_, (c + 1) * nChannels_, nChannels_);
+		}
+		else {
+			if(flags & BOUND_EDGE_UP)
+				copyChannels(x, (c + up) * nChannels_, c * nChannels_, nChannels_);
+			if(flags & BOUND_EDGE_RIGHT)
+				copyChannels(x, (c + 1) * nChannels_, c * nChannels_, nChannels_);
+		}
+	}
+
+	//handle corner conditions of objects
+	for (size_t e = 0; e < boundCorners_.size(); e++) {
+		const BoundCorner& corner = boundCorners_[e];
+		for (int n = 0; n < nChannels_; n++)
+			storeDensity(0.5f * (loadDensity(x[corner.a * nChannels_ + n]) + loadDensity(x[corner.b * nChannels_ + n])),
+						 x[corner.cell * nChannels_ + n]);
+	}
+
+	//corner conditions
+	for (int n = 0; n < nChannels_; n++) {
+		storeDensity(0.5f * (loadDensity(x[UX(1,      0        ) + n]) + loadDensity(x[UX(0,          1      ) + n])), x[UX(0,          0          ) + n]);
+		storeDensity(0.5f * (loadDensity(x[UX(1,      height_+1) + n]) + loadDensity(x[UX(0,          height_) + n])), x[UX(0,          height_ + 1) + n]);
+		storeDensity(0.5f * (loadDensity(x[UX(width_, 0        ) + n]) + loadDensity(x[UX(width_ + 1, 1      ) + n])), x[UX(width_ + 1, 0          ) + n]);
+		storeDensity(0.5f * (loadDensity(x[UX(width_, height_+1) + n]) + loadDensity(x[UX(width_ + 1, height_) + n])), x[UX(width_ + 1, height_ + 1) + n]);
+	}
+}
+
+
+
+template <class T>
+void FluidSolverMultiUser::exchangeUserHalos(T* x)
+{
+	if (!exchangingHalos_)
+		return;
+
+	for (int e = 0; e < EDGE_COUNT; e++) {
+		if (!edgeLinks_[e])
+			continue;
+
+		int inner, ghost, stride, length;
+		getHaloCells((TileEdge)e, inner, ghost, stride, length);
+
+		int count = length * nChannels_;
+		haloSend_.resize(count);
+		haloReceive_.resize(count);
+		//the ghost cells keep the wall's values if the neighbor has never answered
+		for (int k = 0; k < length; k++)
+			for (int n = 0; n < nChannels_; n++) {
+				haloSend_   [k * nChannels_ + n] = loadDensity(x[(inner + k * stride) * nChannels_ + n]);
+				haloReceive_[k * nChannels_ + n] = loadDensity(x[(ghost + k * stride) * nChannels_ + n]);
+			}
+
+		edgeLinks_[e]->exchange(&haloSend_[0], &haloReceive_[0], count);
+		for (int k = 0; k < length; k++)
+			for (int n = 0; n < nChannels_; n++)
+				storeDensity(haloReceive_[k * nChannels_ + n], x[(ghost + k * stride) * nChannels_ + n]);
+	}
+}
+
+
+
+void FluidSolverMultiUser::addUserSources(float* x, const float* s, int count)
+{
+	kernels_.addSource(x, s, dt_, count);
+}
+
+
+
+void FluidSolverMultiUser::addUserSources(unsigned short* x, const unsigned short* s, int count)
+{
+	//the sources already include the dt of this step, see getSourceScale()
+	kernels_.addHalves(x, s, count);
+}
+
+
+
+int FluidSolverMultiUser::getTileIndex(int i, int j)
+{
+	return (i - 1) / TILE_SIZE + tilesPerRow_ * ((j - 1) / TILE_SIZE);
+}
+
+
+
+void FluidSolverMultiUser::activateLinkedEdgeTiles()
+{
+	if (!hasEdgeLinks())
+		return;
+
+	for (int ty = 0; ty < tileRows_; ty++)
+		for (int tx = 0; tx < tilesPerRow_; tx++) {
+			bool isOnLinkedEdge = (tx == 0                && edgeLinks_[EDGE_LEFT])   ||
+								  (tx == tilesPerRow_ - 1 && edgeLinks_[EDGE_RIGHT])  ||
+								  (ty == 0                && edgeLinks_[EDGE_BOTTOM]) ||
+								  (ty == tileRows_ - 1    && edgeLinks_[EDGE_TOP]);
+			if (!isOnLinkedEdge)
+				continue;
+
+			for (int n = 0; n < nChannels_; n++)
+				activeTiles_[(tx + tilesPerRow_ * ty) * nChannels_ + n] = 1;
+		}
+}
+
+
+
+void FluidSolverMultiUser::dilateActiveTiles(int radius)
+{
+	dilateActiveTiles(radius, radius, radius, radius);
+}
+
+
+
+void FluidSolverMultiUser::dilateActiveTiles(int left, int right, int down, int up)
+{
+	const int n    = tilesPerRow_;
+	const int rows = tileRows_;
+
+	#pragma omp parallel for schedule(static) if(height_ >= MIN_PARALLEL_N)
+	for (int tj = 0; tj < rows; tj++) {
+		for (int ti = 0; ti < n; ti++) {
+			int  tile  = ti + n * tj;
+			int  count = 0;
+
+			for (int channel = 0; channel < nChannels_; channel++) {
+				//a tile needs work if an active tile is within reach; density moving right
+				//comes from active tiles on the left
+				bool active = false;
+				for (int y = max(tj - up, 0); y <= min(tj + down, rows - 1) && !active; y++)
+					for (int x = max(ti - right, 0); x <= min(ti + left, n - 1) && !active; x++)
+						active = activeTiles_[(x + n * y) * nChannels_ + channel] != 0;
+
+				dilatedTiles_[tile * nChannels_ + channel] = active ? 1 : 0;
+				if (active)
+					tileChannels_[tile * nChannels_ + count++] = channel;
+			}
+			tileChannelCounts_[tile] = count;
+		}
+	}
+}
+
+
+
+template <class T>
+void FluidSolverMultiUser::diffuseUsers(T* x, T* x0)
+{
+	ScopedTimer timer(PROFILE_DIFFUSE);
+	const float a     = dt_ * diff_ * getCellsPerUnit() * getCellsPerUnit();
+	const float invC  = 1.0f / (1 + 4 * a);
+	const int   right = nChannels_;
+	const int   up    = (ROW_WIDTH) * nChannels_;
+	int i, j, k;
+
+	//a red-black sweep spreads density by two cells, the black cells read the new red 
+	//ones. A lexicographic sweep reads the new values left of and below each cell, so it 
+	//carries density across the whole grid to the right and up, and one cell back.
+	if (linearSolver_ == RED_BLACK_GAUSS_SEIDEL)
+		dilateActiveTiles((2 * solverIterations_ + TILE_SIZE - 1) / TILE_SIZE);
+	else {
+		int back = (solverIterations_ + TILE_SIZE - 1) / TILE_SIZE;
+		dilateActiveTiles(back, tilesPerRow_, back, tileRows_);
+	}
+
+	for (k = 0; k < solverIterations_; k++) {
+		if (linearSolver_ == RED_BLACK_GAUSS_SEIDEL) {
+			for (int color = 0; color < 2; color++) {
+				#pragma omp parallel for private(i) schedule(static) if(height_ >= MIN_PARALLEL_N)
+				for (j = 1; j <= height_; j++)
+					for (i = 1 + ((1 + j + color) & 1); i <= width_; i += 2) {
+						int tile = getTileIndex(i, j);
+						relaxChannels(kernels_, x, x0, UX(i,j), right, up, &tileChannels_[tile * nChannels_], 
+									  tileChannelCounts_[tile], a, invC);
+					}
+
+				//the second color reads the first one's new values across a tile edge too,
+				//setUserBounds() exchanges the second color's
+				if (color == 0)
+					exchangeUserHalos(x);
+			}
+		}
+		else {
+			FOR_EACH_CELL
+				int tile = getTileIndex(i, j);
+				relaxChannels(kernels_, x, x0, UX(i,j), right, up, &tileChannels_[tile * nChannels_], 
+							  tileChannelCounts_[tile], a, invC);
+			END_FOR
+		}
+		setUserBounds<T>(x);
+	}
+
+	//skipped channels kept their initial guess, which only holds this frame's
+	//sources; those tiles were already marked active by addDensityAt()
+	activeTiles_ = dilatedTiles_;
+}
+
+
+
+template <class T>
+void FluidSolverMultiUser::advectUsers(T* d, T* d0, float* u, float* v)
+{
+	ScopedTimer timer(PROFILE_ADVECT);
+	const float dt0      = dt_ * getCellsPerUnit();
+	const int   rowWidth = ROW_WIDTH;
+	const int   size     = getSize();
+
+	//farthest any backtrace can reach, plus one cell for the bilinear blend
+	float maxVelocity = 0.0f;
+	for (int k = 0; k < size; k++) {
+		if (fabs(u[k]) > maxVelocity) maxVelocity = fabs(u[k]);
+		if (fabs(v[k]) > maxVelocity) maxVelocity = fabs(v[k]);
+	}
+	float reach = min(dt0 * maxVelocity, (float)max(width_, height_)) + 1.0f;
+	dilateActiveTiles((int)ceil(reach / TILE_SIZE));
+
+	const int nTiles = tilesPerRow_ * tileRows_;
+
+	#pragma omp parallel for schedule(dynamic) if(height_ >= MIN_PARALLEL_N)
+	for (int tile = 0; tile < nTiles; tile++) {
+		const int* channels  = &tileChannels_[tile * nChannels_];
+		const int  nChannels = tileChannelCounts_[tile];
+		unsigned char* active = &activeTiles_[tile * nChannels_];
+
+		//tiles only stay active while they hold visible density
+		for (int n = 0; n < nChannels_; n++)
+			active[n] = 0;
+
+		int iStart = 1 + TILE_SIZE * (tile % tilesPerRow_), iEnd = min(iStart + TILE_SIZE - 1, width_);
+		int jStart = 1 + TILE_SIZE * (tile / tilesPerRow_), jEnd = min(jStart + TILE_SIZE - 1, height_);
+
+		for (int j = jStart; j <= jEnd; j++) {
+			for (int i = iStart; i <= iEnd; i++) {
+				T* out = d + UX(i, j);
+				for (int n = 0; n < nChannels_; n++)
+					out[n] = T();
+				if (nChannels == 0)
+					continue;
+
+				//backtrace once per cell, the weights are the same for every user
+				float x = i - dt0 * u[IX(i,j)];
+				float y = j - dt0 * v[IX(i,j)];
+
+				if (x < 0.5f)          x = 0.5f;
+				if (x > width_ + 0.5f)  x = width_ + 0.5f;
+				if (y < 0.5f)          y = 0.5f;
+				if (y > height_ + 0.5f) y = height_ + 0.5f;
+				int i0 = (int)x;
+				int j0 = (int)y;
+
+				float s1 = x - i0, s0 = 1 - s1;
+				float t1 = y - j0, t0 = 1 - t1;
+				float weights[] = { s0, s1, t0, t1 };
+
+				const T* c00 = d0 + UX(i0, j0);
+				const T* c01 = c00 + rowWidth * nChannels_;
+				const T* corners[] = { c00, c01, c00 + nChannels_, c01 + nChannels_ };
+
+				blendChannels(kernels_, out, corners, weights, channels, nChannels, active);
+			}
+		}
+	}
+
+	setUserBounds<T>(d);
+}
+
+
+
+template <class T>
+void FluidSolverMultiUser::correctUsersMacCormack(T* d, const T* d1, const T* d0, 
+												  const float* u, const float* v)
+{
+	ScopedTimer timer(PROFILE_ADVECT);
+	const float dt0      = dt_ * getCellsPerUnit();
+	const int   rowWidth = ROW_WIDTH;
+	const int   nTiles   = tilesPerRow_ * tileRows_;
+
+	//same tiles and channels as the advectUsers() call that produced d1
+	#pragma omp parallel for schedule(dynamic) if(height_ >= MIN_PARALLEL_N)
+	for (int tile = 0; tile < nTiles; tile++) {
+		const int* channels  = &tileChannels_[tile * nChannels_];
+		const int  nChannels = tileChannelCounts_[tile];
+		unsigned char* active = &activeTiles_[tile * nChannels_];
+
+		int iStart = 1 + TILE_SIZE * (tile % tilesPerRow_), iEnd = min(iStart + TILE_SIZE - 1, width_);
+		int jStart = 1 + TILE_SIZE * (tile / tilesPerRow_), jEnd = min(jStart + TILE_SIZE - 1, height_);
+
+		for (int j = jStart; j <= jEnd; j++) {
+			for (int i = iStart; i <= iEnd; i++) {
+				T* out = d + UX(i, j);
+				for (int n = 0; n < nChannels_; n++)
+					out[n] = T();
+				if (nChannels == 0)
+					continue;
+
+				float du = dt0 * u[IX(i,j)];
+				float dv = dt0 * v[IX(i,j)];
+
+				//backtrace of the first pass, for the limiter
+				float x = i - du, y = j - dv;
+				if (x < 0.5f)           x = 0.5f;
+				if (x > width_ + 0.5f)  x = width_ + 0.5f;
+				if (y < 0.5f)           y = 0.5f;
+				if (y > height_ + 0.5f) y = height_ + 0.5f;
+				const T* b00 = d0 + UX((int)x, (int)y);
+				const T* b01 = b00 + rowWidth * nChannels_;
+				const T* limits[] = { b00, b01, b00 + nChannels_, b01 + nChannels_ };
+
+				//forward trace of the first pass result
+				x = i + du;
+				y = j + dv;
+				if (x < 0.5f)           x = 0.5f;
+				if (x > width_ + 0.5f)  x = width_ + 0.5f;
+				if (y < 0.5f)           y = 0.5f;
+				if (y > height_ + 0.5f) y = height_ + 0.5f;
+				int i0 = (int)x;
+				int j0 = (int)y;
+
+				float s1 = x - i0, s0 = 1 - s1;
+				float t1 = y - j0, t0 = 1 - t1;
+				float weights[] = { s0, s1, t0, t1 };
+
+				const T* c00 = d1 + UX(i0, j0);
+				const T* c01 = c00 + rowWidth * nChannels_;
+				const T* corners[] = { c00, c01, c00 + nChannels_, c01 + nChannels_ };
+
+				correctChannels(kernels_, out, d1 + UX(i, j), d0 + UX(i, j), corners, weights, limits, 
+								channels, nChannels, active);
+			}
 		}
-}
\ No newline at end of file
+	}
+
+	setUserBounds<T>(d);
+}
+
+
+
+void FluidSolverMultiUser::computeUserDensityStep(float* u, float* v)
+{
+	//with only the implicit user 0 there is nothing to move
+	if (nChannels_ == 0)
+		return;
+
+	if (storage_ == DENSITY_HALF)
+		computeUserDensityStep<unsigned short>(u, v);
+	else
+		computeUserDensityStep<float>(u, v);
+}
+
+
+
+template <class T>
+void FluidSolverMultiUser::computeUserDensityStep(float* u, float* v)
+{
+	activateLinkedEdgeTiles();
+	addUserSources((T*)userDensity_, (const T*)userDensity_prev_, getSize() * nChannels_);
+	swap(userDensity_prev_, userDensity_);
+
+	//without diffusion the relaxation would only copy userDensity_prev_ 20 times; the
+	//boundary conditions it would set are still needed by the backtrace
+	if (diff_ != 0.0f) {
+		diffuseUsers<T>((T*)userDensity_, (T*)userDensity_prev_);
+		swap(userDensity_prev_, userDensity_);
+	}
+	else
+		setUserBounds<T>((T*)userDensity_prev_);
+
+	advectUsers<T>((T*)userDensity_, (T*)userDensity_prev_, u, v);
+	if (advectionScheme_ == ADVECT_MACCORMACK) {
+		correctUsersMacCormack<T>((T*)userDensity_next_, (const T*)userDensity_, (const T*)userDensity_prev_, u, v);
+		swap(userDensity_next_, userDensity_);
+	}
+}
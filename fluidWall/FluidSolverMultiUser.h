@@ -26,11 +26,24 @@
  * Extends the 2D FluidSolver to support simulation of densities that represent various 
  * users in the Fluid Wall simulation
  *
+ * User 0, "no user", is not stored: its density is 1 minus the sum of the other users', 
+ * at least 0. Only users 1 - nUsers-1 have channels, and they can be stored as 32 bit
+ * floats or halves (see DensityStorage). The steps compute in floats and only convert 
+ * when they load and store a channel, in the half kernels of FluidKernels.
  */
 class FluidSolverMultiUser :
 	public FluidSolver
 {
 public:
+	/**
+	 * Number formats of the user channels.
+	 *
+	 * DENSITY_FLOAT - 32 bit floats
+	 * DENSITY_HALF  - 16 bit floats, about 3 significant digits (see HalfFloat.h). Half the
+	 *                 memory traffic; as fast as floats with F16C, slower without it.
+	 */
+	enum DensityStorage { DENSITY_FLOAT, DENSITY_HALF };
+
 	/**
 	 * Parameter constructor
 	 * @param nUsers Number of users that the solver will calculate.
@@ -40,6 +53,17 @@ public:
 	 * @param visc   Viscosity coefficient
 	 */
 	FluidSolverMultiUser(int nUsers, int N, float dt, float diff, float visc);
+
+	/**
+	 * Parameter constructor for rectangular grids (see FluidSolver).
+	 * @param nUsers Number of users that the solver will calculate.
+	 * @param width  Number of cells per row of the fluid simulation grid
+	 * @param height Number of rows of the fluid simulation grid
+	 * @param dt     Timestep size
+	 * @param diff   Diffusion coefficient
+	 * @param visc   Viscosity coefficient
+	 */
+	FluidSolverMultiUser(int nUsers, int width, int height, float dt, float diff, float visc);
 	~FluidSolverMultiUser(void);
 
 	/**
@@ -49,7 +73,7 @@ public:
 	 * and then commit them to the simulation using update(). Valid indicies range from 
 	 * 1 to N. Indicies 0 and N+1 are buffer rows for algorithms.
 	 *
-	 * @param userNo User number to add density to
+	 * @param userNo User number to add density to, 1 - nUsers-1; user 0 is implicit
 	 * @param x     x-coordinate, valid values: 1 - N
 	 * @param y     y-coordinate, valid values: 1 - N
 	 * @param value  Density value to be added
@@ -67,6 +91,24 @@ public:
 	 */
 	float getDensityAt(int userNo, int x, int y);
 
+	/**
+	 * Reads the densities of all users, user 0 included, for a run of cells of one row.
+	 *
+	 * @param x, y       first cell, 0 - width+1 and 0 - height+1
+	 * @param count      number of cells
+	 * @param densities  receives count * nUsers values, user n of cell c at c * nUsers + n
+	 */
+	void getUserDensities(int x, int y, int count, float* densities);
+
+	/**
+	 * Accessor: returns the number of activity tiles in which a user currently has density.
+	 * Users without active tiles cost nothing in diffuse and advect, and neither does the
+	 * implicit user 0, for which this returns 0.
+	 *
+	 * @param userNo  User ID.
+	 */
+	int getActiveTileCount(int userNo);
+
 	/**
 	 * Runs an iteration of the simulation, updating density and velocity values.
 	 * Also resets u_prev, v_prev, and dens_prev.
@@ -80,18 +122,202 @@ public:
 	 */
 	void reset();
 
+
+	/**
+	 * Changes the grid resolution like FluidSolver::resize(), resampling the user channels
+	 * as well. Every activity tile starts out active on the new grid.
+	 */
+	void resize(int width, int height);
+
+
+	/**
+	 * Frees the fields like FluidSolver::releaseFields(), including the user channels and
+	 * the activity tiles.
+	 */
+	void releaseFields();
+
+
+	/**
+	 * Changes the number format of the user channels, see DensityStorage. The fluid and
+	 * the bounds are carried over, so it can be called at any time; it is cheapest on a 
+	 * solver whose fields are released. DENSITY_FLOAT by default.
+	 */
+	void           setDensityStorage(DensityStorage storage);
+	DensityStorage getDensityStorage();
+
 protected:
-	int     nUsers_;
-	float** userDensity_;
-	float** userDensity_prev_;
+	int            nUsers_;
+	int            nChannels_;        // stored channels, nUsers_ - 1: user 0 is implicit
+	DensityStorage storage_;
+	unsigned char* userDensity_;      // nChannels_ values per cell in storage_'s format, 
+	                                  // interleaved: UX(i,j) + userNo - 1
+	unsigned char* userDensity_prev_;
+	unsigned char* userDensity_next_; // result of the MacCormack correction, swapped with userDensity_
+	vector<float>  snapshotDensity_;  // all users as floats while a snapshot is taken or restored
+
+	//activity tracking: the grid is split into TILE_SIZE^2 cell tiles. A (tile, user) pair 
+	//is active while it holds density above ACTIVE_DENSITY or received density this frame.
+	//Advection writes 0 for inactive pairs, so a tile whose density has all faded below 
+	//ACTIVE_DENSITY is cleared. Results only match an untracked solver above that level.
+	int                   tilesPerRow_;
+	int                   tileRows_;
+	vector<unsigned char> activeTiles_;       // tile * nChannels_ + userNo - 1
+	vector<unsigned char> dilatedTiles_;      // active tiles grown by the reach of a step
+	vector<int>           tileChannels_;      // per tile, the channels that need work
+	vector<int>           tileChannelCounts_; // per tile, the number of users in tileChannels_
+
+	/**
+	 * Adds the three interleaved user density arrays to the base fields in arena_.
+	 */
+	size_t getFieldBytes();
+	void   allocateFields();
+
+	/**
+	 * Returns the size in bytes of one stored density value.
+	 */
+	int getDensityBytes();
+
+	/**
+	 * Returns the factor from a density added with addDensityAt() to the value stored in
+	 * userDensity_prev_. Floats store value * dt and the step multiplies by dt again, like 
+	 * FluidSolver does. Halves store the final value * dt * dt, so that 
+	 * FluidKernels::addHalves() only has to add.
+	 */
+	float getSourceScale();
+
+	/**
+	 * Snapshots hold all users as floats, user 0 included, instead of the unused base 
+	 * density, so they do not depend on the storage format.
+	 */
+	float* getSnapshotDensity(int& channels);
+	void   endSnapshotDensity(bool isChanged);
+	void   finishRestore();
+
+	/**
+	 * Convert between stored user channels and floats, in storage_'s format.
+	 *
+	 * @param from, to  - first value of the source and destination
+	 * @param count     - number of values
+	 */
+	void decodeUserDensities(const unsigned char* from, int count, float* to);
+	void encodeUserDensities(const float* from, int count, unsigned char* to);
+
+	/**
+	 * Returns or changes one stored value, in storage_'s format.
+	 *
+	 * @param field  - interleaved user channels
+	 * @param index  - UX(i,j) + userNo - 1
+	 */
+	float loadUserDensity(const unsigned char* field, int index);
+	void  storeUserDensity(unsigned char* field, int index, float value);
+
+	/**
+	 * Adds the density of a splat to the user channel splat.userNo and marks the tiles it 
+	 * covers active.
+	 */
+	void addSplatDensity(const Splat& splat, int xMin, int xMax, int yMin, int yMax);
+
+	/**
+	 * Returns the activity tile of an interior cell.
+	 */
+	int getTileIndex(int i, int j);
+
+	/**
+	 * Grows the active tiles by radius tiles in every direction into dilatedTiles_ and 
+	 * rebuilds each tile's list of users that need work.
+	 *
+	 * @param radius - number of tiles that density can travel in the next step
+	 */
+	void dilateActiveTiles(int radius);
+
+	/**
+	 * Like dilateActiveTiles(radius), for density that travels further in some directions.
+	 *
+	 * @param left, right, down, up - number of tiles density can travel in each direction,
+	 *                                up being increasing j
+	 */
+	void dilateActiveTiles(int left, int right, int down, int up);
+
+	/**
+	 * Marks every user of the tiles along linked sides of the grid active, because density
+	 * can come in through their ghost cells at any time.
+	 */
+	void activateLinkedEdgeTiles();
+
+	/**
+	 * Clears all stored channels of an interleaved density array, which leaves the 
+	 * implicit user 0 with 1.0 density.
+	 */
+	void resetUserDensities(unsigned char* userDensity);
+
+	/**
+	 * Sets the scalar boundary conditions (FluidSolver::setBounds(0, x)) for every user 
+	 * channel of an interleaved density array.
+	 *
+	 * @param x    - pointer to an interleaved user density array
+	 */
+	void setUserBounds(unsigned char* x);
+	template <class T> void setUserBounds(T* x);
+
+	/**
+	 * Like FluidSolver::exchangeHalos() for the stored channels. Halos travel as floats,
+	 * whatever the storage format of the tiles.
+	 *
+	 * @param x    - pointer to an interleaved user density array
+	 */
+	template <class T> void exchangeUserHalos(T* x);
+
+	/**
+	 * Adds the sources s to x for count values, see FluidSolver::addSource() and
+	 * getSourceScale().
+	 */
+	void addUserSources(float* x, const float* s, int count);
+	void addUserSources(unsigned short* x, const unsigned short* s, int count);
 
 	/**
-	 * Resets values in userDensity so that user 0 
-	 * has 1.0 density.
+	 * Diffuses all user channels together, using the relaxation scheme selected with 
+	 * setLinearSolver().
+	 *
+	 * @param x    - pointer to the final interleaved user densities
+	 * @param x0   - pointer to the initial interleaved user densities
+	 */
+	template <class T> void diffuseUsers(T* x, T* x0);
+
+	/**
+	 * Advects all user channels together. The backtrace, clamps and bilinear weights are 
+	 * calculated once per cell and applied to every channel.
+	 *
+	 * @param d    - pointer to the final interleaved user densities
+	 * @param d0   - pointer to the initial interleaved user densities
+	 * @param u    - pointer to a matrix array containing horizontal velocity components
+	 * @param v    - pointer to a matrix array containing vertical velocity components
+	 */
+	template <class T> void advectUsers(T* d, T* d0, float* u, float* v);
+
+	/**
+	 * MacCormack correction of advectUsers() for all user channels: traces d1 forward, 
+	 * adds half the difference to d0 and clamps to the cells the backtrace blended. Works 
+	 * on the same tiles and channels as the advectUsers() call before it.
+	 *
+	 * @param d    - pointer to the corrected interleaved user densities
+	 * @param d1   - pointer to the result of advectUsers()
+	 * @param d0   - pointer to the densities advectUsers() started from
+	 * @param u    - pointer to a matrix array containing horizontal velocity components
+	 * @param v    - pointer to a matrix array containing vertical velocity components
 	 */
-	void resetUserDensities(float** userDensity);
-	//normalize
+	template <class T> void correctUsersMacCormack(T* d, const T* d1, const T* d0, const float* u, const float* v);
 
+	/**
+	 * Density step for all users: adds the sources, diffuses (skipped when the diffusion 
+	 * coefficient is zero) and advects. Swaps userDensity_ and userDensity_prev_ as needed,
+	 * the result is always left in userDensity_. The template does the work for the 
+	 * value type of storage_.
+	 *
+	 * @param u    - pointer to a matrix array containing horizontal velocity components
+	 * @param v    - pointer to a matrix array containing vertical velocity components
+	 */
+	void computeUserDensityStep(float* u, float* v);
+	template <class T> void computeUserDensityStep(float* u, float* v);
 
 };
 
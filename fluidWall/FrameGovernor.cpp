@@ -0,0 +1,217 @@
+/**
+ * @file      FrameGovernor.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "FrameGovernor.h"
+#include "Profiler.h"
+#include <stdio.h>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+#define GOVERNOR_RAISE_FRACTION 0.7f	//windows below this fraction of the budget are calm
+
+struct SimulationStep { int solverIterations, maxEmitters, gridStepsDown; };
+struct CaptureStep    { int flowLevels, gridStepsDown; };
+
+//the first steps give up what is hardest to see: a few splashes, then solver accuracy
+static const SimulationStep simulationLadder[] =
+{
+	{ 20, 200, 0 }, { 20, 120, 0 }, { 14, 120, 0 }, { 14, 80, 0 }, 
+	{ 10,  80, 0 }, { 10,  80, 1 }, {  8,  60, 1 }, {  8, 60, 2 }
+};
+
+static const CaptureStep captureLadder[] =
+{
+	{ 3, 0 }, { 2, 0 }, { 1, 0 }, { 1, 1 }, { 1, 2 }
+};
+
+#define COUNT_OF(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+
+
+FrameGovernor::FrameGovernor(float budgetMilliseconds)
+{
+	budget_  = budgetMilliseconds;
+	enabled_ = true;
+	initTrack(simulation_, "simulation", COUNT_OF(simulationLadder));
+	initTrack(capture_,    "flow",       COUNT_OF(captureLadder));
+	updateSettings();
+}
+
+
+
+void FrameGovernor::initTrack(Track& track, const char* name, int stepCount)
+{
+	track.name        = name;
+	track.step        = 0;
+	track.stepCount   = stepCount;
+	track.frames      = 0;
+	track.calmWindows = 0;
+	track.settling    = false;
+	track.lastP90     = 0.0f;
+}
+
+
+
+void FrameGovernor::setEnabled(bool enabled)
+{
+	enabled_ = enabled;
+	initTrack(simulation_, simulation_.name, simulation_.stepCount);
+	initTrack(capture_,    capture_.name,    capture_.stepCount);
+	updateSettings();
+}
+
+
+
+bool FrameGovernor::isEnabled()
+{
+	return enabled_;
+}
+
+
+
+float FrameGovernor::getBudget()
+{
+	return budget_;
+}
+
+
+
+bool FrameGovernor::addSimulationFrame(float milliseconds)
+{
+	if (!enabled_ || !addFrame(simulation_, milliseconds))
+		return false;
+
+	//a coarser or finer grid changes the cost of the flow as well
+	int gridStepsDown = settings_.gridStepsDown;
+	updateSettings();
+	if (settings_.gridStepsDown != gridStepsDown)
+		capture_.settling = true;
+	return true;
+}
+
+
+
+bool FrameGovernor::addCaptureFrame(float milliseconds)
+{
+	if (!enabled_ || !addFrame(capture_, milliseconds))
+		return false;
+
+	int gridStepsDown = settings_.gridStepsDown;
+	updateSettings();
+	if (settings_.gridStepsDown != gridStepsDown)
+		simulation_.settling = true;
+	return true;
+}
+
+
+
+bool FrameGovernor::addFrame(Track& track, float milliseconds)
+{
+	track.samples[track.frames++] = milliseconds;
+	if (track.frames < GOVERNOR_WINDOW)
+		return false;
+	track.frames = 0;
+
+	float sorted[GOVERNOR_WINDOW];
+	copy(track.samples, track.samples + GOVERNOR_WINDOW, sorted);
+	nth_element(sorted, sorted + GOVERNOR_WINDOW * 9 / 10, sorted + GOVERNOR_WINDOW);
+	track.lastP90 = sorted[GOVERNOR_WINDOW * 9 / 10];
+
+	if (track.settling) {
+		track.settling = false;
+		return false;
+	}
+
+	int step = track.step;
+	if (track.lastP90 > budget_) {
+		track.calmWindows = 0;
+		step = min(step + 1, track.stepCount - 1);
+	}
+	else if (track.lastP90 < GOVERNOR_RAISE_FRACTION * budget_) {
+		if (++track.calmWindows >= RAISE_WINDOWS) {
+			track.calmWindows = 0;
+			step = max(step - 1, 0);
+		}
+	}
+	else
+		track.calmWindows = 0;
+
+	if (step == track.step)
+		return false;
+
+	cout<<"Frame governor: "<<track.name<<" step "<<track.step<<" -> "<<step<<", p90 "
+		<<track.lastP90<<" ms of "<<budget_<<" ms"<<endl;
+	track.step     = step;
+	track.settling = true;
+	return true;
+}
+
+
+
+void FrameGovernor::updateSettings()
+{
+	const SimulationStep& s = simulationLadder[simulation_.step];
+	const CaptureStep&    c = captureLadder[capture_.step];
+
+	settings_.solverIterations = s.solverIterations;
+	settings_.maxEmitters      = s.maxEmitters;
+	settings_.flowLevels       = c.flowLevels;
+	settings_.gridStepsDown    = max(s.gridStepsDown, c.gridStepsDown);
+
+	Profiler& profiler = getProfiler();
+	profiler.addEvent("governor simulation step", (float)simulation_.step);
+	profiler.addEvent("governor flow step",       (float)capture_.step);
+	profiler.addEvent("governor solver iterations", (float)settings_.solverIterations);
+	profiler.addEvent("governor max emitters",    (float)settings_.maxEmitters);
+	profiler.addEvent("governor flow levels",     (float)settings_.flowLevels);
+	profiler.addEvent("governor grid steps down", (float)settings_.gridStepsDown);
+}
+
+
+
+const FrameGovernor::Settings& FrameGovernor::getSettings()
+{
+	return settings_;
+}
+
+
+
+void FrameGovernor::describe(char* line)
+{
+	if (!enabled_) {
+		sprintf(line, "governor off");
+		return;
+	}
+	sprintf(line, "governor %4.1f ms: sim %d/%d %6.2f, flow %d/%d %6.2f", budget_,
+			simulation_.step, simulation_.stepCount - 1, min(simulation_.lastP90, 999.0f),
+			capture_.step, capture_.stepCount - 1, min(capture_.lastP90, 999.0f));
+}
+
+
+
+void FrameGovernor::describeSettings(char* line)
+{
+	sprintf(line, "  %d sweeps, %d emitters, %d flow levels, grid -%d", settings_.solverIterations,
+			settings_.maxEmitters, settings_.flowLevels, settings_.gridStepsDown);
+}
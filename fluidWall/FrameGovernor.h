@@ -0,0 +1,133 @@
+/**
+ * @file      FrameGovernor.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+/**
+ * Keeps the frame time within a budget by giving up some fluid fidelity when the wall is 
+ * busy, and taking it back once there is time to spare.
+ *
+ * Two costs are watched separately, because different settings relieve them:
+ * - the simulation step, relieved by fewer splash emitters, fewer relaxation sweeps and a
+ *   coarser grid, in that order,
+ * - the optical flow of the capture thread, relieved by fewer pyramid levels, then a 
+ *   coarser grid (the Kinect images have the size of the grid).
+ * Each cost has a ladder of settings from full quality to cheapest. The grid gets the 
+ * coarser of the two ladders' grids.
+ *
+ * The frame times are judged in windows of GOVERNOR_WINDOW frames by their 90th 
+ * percentile. A window over the budget moves its ladder one step down; RAISE_WINDOWS windows
+ * in a row below GOVERNOR_RAISE_FRACTION of the budget move it one step up. The gap between
+ * the two thresholds keeps the governor from flipping between neighbouring steps, and the 
+ * window after every change is ignored while the new settings settle in.
+ *
+ * Decisions are printed and written to the profiler's CSV file. The governor is not thread
+ * safe; fluidWall uses it on the simulation thread under simLock.
+ */
+class FrameGovernor
+{
+public:
+	const static int GOVERNOR_WINDOW = 30;	//frames per decision
+	const static int RAISE_WINDOWS   = 4;	//calm windows before a step up
+	const static int DESCRIPTION_SIZE = 64;	//longest describe() line, with the terminator
+
+	/**
+	 * What the application should use. gridStepsDown counts the grid resolutions below the
+	 * one the user selected.
+	 */
+	struct Settings
+	{
+		int solverIterations;	//relaxation sweeps per linear solve
+		int maxEmitters;		//live splash emitters
+		int flowLevels;			//optical flow pyramid levels
+		int gridStepsDown;
+	};
+
+	/**
+	 * @param budgetMilliseconds   longest acceptable frame, e.g. 16.6 for 60 Hz projectors
+	 */
+	FrameGovernor(float budgetMilliseconds);
+
+	/**
+	 * Turns the governor on or off. Off, and right after being turned on, it asks for the 
+	 * full quality settings.
+	 */
+	void setEnabled(bool enabled);
+	bool isEnabled();
+
+	float getBudget();
+
+	/**
+	 * Adds the time of one simulation step, or of the optical flow of one capture frame.
+	 * @return   true if the settings changed
+	 */
+	bool addSimulationFrame(float milliseconds);
+	bool addCaptureFrame(float milliseconds);
+
+	const Settings& getSettings();
+
+	/**
+	 * Writes one line about the ladders, e.g. for the profiler overlay: their steps and the
+	 * 90th percentiles of their last windows.
+	 *
+	 * @param line   receives the text, DESCRIPTION_SIZE characters at most
+	 */
+	void describe(char* line);
+
+	/**
+	 * Writes one line about the current settings, like describe().
+	 */
+	void describeSettings(char* line);
+
+private:
+	/**
+	 * One ladder and the frames of its current window.
+	 */
+	struct Track
+	{
+		const char* name;
+		int   step, stepCount;
+		int   frames;
+		int   calmWindows;
+		bool  settling;
+		float lastP90;
+		float samples[GOVERNOR_WINDOW];
+	};
+
+	bool     enabled_;
+	float    budget_;
+	Track    simulation_, capture_;
+	Settings settings_;
+
+	void initTrack(Track& track, const char* name, int stepCount);
+
+	/**
+	 * Adds a frame to a track and moves it along its ladder at the end of a window.
+	 * @return   true if the step changed
+	 */
+	bool addFrame(Track& track, float milliseconds);
+
+	/**
+	 * Derives settings_ from the steps of both ladders.
+	 */
+	void updateSettings();
+};
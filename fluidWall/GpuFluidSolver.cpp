@@ -0,0 +1,970 @@
+/**
+ * @file      GpuFluidSolver.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "GpuFluidSolver.h"
+#include <GL/freeglut_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+#define ROW_WIDTH width_+2
+#define SWAP_TEX(x0,x) { GLuint tmp=x0; x0=x; x=tmp; }
+
+#define MAX_TEXTURE_UNITS    3  //most samplers used by any pass
+
+//OpenGL 2.0+ tokens that the Windows OpenGL 1.1 headers do not define
+#ifndef APIENTRY
+	#define APIENTRY
+#endif
+#ifndef GL_FRAGMENT_SHADER
+	#define GL_FRAGMENT_SHADER     0x8B30
+	#define GL_VERTEX_SHADER       0x8B31
+	#define GL_COMPILE_STATUS      0x8B81
+	#define GL_LINK_STATUS         0x8B82
+	#define GL_INFO_LOG_LENGTH     0x8B84
+#endif
+#ifndef GL_TEXTURE0
+	#define GL_TEXTURE0            0x84C0
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+	#define GL_CLAMP_TO_EDGE       0x812F
+#endif
+#ifndef GL_FRAMEBUFFER
+	#define GL_FRAMEBUFFER         0x8D40
+	#define GL_COLOR_ATTACHMENT0   0x8CE0
+	#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+	#define GL_FRAMEBUFFER_BINDING 0x8CA6
+#endif
+#ifndef GL_R32F
+	#define GL_R32F                0x822E
+#endif
+
+typedef GLuint (APIENTRY *CreateShaderFunc)        (GLenum type);
+typedef void   (APIENTRY *ShaderSourceFunc)        (GLuint shader, GLsizei count, const char** source, const GLint* length);
+typedef void   (APIENTRY *CompileShaderFunc)       (GLuint shader);
+typedef void   (APIENTRY *GetShaderivFunc)         (GLuint shader, GLenum pname, GLint* params);
+typedef void   (APIENTRY *GetShaderInfoLogFunc)    (GLuint shader, GLsizei size, GLsizei* length, char* log);
+typedef void   (APIENTRY *DeleteShaderFunc)        (GLuint shader);
+typedef GLuint (APIENTRY *CreateProgramFunc)       (void);
+typedef void   (APIENTRY *AttachShaderFunc)        (GLuint program, GLuint shader);
+typedef void   (APIENTRY *LinkProgramFunc)         (GLuint program);
+typedef void   (APIENTRY *GetProgramivFunc)        (GLuint program, GLenum pname, GLint* params);
+typedef void   (APIENTRY *GetProgramInfoLogFunc)   (GLuint program, GLsizei size, GLsizei* length, char* log);
+typedef void   (APIENTRY *DeleteProgramFunc)       (GLuint program);
+typedef void   (APIENTRY *UseProgramFunc)          (GLuint program);
+typedef GLint  (APIENTRY *GetUniformLocationFunc)  (GLuint program, const char* name);
+typedef void   (APIENTRY *Uniform1iFunc)           (GLint location, GLint value);
+typedef void   (APIENTRY *Uniform1fFunc)           (GLint location, GLfloat value);
+typedef void   (APIENTRY *ActiveTextureFunc)       (GLenum texture);
+typedef void   (APIENTRY *GenFramebuffersFunc)     (GLsizei n, GLuint* framebuffers);
+typedef void   (APIENTRY *DeleteFramebuffersFunc)  (GLsizei n, const GLuint* framebuffers);
+typedef void   (APIENTRY *BindFramebufferFunc)     (GLenum target, GLuint framebuffer);
+typedef void   (APIENTRY *FramebufferTexture2DFunc)(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+typedef GLenum (APIENTRY *CheckFramebufferStatusFunc)(GLenum target);
+
+/**
+ * Entry points loaded at runtime, opengl32.lib only exports OpenGL 1.1.
+ */
+static struct
+{
+	bool                       loaded;
+	CreateShaderFunc           CreateShader;
+	ShaderSourceFunc           ShaderSource;
+	CompileShaderFunc          CompileShader;
+	GetShaderivFunc            GetShaderiv;
+	GetShaderInfoLogFunc       GetShaderInfoLog;
+	DeleteShaderFunc           DeleteShader;
+	CreateProgramFunc          CreateProgram;
+	AttachShaderFunc           AttachShader;
+	LinkProgramFunc            LinkProgram;
+	GetProgramivFunc           GetProgramiv;
+	GetProgramInfoLogFunc      GetProgramInfoLog;
+	DeleteProgramFunc          DeleteProgram;
+	UseProgramFunc             UseProgram;
+	GetUniformLocationFunc     GetUniformLocation;
+	Uniform1iFunc              Uniform1i;
+	Uniform1fFunc              Uniform1f;
+	ActiveTextureFunc          ActiveTexture;
+	GenFramebuffersFunc        GenFramebuffers;
+	DeleteFramebuffersFunc     DeleteFramebuffers;
+	BindFramebufferFunc        BindFramebuffer;
+	FramebufferTexture2DFunc   FramebufferTexture2D;
+	CheckFramebufferStatusFunc CheckFramebufferStatus;
+} gl;
+
+
+
+/**
+ * Looks up an entry point under its core, ARB and EXT names.
+ */
+static GLUTproc getProc(const char* name)
+{
+	static const char* suffixes[] = { "", "ARB", "EXT" };
+	char fullName[64];
+
+	for (int i = 0; i < 3; i++) {
+		strcpy(fullName, name);
+		strcat(fullName, suffixes[i]);
+		GLUTproc proc = glutGetProcAddress(fullName);
+		if (proc)
+			return proc;
+	}
+	return NULL;
+}
+
+#define LOAD_GL(type, name) gl.name = (type)getProc("gl" #name); if (!gl.name) return false;
+
+static bool loadGlFunctions()
+{
+	if (gl.loaded)
+		return true;
+
+	LOAD_GL(CreateShaderFunc,           CreateShader);
+	LOAD_GL(ShaderSourceFunc,           ShaderSource);
+	LOAD_GL(CompileShaderFunc,          CompileShader);
+	LOAD_GL(GetShaderivFunc,            GetShaderiv);
+	LOAD_GL(GetShaderInfoLogFunc,       GetShaderInfoLog);
+	LOAD_GL(DeleteShaderFunc,           DeleteShader);
+	LOAD_GL(CreateProgramFunc,          CreateProgram);
+	LOAD_GL(AttachShaderFunc,           AttachShader);
+	LOAD_GL(LinkProgramFunc,            LinkProgram);
+	LOAD_GL(GetProgramivFunc,           GetProgramiv);
+	LOAD_GL(GetProgramInfoLogFunc,      GetProgramInfoLog);
+	LOAD_GL(DeleteProgramFunc,          DeleteProgram);
+	LOAD_GL(UseProgramFunc,             UseProgram);
+	LOAD_GL(GetUniformLocationFunc,     GetUniformLocation);
+	LOAD_GL(Uniform1iFunc,              Uniform1i);
+	LOAD_GL(Uniform1fFunc,              Uniform1f);
+	LOAD_GL(ActiveTextureFunc,          ActiveTexture);
+	LOAD_GL(GenFramebuffersFunc,        GenFramebuffers);
+	LOAD_GL(DeleteFramebuffersFunc,     DeleteFramebuffers);
+	LOAD_GL(BindFramebufferFunc,        BindFramebuffer);
+	LOAD_GL(FramebufferTexture2DFunc,   FramebufferTexture2D);
+	LOAD_GL(CheckFramebufferStatusFunc, CheckFramebufferStatus);
+
+	gl.loaded = true;
+	return true;
+}
+
+
+
+/*
+  ----------------------------------------------------------------------
+   shaders
+  ----------------------------------------------------------------------
+*/
+
+//every pass draws one quad over the whole (width+2)*(height+2) target
+static const char* VERTEX_SHADER =
+	"#version 120\n"
+	"void main() { gl_Position = gl_Vertex; }\n";
+
+//cell coordinates are integers matching IX(i, j); texel centers are at cell + 0.5
+static const char* COMMON_SHADER =
+	"#version 120\n"
+	"uniform float W;  // cells per row, including buffer cells\n"
+	"uniform float H;  // rows, including buffer cells\n"
+	"uniform float N;  // cells per unit length, FluidSolver::getCellsPerUnit()\n"
+	"vec2  cell()                      { return floor(gl_FragCoord.xy); }\n"
+	"vec2  lastCell()                  { return vec2(W, H) - 2.0; }\n"
+	"float at(sampler2D t, vec2 c)     { return texture2D(t, (c + 0.5) / vec2(W, H)).r; }\n"
+	"bool  isInterior(vec2 c)          { return all(greaterThanEqual(c, vec2(1.0))) && all(lessThanEqual(c, lastCell())); }\n";
+
+static const char* ADD_SOURCE_SHADER =
+	"uniform sampler2D x, s;\n"
+	"uniform float dt;\n"
+	"void main() {\n"
+	"	vec2 c = cell();\n"
+	"	gl_FragColor = vec4(at(x, c) + dt * at(s, c));\n"
+	"}\n";
+
+//relaxes the cells with (i + j) % 2 == color, keeps the others
+static const char* RELAX_SHADER =
+	"uniform sampler2D x, x0;\n"
+	"uniform float a, invC, color;\n"
+	"void main() {\n"
+	"	vec2  c     = cell();\n"
+	"	float value = at(x, c);\n"
+	"	if (isInterior(c) && mod(c.x + c.y, 2.0) == color)\n"
+	"		value = (at(x0, c) + a * (at(x, c - vec2(1.0, 0.0)) + at(x, c + vec2(1.0, 0.0)) +\n"
+	"		                          at(x, c - vec2(0.0, 1.0)) + at(x, c + vec2(0.0, 1.0)))) * invC;\n"
+	"	gl_FragColor = vec4(value);\n"
+	"}\n";
+
+//gather form of FluidSolver::setBounds(). The CPU version overwrites every value that a
+//fluid cell scatters into a boundary cell when it reaches that boundary cell, so each
+//boundary cell only depends on its right and top neighbors.
+static const char* SET_BOUNDS_SHADER =
+	"uniform sampler2D x, bounds;\n"
+	"uniform float flag;\n"
+	"#define su ((flag == 1.0) ? -1.0 : 1.0)  // sign of u across vertical walls\n"
+	"#define sv ((flag == 2.0) ? -1.0 : 1.0)  // sign of v across horizontal walls\n"
+	"bool  isBound(vec2 c) { return at(bounds, c) > 0.5; }\n"
+	"float walled(vec2 c) {\n"
+	"	vec2 inner = clamp(c, vec2(1.0), lastCell());\n"
+	"	bool xWall = c.x != inner.x;\n"
+	"	bool yWall = c.y != inner.y;\n"
+	"	if (xWall && yWall) return 0.5 * (su + sv) * at(x, inner);\n"
+	"	if (xWall)          return su * at(x, inner);\n"
+	"	if (yWall)          return sv * at(x, inner);\n"
+	"	return at(x, c);\n"
+	"}\n"
+	"float boundValue(vec2 c) {\n"
+	"	float value = 0.0;\n"
+	"	if (!isBound(c + vec2(0.0, 1.0))) value = sv * walled(c + vec2(0.0, 1.0));\n"
+	"	if (!isBound(c + vec2(1.0, 0.0))) value = su * walled(c + vec2(1.0, 0.0));\n"
+	"	return value;\n"
+	"}\n"
+	"void main() {\n"
+	"	vec2  c     = cell();\n"
+	"	float value = walled(c);\n"
+	"	if (isInterior(c) && isBound(c)) {\n"
+	"		vec2 r = vec2(1.0, 0.0), u = vec2(0.0, 1.0);\n"
+	"		bool br = isBound(c + r), bl = isBound(c - r), bu = isBound(c + u), bd = isBound(c - u);\n"
+	"		value = boundValue(c);\n"
+	"		//corners of objects\n"
+	"		if      (br && bu && !isBound(c + r + u)) value = 0.5 * (boundValue(c + r) + boundValue(c + u));\n"
+	"		else if (br && bd && !isBound(c + r - u)) value = 0.5 * (boundValue(c + r) + boundValue(c - u));\n"
+	"		else if (bl && bd && !isBound(c - r - u)) value = 0.5 * (boundValue(c - r) + boundValue(c - u));\n"
+	"		else if (bl && bu && !isBound(c - r + u)) value = 0.5 * (boundValue(c - r) + boundValue(c + u));\n"
+	"	}\n"
+	"	gl_FragColor = vec4(value);\n"
+	"}\n";
+
+static const char* ADVECT_SHADER =
+	"uniform sampler2D d0, u, v;\n"
+	"uniform float dt0;\n"
+	"void main() {\n"
+	"	vec2 c = cell();\n"
+	"	if (!isInterior(c)) { gl_FragColor = vec4(0.0); return; }\n"
+	"	vec2 p  = clamp(c - dt0 * vec2(at(u, c), at(v, c)), vec2(0.5), lastCell() + 0.5);\n"
+	"	vec2 p0 = floor(p);\n"
+	"	vec2 s  = p - p0;\n"
+	"	float left  = mix(at(d0, p0),                  at(d0, p0 + vec2(0.0, 1.0)), s.y);\n"
+	"	float right = mix(at(d0, p0 + vec2(1.0, 0.0)), at(d0, p0 + vec2(1.0, 1.0)), s.y);\n"
+	"	gl_FragColor = vec4(mix(left, right, s.x));\n"
+	"}\n";
+
+static const char* DIVERGENCE_SHADER =
+	"uniform sampler2D u, v;\n"
+	"void main() {\n"
+	"	vec2 c = cell();\n"
+	"	if (!isInterior(c)) { gl_FragColor = vec4(0.0); return; }\n"
+	"	gl_FragColor = vec4(-0.5 / N * (at(u, c + vec2(1.0, 0.0)) - at(u, c - vec2(1.0, 0.0)) +\n"
+	"	                                at(v, c + vec2(0.0, 1.0)) - at(v, c - vec2(0.0, 1.0))));\n"
+	"}\n";
+
+//axis 0 subtracts the horizontal gradient from u, axis 1 the vertical gradient from v
+static const char* SUBTRACT_GRADIENT_SHADER =
+	"uniform sampler2D x, p;\n"
+	"uniform float axis;\n"
+	"void main() {\n"
+	"	vec2  c     = cell();\n"
+	"	vec2  dir   = (axis == 0.0) ? vec2(1.0, 0.0) : vec2(0.0, 1.0);\n"
+	"	float value = at(x, c);\n"
+	"	if (isInterior(c))\n"
+	"		value -= 0.5 * N * (at(p, c + dir) - at(p, c - dir));\n"
+	"	gl_FragColor = vec4(value);\n"
+	"}\n";
+
+//mask covers cells 1..width and 1..height, buffer cells are never boundaries
+static const char* IMPORT_BOUNDS_SHADER =
+	"uniform sampler2D mask;\n"
+	"void main() {\n"
+	"	vec2 c = cell();\n"
+	"	bool isBound = isInterior(c) && texture2D(mask, (c - 0.5) / lastCell()).r > 0.0;\n"
+	"	gl_FragColor = vec4(isBound ? 1.0 : 0.0);\n"
+	"}\n";
+
+
+
+/**
+ * Compiles one shader stage. Prints the info log on failure.
+ * @return shader name, or 0 on failure
+ */
+static GLuint compileShader(GLenum type, const char* header, const char* body)
+{
+	const char* sources[2] = { header, body };
+	GLuint shader = gl.CreateShader(type);
+	gl.ShaderSource(shader, body ? 2 : 1, sources, NULL);
+	gl.CompileShader(shader);
+
+	GLint status = 0;
+	gl.GetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		char log[2048];
+		gl.GetShaderInfoLog(shader, sizeof(log), NULL, log);
+		cout<<"ERROR: GPU solver shader failed to compile:"<<endl<<log<<endl;
+		gl.DeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+
+
+/**
+ * Links a pass program from the shared vertex shader and a fragment shader body.
+ * @return program name, or 0 on failure
+ */
+static GLuint linkProgram(const char* fragmentBody)
+{
+	GLuint vertex   = compileShader(GL_VERTEX_SHADER,   VERTEX_SHADER, NULL);
+	GLuint fragment = compileShader(GL_FRAGMENT_SHADER, COMMON_SHADER, fragmentBody);
+	if (!vertex || !fragment)
+		return 0;
+
+	GLuint program = gl.CreateProgram();
+	gl.AttachShader(program, vertex);
+	gl.AttachShader(program, fragment);
+	gl.LinkProgram(program);
+
+	//shaders are only flagged for deletion, the program keeps them alive
+	gl.DeleteShader(vertex);
+	gl.DeleteShader(fragment);
+
+	GLint status = 0;
+	gl.GetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		char log[2048];
+		gl.GetProgramInfoLog(program, sizeof(log), NULL, log);
+		cout<<"ERROR: GPU solver program failed to link:"<<endl<<log<<endl;
+		gl.DeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+
+
+/**
+ * Returns true if the space separated extension list contains name.
+ */
+static bool hasExtension(const char* extensions, const char* name)
+{
+	size_t length = strlen(name);
+	for (const char* p = extensions; p && (p = strstr(p, name)) != NULL; p += length)
+		if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+			return true;
+	return false;
+}
+
+
+
+/*
+  ----------------------------------------------------------------------
+   GpuFluidSolver
+  ----------------------------------------------------------------------
+*/
+
+GpuFluidSolver::GpuFluidSolver(int N, float dt, float diff, float visc) :
+	FluidSolver(N, dt, diff, visc)
+{
+	createResources();
+}
+
+
+
+GpuFluidSolver::GpuFluidSolver(int width, int height, float dt, float diff, float visc) :
+	FluidSolver(width, height, dt, diff, visc)
+{
+	createResources();
+}
+
+
+
+GpuFluidSolver::~GpuFluidSolver(void)
+{
+	if (!gl.loaded)
+		return;
+
+	GLuint textures[] = { u_tex_, v_tex_, u_prev_tex_, v_prev_tex_, dens_tex_, dens_prev_tex_,
+	                      scratch_tex_, bounds_tex_ };
+	glDeleteTextures(8, textures);
+
+	if (framebuffer_)
+		gl.DeleteFramebuffers(1, &framebuffer_);
+	for (int i = 0; i < PROGRAM_COUNT; i++)
+		if (programs_[i])
+			gl.DeleteProgram(programs_[i]);
+}
+
+
+
+bool GpuFluidSolver::isSupported()
+{
+	const char* version    = (const char*)glGetString(GL_VERSION);
+	const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+	if (!version)
+		return false;
+
+	bool isGl3 = atoi(version) >= 3;
+	bool isGl2 = atoi(version) >= 2;
+	bool hasFeatures = isGl3 ||
+		(isGl2 && hasExtension(extensions, "GL_ARB_texture_float") &&
+		          hasExtension(extensions, "GL_ARB_texture_rg") &&
+		         (hasExtension(extensions, "GL_ARB_framebuffer_object") ||
+		          hasExtension(extensions, "GL_EXT_framebuffer_object")));
+
+	return hasFeatures && loadGlFunctions();
+}
+
+
+
+bool GpuFluidSolver::isValid()
+{
+	return valid_;
+}
+
+
+
+void GpuFluidSolver::setBoundsTexture(GLuint texture)
+{
+	external_bounds_tex_ = texture;
+	boundsDirty_         = true;
+}
+
+
+
+GLuint GpuFluidSolver::getDensityTexture()
+{
+	return dens_tex_;
+}
+
+
+
+GLuint GpuFluidSolver::getHorzVelocityTexture()
+{
+	return u_tex_;
+}
+
+
+
+GLuint GpuFluidSolver::getVertVelocityTexture()
+{
+	return v_tex_;
+}
+
+
+
+GLuint GpuFluidSolver::getBoundsTexture()
+{
+	return bounds_tex_;
+}
+
+
+
+void GpuFluidSolver::setBoundAt(int x, int y, bool isBound)
+{
+	FluidSolver::setBoundAt(x, y, isBound);
+	boundsDirty_ = true;
+}
+
+
+
+void GpuFluidSolver::setBoundsFromMask(const unsigned char* mask, size_t step, int cols, int rows,
+									   int offsetX, int offsetY)
+{
+	FluidSolver::setBoundsFromMask(mask, step, cols, rows, offsetX, offsetY);
+	boundsDirty_ = true;
+}
+
+
+
+bool GpuFluidSolver::isBoundAt(int x, int y)
+{
+	readbackBounds();
+	return FluidSolver::isBoundAt(x, y);
+}
+
+
+
+float GpuFluidSolver::getDensityAt(int x, int y)
+{
+	readback();
+	return FluidSolver::getDensityAt(x, y);
+}
+
+
+
+float GpuFluidSolver::getVertVelocityAt(int x, int y)
+{
+	readback();
+	return FluidSolver::getVertVelocityAt(x, y);
+}
+
+
+
+float GpuFluidSolver::getHorzVelocityAt(int x, int y)
+{
+	readback();
+	return FluidSolver::getHorzVelocityAt(x, y);
+}
+
+
+
+void GpuFluidSolver::update()
+{
+	if (!valid_) {
+		FluidSolver::update();
+		return;
+	}
+
+	//sources were collected on the CPU; the prev textures are free to take them
+	uploadTexture(u_prev_tex_,    u_prev_);
+	uploadTexture(v_prev_tex_,    v_prev_);
+	uploadTexture(dens_prev_tex_, dens_prev_);
+
+	beginPasses();
+		uploadBounds();
+		computeDensityStepGpu(dens_tex_, dens_prev_tex_, u_tex_, v_tex_);
+		computeVelocityStepGpu(u_tex_, v_tex_, u_prev_tex_, v_prev_tex_);
+	endPasses();
+
+	pressureIterations_ = 2 * solverIterations_;
+	readbackPending_    = true;
+
+	//reset u_prev_, v_prev_, and dens_prev
+	for (int i=0 ; i < getSize() ; i++)
+		u_prev_[i] = v_prev_[i] = dens_prev_[i] = 0.0f;
+}
+
+
+
+void GpuFluidSolver::resize(int width, int height)
+{
+	if (width == width_ && height == height_)
+		return;
+
+	//the CPU arrays resample the current state, then the textures take it over
+	readback();
+	readbackBounds();
+	FluidSolver::resize(width, height);
+	boundsScratch_.assign(getSize(), 0.0f);
+	boundsDirty_ = true;
+
+	if (!valid_)
+		return;
+
+	GLuint textures[] = { u_tex_, v_tex_, u_prev_tex_, v_prev_tex_, dens_tex_, dens_prev_tex_,
+	                      scratch_tex_, bounds_tex_ };
+	for (int i = 0; i < 8; i++)
+		sizeTexture(textures[i]);
+	setGridUniforms();
+
+	uploadTexture(u_tex_,    u_);
+	uploadTexture(v_tex_,    v_);
+	uploadTexture(dens_tex_, dens_);
+	beginPasses();
+		clearTexture(u_prev_tex_);
+		clearTexture(v_prev_tex_);
+		clearTexture(dens_prev_tex_);
+		clearTexture(scratch_tex_);
+	endPasses();
+}
+
+
+
+void GpuFluidSolver::reset()
+{
+	FluidSolver::reset();
+	boundsDirty_           = true;
+	readbackPending_       = false;
+	boundsReadbackPending_ = false;
+
+	if (!valid_)
+		return;
+
+	GLuint textures[] = { u_tex_, v_tex_, u_prev_tex_, v_prev_tex_, dens_tex_, dens_prev_tex_,
+	                      scratch_tex_, bounds_tex_ };
+	beginPasses();
+		for (int i = 0; i < 8; i++)
+			clearTexture(textures[i]);
+	endPasses();
+}
+
+
+
+///protected functions
+void GpuFluidSolver::createResources()
+{
+	framebuffer_ = 0;
+	u_tex_ = v_tex_ = u_prev_tex_ = v_prev_tex_ = dens_tex_ = dens_prev_tex_ = 0;
+	scratch_tex_ = bounds_tex_ = external_bounds_tex_ = 0;
+	for (int i = 0; i < PROGRAM_COUNT; i++)
+		programs_[i] = 0;
+
+	boundsDirty_           = true;
+	readbackPending_       = false;
+	boundsReadbackPending_ = false;
+	boundsScratch_.assign(getSize(), 0.0f);
+
+	valid_ = isSupported() && createPrograms();
+	if (valid_) {
+		u_tex_         = createTexture();
+		v_tex_         = createTexture();
+		u_prev_tex_    = createTexture();
+		v_prev_tex_    = createTexture();
+		dens_tex_      = createTexture();
+		dens_prev_tex_ = createTexture();
+		scratch_tex_   = createTexture();
+		bounds_tex_    = createTexture();
+
+		gl.GenFramebuffers(1, &framebuffer_);
+
+		GLint previous = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+		gl.BindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+		gl.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scratch_tex_, 0);
+		valid_ = (gl.CheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+		gl.BindFramebuffer(GL_FRAMEBUFFER, previous);
+
+		if (!valid_)
+			cout<<"ERROR: GPU solver float textures are not renderable"<<endl;
+	}
+
+	if (!valid_)
+		cout<<"GPU solver unavailable, using the CPU solver"<<endl;
+
+	reset();
+}
+
+
+
+bool GpuFluidSolver::createPrograms()
+{
+	const char* bodies[PROGRAM_COUNT] = { ADD_SOURCE_SHADER, RELAX_SHADER, SET_BOUNDS_SHADER,
+	                                      ADVECT_SHADER, DIVERGENCE_SHADER,
+	                                      SUBTRACT_GRADIENT_SHADER, IMPORT_BOUNDS_SHADER };
+	for (int i = 0; i < PROGRAM_COUNT; i++) {
+		programs_[i] = linkProgram(bodies[i]);
+		if (!programs_[i])
+			return false;
+	}
+	setGridUniforms();
+	return true;
+}
+
+
+
+void GpuFluidSolver::setGridUniforms()
+{
+	for (int i = 0; i < PROGRAM_COUNT; i++) {
+		gl.UseProgram(programs_[i]);
+		setUniform((Program)i, "W", (float)(ROW_WIDTH));
+		setUniform((Program)i, "H", (float)(height_ + 2));
+		setUniform((Program)i, "N", getCellsPerUnit());
+	}
+	gl.UseProgram(0);
+}
+
+
+
+GLuint GpuFluidSolver::createTexture()
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	sizeTexture(texture);
+	return texture;
+}
+
+
+
+void GpuFluidSolver::sizeTexture(GLuint texture)
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, ROW_WIDTH, height_ + 2, 0, GL_RED, GL_FLOAT, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+
+
+void GpuFluidSolver::uploadTexture(GLuint texture, const float* data)
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, ROW_WIDTH, height_ + 2, GL_RED, GL_FLOAT, data);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+
+
+void GpuFluidSolver::beginPasses()
+{
+	glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT);
+	glDisable(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glViewport(0, 0, ROW_WIDTH, height_ + 2);
+	gl.BindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+}
+
+
+
+void GpuFluidSolver::endPasses()
+{
+	gl.UseProgram(0);
+	gl.BindFramebuffer(GL_FRAMEBUFFER, 0);
+	glPopAttrib();
+}
+
+
+
+void GpuFluidSolver::runPass(Program program, GLuint& target)
+{
+	gl.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scratch_tex_, 0);
+
+	glBegin(GL_QUADS);
+		glVertex2f(-1.0f, -1.0f);
+		glVertex2f( 1.0f, -1.0f);
+		glVertex2f( 1.0f,  1.0f);
+		glVertex2f(-1.0f,  1.0f);
+	glEnd();
+
+	//the old target becomes the next scratch texture; unbind it so that it is never
+	//sampled while being rendered into
+	for (int unit = MAX_TEXTURE_UNITS - 1; unit >= 0; unit--) {
+		gl.ActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	SWAP_TEX(target, scratch_tex_);
+}
+
+
+
+void GpuFluidSolver::clearTexture(GLuint texture)
+{
+	gl.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+
+
+void GpuFluidSolver::bindTexture(Program program, const char* sampler, int unit, GLuint texture)
+{
+	gl.ActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	gl.Uniform1i(gl.GetUniformLocation(programs_[program], sampler), unit);
+}
+
+
+
+void GpuFluidSolver::setUniform(Program program, const char* name, float value)
+{
+	gl.Uniform1f(gl.GetUniformLocation(programs_[program], name), value);
+}
+
+
+
+void GpuFluidSolver::uploadBounds()
+{
+	if (external_bounds_tex_) {
+		gl.UseProgram(programs_[IMPORT_BOUNDS]);
+		bindTexture(IMPORT_BOUNDS, "mask", 0, external_bounds_tex_);
+		runPass(IMPORT_BOUNDS, bounds_tex_);
+		boundsReadbackPending_ = true;
+		return;
+	}
+
+	if (!boundsDirty_)
+		return;
+
+	for (int i = 0; i < getSize(); i++)
+		boundsScratch_[i] = bounds_[i] ? 1.0f : 0.0f;
+
+	uploadTexture(bounds_tex_, &boundsScratch_[0]);
+	boundsDirty_ = false;
+}
+
+
+
+void GpuFluidSolver::readback()
+{
+	if (!valid_ || !readbackPending_)
+		return;
+
+	GLint previous = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+	gl.BindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	GLuint textures[] = { u_tex_, v_tex_, dens_tex_ };
+	float* arrays[]   = { u_,     v_,     dens_     };
+	for (int i = 0; i < 3; i++) {
+		gl.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+		glReadPixels(0, 0, ROW_WIDTH, height_ + 2, GL_RED, GL_FLOAT, arrays[i]);
+	}
+
+	gl.BindFramebuffer(GL_FRAMEBUFFER, previous);
+	readbackPending_ = false;
+}
+
+
+
+void GpuFluidSolver::readbackBounds()
+{
+	if (!valid_ || !boundsReadbackPending_)
+		return;
+
+	GLint previous = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+	gl.BindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+	gl.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bounds_tex_, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, ROW_WIDTH, height_ + 2, GL_RED, GL_FLOAT, &boundsScratch_[0]);
+	gl.BindFramebuffer(GL_FRAMEBUFFER, previous);
+
+	for (int i = 0; i < getSize(); i++)
+		writeBound(i, boundsScratch_[i] > 0.5f);
+	boundsReadbackPending_ = false;
+}
+
+
+
+void GpuFluidSolver::addSourceGpu(GLuint& x, GLuint s)
+{
+	gl.UseProgram(programs_[ADD_SOURCE]);
+	setUniform(ADD_SOURCE, "dt", dt_);
+	bindTexture(ADD_SOURCE, "x", 0, x);
+	bindTexture(ADD_SOURCE, "s", 1, s);
+	runPass(ADD_SOURCE, x);
+}
+
+
+
+void GpuFluidSolver::setBoundsGpu(int boundsFlag, GLuint& x)
+{
+	gl.UseProgram(programs_[SET_BOUNDS]);
+	setUniform(SET_BOUNDS, "flag", (float)boundsFlag);
+	bindTexture(SET_BOUNDS, "x",      0, x);
+	bindTexture(SET_BOUNDS, "bounds", 1, bounds_tex_);
+	runPass(SET_BOUNDS, x);
+}
+
+
+
+void GpuFluidSolver::linearSolveGpu(int boundsFlag, GLuint& x, GLuint x0, float a, float c)
+{
+	for (int k = 0; k < solverIterations_; k++) {
+		for (int color = 0; color < 2; color++) {
+			gl.UseProgram(programs_[RELAX]);
+			setUniform(RELAX, "a",     a);
+			setUniform(RELAX, "invC",  1.0f / c);
+			setUniform(RELAX, "color", (float)color);
+			bindTexture(RELAX, "x",  0, x);
+			bindTexture(RELAX, "x0", 1, x0);
+			runPass(RELAX, x);
+		}
+		// factor in boundary conditions with each solution iteration
+		setBoundsGpu(boundsFlag, x);
+	}
+}
+
+
+
+void GpuFluidSolver::diffuseGpu(int boundsFlag, GLuint& x, GLuint x0)
+{
+	float diffusionPerCell = dt_ * diff_ * getCellsPerUnit() * getCellsPerUnit();
+	linearSolveGpu(boundsFlag, x, x0, diffusionPerCell, 1+4*diffusionPerCell);
+}
+
+
+
+void GpuFluidSolver::advectGpu(int boundsFlag, GLuint& d, GLuint d0, GLuint u, GLuint v)
+{
+	gl.UseProgram(programs_[ADVECT]);
+	setUniform(ADVECT, "dt0", dt_ * getCellsPerUnit());
+	bindTexture(ADVECT, "d0", 0, d0);
+	bindTexture(ADVECT, "u",  1, u);
+	bindTexture(ADVECT, "v",  2, v);
+	runPass(ADVECT, d);
+
+	setBoundsGpu(boundsFlag, d);
+}
+
+
+
+void GpuFluidSolver::projectGpu(GLuint& u, GLuint& v, GLuint& p, GLuint& div)
+{
+	gl.UseProgram(programs_[DIVERGENCE]);
+	bindTexture(DIVERGENCE, "u", 0, u);
+	bindTexture(DIVERGENCE, "v", 1, v);
+	runPass(DIVERGENCE, div);
+	setBoundsGpu(0, div);
+
+	//a zero field already satisfies setBounds(0, p)
+	clearTexture(p);
+
+	linearSolveGpu(0, p, div, 1, 4);
+
+	GLuint* velocities[] = { &u, &v };
+	for (int axis = 0; axis < 2; axis++) {
+		gl.UseProgram(programs_[SUBTRACT_GRADIENT]);
+		setUniform(SUBTRACT_GRADIENT, "axis", (float)axis);
+		bindTexture(SUBTRACT_GRADIENT, "x", 0, *velocities[axis]);
+		bindTexture(SUBTRACT_GRADIENT, "p", 1, p);
+		runPass(SUBTRACT_GRADIENT, *velocities[axis]);
+	}
+
+	//set boundaries for velocity
+	setBoundsGpu(1, u);
+	setBoundsGpu(2, v);
+}
+
+
+
+void GpuFluidSolver::computeDensityStepGpu(GLuint& x, GLuint& x0, GLuint u, GLuint v)
+{
+	addSourceGpu(x, x0);
+	SWAP_TEX(x0, x);
+	diffuseGpu(0, x, x0);
+	SWAP_TEX(x0, x);
+	advectGpu(0, x, x0, u, v);
+}
+
+
+
+void GpuFluidSolver::computeVelocityStepGpu(GLuint& u, GLuint& v, GLuint& u0, GLuint& v0)
+{
+	addSourceGpu(u, u0);
+	addSourceGpu(v, v0);
+	//diffuse horizontal
+	SWAP_TEX(u0, u);
+	diffuseGpu(1, u, u0);
+
+	//diffuse vertical
+	SWAP_TEX(v0, v);
+	diffuseGpu(2, v, v0);
+	projectGpu(u, v, u0, v0);
+	SWAP_TEX(u0, u);
+	SWAP_TEX(v0, v);
+
+	//advect velocities
+	advectGpu(1, u, u0, u0, v0);
+	advectGpu(2, v, v0, u0, v0);
+	projectGpu(u, v, u0, v0);
+}
@@ -0,0 +1,236 @@
+/**
+ * @file      GpuFluidSolver.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+#include <GL/glut.h>
+#include "FluidSolver.h"
+
+/**
+ * FluidSolver that runs the Stable Fluids steps as GLSL fragment shader passes.
+ *
+ * u, v, density and bounds live in (width+2)*(height+2) textures. Texel (i, j) holds cell IX(i, j),
+ * so the CPU arrays of FluidSolver can be uploaded and read back without reordering.
+ * Every pass renders into a scratch texture which is then swapped with its destination,
+ * the same way the CPU solver swaps array pointers.
+ *
+ * Sources added with add*At() are collected in the CPU arrays and uploaded once per
+ * update(). Density, velocity and bounds are only read back when one of the accessors is
+ * called after an update; renderers should use the get*Texture() accessors instead.
+ *
+ * The linear solver is red-black Gauss-Seidel, one pass per color. The multigrid, SIMD and
+ * advection scheme settings of FluidSolver do not apply; advection is semi-Lagrangian.
+ *
+ * An OpenGL context must be current for the constructor, update(), reset(), the accessors
+ * and the destructor. If the context does not support shaders, float textures and
+ * framebuffer objects, isValid() returns false and update() runs on the CPU instead.
+ */
+class GpuFluidSolver :
+	public FluidSolver
+{
+public:
+	/**
+	 * Parameter constructor. Compiles the shaders and allocates the textures.
+	 * @param N      Width (and height) of the square fluid simulation grid
+	 * @param dt     Timestep size
+	 * @param diff   Diffusion coefficient
+	 * @param visc   Viscosity coefficient
+	 */
+	GpuFluidSolver(int N, float dt, float diff, float visc);
+
+	/**
+	 * Parameter constructor for a rectangular grid. Compiles the shaders and allocates the 
+	 * textures.
+	 * @param width  Number of cells per row of the fluid simulation grid
+	 * @param height Number of rows of the fluid simulation grid
+	 * @param dt     Timestep size
+	 * @param diff   Diffusion coefficient
+	 * @param visc   Viscosity coefficient
+	 */
+	GpuFluidSolver(int width, int height, float dt, float diff, float visc);
+	~GpuFluidSolver(void);
+
+	/**
+	 * Returns true if the current OpenGL context supports everything the GPU solver needs
+	 * (OpenGL 3.0, or GLSL with ARB_texture_float, ARB_texture_rg and ARB_framebuffer_object).
+	 */
+	static bool isSupported();
+
+	/**
+	 * Accessor: returns false if setting up the shaders or textures failed. The solver
+	 * then falls back to the CPU implementation.
+	 */
+	bool isValid();
+
+	/**
+	 * Takes the bounds for the next update() from a texture instead of setBoundAt(). Any
+	 * texel greater than zero is a boundary. The texture covers cells 1..width and 
+	 * 1..height and can have any size and format that can be sampled, e.g. the resized
+	 * Kinect depth image uploaded as GL_LUMINANCE.
+	 *
+	 * @param texture   Texture name, or 0 to go back to the bounds set with setBoundAt().
+	 */
+	void setBoundsTexture(GLuint texture);
+
+	/**
+	 * Accessors: return the textures holding the current density, velocity and bounds.
+	 * The names change between updates, so fetch them again every frame.
+	 */
+	GLuint getDensityTexture();
+	GLuint getHorzVelocityTexture();
+	GLuint getVertVelocityTexture();
+	GLuint getBoundsTexture();
+
+	void  setBoundAt(int x, int y, bool isBound);
+	void  setBoundsFromMask(const unsigned char* mask, size_t step, int cols, int rows,
+							int offsetX = 0, int offsetY = 0);
+	bool  isBoundAt(int x, int y);
+	float getDensityAt(int x, int y);
+	float getVertVelocityAt(int x, int y);
+	float getHorzVelocityAt(int x, int y);
+
+	/**
+	 * Uploads the sources and bounds, then runs one density and one velocity step on the GPU.
+	 * Resets u_prev, v_prev, and dens_prev.
+	 */
+	void update();
+
+	/**
+	 * Resets all arrays and textures to zero.
+	 */
+	void reset();
+
+	/**
+	 * Resamples the fields like FluidSolver::resize(), then sizes the textures again and
+	 * uploads the resampled fields into them.
+	 */
+	void resize(int width, int height);
+
+protected:
+	/**
+	 * Shader programs, one per pass.
+	 */
+	enum Program { ADD_SOURCE, RELAX, SET_BOUNDS, ADVECT, DIVERGENCE, SUBTRACT_GRADIENT,
+		           IMPORT_BOUNDS, PROGRAM_COUNT };
+
+	bool   valid_;
+	GLuint programs_[PROGRAM_COUNT];
+	GLuint framebuffer_;
+
+	//field textures, swapped like the CPU arrays
+	GLuint u_tex_, v_tex_, u_prev_tex_, v_prev_tex_, dens_tex_, dens_prev_tex_;
+	GLuint scratch_tex_;
+	GLuint bounds_tex_;
+	GLuint external_bounds_tex_;
+
+	bool boundsDirty_;      // bounds_ changed since the last upload
+	bool readbackPending_;  // textures changed since the last readback
+	bool boundsReadbackPending_;
+	vector<float> boundsScratch_;
+
+	/**
+	 * Compiles the shaders and creates the textures and the framebuffer. Shared by the 
+	 * constructors.
+	 */
+	void createResources();
+
+	/**
+	 * Compiles and links all passes.
+	 * @return true on success
+	 */
+	bool createPrograms();
+
+	/**
+	 * Sets the grid size uniforms of all passes. Called again when the grid is resized.
+	 */
+	void setGridUniforms();
+
+	/**
+	 * Creates a (width+2)*(height+2) single channel float texture with nearest sampling.
+	 */
+	GLuint createTexture();
+
+	/**
+	 * Gives a texture (width+2)*(height+2) texels of undefined contents.
+	 */
+	void sizeTexture(GLuint texture);
+
+	/**
+	 * Replaces the contents of a texture with a CPU array laid out like the IX(i, j) cells.
+	 */
+	void uploadTexture(GLuint texture, const float* data);
+
+	/**
+	 * Saves the OpenGL state touched by the passes and sets up the grid viewport.
+	 * Every group of passes must be enclosed in beginPasses() / endPasses().
+	 */
+	void beginPasses();
+	void endPasses();
+
+	/**
+	 * Renders a full grid pass with the given program into scratch_tex_ and swaps
+	 * scratch_tex_ with target. Uniforms and textures must be set by the caller.
+	 */
+	void runPass(Program program, GLuint& target);
+
+	/**
+	 * Sets every texel of a texture to zero.
+	 */
+	void clearTexture(GLuint texture);
+
+	/**
+	 * Binds a texture to a texture unit and points the sampler uniform of the current
+	 * program at it.
+	 */
+	void bindTexture(Program program, const char* sampler, int unit, GLuint texture);
+
+	/**
+	 * Sets a float uniform of a program. The program must be current.
+	 */
+	void setUniform(Program program, const char* name, float value);
+
+	/**
+	 * Copies the CPU bounds or the external bounds texture into bounds_tex_.
+	 */
+	void uploadBounds();
+
+	/**
+	 * Reads the field textures back into the CPU arrays if they changed.
+	 */
+	void readback();
+
+	/**
+	 * Reads the bounds texture back into bounds_ if it was imported from a texture.
+	 */
+	void readbackBounds();
+
+	/**
+	 * GPU versions of the FluidSolver steps. Textures are passed by reference because
+	 * every pass replaces its output texture.
+	 */
+	void addSourceGpu(GLuint& x, GLuint s);
+	void setBoundsGpu(int boundsFlag, GLuint& x);
+	void linearSolveGpu(int boundsFlag, GLuint& x, GLuint x0, float a, float c);
+	void diffuseGpu(int boundsFlag, GLuint& x, GLuint x0);
+	void advectGpu(int boundsFlag, GLuint& d, GLuint d0, GLuint u, GLuint v);
+	void projectGpu(GLuint& u, GLuint& v, GLuint& p, GLuint& div);
+	void computeDensityStepGpu(GLuint& x, GLuint& x0, GLuint u, GLuint v);
+	void computeVelocityStepGpu(GLuint& u, GLuint& v, GLuint& u0, GLuint& v0);
+};
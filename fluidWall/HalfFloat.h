@@ -0,0 +1,90 @@
+/**
+ * @file      HalfFloat.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+/**
+ * Conversion between 32 bit floats and IEEE 754 half precision (16 bit) floats, for 
+ * fields that are stored compactly and computed on in floats. Halves have 11 significant 
+ * bits, about 3 decimal digits, and reach 65504; larger values become infinity.
+ *
+ * Plain integer code, so it needs no F16C instructions and gives the same bits everywhere.
+ */
+
+/**
+ * Returns the half nearest to a float, ties to even. NaN stays NaN.
+ */
+inline unsigned short floatToHalf(float value)
+{
+	union { float f; unsigned int u; } bits;
+	bits.f = value;
+
+	unsigned int sign = bits.u & 0x80000000u;
+	unsigned short half;
+	bits.u ^= sign;
+
+	if (bits.u >= (127 + 16) << 23) {
+		//too large for a half, infinity or NaN
+		half = (unsigned short)(bits.u > 0x7F800000u ? 0x7E00 : 0x7C00);
+	}
+	else if (bits.u < (127 - 14) << 23) {
+		//subnormal half or zero: adding the magic number rounds the mantissa into place
+		union { float f; unsigned int u; } magic;
+		magic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+		bits.f += magic.f;
+		half = (unsigned short)(bits.u - magic.u);
+	}
+	else {
+		//rebias the exponent and round the 13 dropped mantissa bits to even
+		unsigned int isOdd = (bits.u >> 13) & 1;
+		bits.u += ((unsigned int)(15 - 127) << 23) + 0xFFF + isOdd;
+		half = (unsigned short)(bits.u >> 13);
+	}
+	return (unsigned short)(half | (sign >> 16));
+}
+
+/**
+ * Returns the float value of a half, exactly.
+ */
+inline float halfToFloat(unsigned short half)
+{
+	union { float f; unsigned int u; } bits;
+	const unsigned int exponentMask = 0x7C00u << 13;
+
+	bits.u = (half & 0x7FFFu) << 13;
+	unsigned int exponent = bits.u & exponentMask;
+	bits.u += (127 - 15) << 23;
+
+	if (exponent == exponentMask) {
+		//infinity or NaN
+		bits.u += (128 - 16) << 23;
+	}
+	else if (exponent == 0) {
+		//zero or subnormal: renormalize through a float subtraction
+		union { float f; unsigned int u; } magic;
+		magic.u = 113 << 23;
+		bits.u += 1 << 23;
+		bits.f -= magic.f;
+	}
+	bits.u |= (half & 0x8000u) << 16;
+	return bits.f;
+}
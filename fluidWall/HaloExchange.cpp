@@ -0,0 +1,336 @@
+/**
+ * @file      HaloExchange.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "HaloExchange.h"
+#include "Profiler.h"
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <winsock2.h>
+	#ifdef _MSC_VER
+		#pragma comment(lib, "ws2_32.lib")
+	#endif
+	typedef int socklen_t;
+	#define closesocket_ closesocket
+#else
+	#include <sys/socket.h>
+	#include <sys/select.h>
+	#include <netinet/in.h>
+	#include <arpa/inet.h>
+	#include <netdb.h>
+	#include <unistd.h>
+	typedef int SOCKET;
+	#define INVALID_SOCKET -1
+	#define closesocket_ close
+#endif
+
+
+
+HaloLink::HaloLink(int timeoutMilliseconds)
+{
+	timeout_        = timeoutMilliseconds;
+	step_           = 0;
+	exchange_       = 0;
+	waiting_        = true;
+	mismatched_     = false;
+	stepMismatched_ = false;
+	staleCount_     = 0;
+	remoteStep_     = -1;
+	for (int e = 0; e < MAX_EXCHANGES; e++)
+		slots_[e].step = -1;
+}
+
+
+
+HaloLink::~HaloLink(void)
+{
+}
+
+
+
+void HaloLink::beginStep()
+{
+	//a mismatch is reported again only after a step without one
+	if (!stepMismatched_)
+		mismatched_ = false;
+	stepMismatched_ = false;
+
+	step_++;
+	exchange_ = 0;
+}
+
+
+
+bool HaloLink::exchange(const float* send, float* receive, int count)
+{
+	int exchange = exchange_++ % MAX_EXCHANGES;
+
+	//a neighbor that is further on was started earlier, this step continues its count;
+	//in step the neighbor cannot get ahead before this exchange is sent
+	{
+		ScopedLock lock(lock_);
+		step_ = max(step_, remoteStep_);
+	}
+
+	MessageHeader header = { MESSAGE_MAGIC, step_, exchange, count };
+	sendMessage(header, send);
+
+	//after a timeout, wait again once the neighbor is back within a step of this one and 
+	//sends halos of the right size
+	if (!waiting_ && !mismatched_) {
+		receiveMessages(0);
+		ScopedLock lock(lock_);
+		waiting_ = remoteStep_ >= step_ - 1;
+	}
+
+	long long ticksPerMillisecond = Profiler::getTicksPerSecond() / 1000;
+	long long deadline = Profiler::getTicks() + (waiting_ ? timeout_ : 0) * ticksPerMillisecond;
+	int sentCount;
+	for (;;) {
+		if (takeSlot(exchange, receive, count, sentCount) >= step_) {
+			waiting_ = true;
+			return true;
+		}
+
+		int left = (int)((deadline - Profiler::getTicks()) / ticksPerMillisecond);
+		if (left <= 0)
+			break;
+		receiveMessages(left);
+	}
+
+	//the neighbor's newest values of an earlier step, if it ever sent any
+	receiveMessages(0);
+	if (takeSlot(exchange, receive, count, sentCount) >= step_) {
+		waiting_ = true;
+		return true;
+	}
+	waiting_ = false;
+	staleCount_++;
+
+	if (sentCount >= 0 && sentCount != count) {
+		if (!mismatched_)
+			cout<<"Halo link: the neighbor sends "<<sentCount<<" values where "<<count<<" are expected, "
+				<<"the tiles run different modes or grid sizes; the edge is a wall until they match"<<endl;
+		mismatched_     = true;
+		stepMismatched_ = true;
+	}
+	return false;
+}
+
+
+
+int HaloLink::getStaleCount()
+{
+	return staleCount_;
+}
+
+
+
+int HaloLink::getStep()
+{
+	return step_;
+}
+
+
+
+void HaloLink::deliver(const MessageHeader& header, const float* values)
+{
+	if (header.magic != MESSAGE_MAGIC || header.exchange < 0 || header.exchange >= MAX_EXCHANGES || header.count < 0)
+		return;
+
+	ScopedLock lock(lock_);
+	remoteStep_ = max(remoteStep_, header.step);
+
+	Slot& slot = slots_[header.exchange];
+	if (header.step < slot.step)
+		return;  //overtaken by a newer message
+
+	slot.step = header.step;
+	slot.values.assign(values, values + header.count);
+}
+
+
+
+int HaloLink::takeSlot(int exchange, float* receive, int count, int& sentCount)
+{
+	ScopedLock lock(lock_);
+	const Slot& slot = slots_[exchange];
+	sentCount = slot.step < 0 ? -1 : (int)slot.values.size();
+	if (sentCount != count)
+		return -1;
+
+	copy(slot.values.begin(), slot.values.end(), receive);
+	return slot.step;
+}
+
+
+
+LocalHaloLink::LocalHaloLink(int timeoutMilliseconds) : 
+	HaloLink(timeoutMilliseconds)
+{
+	peer_ = NULL;
+}
+
+
+
+void LocalHaloLink::connect(LocalHaloLink* peer)
+{
+	peer_       = peer;
+	peer->peer_ = this;
+}
+
+
+
+void LocalHaloLink::sendMessage(const MessageHeader& header, const float* values)
+{
+	if (!peer_)
+		return;
+
+	peer_->deliver(header, values);
+	peer_->arrived_.signal();
+}
+
+
+
+void LocalHaloLink::receiveMessages(int milliseconds)
+{
+	arrived_.wait(milliseconds);
+}
+
+
+
+UdpHaloLink::UdpHaloLink(int localPort, const char* remoteHost, int remotePort, int timeoutMilliseconds) :
+	HaloLink(timeoutMilliseconds)
+{
+	socket_        = -1;
+	remoteAddress_ = 0;
+	remotePort_    = htons((unsigned short)remotePort);
+
+	#ifdef _WIN32
+		WSADATA wsaData;
+		if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+			cout<<"Halo link: no Winsock"<<endl;
+			return;
+		}
+	#endif
+
+	hostent* host = gethostbyname(remoteHost);
+	if (!host || host->h_addrtype != AF_INET) {
+		cout<<"Halo link: unknown host "<<remoteHost<<endl;
+		return;
+	}
+	memcpy(&remoteAddress_, host->h_addr_list[0], sizeof(in_addr));
+
+	SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (s == INVALID_SOCKET)
+		return;
+
+	sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family      = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	local.sin_port        = htons((unsigned short)localPort);
+	if (bind(s, (sockaddr*)&local, sizeof(local)) != 0) {
+		cout<<"Halo link: cannot bind port "<<localPort<<endl;
+		closesocket_(s);
+		return;
+	}
+	socket_ = (long long)s;
+}
+
+
+
+UdpHaloLink::~UdpHaloLink(void)
+{
+	if (socket_ != -1)
+		closesocket_((SOCKET)socket_);
+
+	#ifdef _WIN32
+		WSACleanup();
+	#endif
+}
+
+
+
+bool UdpHaloLink::isOpen()
+{
+	return socket_ != -1;
+}
+
+
+
+void UdpHaloLink::sendMessage(const MessageHeader& header, const float* values)
+{
+	if (socket_ == -1)
+		return;
+
+	size_t bytes = sizeof(header) + header.count * sizeof(float);
+	buffer_.resize(bytes);
+	memcpy(&buffer_[0], &header, sizeof(header));
+	memcpy(&buffer_[sizeof(header)], values, header.count * sizeof(float));
+
+	sockaddr_in remote;
+	memset(&remote, 0, sizeof(remote));
+	remote.sin_family      = AF_INET;
+	remote.sin_addr.s_addr = remoteAddress_;
+	remote.sin_port        = remotePort_;
+	sendto((SOCKET)socket_, &buffer_[0], (int)bytes, 0, (sockaddr*)&remote, sizeof(remote));
+}
+
+
+
+void UdpHaloLink::receiveMessages(int milliseconds)
+{
+	if (socket_ == -1)
+		return;
+
+	const static int MAX_DATAGRAM = 65507;
+	SOCKET s = (SOCKET)socket_;
+	timeval timeout = { milliseconds / 1000, (milliseconds % 1000) * 1000 };
+
+	//everything that is waiting, but only wait for the first datagram
+	for (;;) {
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(s, &readable);
+		if (select((int)s + 1, &readable, NULL, NULL, &timeout) <= 0)
+			return;
+		timeout.tv_sec = timeout.tv_usec = 0;
+
+		buffer_.resize(MAX_DATAGRAM);
+		int bytes = recvfrom(s, &buffer_[0], MAX_DATAGRAM, 0, NULL, NULL);
+		if (bytes < 0)
+			return;  //e.g. the neighbor's port is not open yet
+		if (bytes < (int)sizeof(MessageHeader))
+			continue;
+
+		MessageHeader header;
+		memcpy(&header, &buffer_[0], sizeof(header));
+		if (header.count < 0 || bytes != (int)(sizeof(header) + header.count * sizeof(float)))
+			continue;
+		deliver(header, (const float*)&buffer_[sizeof(header)]);
+	}
+}
@@ -0,0 +1,208 @@
+/**
+ * @file      HaloExchange.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+#include <vector>
+#include "Threading.h"
+
+using namespace std;
+
+/**
+ * Sides of a solver grid. A side that is linked to a neighboring tile with 
+ * FluidSolver::setEdgeLink() takes its ghost cells from the neighbor instead of a wall.
+ */
+enum TileEdge { EDGE_LEFT, EDGE_RIGHT, EDGE_BOTTOM, EDGE_TOP, EDGE_COUNT };
+
+/**
+ * Connection between two solver tiles that share an edge, e.g. two projectors of one wall
+ * driven by different PCs. Every FluidSolver::setBounds() call during an update sends the
+ * row of cells next to the edge and receives the neighbor's row into the ghost cells.
+ *
+ * Both tiles run the same steps and settings, so the n-th exchange of a step on one side
+ * matches the n-th exchange of the step on the other; each message is labeled with both 
+ * numbers. Tiles started at different times agree on the step number: a link that hears
+ * a neighbor further on continues from the neighbor's step, so the later tile catches up
+ * within a step of hearing the other and a restarted tile rejoins the wall's count.
+ * Messages that arrive early are kept until their exchange comes. A message that
+ * has not arrived after the timeout is replaced by the newest older message for the same
+ * exchange, so a slow neighbor makes the halo a step stale instead of stalling the wall.
+ * After a timeout the link stops waiting until the neighbor is heard within a step of 
+ * this one again, so a neighbor that went away costs nothing; the edge then behaves like
+ * a wall. A neighbor
+ * whose halos have a different size, e.g. one running another mode, is reported and 
+ * also treated like a wall.
+ *
+ * The halo is one cell wide, so tiles match a single solver only while the fluid moves 
+ * less than about a cell per step across the edge; faster flow is traced back no further 
+ * than the ghost cells.
+ *
+ * Subclasses move the messages: LocalHaloLink between threads of one process, 
+ * UdpHaloLink between machines.
+ */
+class HaloLink
+{
+public:
+	const static int MAX_EXCHANGES = 512;	//exchanges per step that are told apart
+
+	/**
+	 * @param timeoutMilliseconds   longest wait for the neighbor's half of an exchange
+	 */
+	HaloLink(int timeoutMilliseconds);
+	virtual ~HaloLink(void);
+
+	/**
+	 * Starts the exchanges of a new step. Called by the solver at the start of update().
+	 */
+	void beginStep();
+
+	/**
+	 * Sends count values to the neighbor and receives its count values of the same 
+	 * exchange. receive is not touched if the neighbor has never sent that exchange.
+	 *
+	 * @return   true if the neighbor's values belong to this step or a newer one
+	 */
+	bool exchange(const float* send, float* receive, int count);
+
+	/**
+	 * Accessors: return the number of exchanges that timed out since the link was created,
+	 * and the step both ends of the link count, e.g. to switch modes at the same time.
+	 */
+	int getStaleCount();
+	int getStep();
+
+protected:
+	/**
+	 * What every message starts with, followed by count floats.
+	 */
+	struct MessageHeader
+	{
+		int magic;
+		int step;
+		int exchange;
+		int count;
+	};
+	const static int MESSAGE_MAGIC = 0x46574831;	//"FWH1"
+
+	/**
+	 * Sends one message to the neighbor.
+	 */
+	virtual void sendMessage(const MessageHeader& header, const float* values) = 0;
+
+	/**
+	 * Waits up to the given time for messages from the neighbor and hands them to 
+	 * deliver(). May return early, e.g. after one message.
+	 */
+	virtual void receiveMessages(int milliseconds) = 0;
+
+	/**
+	 * Stores a message until its exchange comes. Safe to call from any thread.
+	 */
+	void deliver(const MessageHeader& header, const float* values);
+
+private:
+	struct Slot
+	{
+		int           step;		//-1 until a message arrived
+		vector<float> values;
+	};
+
+	int  timeout_;
+	int  step_;
+	int  exchange_;
+	bool waiting_;			//false after a timeout, until the neighbor is heard within a step
+	bool mismatched_;		//true once a size mismatch is reported, until a step has none
+	bool stepMismatched_;	//true if an exchange of this step had a size mismatch
+	int  staleCount_;
+
+	Mutex lock_;		//guards slots_ and remoteStep_
+	Slot  slots_[MAX_EXCHANGES];
+	int   remoteStep_;	//newest step heard from the neighbor, -1 before the first message
+
+	/**
+	 * Copies the slot of an exchange to receive if it holds count values.
+	 * @param sentCount   receives the number of values in the slot, -1 if it is empty
+	 * @return            step of the message, -1 if there is none of that size
+	 */
+	int takeSlot(int exchange, float* receive, int count, int& sentCount);
+
+	HaloLink(const HaloLink&);
+	HaloLink& operator=(const HaloLink&);
+};
+
+
+
+/**
+ * Link between two tiles simulated by different threads of one process, e.g. one PC with
+ * a projector per graphics output. Create both ends, then connect() one to the other.
+ */
+class LocalHaloLink : public HaloLink
+{
+public:
+	LocalHaloLink(int timeoutMilliseconds);
+
+	/**
+	 * Connects both ends of the link.
+	 */
+	void connect(LocalHaloLink* peer);
+
+protected:
+	void sendMessage(const MessageHeader& header, const float* values);
+	void receiveMessages(int milliseconds);
+
+private:
+	LocalHaloLink* peer_;
+	Event          arrived_;
+};
+
+
+
+/**
+ * Link between tiles on different machines, one UDP datagram per message. Each end binds
+ * its own port and sends to the neighbor's.
+ */
+class UdpHaloLink : public HaloLink
+{
+public:
+	/**
+	 * @param localPort    port to receive the neighbor's messages on
+	 * @param remoteHost   name or address of the neighbor
+	 * @param remotePort   port the neighbor receives on
+	 * @param timeoutMilliseconds   see HaloLink
+	 */
+	UdpHaloLink(int localPort, const char* remoteHost, int remotePort, int timeoutMilliseconds);
+	~UdpHaloLink(void);
+
+	/**
+	 * Accessor: returns false if the socket could not be opened or the host not found.
+	 */
+	bool isOpen();
+
+protected:
+	void sendMessage(const MessageHeader& header, const float* values);
+	void receiveMessages(int milliseconds);
+
+private:
+	long long      socket_;			//SOCKET on Windows, file descriptor elsewhere; -1 if closed
+	unsigned long  remoteAddress_;	//IPv4 address of the neighbor, network byte order
+	unsigned short remotePort_;		//network byte order
+	vector<char>   buffer_;			//one message being sent or received
+};
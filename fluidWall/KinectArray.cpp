@@ -0,0 +1,273 @@
+/**
+ * @file      KinectArray.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "KinectArray.h"
+#include <algorithm>
+
+static const int SENSOR_RETRY_DELAY = 100;	//ms a camera thread waits after a failed frame
+
+
+
+KinectArray::KinectArray(int sensorCount, int userCount, int iterationCount, int depthValue, int motorAngle,
+						 const char* playbackPath)
+{
+	int count = playbackPath ? 1 : max(1, min(sensorCount, (int)MAX_SENSORS));
+	maxUsers_ = userCount;
+	running_  = true;
+
+	for (int s = 0; s < count; s++) {
+		Sensor* sensor     = new Sensor;
+		sensor->owner      = this;
+		sensor->index      = s;
+		sensor->controller = new KinectController(userCount, iterationCount, depthValue, motorAngle, playbackPath, s);
+		sensor->controller->setCoverage((float)s / count, 0.0f, 1.0f / count, 1.0f);
+		sensors_.push_back(sensor);
+	}
+
+	if (count > 1) {
+		cout<<"Merging "<<count<<" Kinects"<<endl;
+		for (int s = 0; s < count; s++)
+			sensors_[s]->thread.start(sensorLoop, sensors_[s]);
+	}
+}
+
+
+
+KinectArray::~KinectArray(void)
+{
+	running_ = false;
+	for (size_t s = 0; s < sensors_.size(); s++)
+		sensors_[s]->thread.join();
+
+	for (size_t s = 0; s < sensors_.size(); s++) {
+		delete sensors_[s]->controller;
+		delete sensors_[s];
+	}
+}
+
+
+
+void KinectArray::sensorLoop(void* argument)
+{
+	Sensor* sensor = (Sensor*)argument;
+
+	while (sensor->owner->running_) {
+		bool hasFrame;
+		{
+			ScopedLock lock(sensor->lock);
+			hasFrame = sensor->controller->update() == XN_STATUS_OK;
+			if (hasFrame) {
+				SensorFrame& frame = sensor->frames.getWriteSlot();
+				sensor->controller->getDepthMat().copyTo(frame.depth);
+				sensor->controller->getUsersMat().copyTo(frame.users);
+			}
+		}
+
+		if (hasFrame) {
+			sensor->frames.publish();
+			sensor->owner->arrived_.signal();
+		}
+		else
+			sleepMilliseconds(SENSOR_RETRY_DELAY);
+	}
+}
+
+
+
+XnStatus KinectArray::update()
+{
+	if (sensors_.size() == 1) {
+		ScopedLock lock(sensors_[0]->lock);
+		XnStatus status = sensors_[0]->controller->update();
+		depth_ = sensors_[0]->controller->getDepthMat();
+		users_ = sensors_[0]->controller->getUsersMat();
+		return status;
+	}
+
+	//merge again after the timeout as well, e.g. when the cameras' frames no longer fit the grid
+	arrived_.wait(FRAME_WAIT_MS);
+	fuseFrames();
+	return XN_STATUS_OK;
+}
+
+
+
+void KinectArray::fuseFrames()
+{
+	const int count = (int)sensors_.size();
+
+	//the newest frame of each camera that has the size of the grid
+	const SensorFrame* frames[MAX_SENSORS];
+	int                rows = 0, cols = 0, usable = 0;
+	int                sensorOf[MAX_SENSORS];
+	for (int s = 0; s < count; s++) {
+		sensors_[s]->frames.update();
+		const SensorFrame& frame = sensors_[s]->frames.getReadSlot();
+		if (frame.depth.empty())
+			continue;
+		if (usable == 0) {
+			rows = frame.depth.rows;
+			cols = frame.depth.cols;
+		}
+		if (frame.depth.rows != rows || frame.depth.cols != cols)
+			continue;  //captured before a setOutputSize(), skipped until the camera catches up
+		frames[usable]   = &frame;
+		sensorOf[usable] = s;
+		usable++;
+	}
+	if (usable == 0)
+		return;
+
+	depth_.create(rows, cols, CV_8UC1);
+	users_.create(rows, cols, CV_8UC1);
+	const int otherUsers = max(1, maxUsers_ - 1);  //IDs 1 - maxUsers - 1, 0 is the background
+
+	for (int y = 0; y < rows; y++) {
+		const uchar* depthIn[MAX_SENSORS];
+		const uchar* usersIn[MAX_SENSORS];
+		for (int f = 0; f < usable; f++) {
+			depthIn[f] = frames[f]->depth.ptr<uchar>(y);
+			usersIn[f] = frames[f]->users.ptr<uchar>(y);
+		}
+		uchar* depthOut = depth_.ptr<uchar>(y);
+		uchar* usersOut = users_.ptr<uchar>(y);
+
+		for (int x = 0; x < cols; x++) {
+			//nearest silhouette (brightest depth), or any user at all if none has a depth
+			int best = -1, bestDepth = 0;
+			for (int f = 0; f < usable; f++) {
+				int depth = depthIn[f][x];
+				if (depth > bestDepth || (best < 0 && usersIn[f][x])) {
+					best      = f;
+					bestDepth = max(bestDepth, depth);
+				}
+			}
+
+			depthOut[x] = (uchar)bestDepth;
+			int label   = best < 0 ? 0 : usersIn[best][x];
+			usersOut[x] = label ? (uchar)(1 + ((label - 1) * count + sensorOf[best]) % otherUsers) : 0;
+		}
+	}
+}
+
+
+
+void KinectArray::reset()
+{
+	for (size_t s = 0; s < sensors_.size(); s++) {
+		ScopedLock lock(sensors_[s]->lock);
+		sensors_[s]->controller->reset();
+	}
+}
+
+
+
+void KinectArray::setOutputSize(int cols, int rows, bool flipVertical)
+{
+	for (size_t s = 0; s < sensors_.size(); s++) {
+		ScopedLock lock(sensors_[s]->lock);
+		sensors_[s]->controller->setOutputSize(cols, rows, flipVertical);
+	}
+	if (sensors_.size() == 1) {
+		depth_ = sensors_[0]->controller->getDepthMat();
+		users_ = sensors_[0]->controller->getUsersMat();
+	}
+}
+
+
+
+void KinectArray::setCoverage(int sensor, float left, float top, float width, float height)
+{
+	if (sensor < 0 || sensor >= (int)sensors_.size())
+		return;
+
+	ScopedLock lock(sensors_[sensor]->lock);
+	sensors_[sensor]->controller->setCoverage(left, top, width, height);
+}
+
+
+
+void KinectArray::setDepth(int depthDelta)
+{
+	for (size_t s = 0; s < sensors_.size(); s++) {
+		ScopedLock lock(sensors_[s]->lock);
+		sensors_[s]->controller->setDepth(depthDelta);
+	}
+}
+
+
+
+void KinectArray::setMotorAngle(int angle)
+{
+	for (size_t s = 0; s < sensors_.size(); s++) {
+		ScopedLock lock(sensors_[s]->lock);
+		sensors_[s]->controller->setMotorAngle(angle);
+	}
+}
+
+
+
+void KinectArray::resetMotorAngle()
+{
+	for (size_t s = 0; s < sensors_.size(); s++) {
+		ScopedLock lock(sensors_[s]->lock);
+		sensors_[s]->controller->resetMotorAngle();
+	}
+}
+
+
+
+bool KinectArray::startRecording(const char* path)
+{
+	ScopedLock lock(sensors_[0]->lock);
+	return sensors_[0]->controller->startRecording(path);
+}
+
+
+
+void KinectArray::stopRecording()
+{
+	ScopedLock lock(sensors_[0]->lock);
+	sensors_[0]->controller->stopRecording();
+}
+
+
+
+bool KinectArray::isRecording()
+{
+	ScopedLock lock(sensors_[0]->lock);
+	return sensors_[0]->controller->isRecording();
+}
+
+
+
+bool KinectArray::isPlayingBack()
+{
+	return sensors_[0]->controller->isPlayingBack();
+}
+
+
+
+int KinectArray::getSensorCount()
+{
+	return (int)sensors_.size();
+}
@@ -0,0 +1,144 @@
+/**
+ * @file      KinectArray.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+#include "KinectController.h"
+#include "Threading.h"
+
+/**
+ * Several Kinects that together cover one wall, merged into a single depth and user image
+ * of the simulation grid. Has the interface of one KinectController, so the capture thread
+ * does not care how many cameras there are.
+ *
+ * Each Kinect has its own KinectController, calibrated with setCoverage() to the part of 
+ * the grid it sees, and its own thread that waits for its frames and hands the grid sized
+ * images over in a TripleBuffer. update() waits for any camera's next frame and merges the
+ * newest frame of every camera in one pass over the grid: where the cameras overlap, the 
+ * nearest silhouette wins. The user IDs of the cameras are interleaved so that users seen
+ * by different cameras get different IDs below maxUsers.
+ *
+ * With one Kinect there are no extra threads: update() reads the camera itself and the 
+ * images are the controller's own.
+ *
+ * Not thread safe, like KinectController; the threads it starts only touch their camera.
+ */
+class KinectArray
+{
+public:
+	const static int MAX_SENSORS   = 4;
+	const static int FRAME_WAIT_MS = 100;	//longest wait in update() for a new frame
+
+	/**
+	 * Opens the Kinects and starts their threads. The cameras cover the grid side by side 
+	 * in equal slices, in the order OpenNI lists them; change that with setCoverage().
+	 *
+	 * @param sensorCount    number of Kinects, 1 - MAX_SENSORS. A recording is always 
+	 *                       played back as one.
+	 * @param playbackPath   see KinectController, or NULL for the cameras
+	 * Other parameters: see KinectController
+	 */
+	KinectArray(int sensorCount, int userCount, int iterationCount, int depthValue, int motorAngle,
+				const char* playbackPath = NULL);
+	~KinectArray(void);
+
+	/**
+	 * Waits for new frames and merges the newest frame of every camera into getDepthMat() 
+	 * and getUsersMat().
+	 */
+	XnStatus update();
+
+	/**
+	 * Restarts the OpenNI modules of every camera in the background, see 
+	 * KinectController::reset().
+	 */
+	void reset();
+
+	/**
+	 * Size of the merged images; each camera delivers images of this size.
+	 */
+	void setOutputSize(int cols, int rows, bool flipVertical = false);
+
+	/**
+	 * Calibrates the part of the grid a camera sees, see KinectController::setCoverage().
+	 */
+	void setCoverage(int sensor, float left, float top, float width, float height);
+
+	/**
+	 * Applied to every camera.
+	 */
+	void setDepth(int depthDelta);
+	void setMotorAngle(int angle);
+	void resetMotorAngle();
+
+	/**
+	 * Recordings hold the frames of one camera, the first one.
+	 */
+	bool startRecording(const char* path);
+	void stopRecording();
+	bool isRecording();
+	bool isPlayingBack();
+
+	int getSensorCount();
+
+	Mat getDepthMat() { return depth_; }
+	Mat getUsersMat() { return users_; }
+
+private:
+	/**
+	 * Grid sized images of one camera frame.
+	 */
+	struct SensorFrame
+	{
+		Mat depth;
+		Mat users;
+	};
+
+	struct Sensor
+	{
+		KinectArray*              owner;
+		int                       index;
+		KinectController*         controller;
+		Mutex                     lock;		//held while controller is used
+		TripleBuffer<SensorFrame> frames;	//camera thread -> update()
+		Thread                    thread;
+	};
+
+	vector<Sensor*> sensors_;
+	int             maxUsers_;
+	volatile bool   running_;
+	Event           arrived_;	//a camera thread published a frame
+	Mat             depth_;		//merged images
+	Mat             users_;
+
+	/**
+	 * Camera thread: reads frames of one Kinect until the array is destroyed.
+	 */
+	static void sensorLoop(void* sensor);
+
+	/**
+	 * Merges the newest frames of the cameras into depth_ and users_.
+	 */
+	void fuseFrames();
+
+	KinectArray(const KinectArray&);
+	KinectArray& operator=(const KinectArray&);
+};
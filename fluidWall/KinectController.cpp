@@ -26,6 +26,9 @@
  */
 
 #include "KinectController.h"
+#include <algorithm>
+#include <math.h>
+#include "Profiler.h"
 
 // XnOpenNI Callbacks when user is detected or lost
 void XN_CALLBACK_TYPE User_NewUser  (xn::UserGenerator& generator, XnUserID nId, void* pCookie);
@@ -33,12 +36,42 @@ void XN_CALLBACK_TYPE User_LostUser (xn::UserGenerator& generator, XnUserID nId,
 
 
 // (Default) Constructor
-KinectController::KinectController (int userCount, int iterationCount, int depthValue, int motorAngle)
+KinectController::KinectController (int userCount, int iterationCount, int depthValue, int motorAngle,
+									const char* playbackPath, int deviceIndex)
 {
 	maxUsers		= userCount;
 	maxIterate		= iterationCount;
 	depthThresh		= depthValue;
 	nuiAngle		= initAngle	 = (motorAngle > 15000? 15000 : motorAngle < -15000? -15000 : motorAngle);
+	outputCols		= X_RES;
+	outputRows		= Y_RES;
+	outputFlipped	= false;
+	coverLeft		= coverTop	  = 0.0f;
+	coverWidth		= coverHeight = 1.0f;
+	this->deviceIndex = deviceIndex;
+	userIDs.resize(maxUsers);
+	usePlayback		= false;
+	device			= retiredDevice = openedDevice = NULL;
+	resetRunning	= resetFinished = false;
+	retryTicks		= 0;
+	lostFrames		= 0;
+
+	if (playbackPath)
+	{
+		// recordings are made at the camera resolution, update() downsamples them like camera frames
+		if (playback.open(playbackPath) && playback.getCols() == X_RES && playback.getRows() == Y_RES)
+		{
+			usePlayback = true;
+			playbackDepth.resize(X_RES * Y_RES);
+			playbackLabels.resize(X_RES * Y_RES);
+			cout<<"Playing back "<<playbackPath<<endl;
+		}
+		else
+		{
+			playback.close();
+			cout<<"Could not play back "<<playbackPath<<", using the Kinect"<<endl;
+		}
+	}
 	
 	init();
 }
@@ -48,29 +81,176 @@ XnStatus KinectController::init()
 {
 	colorByDepth	= (float)COLOR_RANGE/(float)depthThresh;
 	iterations		= 0;
-	depthMatrix		= Mat::zeros(480,640,CV_8UC1);
-	usersMatrix		= Mat::zeros(480,640,CV_8UC1);
+	initOutput();
 
-	initDepthControl();			CHECK_RC(xnRetVal, "InitDepthControl");
-	initMotorControl();
+	xnRetVal		= XN_STATUS_OK;
+	if (usePlayback)
+		return xnRetVal;
+
+	// a Kinect that is not there yet is opened by update() once it is plugged in
+	device			= openDevice(createDevice(nuiAngle));
+	xnRetVal		= device ? XN_STATUS_OK : XN_STATUS_NO_NODE_PRESENT;
+	retryTicks		= Profiler::getTicks() + RECONNECT_DELAY * Profiler::getTicksPerSecond() / 1000;
+	CHECK_RC(xnRetVal, "InitDepthControl");
 	return xnRetVal;
 }
 
 
 
+// Set the size of the depth & user matrices
+void KinectController::setOutputSize(int cols, int rows, bool flipVertical)
+{
+	outputCols		= cols;
+	outputRows		= rows;
+	outputFlipped	= flipVertical;
+	initOutput();
+}
+
+// Calibrate the part of the output the camera image is stretched over
+void KinectController::setCoverage(float left, float top, float width, float height)
+{
+	coverLeft		= left;
+	coverTop		= top;
+	coverWidth		= width  > 0.0f ? width	 : 1.0f;
+	coverHeight		= height > 0.0f ? height : 1.0f;
+	initOutput();
+}
+
+// Allocate the output matrices and sampling tables for the current output size
+void KinectController::initOutput()
+{
+	depthMatrix		= Mat::zeros(outputRows, outputCols, CV_8UC1);
+	usersMatrix		= Mat::zeros(outputRows, outputCols, CV_8UC1);
+
+	// camera rectangle of each output pixel; together they tile the whole camera image
+	mapOutputAxis(outputCols, X_RES, coverLeft, coverWidth,  true,			 columnBegin, columnEnd);	// mirrored
+	mapOutputAxis(outputRows, Y_RES, coverTop,	coverHeight, outputFlipped, rowBegin,	 rowEnd);
+
+	depthSums.assign(outputCols, 0);
+	depthCounts.assign(outputCols, 0);
+	labelVotes.assign(outputCols * LABEL_VOTES, 0);
+}
+
+// Fill the camera ranges covered by the output pixels of one axis. Pixels outside of the
+// covered part get an empty range, so downsample() leaves them 0.
+void KinectController::mapOutputAxis(int count, int cameraSize, float cover, float coverSize, bool flip,
+									 vector<int>& begin, vector<int>& end)
+{
+	begin.resize(count);
+	end.resize(count);
+	for (int i = 0; i < count; i++) {
+		// exact integer edges for the default coverage of the whole output
+		double from = ((double)i		 * cameraSize / count - cover * cameraSize) / coverSize;
+		double to	= ((double)(i + 1) * cameraSize / count - cover * cameraSize) / coverSize;
+		int	   b	= (int)std::max(0.0, std::min((double)cameraSize, floor(from)));
+		int	   e	= (int)std::max(0.0, std::min((double)cameraSize, floor(to)));
+		begin[i]	= flip ? cameraSize - e : b;
+		end[i]		= flip ? cameraSize - b : e;
+	}
+}
+
+// Start saving the camera frames to a recording file
+bool KinectController::startRecording(const char* path)
+{
+	return recorder.open(path, X_RES, Y_RES);
+}
+
+// Threshold, mirror and downsample the camera buffers into depthMatrix & usersMatrix
+void KinectController::downsample(const XnDepthPixel* pDepthMap, const XnLabel* pLabels)
+{
+	// depth * colorByDepth in 16.16 fixed point
+	const int depthScale = (int)(colorByDepth * 65536.0f);
+
+	for (int y = 0; y < outputRows; y++)
+	{
+		std::fill(depthSums.begin(),   depthSums.end(),   0);
+		std::fill(depthCounts.begin(), depthCounts.end(), 0);
+		std::fill(labelVotes.begin(),  labelVotes.end(),  0);
+
+		// accumulate all camera rows of this output row
+		for (int sy = rowBegin[y]; sy < rowEnd[y]; sy++)
+		{
+			const XnDepthPixel* depthRow = pDepthMap + sy * X_RES;
+			const XnLabel*		labelRow = pLabels	 + sy * X_RES;
+
+			for (int x = 0; x < outputCols; x++)
+			{
+				unsigned short* votes = &labelVotes[x * LABEL_VOTES];
+				for (int sx = columnBegin[x]; sx < columnEnd[x]; sx++)
+				{
+					int depth = depthRow[sx];
+					if (depth < depthThresh)	// only show if object at current pixel is within depth threshold
+					{
+						// negated depth stored in a byte, near objects are bright
+						int value = (COLOR_RANGE + 1 - ((depth * depthScale) >> 16)) & COLOR_RANGE;
+						if (value) {
+							depthSums[x] += value;
+							depthCounts[x]++;
+						}
+						XnLabel label = labelRow[sx];
+						votes[label < LABEL_VOTES ? label : 0]++;
+					}
+					else
+						votes[0]++;
+				}
+			}
+		}
+
+		uchar* depthOut = depthMatrix.ptr<uchar>(y);
+		uchar* usersOut = usersMatrix.ptr<uchar>(y);
+		int    rows		= rowEnd[y] - rowBegin[y];
+
+		for (int x = 0; x < outputCols; x++)
+		{
+			// silhouette only where it covers at least half of the rectangle
+			int area = rows * (columnEnd[x] - columnBegin[x]);
+			depthOut[x] = (2 * depthCounts[x] >= area && depthCounts[x] > 0) ? 
+						  (uchar)(depthSums[x] / depthCounts[x]) : 0;
+
+			// majority vote, ties go to the user rather than the background
+			const unsigned short* votes = &labelVotes[x * LABEL_VOTES];
+			int best = 0;
+			for (int label = 1; label < LABEL_VOTES; label++)
+				if (votes[label] > 0 && votes[label] >= votes[best])
+					best = label;
+			usersOut[x] = (uchar)best;
+		}
+	}
+}
+
+
+
 /****************************************//**
 *	Depth & User Tracking Modules
 ********************************************/
-XnStatus KinectController::initDepthControl()
+XnStatus KinectController::initDepthControl(Device& dev)
 {	
 	// Initialize Status variable and creating Context object
-	xnRetVal = XN_STATUS_OK;	
-	xnRetVal = xnContext.Init(); 	
+	XnStatus xnRetVal = XN_STATUS_OK;	// not the member, this may run on the reset thread
+	xnRetVal = dev.xnContext.Init(); 	
 	CHECK_RC(xnRetVal, "Context.Init");
 	
+
+	// Device:			Open the Kinect with our index, so every controller gets its own
+	xn::NodeInfoList devices;
+	xnRetVal = dev.xnContext.EnumerateProductionTrees(XN_NODE_TYPE_DEVICE, NULL, devices);
+	CHECK_RC(xnRetVal, "Context.EnumerateDevices");
+
+	xn::NodeInfoList::Iterator deviceIt = devices.Begin();
+	for (int d = 0; d < deviceIndex && deviceIt != devices.End(); d++)
+		deviceIt++;
+	if (deviceIt == devices.End())
+		xnRetVal = XN_STATUS_NO_NODE_PRESENT;
+	CHECK_RC(xnRetVal, "Finding the Kinect");
+
+	xn::NodeInfo deviceInfo = *deviceIt;
+	xnRetVal = dev.xnContext.CreateProductionTree(deviceInfo);
+	CHECK_RC(xnRetVal, "Context.CreateDevice");
  
-	// DepthGenerator:	Create node
-	xnRetVal = xnDepthGenerator.Create(xnContext); 
+	// DepthGenerator:	Create node on that device
+	xn::Query depthQuery;
+	depthQuery.AddNeededNode(deviceInfo.GetInstanceName());
+	xnRetVal = dev.xnDepthGenerator.Create(dev.xnContext, &depthQuery); 
 	CHECK_RC(xnRetVal, "DepthGenerator.Create");
 
 	// DepthGenerator:	Set it to VGA maps at 30 FPS 
@@ -80,24 +260,26 @@ XnStatus KinectController::initDepthControl()
 	mapMode.nFPS = 30; 
 
 	// DepthGenerator:	Set MapMode 
-	xnRetVal = xnDepthGenerator.SetMapOutputMode(mapMode); 
+	xnRetVal = dev.xnDepthGenerator.SetMapOutputMode(mapMode); 
 	CHECK_RC(xnRetVal, "DepthGenerator.SetOutputMode");
 		
 	
-	// UserGenerator: Create node 
-	xnRetVal = xnUserGenerator.Create(xnContext); 
+	// UserGenerator: Create node on our depth generator
+	xn::Query userQuery;
+	userQuery.AddNeededNode(dev.xnDepthGenerator.GetName());
+	xnRetVal = dev.xnUserGenerator.Create(dev.xnContext, &userQuery); 
 	CHECK_RC(xnRetVal, "UserGenerator.Create");	
 
 	// UserGenerator:  Set Callbacks Handles 
 	XnCallbackHandle h1;
-	xnUserGenerator.RegisterUserCallbacks (User_NewUser, User_LostUser, NULL, h1);
+	dev.xnUserGenerator.RegisterUserCallbacks (User_NewUser, User_LostUser, NULL, h1);
 	
-	xnDepthGenerator.GetMetaData(xnDepthMD);
-	xnUserGenerator.GetUserPixels(0, xnSceneMD);
+	dev.xnDepthGenerator.GetMetaData(dev.xnDepthMD);
+	dev.xnUserGenerator.GetUserPixels(0, dev.xnSceneMD);
 	
 
 	// Generate all objects
-	xnRetVal = xnContext.StartGeneratingAll();
+	xnRetVal = dev.xnContext.StartGeneratingAll();
 	CHECK_RC(xnRetVal, "StartGenerating");	
 
 	return xnRetVal;
@@ -106,68 +288,182 @@ XnStatus KinectController::initDepthControl()
 // Update the XnOpenNI Depth & User tracking data for each frame of video captured
 XnStatus KinectController::update()
 {
-	// Restart all kinect processes every once in a while
-	if (iterations > maxIterate)
+	// Playback:	Take the next recorded frame instead of waiting for the camera
+	if (usePlayback)
+	{
+		if (iterations > maxIterate)
+			reset();
+		// a frame that does not decode: start over at the first one, and if that fails
+		// too, hand over to the Kinect, which the update() after this one opens in the background
+		if (!playback.read(&playbackDepth[0], &playbackLabels[0]))
+		{
+			playback.seek(0);
+			if (!playback.read(&playbackDepth[0], &playbackLabels[0]))
+			{
+				cout<<"Kinect "<<deviceIndex<<" could not read the recording, using the Kinect"<<endl;
+				playback.close();
+				usePlayback	= false;
+				retryTicks	= 0;
+				holdFrame();
+				return XN_STATUS_OK;
+			}
+		}
+		downsample(&playbackDepth[0], &playbackLabels[0]);
+		iterations++;
+		return xnRetVal;
+	}
+
+	// Restart all kinect processes every once in a while, in the background
+	if (iterations > maxIterate && device)
 		reset();
 
+	// Reset:	Take over the new context as soon as it is open; until then, and while the
+	//			Kinect is unplugged, keep delivering the last good frame
+	if (resetFinished)
+		finishReset();
+	if (!device)
+	{
+		if (!resetRunning && Profiler::getTicks() >= retryTicks)
+			reset();
+		holdFrame();
+		return XN_STATUS_OK;
+	}
+
 	// Context:	Wait for new data to be available 
-	xnRetVal = xnContext.WaitOneUpdateAll(xnDepthGenerator);
+	xnRetVal = device->xnContext.WaitOneUpdateAll(device->xnDepthGenerator);
+	if (xnRetVal != XN_STATUS_OK && ++lostFrames >= MAX_LOST_FRAMES)
+	{
+		cout<<"Kinect "<<deviceIndex<<" stopped delivering frames, reconnecting"<<endl;
+		reset();
+	}
 	CHECK_RC(xnRetVal, "UpdateAll");	
+	lostFrames = 0;
 	
 	// DepthGenerator:	Take current depth map 
-	const XnDepthPixel* pDepthMap	= xnDepthGenerator.GetDepthMap(); 
-	const XnDepthPixel* pDepth		= xnDepthMD.Data();
-	const XnLabel*		pLabels		= xnSceneMD.Data();
+	const XnDepthPixel* pDepthMap	= device->xnDepthGenerator.GetDepthMap(); 
+	const XnDepthPixel* pDepth		= device->xnDepthMD.Data();
+	const XnLabel*		pLabels		= device->xnSceneMD.Data();
 
 
-	// UserGenerator:	Define number of users to be tracked
-	XnUserID* userID	= new XnUserID [maxUsers];	
-	XnUInt16 nUsers		= maxUsers;	 
-	
 	// UserGenerator:	Get Tracked Users' IDs
-	xnUserGenerator.GetUsers(userID, nUsers);
+	XnUInt16 nUsers		= maxUsers;	 
+	device->xnUserGenerator.GetUsers(&userIDs[0], nUsers);
 	CHECK_RC(xnRetVal, "UserGenerator.GetUser");	
 	
+	if (recorder.isOpen())
+		recorder.write(pDepthMap, pLabels);
 
-	// Create temp matrices to store depth & user detection values before flip
-	Mat toflip_depthMatrix = Mat::zeros(480,640,CV_8UC1);
-	Mat toflip_usersMatrix = Mat::zeros(480,640,CV_8UC1);
+	// Threshold, mirror and downsample in one pass, straight from the OpenNI buffers
+	// into the preallocated output matrices
+	downsample(pDepthMap, pLabels);
+		
+	iterations++;
+	return xnRetVal;
+}
 
+// Deliver the last good frame again at the camera's pace, a little darker each time, so 
+// silhouettes fade from the wall instead of freezing on it during a long outage
+void KinectController::holdFrame()
+{
+	sleepMilliseconds(HOLD_FRAME_MS);
 
-	// Iterate through the current frame and store depth & user detection values in above matrices
-	for (int y = 0; y < Y_RES; y++)
+	for (int y = 0; y < outputRows; y++)
 	{
-		for (int x = 0; x < X_RES; x++)
+		uchar* depthOut = depthMatrix.ptr<uchar>(y);
+		uchar* usersOut = usersMatrix.ptr<uchar>(y);
+		for (int x = 0; x < outputCols; x++)
 		{
-			int ind = y*X_RES + x;
-			if (pDepthMap[ind] < depthThresh)	// only show if object at current pixel is within depth threshold
-			{
-				toflip_depthMatrix.data[ind] = -(pDepthMap[ind] * colorByDepth);
-				toflip_usersMatrix.data[ind] = pLabels[ind];
-			}
-			else								
-			{
-				toflip_depthMatrix.data[ind] = 0;
-				toflip_usersMatrix.data[ind] = 0;
-			}
+			depthOut[x] = (uchar)(depthOut[x] * 15 / 16);
+			if (!depthOut[x])
+				usersOut[x] = 0;
 		}
 	}
-	flip( toflip_depthMatrix, depthMatrix, 1 );
-	flip( toflip_usersMatrix, usersMatrix, 1 ); 
-		
-	iterations++;
-	return xnRetVal;
 }
 
 
-// Shutdown and restart all Kinect modules
-XnStatus KinectController::reset()
+// Shutdown and restart all Kinect modules on the reset thread
+void KinectController::reset()
 {
-	kinectCleanupExit();
 	iterations		= 0;
-	init   ();
-	update ();
-	return xnRetVal;
+	if (usePlayback || resetRunning)
+		return;
+
+	cout<<"Restarting Kinect "<<deviceIndex<<endl;
+	retiredDevice	= device;
+	openedDevice	= createDevice(nuiAngle);
+	device			= NULL;
+	lostFrames		= 0;
+	resetFinished	= false;
+	resetRunning	= true;
+	if (!resetThread.start(resetMain, this))
+	{
+		resetMain(this);  // no thread, restart in place
+	}
+}
+
+// Reset thread: the old context has to be shut down before the device can be opened again
+void KinectController::resetMain(void* controller)
+{
+	KinectController* kinect = (KinectController*)controller;
+
+	kinect->closeDevice(kinect->retiredDevice);
+	kinect->retiredDevice	= NULL;
+	kinect->openedDevice	= kinect->openDevice(kinect->openedDevice);
+	kinect->resetFinished	= true;
+}
+
+// Take over the connection opened by the reset thread
+void KinectController::finishReset()
+{
+	resetThread.join();
+	device			= openedDevice;
+	openedDevice	= NULL;
+	resetFinished	= resetRunning = false;
+
+	if (device)
+	{
+		// the angle may have been changed while the reset thread opened the device
+		if (device->motorAngle != nuiAngle)
+			SetNUIMotorPosition(device->nuiMotor, nuiAngle);
+		cout<<"Kinect "<<deviceIndex<<" restarted"<<endl;
+	}
+	else
+	{
+		cout<<"Kinect "<<deviceIndex<<" not found, retrying in "<<RECONNECT_DELAY<<" ms"<<endl;
+		retryTicks	= Profiler::getTicks() + RECONNECT_DELAY * Profiler::getTicksPerSecond() / 1000;
+	}
+}
+
+// Allocate a connection; it is opened by openDevice()
+KinectController::Device* KinectController::createDevice(int motorAngle)
+{
+	Device* dev		= new Device;
+	dev->nuiMotor	= NULL;
+	dev->motorAngle	= motorAngle;
+	return dev;
+}
+
+// Open a connection to the Kinect with all its modules
+KinectController::Device* KinectController::openDevice(Device* dev)
+{
+	if (initDepthControl(*dev) != XN_STATUS_OK)
+	{
+		closeDevice(dev);
+		return NULL;
+	}
+	initMotorControl(*dev);
+	return dev;
+}
+
+// Shutdown all modules of a connection
+void KinectController::closeDevice(Device* dev)
+{
+	if (!dev)
+		return;
+	dev->xnContext.Shutdown();
+	if (dev->nuiMotor)
+		DestroyNUIMotor(dev->nuiMotor);
+	delete dev;
 }
 
 /*! Set Depth Threshold		*/
@@ -180,18 +476,23 @@ void KinectController::setDepth(int depthDelta)
 // Shutdown function
 void KinectController:: kinectCleanupExit()
 {
-	stopDepthControl();
-	stopMotorControl(); 
+	if (usePlayback)
+		return;
+	resetThread.join();
+	closeDevice(device);
+	closeDevice(openedDevice);
+	device			= openedDevice = NULL;
+	resetRunning	= resetFinished = false;
 }
 
 /********************************//**
 *	Motor Control Modules
 ************************************/
-void KinectController::initMotorControl()
+void KinectController::initMotorControl(Device& dev)
 {
-	PCHAR serial	= GetNUIDeviceSerial(0);
-	nuiMotor		= CreateNUIMotor (serial);
-	SetNUIMotorPosition (nuiMotor, nuiAngle);
+	PCHAR serial	= GetNUIDeviceSerial(deviceIndex);
+	dev.nuiMotor	= CreateNUIMotor (serial);
+	SetNUIMotorPosition (dev.nuiMotor, dev.motorAngle);
 }
 
 // Set Motor angle [range: (top/down) 15000/-15000]
@@ -199,7 +500,8 @@ void KinectController::setMotorAngle(int angle)
 {
 	nuiAngle+= angle;
 	nuiAngle = (nuiAngle > 15000? 15000 : nuiAngle < -15000? -15000 : nuiAngle);
-	SetNUIMotorPosition(nuiMotor, nuiAngle);
+	if (device)
+		SetNUIMotorPosition(device->nuiMotor, nuiAngle);
 	cout<<"Motor Angle: "<<nuiAngle<<endl;
 }
 
@@ -207,7 +509,8 @@ void KinectController::setMotorAngle(int angle)
 void KinectController::resetMotorAngle()
 { 	
 	nuiAngle = initAngle; 
-	SetNUIMotorPosition(nuiMotor, nuiAngle);
+	if (device)
+		SetNUIMotorPosition(device->nuiMotor, nuiAngle);
 }
 
 /**
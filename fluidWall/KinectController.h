@@ -38,15 +38,23 @@
 #include <cxcore.h>
 #include <highgui.h>
 #include <iostream>
+#include <vector>
 
 //CL NUI includes
 #include <CLNUIDevice.h>
 
+#include "KinectRecording.h"
+#include "Threading.h"
+
 
 #define COLOR_RANGE		255
+#define LABEL_VOTES		16		// user labels counted by the majority vote, higher labels count as 0
 #define Y_RES			XN_VGA_Y_RES
 #define X_RES			XN_VGA_X_RES
 #define SAMPLE_XML_PATH "Data/SamplesConfig.xml"
+#define HOLD_FRAME_MS	33		// pace of update() while there is no camera, one camera frame
+#define MAX_LOST_FRAMES 3		// failed frames in a row before the Kinect is reopened
+#define RECONNECT_DELAY 2000	// ms between attempts to open a Kinect that is not there
 #define CHECK_RC(nRetVal, what)										\
 	if (nRetVal != XN_STATUS_OK)									\
 	{																\
@@ -73,17 +81,26 @@ public:
 	*							them (to clear the system every once in a while)
 	* @param	vDepth			variable to initialize the depth threshold for the Kinect camera
 	* @param	vMotor			variable to initialize the motor angle for the Kinect motor [up/down: +/-]
+	* @param	playbackPath	if set, frames are read from this recording file (see KinectRecorder)
+	*							instead of the camera, and the camera & motor are not used
+	* @param	deviceIndex		which of the connected Kinects to use, in the order OpenNI lists them
 	*/
 	KinectController    (	int userCount	= 6,	int iterationCount	= 10000, 
-							int depthValue	= 6000, int motorAngle		= 10000);
+							int depthValue	= 6000, int motorAngle		= 10000,
+							const char* playbackPath = NULL, int deviceIndex = 0);
 	~KinectController() {	kinectCleanupExit();	}
 	
 	/*! Initialize all KinectController variables & modules	*/
 	XnStatus init();
-	/*! Depth & User Tracking Modules	*/
+	/*! Update the XnOpenNI Depth & User tracking data for each frame of video captured. 
+	 *  While the Kinect is being reopened, the last good frame is delivered instead, fading
+	 *  out, at the camera's frame rate.	*/
 	XnStatus update();
-	/*! Update the XnOpenNI Depth & User tracking data for each frame of video captured */
-	XnStatus reset();
+	/*! Restart the Kinect modules. The old context is shut down and a new one opened on a
+	 *  background thread; update() takes it over with its first frame after that, so the 
+	 *  capture never stops. Frames that keep failing (e.g. the USB cable was pulled) start 
+	 *  the same restart, and it is retried until the Kinect is back.	*/
+	void reset();
 
 	/*! Set Depth Threshold		*/
 	void setDepth(int depthDelta);
@@ -92,6 +109,29 @@ public:
 	/*! Reset Kinect Motor to 'initAngle' value passed at intialization */
 	void resetMotorAngle();
 	
+	/*! Set the size of the depth & user matrices. update() downsamples the camera image to this size
+	 *  and mirrors it horizontally (and vertically if flipVertical is set) in the same pass.
+	 *  Each output pixel covers a rectangle of camera pixels: the depth is the average of the 
+	 *  silhouette pixels if they cover at least half of it, the user ID is the majority vote.
+	 *  The default is the full camera resolution, mirrored horizontally.		*/
+	void setOutputSize(int cols, int rows, bool flipVertical = false);
+
+	/*! Calibrate where the camera image lands in the output, as fractions of the output size: 
+	 *  the (mirrored) camera image is stretched over the rectangle left - left + width, 
+	 *  top - top + height, and output pixels outside of it stay 0. Several Kinects that cover
+	 *  different parts of a wall get the parts of one output grid this way, see KinectArray.
+	 *  The default is the whole output.		*/
+	void setCoverage(float left, float top, float width, float height);
+
+	/*! Start saving the camera depth & label frames that update() reads to a recording file, 
+	 *  which can be replayed by passing it as playbackPath. Returns false if it could not be created. */
+	bool startRecording(const char* path);
+	/*! Stop saving frames and close the recording file */
+	void stopRecording()	{	recorder.close();			}
+	bool isRecording()		{	return recorder.isOpen();	}
+	/*! True if frames are read from a recording file instead of the camera */
+	bool isPlayingBack()	{	return usePlayback;			}
+
 	/*! Get depth matrix for current video frame 	*/
 	Mat getDepthMat()		{	return depthMatrix; }
 	/*! Get matrix	of tracked users for current video frame */
@@ -100,12 +140,28 @@ public:
 private: 
 	// OPENNI DEPTH & USER TRACKING VARIABLES
 
-	xn::Context			xnContext;			/*! context object that creates depth and user data nodes	*/
-	xn::DepthGenerator	xnDepthGenerator;	/*! captures and returns depth values at each frame	*/
-	xn::UserGenerator	xnUserGenerator;	/*! captures and returns user detection data at each frame	*/
+	/*! One connection to the Kinect, opened and shut down as a whole	*/
+	struct Device
+	{
+		xn::Context			xnContext;			/*! context object that creates depth and user data nodes	*/
+		xn::DepthGenerator	xnDepthGenerator;	/*! captures and returns depth values at each frame	*/
+		xn::UserGenerator	xnUserGenerator;	/*! captures and returns user detection data at each frame	*/
+
+		xn::SceneMetaData	xnSceneMD;			/*! scene metadata: gives access to IDs of detected users at each pixel of a captured frame	*/
+		xn::DepthMetaData	xnDepthMD;			/*! depth metadata: gives access to depth data at each pixel of a captured frame	*/
+
+		CLNUIMotor			nuiMotor;			/*! motor object, NULL until created	*/
+		int					motorAngle;			/*! angle the motor is set to when it is created	*/
+	};
 
-	xn::SceneMetaData	xnSceneMD;			/*! scene metadata: gives access to IDs of detected users at each pixel of a captured frame	*/
-	xn::DepthMetaData	xnDepthMD;			/*! depth metadata: gives access to depth data at each pixel of a captured frame	*/
+	Device*			device;					/*! connection used by update(), NULL while there is none	*/
+	Device*			retiredDevice;			/*! connection the reset thread shuts down	*/
+	Device*			openedDevice;			/*! connection the reset thread opened, NULL if it failed	*/
+	Thread			resetThread;			/*! shuts down and reopens the Kinect for reset()	*/
+	volatile bool	resetRunning;			/*! resetThread has been started and not joined yet	*/
+	volatile bool	resetFinished;			/*! resetThread is done, openedDevice can be taken over	*/
+	long long		retryTicks;				/*! when update() may try to open a missing Kinect again	*/
+	int				lostFrames;				/*! failed frames in a row	*/
 
 
 	XnStatus xnRetVal;						/*! used to check the status of each call to an XNOpenNI function	*/
@@ -117,22 +173,58 @@ private:
 	Mat		depthMatrix;					/*! image-sized matrix containing the depth values at each pixel	*/
 	Mat		usersMatrix;					/*! image-sized matrix containing the userID's of detected people at		
 											/*! each pixel (or 0 if no detected user at that pixel)	*/
+	int		outputCols, outputRows;			/*! size of depthMatrix & usersMatrix	*/
+	bool	outputFlipped;					/*! depthMatrix & usersMatrix are also flipped vertically	*/
+	float	coverLeft, coverTop;			/*! part of the output the camera image is stretched over	*/
+	float	coverWidth, coverHeight;
+	int		deviceIndex;					/*! index of the Kinect among the connected ones	*/
+	vector<int>		 columnBegin, columnEnd;/*! camera columns [begin, end) covered by each output column (mirrored)	*/
+	vector<int>		 rowBegin, rowEnd;		/*! camera rows [begin, end) covered by each output row	*/
+	vector<int>		 depthSums;				/*! per output column: sum of the silhouette depth values in the rectangle	*/
+	vector<int>		 depthCounts;			/*! per output column: number of silhouette pixels in the rectangle	*/
+	vector<unsigned short> labelVotes;		/*! per output column: LABEL_VOTES counters for the majority vote	*/
+	vector<XnUserID> userIDs;				/*! IDs of the tracked users, filled by update()	*/
+
+	// RECORDING & PLAYBACK VARIABLES
+
+	KinectRecorder		 recorder;			/*! saves the camera frames while recording	*/
+	KinectPlayback		 playback;			/*! source of the frames in playback mode	*/
+	bool				 usePlayback;		/*! read frames from playback instead of the camera	*/
+	vector<XnDepthPixel> playbackDepth;		/*! camera sized buffers the recorded frames are read into	*/
+	vector<XnLabel>		 playbackLabels;
 	
 	// MOTOR CONTROL VARIABLES
 
-	CLNUIMotor	nuiMotor;					/*! motor object	*/
 	int			initAngle;					/*! motor's initial angle set at the start of program	*/
 	int			nuiAngle;					/*! motor's current angle	*/
 		
 
-	/*! Initialize XnOpenNI depth control & user tracking modules */
-	XnStatus initDepthControl();
-	/*! Destroy & shutdown XnOpenNI depth control & user tracking modules */
-	void stopDepthControl()		{	xnContext.Shutdown();		}
-	/*! Initialize CLNUI motor control modules	*/
-	void initMotorControl();
-	/*! Destroy & shutdown CLNUI motor control modules	*/
-	void stopMotorControl()		{	DestroyNUIMotor (nuiMotor); }
+	/*! Allocate the output matrices and rectangle tables for the current output size */
+	void initOutput();
+	/*! Fill the camera ranges [begin, end) covered by each of count output pixels along one axis */
+	void mapOutputAxis(int count, int cameraSize, float cover, float coverSize, bool flip,
+					   vector<int>& begin, vector<int>& end);
+
+	/*! Threshold, mirror and downsample the camera buffers into depthMatrix & usersMatrix */
+	void downsample(const XnDepthPixel* pDepthMap, const XnLabel* pLabels);
+
+	/*! Initialize XnOpenNI depth control & user tracking modules of a connection. Runs on
+	 *  the reset thread as well, so it only touches dev	*/
+	XnStatus initDepthControl(Device& dev);
+	/*! Initialize CLNUI motor control modules of a connection	*/
+	void initMotorControl(Device& dev);
+	/*! Allocate a connection that is not open yet	*/
+	Device* createDevice(int motorAngle);
+	/*! Open a connection created by createDevice(); closes it and returns NULL if that failed	*/
+	Device* openDevice(Device* dev);
+	/*! Destroy & shutdown the depth, user tracking and motor modules of a connection	*/
+	void closeDevice(Device* dev);
+	/*! Reset thread: shuts down retiredDevice and opens openedDevice	*/
+	static void resetMain(void* controller);
+	/*! Take over the connection opened by the reset thread	*/
+	void finishReset();
+	/*! Deliver the last good frame again, fading out, instead of a camera frame	*/
+	void holdFrame();
 	/*! Run Shutdown functions for Depth and Motor control 	*/
 	void kinectCleanupExit();
 };
@@ -0,0 +1,590 @@
+/**
+ * @file      KinectRecording.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "KinectRecording.h"
+#include <string.h>
+#include <algorithm>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+static const char   RECORDING_MAGIC[4]        = { 'F', 'W', 'K', 'R' };
+static const int    RECORDING_HEADER_BYTES    = 32;
+static const int    RECORDING_COUNT_OFFSET    = 20;			// frame count and index offset in the header
+static const int    FRAME_HEADER_BYTES        = 8;
+static const size_t MAPPING_WINDOW_BYTES      = 64 << 20;
+
+// control bytes of the run length code, see KinectRecording.h
+static const int    MAX_ZERO_RUN              = 0x80;
+static const int    LONG_ZERO_RUN             = 0xFF;
+static const int    MAX_LONG_ZERO_RUN         = 0x10000;
+static const int    SMALL_DELTAS              = 0x80;
+static const int    MAX_SMALL_DELTAS          = 0x40;
+static const int    LARGE_DELTAS              = 0xC0;
+static const int    MAX_LARGE_DELTAS          = 0x3F;
+
+
+
+static inline int wrapDelta(unsigned short delta)	{ return (short)delta;		 }
+static inline int wrapDelta(unsigned char delta)	{ return (signed char)delta; }
+
+static inline void putU16(unsigned char*& out, unsigned int value)
+{
+	*out++ = (unsigned char)(value & 0xFF);
+	*out++ = (unsigned char)(value >> 8);
+}
+
+static inline unsigned int getU32(const unsigned char* in)
+{
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((unsigned int)in[3] << 24);
+}
+
+static inline unsigned long long getU64(const unsigned char* in)
+{
+	return getU32(in) | ((unsigned long long)getU32(in + 4) << 32);
+}
+
+/**
+ * Upper bound of the coded size of count values. The worst case alternates small and large 
+ * deltas, every one its own run: 2 + 3 bytes per pair. Longer large runs cost at most 
+ * (1 + 2n) / n, and a large run of one is always followed by a run costing at most 2 bytes 
+ * per value, so no input averages more than 2.5 bytes per value.
+ */
+static size_t getMaxCodedBytes(int count)
+{
+	return 5 * (size_t)count / 2 + 16;
+}
+
+
+
+/**
+ * Run length codes the deltas from previous to current.
+ * @return   number of bytes written to out, at most getMaxCodedBytes(count)
+ */
+template <class T>
+static size_t encodeDeltas(const T* previous, const T* current, int count, unsigned char* out)
+{
+	unsigned char* begin = out;
+	int p = 0;
+	while (p < count) {
+		int run = 0;
+		while (p + run < count && current[p + run] == previous[p + run])
+			run++;
+
+		if (run > 0) {
+			p += run;
+			while (run > MAX_ZERO_RUN) {
+				int n = run < MAX_LONG_ZERO_RUN ? run : MAX_LONG_ZERO_RUN;
+				*out++ = LONG_ZERO_RUN;
+				putU16(out, n - 1);
+				run -= n;
+			}
+			if (run > 0)
+				*out++ = (unsigned char)(run - 1);
+			continue;
+		}
+
+		//literal run of deltas of the same width
+		int  delta   = wrapDelta((T)(current[p] - previous[p]));
+		bool isSmall = delta >= -128 && delta <= 127;
+		int  maxRun  = isSmall ? MAX_SMALL_DELTAS : MAX_LARGE_DELTAS;
+		int  n       = 0;
+		while (n < maxRun && p + n < count) {
+			delta = wrapDelta((T)(current[p + n] - previous[p + n]));
+			if (delta == 0 || isSmall != (delta >= -128 && delta <= 127))
+				break;
+			n++;
+		}
+
+		*out++ = (unsigned char)((isSmall ? SMALL_DELTAS : LARGE_DELTAS) + n - 1);
+		for (int k = 0; k < n; k++, p++) {
+			delta = wrapDelta((T)(current[p] - previous[p]));
+			if (isSmall)
+				*out++ = (unsigned char)delta;
+			else
+				putU16(out, delta & 0xFFFF);
+		}
+	}
+	return out - begin;
+}
+
+
+
+/**
+ * Adds run length coded deltas to values.
+ * @return   false if the data is corrupt or does not cover exactly count values
+ */
+template <class T>
+static bool decodeDeltas(const unsigned char* in, size_t bytes, T* values, int count)
+{
+	const unsigned char* end = in + bytes;
+	int p = 0;
+	while (in < end) {
+		int control = *in++;
+		if (control < SMALL_DELTAS) {
+			p += control + 1;
+		}
+		else if (control == LONG_ZERO_RUN) {
+			if (end - in < 2)
+				return false;
+			p  += (in[0] | (in[1] << 8)) + 1;
+			in += 2;
+		}
+		else if (control < LARGE_DELTAS) {
+			int n = control - SMALL_DELTAS + 1;
+			if (p + n > count || end - in < n)
+				return false;
+			for (int k = 0; k < n; k++, p++)
+				values[p] = (T)(values[p] + (signed char)*in++);
+		}
+		else {
+			int n = control - LARGE_DELTAS + 1;
+			if (p + n > count || end - in < 2 * n)
+				return false;
+			for (int k = 0; k < n; k++, p++, in += 2)
+				values[p] = (T)(values[p] + (in[0] | (in[1] << 8)));
+		}
+		if (p > count)
+			return false;
+	}
+	return p == count;
+}
+
+
+
+KinectRecorder::KinectRecorder(void)
+{
+	file_   = NULL;
+	cols_   = rows_ = 0;
+	offset_ = 0;
+}
+
+
+
+KinectRecorder::~KinectRecorder(void)
+{
+	close();
+}
+
+
+
+bool KinectRecorder::open(const char* path, int cols, int rows)
+{
+	close();
+
+	file_ = fopen(path, "wb");
+	if (!file_)
+		return false;
+
+	//frame count and index offset stay 0 until close()
+	int                header[5]   = { KINECT_RECORDING_VERSION, cols, rows, KINECT_KEY_FRAME_INTERVAL, 0 };
+	unsigned long long indexOffset = 0;
+	fwrite(RECORDING_MAGIC, 1, sizeof(RECORDING_MAGIC), file_);
+	fwrite(header, sizeof(int), 5, file_);
+	fwrite(&indexOffset, sizeof(indexOffset), 1, file_);
+
+	int pixels = cols * rows;
+	cols_   = cols;
+	rows_   = rows;
+	offset_ = RECORDING_HEADER_BYTES;
+	frameOffsets_.clear();
+	depth_.assign(pixels, 0);
+	labels_.assign(pixels, 0);
+	labelBytes_.resize(pixels);
+	encoded_.resize(2 * getMaxCodedBytes(pixels));	//depth and labels
+	return true;
+}
+
+
+
+void KinectRecorder::write(const unsigned short* depth, const unsigned short* labels)
+{
+	if (!file_)
+		return;
+
+	int pixels = cols_ * rows_;
+	if (frameOffsets_.size() % KINECT_KEY_FRAME_INTERVAL == 0) {
+		fill(depth_.begin(),  depth_.end(),  0);
+		fill(labels_.begin(), labels_.end(), 0);
+	}
+	for (int p = 0; p < pixels; p++)
+		labelBytes_[p] = (unsigned char)(labels[p] < 255 ? labels[p] : 255);
+
+	unsigned char* out        = &encoded_[0];
+	unsigned int   sizes[2];
+	sizes[0] = (unsigned int)encodeDeltas(&depth_[0], depth, pixels, out);
+	sizes[1] = (unsigned int)encodeDeltas(&labels_[0], &labelBytes_[0], pixels, out + sizes[0]);
+
+	fwrite(sizes, sizeof(unsigned int), 2, file_);
+	fwrite(out, 1, sizes[0] + sizes[1], file_);
+
+	frameOffsets_.push_back(offset_);
+	offset_ += FRAME_HEADER_BYTES + sizes[0] + sizes[1];
+
+	//the next frame is coded against this one
+	memcpy(&depth_[0],  depth,            pixels * sizeof(unsigned short));
+	memcpy(&labels_[0], &labelBytes_[0], pixels);
+}
+
+
+
+void KinectRecorder::close()
+{
+	if (!file_)
+		return;
+
+	int                frameCount  = (int)frameOffsets_.size();
+	unsigned long long indexOffset = offset_;
+	if (frameCount > 0)
+		fwrite(&frameOffsets_[0], sizeof(unsigned long long), frameCount, file_);
+
+	fseek(file_, RECORDING_COUNT_OFFSET, SEEK_SET);
+	fwrite(&frameCount, sizeof(int), 1, file_);
+	fwrite(&indexOffset, sizeof(indexOffset), 1, file_);
+	fclose(file_);
+	file_ = NULL;
+}
+
+
+
+MappedFile::MappedFile(void)
+{
+	file_         = NULL;
+	mapping_      = NULL;
+	size_         = 0;
+	window_       = NULL;
+	windowOffset_ = 0;
+	windowBytes_  = 0;
+}
+
+
+
+MappedFile::~MappedFile(void)
+{
+	close();
+}
+
+
+
+const unsigned char* MappedFile::view(unsigned long long offset, size_t bytes)
+{
+	if (offset > size_ || bytes > size_ - offset)
+		return NULL;
+	if (window_ && offset >= windowOffset_ && offset + bytes <= windowOffset_ + windowBytes_)
+		return window_ + (offset - windowOffset_);
+
+	unmapWindow();
+
+	//views have to start at a multiple of the allocation granularity
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	unsigned long long granularity = info.dwAllocationGranularity;
+#else
+	unsigned long long granularity = sysconf(_SC_PAGESIZE);
+#endif
+	unsigned long long begin = offset - offset % granularity;
+	unsigned long long end   = offset + (bytes > MAPPING_WINDOW_BYTES ? bytes : MAPPING_WINDOW_BYTES);
+	if (end > size_)
+		end = size_;
+
+#ifdef _WIN32
+	void* window = MapViewOfFile(mapping_, FILE_MAP_READ, (DWORD)(begin >> 32), (DWORD)begin, (SIZE_T)(end - begin));
+	if (!window)
+		return NULL;
+#else
+	void* window = mmap(NULL, (size_t)(end - begin), PROT_READ, MAP_PRIVATE, (int)(size_t)file_, (off_t)begin);
+	if (window == MAP_FAILED)
+		return NULL;
+#endif
+
+	window_       = (const unsigned char*)window;
+	windowOffset_ = begin;
+	windowBytes_  = (size_t)(end - begin);
+	return window_ + (offset - windowOffset_);
+}
+
+
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, 
+							  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	file_    = file;
+	mapping_ = mapping;
+	size_    = size.QuadPart;
+	return true;
+}
+
+
+
+void MappedFile::unmapWindow()
+{
+	if (window_)
+		UnmapViewOfFile(window_);
+	window_ = NULL;
+}
+
+
+
+void MappedFile::close()
+{
+	unmapWindow();
+	if (mapping_)
+		CloseHandle(mapping_);
+	if (file_)
+		CloseHandle(file_);
+	file_    = mapping_ = NULL;
+	size_    = 0;
+}
+
+#else
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+	int file = ::open(path, O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size <= 0) {
+		::close(file);
+		return false;
+	}
+
+	file_ = (void*)(size_t)file;
+	size_ = status.st_size;
+	return true;
+}
+
+
+
+void MappedFile::unmapWindow()
+{
+	if (window_)
+		munmap((void*)window_, windowBytes_);
+	window_ = NULL;
+}
+
+
+
+void MappedFile::close()
+{
+	unmapWindow();
+	if (size_ > 0)
+		::close((int)(size_t)file_);
+	file_ = NULL;
+	size_ = 0;
+}
+
+#endif
+
+
+
+KinectPlayback::KinectPlayback(void)
+{
+	cols_ = rows_     = 0;
+	keyFrameInterval_ = KINECT_KEY_FRAME_INTERVAL;
+	decodedFrame_     = -1;
+	nextFrame_        = 0;
+	loops_            = 0;
+}
+
+
+
+KinectPlayback::~KinectPlayback(void)
+{
+	close();
+}
+
+
+
+bool KinectPlayback::open(const char* path)
+{
+	close();
+	if (!file_.open(path))
+		return false;
+
+	const unsigned char* header = file_.view(0, RECORDING_HEADER_BYTES);
+	if (!header || memcmp(header, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0 ||
+		(int)getU32(header + 4) != KINECT_RECORDING_VERSION) {
+		close();
+		return false;
+	}
+
+	cols_                          = (int)getU32(header + 8);
+	rows_                          = (int)getU32(header + 12);
+	keyFrameInterval_              = (int)getU32(header + 16);
+	int                frameCount  = (int)getU32(header + RECORDING_COUNT_OFFSET);
+	unsigned long long indexOffset = getU64(header + RECORDING_COUNT_OFFSET + 4);
+	if (cols_ <= 0 || rows_ <= 0 || keyFrameInterval_ <= 0) {
+		close();
+		return false;
+	}
+
+	//a recording that was not closed has no index
+	if (!readIndex(indexOffset, frameCount) && !scanFrames(RECORDING_HEADER_BYTES)) {
+		close();
+		return false;
+	}
+
+	depth_.assign(cols_ * rows_, 0);
+	labels_.assign(cols_ * rows_, 0);
+	decodedFrame_ = -1;
+	nextFrame_    = 0;
+	loops_        = 0;
+	return true;
+}
+
+
+
+bool KinectPlayback::readIndex(unsigned long long indexOffset, int frameCount)
+{
+	if (indexOffset == 0 || frameCount <= 0)
+		return false;
+
+	const unsigned char* index = file_.view(indexOffset, frameCount * sizeof(unsigned long long));
+	if (!index)
+		return false;
+
+	frameOffsets_.resize(frameCount);
+	for (int f = 0; f < frameCount; f++)
+		frameOffsets_[f] = getU64(index + f * sizeof(unsigned long long));
+	return true;
+}
+
+
+
+bool KinectPlayback::scanFrames(unsigned long long dataOffset)
+{
+	frameOffsets_.clear();
+
+	//a frame cut short by the end of the file is dropped
+	unsigned long long offset = dataOffset;
+	const unsigned char* frame;
+	while ((frame = file_.view(offset, FRAME_HEADER_BYTES)) != NULL) {
+		unsigned long long bytes = FRAME_HEADER_BYTES + (unsigned long long)getU32(frame) + getU32(frame + 4);
+		if (offset + bytes > file_.getSize())
+			break;
+		frameOffsets_.push_back(offset);
+		offset += bytes;
+	}
+	return !frameOffsets_.empty();
+}
+
+
+
+bool KinectPlayback::decodeFrame(int frame)
+{
+	//delta frames need the frame before them, otherwise start from the key frame
+	int first = (frame % keyFrameInterval_ != 0 && decodedFrame_ == frame - 1) ? frame 
+				: frame - frame % keyFrameInterval_;
+
+	int pixels = cols_ * rows_;
+	for (int f = first; f <= frame; f++) {
+		if (f % keyFrameInterval_ == 0) {
+			fill(depth_.begin(),  depth_.end(),  0);
+			fill(labels_.begin(), labels_.end(), 0);
+		}
+
+		decodedFrame_ = -1;
+		const unsigned char* sizes = file_.view(frameOffsets_[f], FRAME_HEADER_BYTES);
+		if (!sizes)
+			return false;
+		size_t depthBytes = getU32(sizes), labelBytes = getU32(sizes + 4);
+
+		const unsigned char* data = file_.view(frameOffsets_[f] + FRAME_HEADER_BYTES, depthBytes + labelBytes);
+		if (!data || 
+			!decodeDeltas(data,              depthBytes, &depth_[0],  pixels) ||
+			!decodeDeltas(data + depthBytes, labelBytes, &labels_[0], pixels))
+			return false;
+		decodedFrame_ = f;
+	}
+	return true;
+}
+
+
+
+bool KinectPlayback::read(unsigned short* depth, unsigned short* labels)
+{
+	if (frameOffsets_.empty())
+		return false;
+
+	//end of the recording: start over at the first frame
+	if (nextFrame_ >= (int)frameOffsets_.size()) {
+		nextFrame_ = 0;
+		loops_++;
+	}
+
+	if (!decodeFrame(nextFrame_))
+		return false;
+	nextFrame_++;
+
+	int pixels = cols_ * rows_;
+	memcpy(depth, &depth_[0], pixels * sizeof(unsigned short));
+	for (int p = 0; p < pixels; p++)
+		labels[p] = labels_[p];
+	return true;
+}
+
+
+
+void KinectPlayback::seek(int frame)
+{
+	int frameCount = (int)frameOffsets_.size();
+	nextFrame_ = frame < 0 ? 0 : (frame > frameCount ? frameCount : frame);
+}
+
+
+
+void KinectPlayback::close()
+{
+	file_.close();
+	frameOffsets_.clear();
+	cols_ = rows_ = 0;
+	decodedFrame_ = -1;
+}
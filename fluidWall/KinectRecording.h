@@ -0,0 +1,198 @@
+/**
+ * @file      KinectRecording.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+#include <stdio.h>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Recording file of Kinect depth and user label frames, so sessions can be replayed without
+ * a camera, e.g. by KinectController or the benchmark.
+ *
+ * The file starts with a header: the magic "FWKR", then the format version, the frame width,
+ * the frame height, the key frame interval and the frame count as 32 bit integers, and the
+ * 64 bit file offset of the frame index. Then follow the frames, each the byte sizes of its
+ * depth and label data (32 bits each) followed by the data. The frame index at the end holds
+ * the 64 bit file offset of every frame. Values are stored in x86 (little endian) byte order.
+ *
+ * Frames are delta coded against the previous frame: most of a wall installation is static,
+ * so most deltas are 0. Every key frame interval frames, a key frame is coded against an all
+ * zero frame, so a frame can be decoded from the key frame before it. The deltas are run
+ * length coded, one control byte per run:
+ *
+ *   0x00 - 0x7F   c + 1 zero deltas
+ *   0x80 - 0xBF   c - 0x7F small deltas follow, one signed byte each
+ *   0xC0 - 0xFE   c - 0xBF large deltas follow, two bytes each (depth only)
+ *   0xFF          a 16 bit count n follows: n + 1 zero deltas
+ *
+ * Labels are stored in 8 bits; OpenNI never tracks more than 255 users, so nothing is lost.
+ * If a recording was not closed, e.g. after a crash, the header has no frame index and
+ * KinectPlayback rebuilds it from the frame sizes.
+ */
+const static int KINECT_RECORDING_VERSION = 2;
+const static int KINECT_KEY_FRAME_INTERVAL = 30;  // one key frame per second of camera frames
+
+/**
+ * Appends frames to a recording file. Encoding reuses buffers allocated by open().
+ */
+class KinectRecorder
+{
+public:
+	KinectRecorder(void);
+	~KinectRecorder(void);
+
+	/**
+	 * Creates a recording file, replacing its contents, and writes the header.
+	 * @param path   file to write
+	 * @param cols   frame width in pixels
+	 * @param rows   frame height in pixels
+	 * @return       false if the file could not be created
+	 */
+	bool open(const char* path, int cols, int rows);
+
+	/**
+	 * Appends a frame.
+	 * @param depth   cols * rows depth values, row by row
+	 * @param labels  cols * rows user labels, row by row
+	 */
+	void write(const unsigned short* depth, const unsigned short* labels);
+
+	/**
+	 * Writes the frame index, completes the header and closes the file.
+	 */
+	void close();
+	bool isOpen()         { return file_ != NULL; }
+	int  getFrameCount()  { return (int)frameOffsets_.size(); }
+
+	/**
+	 * Returns the number of bytes written so far, to compare with the raw frame size.
+	 */
+	unsigned long long getBytesWritten()  { return offset_; }
+
+private:
+	FILE*                      file_;
+	int                        cols_, rows_;
+	unsigned long long         offset_;        // file offset of the next frame
+	vector<unsigned long long> frameOffsets_;  // frame index
+	vector<unsigned short>     depth_;         // previous frame, all zero before a key frame
+	vector<unsigned char>      labels_;
+	vector<unsigned char>      labelBytes_;    // labels of the current frame in 8 bits
+	vector<unsigned char>      encoded_;       // coded depth, then coded labels
+
+	KinectRecorder(const KinectRecorder&);
+	KinectRecorder& operator=(const KinectRecorder&);
+};
+
+/**
+ * Read only memory mapping of a file. Files larger than the address space of a 32 bit
+ * process are mapped through a sliding window: view() moves the window when the requested
+ * range is outside of it.
+ */
+class MappedFile
+{
+public:
+	MappedFile(void);
+	~MappedFile(void);
+
+	bool open(const char* path);
+	void close();
+	bool isOpen()                  { return size_ > 0; }
+	unsigned long long getSize()   { return size_; }
+
+	/**
+	 * Returns a pointer to bytes [offset, offset + bytes) of the file, valid until the next
+	 * call, or NULL if the range is outside of the file.
+	 */
+	const unsigned char* view(unsigned long long offset, size_t bytes);
+
+private:
+	void*                file_;      // HANDLE on Windows, file descriptor elsewhere
+	void*                mapping_;   // HANDLE of the file mapping on Windows
+	unsigned long long   size_;
+	const unsigned char* window_;    // mapped window of the file
+	unsigned long long   windowOffset_;
+	size_t               windowBytes_;
+
+	void unmapWindow();
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
+/**
+ * Reads the frames of a recording file. The file is memory mapped and frames are decoded
+ * on demand into buffers allocated by open(), so playback allocates nothing per frame.
+ * After the last frame, reading starts over at the first one, so a short recording can 
+ * drive an arbitrarily long run.
+ */
+class KinectPlayback
+{
+public:
+	KinectPlayback(void);
+	~KinectPlayback(void);
+
+	/**
+	 * Opens a recording file and reads its header and frame index.
+	 * @return   false if the file could not be opened or is not a recording
+	 */
+	bool open(const char* path);
+
+	/**
+	 * Reads the next frame.
+	 * @param depth   receives cols * rows depth values
+	 * @param labels  receives cols * rows user labels
+	 * @return        false if the recording holds no complete frame
+	 */
+	bool read(unsigned short* depth, unsigned short* labels);
+
+	/**
+	 * Makes frame the next frame read. Only the frames from the key frame before it are
+	 * decoded, and only once it is read.
+	 */
+	void seek(int frame);
+
+	void close();
+	bool isOpen()         { return file_.isOpen(); }
+	int  getCols()        { return cols_; }
+	int  getRows()        { return rows_; }
+	int  getFrameCount()  { return (int)frameOffsets_.size(); }
+	int  getLoopCount()   { return loops_; }  // times reading started over
+
+private:
+	MappedFile                 file_;
+	int                        cols_, rows_;
+	int                        keyFrameInterval_;
+	vector<unsigned long long> frameOffsets_;
+	vector<unsigned short>     depth_;          // last decoded frame
+	vector<unsigned char>      labels_;
+	int                        decodedFrame_;   // frame in depth_ and labels_, -1 if none
+	int                        nextFrame_;
+	int                        loops_;
+
+	bool readIndex(unsigned long long indexOffset, int frameCount);
+	bool scanFrames(unsigned long long dataOffset);
+	bool decodeFrame(int frame);
+
+	KinectPlayback(const KinectPlayback&);
+	KinectPlayback& operator=(const KinectPlayback&);
+};
@@ -0,0 +1,488 @@
+/**
+ * @file      MultigridSolver.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "MultigridSolver.h"
+#include <math.h>
+#include <algorithm>
+
+#define LX(w,i,j) ((i)+((w)+2)*(j))
+
+#define MIN_LEVEL_N     4     //stop coarsening once a level is this narrow or this short
+#define PRE_SWEEPS      2     //smoothing sweeps before restriction
+#define POST_SWEEPS     2     //smoothing sweeps after prolongation
+#define COARSEST_SWEEPS 20    //sweeps used to "solve" the coarsest level
+#define MIN_PARALLEL_N  32    //levels with fewer rows than this are smoothed on one thread
+#define MIN_RESIDUAL    1e-7f //right hand sides below this have nothing to solve
+
+
+
+MultigridSolver::MultigridSolver(int width, int height)
+{
+	width_    = width;
+	height_   = height;
+	residual_ = 0.0f;
+
+	int w = width, h = height;
+	while (true) {
+		Level level;
+		int size = (w + 2) * (h + 2);
+		level.w = w;
+		level.h = h;
+		level.e.assign(size, 0.0f);
+		level.r.assign(size, 0.0f);
+		level.solid.assign(size, 1);
+		level.wx.assign(size, 0.0f);
+		level.wy.assign(size, 0.0f);
+		level.invDiag.assign(size, 0.0f);
+		levels_.push_back(level);
+
+		//both dimensions are halved together, so coarse cells stay square
+		if (w <= MIN_LEVEL_N || h <= MIN_LEVEL_N)
+			break;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+
+	//sized for the worst case up front, so labelling the regions never allocates
+	int cells = (width + 2) * (height + 2);
+	region_.assign(cells, -1);
+	regionStack_.reserve(cells);
+	regionSum_.reserve(cells / 2 + 1);
+	regionOffset_.reserve(cells / 2 + 1);
+	regionCount_.reserve(cells / 2 + 1);
+}
+
+
+
+MultigridSolver::~MultigridSolver(void)
+{
+}
+
+
+
+float MultigridSolver::getResidual()
+{
+	return residual_;
+}
+
+
+
+int MultigridSolver::getLevelCount()
+{
+	return (int)levels_.size();
+}
+
+
+
+void MultigridSolver::restrictBounds(const bool* bounds)
+{
+	Level& fine = levels_[0];
+	const int fw = width_ + 2;
+	int i, j;
+
+	//a fine face is open when the cells on both sides are fluid. The buffer ring stays 
+	//solid, so the faces of row and column 0 stay closed.
+	for (j = 1; j <= height_; j++)
+		for (i = 1; i <= width_; i++) {
+			int idx = LX(width_,i,j);
+			fine.solid[idx] = bounds[idx] ? 1 : 0;
+			fine.wx[idx-1]  = (fine.solid[idx-1]  || bounds[idx]) ? 0.0f : 1.0f;
+			fine.wy[idx-fw] = (fine.solid[idx-fw] || bounds[idx]) ? 0.0f : 1.0f;
+		}
+	finishLevel(0);
+
+	for (int l = 1; l < (int)levels_.size(); l++) {
+		Level& parent = levels_[l-1];
+		Level& level  = levels_[l];
+		int pw = parent.w, ph = parent.h;
+		int w  = level.w,  h  = level.h;
+
+		//a coarse face passes half the flux of the fine faces it covers, so that fully open 
+		//faces keep weight 1 and faces half blocked by a boundary stay half open, instead of 
+		//the whole coarse cell turning into a wall or into fluid
+		for (int J = 1; J <= h; J++)
+			for (int I = 1; I <= w; I++) {
+				float wx = 0.0f, wy = 0.0f;
+				if (I < w)
+					for (j = 2*J-1; j <= 2*J && j <= ph; j++)
+						wx += parent.wx[LX(pw,2*I,j)];
+				if (J < h)
+					for (i = 2*I-1; i <= 2*I && i <= pw; i++)
+						wy += parent.wy[LX(pw,i,2*J)];
+				level.wx[LX(w,I,J)] = 0.5f * wx;
+				level.wy[LX(w,I,J)] = 0.5f * wy;
+			}
+		finishLevel(l);
+	}
+
+	labelRegions();
+}
+
+
+
+int MultigridSolver::solve(float* x, const float* b, float tolerance, int maxIterations)
+{
+	Level& fine = levels_[0];
+	int iterations = 0;
+
+	//keeps the previous solution as the initial guess, minus its constant offset
+	float residual;
+	float maxB = loadRightHandSide(b, residual);
+
+	if (maxB > MIN_RESIDUAL) {
+		while (residual > tolerance * maxB && iterations < maxIterations) {
+			vCycle(0);
+			iterations++;
+
+			//the residual of the last V-cycle comes with writing the solution
+			if (iterations < maxIterations)
+				residual = computeResidual(0);
+		}
+	}
+	else
+		fine.e.assign(fine.e.size(), 0.0f);
+
+	residual = writeSolution(x);
+	residual_ = (maxB > MIN_RESIDUAL) ? residual / maxB : 0.0f;
+	return iterations;
+}
+
+
+
+///protected functions
+float MultigridSolver::writeSolution(float* x)
+{
+	Level& fine = levels_[0];
+	const int W = width_, H = height_;
+	const int w = W + 2;
+	float maxResidual = 0.0f;
+	int i, j;
+
+	for (j = 1; j <= H; j++)
+		for (i = 1; i <= W; i++) {
+			int idx = LX(W,i,j);
+			if (!fine.solid[idx]) {
+				x[idx] = fine.e[idx];
+				float residual = fabs(residualAt(fine, idx));
+				if (residual > maxResidual) maxResidual = residual;
+				continue;
+			}
+
+			//boundary cells get the average of their fluid neighbors, so the pressure 
+			//gradient across every fluid/boundary face is zero
+			float sum = 0.0f, weight = 0.0f;
+			if (!fine.solid[idx-1]) { sum += fine.e[idx-1]; weight += 1.0f; }
+			if (!fine.solid[idx+1]) { sum += fine.e[idx+1]; weight += 1.0f; }
+			if (!fine.solid[idx-w]) { sum += fine.e[idx-w]; weight += 1.0f; }
+			if (!fine.solid[idx+w]) { sum += fine.e[idx+w]; weight += 1.0f; }
+			x[idx] = (weight > 0.0f) ? sum / weight : 0.0f;
+		}
+
+	//walls and corners mirror the nearest interior cell
+	for (j = 1; j <= H; j++) {
+		x[LX(W,0,  j)] = x[LX(W,1,j)];
+		x[LX(W,W+1,j)] = x[LX(W,W,j)];
+	}
+	for (i = 1; i <= W; i++) {
+		x[LX(W,i,  0)] = x[LX(W,i,1)];
+		x[LX(W,i,H+1)] = x[LX(W,i,H)];
+	}
+	x[LX(W,0,  0  )] = 0.5f * (x[LX(W,1,0  )] + x[LX(W,0,  1)]);
+	x[LX(W,0,  H+1)] = 0.5f * (x[LX(W,1,H+1)] + x[LX(W,0,  H)]);
+	x[LX(W,W+1,0  )] = 0.5f * (x[LX(W,W,0  )] + x[LX(W,W+1,1)]);
+	x[LX(W,W+1,H+1)] = 0.5f * (x[LX(W,W,H+1)] + x[LX(W,W+1,H)]);
+	return maxResidual;
+}
+
+
+
+float MultigridSolver::loadRightHandSide(const float* b, float& maxResidual)
+{
+	Level& fine = levels_[0];
+	float*       r        = &fine.r[0];
+	float*       e        = &fine.e[0];
+	const float* wx       = &fine.wx[0];
+	const float* wy       = &fine.wy[0];
+	const int*   region   = &region_[0];
+	const int    size     = (int)fine.r.size();
+	const int    nRegions = (int)regionCount_.size();
+	const int    w        = width_ + 2;
+	float        maxValue = 0.0f;
+	int          k;
+
+	//sums per region of the right hand side into regionSum_, of the solution into regionOffset_
+	fill(regionSum_.begin(),    regionSum_.end(),    0.0);
+	fill(regionOffset_.begin(), regionOffset_.end(), 0.0);
+	fill(regionCount_.begin(),  regionCount_.end(),  0);
+	for (k = 0; k < size; k++) {
+		int n = region[k];
+		if (n < 0) {
+			r[k] = 0.0f;
+			continue;
+		}
+		r[k] = b[k];
+		regionSum_[n] += b[k];
+		regionOffset_[n] += e[k];
+		regionCount_[n]++;
+	}
+
+	for (int n = 0; n < nRegions; n++) {
+		regionSum_[n] /= regionCount_[n];
+		regionOffset_[n] /= regionCount_[n];
+	}
+	maxResidual = 0.0f;
+	for (k = 0; k < size; k++) {
+		int n = region[k];
+		if (n < 0)
+			continue;
+		float offset = (float)regionOffset_[n];
+		r[k] -= (float)regionSum_[n];
+		if (fabs(r[k]) > maxValue) maxValue = fabs(r[k]);
+
+		//the residual of the initial guess on the way. The cells before k are already
+		//shifted, by the offset of this region wherever the face to them is open.
+		float sum  = wx[k-1] * (e[k-1] + offset) + wx[k] * e[k+1] 
+				   + wy[k-w] * (e[k-w] + offset) + wy[k] * e[k+w];
+		float diag = wx[k-1] + wx[k] + wy[k-w] + wy[k];
+		float residual = fabs(r[k] - (diag * e[k] - sum));
+		if (residual > maxResidual) maxResidual = residual;
+
+		e[k] -= offset;
+	}
+	return maxValue;
+}
+
+
+
+void MultigridSolver::labelRegions()
+{
+	Level& fine = levels_[0];
+	const int            fw    = width_ + 2;
+	const unsigned char* solid = &fine.solid[0];
+	int*                 region = &region_[0];
+
+	fill(region_.begin(), region_.end(), -1);
+	regionSum_.clear();
+	regionOffset_.clear();
+	regionCount_.clear();
+
+	for (int start = 0; start < (int)region_.size(); start++) {
+		if (solid[start] || region[start] >= 0)
+			continue;
+
+		//scanline flood fill: label a whole run of a row at once, then queue the runs it
+		//touches in the rows above and below. The buffer ring is solid, so runs end in it.
+		int n = (int)regionCount_.size();
+		regionSum_.push_back(0.0);
+		regionOffset_.push_back(0.0);
+		regionCount_.push_back(0);
+		regionStack_.clear();
+		regionStack_.push_back(start);
+		while (!regionStack_.empty()) {
+			int seed = regionStack_.back();
+			regionStack_.pop_back();
+			if (region[seed] >= 0)
+				continue;
+
+			int left = seed, right = seed;
+			while (!solid[left - 1])  left--;
+			while (!solid[right + 1]) right++;
+			for (int idx = left; idx <= right; idx++)
+				region[idx] = n;
+
+			for (int row = -fw; row <= fw; row += 2 * fw) {
+				bool inRun = false;
+				for (int idx = left + row; idx <= right + row; idx++) {
+					bool isOpen = !solid[idx] && region[idx] < 0;
+					if (isOpen && !inRun)
+						regionStack_.push_back(idx);
+					inRun = isOpen;
+				}
+			}
+		}
+	}
+}
+
+
+
+void MultigridSolver::finishLevel(int l)
+{
+	Level& level = levels_[l];
+	const int n = level.w;
+	const int w = n + 2;
+
+	for (int j = 1; j <= level.h; j++)
+		for (int i = 1; i <= n; i++) {
+			int idx = LX(n,i,j);
+			float diag = level.wx[idx-1] + level.wx[idx] + level.wy[idx-w] + level.wy[idx];
+
+			//coarse cells without a single open face drop out like boundary cells
+			if (l > 0)
+				level.solid[idx] = (diag == 0.0f) ? 1 : 0;
+			level.invDiag[idx] = (diag == 0.0f || level.solid[idx]) ? 0.0f : 1.0f / diag;
+		}
+}
+
+
+
+void MultigridSolver::smooth(int l, int sweeps)
+{
+	Level& level = levels_[l];
+	const int    n       = level.w;
+	const int    h       = level.h;
+	const int    w       = n + 2;
+	float*       e       = &level.e[0];
+	const float* r       = &level.r[0];
+	const float* wx      = &level.wx[0];
+	const float* wy      = &level.wy[0];
+	const float* invDiag = &level.invDiag[0];
+
+	for (int k = 0; k < sweeps; k++) {
+		for (int color = 0; color < 2; color++) {
+			#pragma omp parallel for schedule(static) if(h >= MIN_PARALLEL_N)
+			for (int j = 1; j <= h; j++) {
+				for (int i = 1 + ((1 + j + color) & 1); i <= n; i += 2) {
+					int idx = LX(n,i,j);
+
+					//closed faces have weight 0, and boundary cells an inverse diagonal of 0
+					float sum = wx[idx-1] * e[idx-1] + wx[idx] * e[idx+1] 
+							  + wy[idx-w] * e[idx-w] + wy[idx] * e[idx+w];
+					e[idx] = (r[idx] + sum) * invDiag[idx];
+				}
+			}
+		}
+	}
+}
+
+
+
+float MultigridSolver::residualAt(const Level& level, int idx)
+{
+	//closed faces have weight 0, so boundary cells, whose right hand side is 0, have none
+	const int    w  = level.w + 2;
+	const float* e  = &level.e[0];
+	const float* wx = &level.wx[0];
+	const float* wy = &level.wy[0];
+
+	float sum  = wx[idx-1] * e[idx-1] + wx[idx] * e[idx+1] + wy[idx-w] * e[idx-w] + wy[idx] * e[idx+w];
+	float diag = wx[idx-1] + wx[idx] + wy[idx-w] + wy[idx];
+	return level.r[idx] - (diag * e[idx] - sum);
+}
+
+
+
+float MultigridSolver::computeResidual(int l)
+{
+	const Level& level = levels_[l];
+	const int n = level.w;
+	float maxResidual = 0.0f;
+
+	for (int j = 1; j <= level.h; j++)
+		for (int i = 1; i <= n; i++) {
+			float residual = fabs(residualAt(level, LX(n,i,j)));
+			if (residual > maxResidual) maxResidual = residual;
+		}
+
+	return maxResidual;
+}
+
+
+
+void MultigridSolver::restrictResidual(int l)
+{
+	Level& fine   = levels_[l];
+	Level& coarse = levels_[l+1];
+	int fw = fine.w,   fh = fine.h;
+	int cw = coarse.w, ch = coarse.h;
+
+	//coarse right hand side is the sum of the covered residuals ((2h)^2 = 4h^2 scaling)
+	#pragma omp parallel for schedule(static) if(ch >= MIN_PARALLEL_N)
+	for (int J = 1; J <= ch; J++) {
+		float*               r     = &coarse.r[LX(cw,0,J)];
+		const unsigned char* solid = &coarse.solid[LX(cw,0,J)];
+		int I;
+
+		for (I = 1; I <= cw; I++)
+			r[I] = 0.0f;
+		for (int j = 2*J-1; j <= 2*J && j <= fh; j++)
+			for (int i = 1; i <= fw; i++)
+				r[(i + 1) / 2] += residualAt(fine, LX(fw,i,j));
+		for (I = 1; I <= cw; I++)
+			if (solid[I])
+				r[I] = 0.0f;
+	}
+}
+
+
+
+void MultigridSolver::prolongCorrection(int l)
+{
+	Level& fine   = levels_[l];
+	Level& coarse = levels_[l+1];
+	const int            fn     = fine.w;
+	const int            fh     = fine.h;
+	const int            cw     = coarse.w + 2;
+	const float*         ce     = &coarse.e[0];
+	const unsigned char* csolid = &coarse.solid[0];
+
+	#pragma omp parallel for schedule(static) if(fh >= MIN_PARALLEL_N)
+	for (int j = 1; j <= fh; j++) {
+		int J  = (j + 1) / 2;
+		int dj = (j & 1) ? -cw : cw;
+		for (int i = 1; i <= fn; i++) {
+			int idx = LX(fn,i,j);
+			if (fine.solid[idx])
+				continue;
+
+			int c00 = LX(coarse.w,(i + 1) / 2,J);
+			int di  = (i & 1) ? -1 : 1;
+
+			//missing neighbors (walls, boundary cells) fall back to the nearest coarse value.
+			//The buffer ring of every level is solid, so the neighbors never leave the grid.
+			float c   = csolid[c00]           ? 0.0f             : ce[c00];
+			float cx  = csolid[c00 + di]      ? c                : ce[c00 + di];
+			float cy  = csolid[c00 + dj]      ? c                : ce[c00 + dj];
+			float cxy = csolid[c00 + di + dj] ? 0.5f * (cx + cy) : ce[c00 + di + dj];
+
+			fine.e[idx] += 0.5625f * c + 0.1875f * (cx + cy) + 0.0625f * cxy;
+		}
+	}
+}
+
+
+
+void MultigridSolver::vCycle(int l)
+{
+	Level& level = levels_[l];
+	if (l > 0)
+		level.e.assign(level.e.size(), 0.0f);
+
+	if (l == (int)levels_.size() - 1) {
+		smooth(l, COARSEST_SWEEPS);
+		return;
+	}
+
+	smooth(l, PRE_SWEEPS);
+	restrictResidual(l);
+	vCycle(l + 1);
+	prolongCorrection(l);
+	smooth(l, POST_SWEEPS);
+}
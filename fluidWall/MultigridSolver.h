@@ -0,0 +1,192 @@
+/**
+ * @file      MultigridSolver.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+#include <vector>
+
+using namespace std;
+
+/**
+ * Geometric multigrid solver for the pressure Poisson equation used by FluidSolver::project().
+ *
+ * Solves 4*p(i,j) - (sum of neighbor p) = div(i,j) with a Neumann (zero flux) condition at
+ * the grid walls and at every boundary cell. Each iteration is one V-cycle with red-black
+ * Gauss-Seidel smoothing. Coarse cells are cell-centered; coarse cell (I,J) covers fine
+ * cells (2I-1..2I, 2J-1..2J).
+ *
+ * Every level stores a weight per face: 1 or 0 on the fine grid, and on coarse grids half 
+ * the weight of the fine faces a coarse face covers. Cells that are part boundary, part 
+ * fluid therefore keep the flux they really pass, which keeps the V-cycles converging 
+ * around silhouettes. Each connected region of fluid is solved for its own mean, so 
+ * pockets closed off by a silhouette do not hold the residual up.
+ *
+ * The fine solution is kept between solves and used as the initial guess for the next one.
+ */
+class MultigridSolver
+{
+public:
+	/**
+	 * Parameter constructor.
+	 * @param width  Cells per row of the fine simulation grid (without buffer cells)
+	 * @param height Rows of the fine simulation grid (without buffer cells)
+	 */
+	MultigridSolver(int width, int height);
+	~MultigridSolver(void);
+
+	/**
+	 * Rebuilds the boundary masks of all levels from the fine grid bounds.
+	 * Must be called whenever the fine bounds change (once per frame).
+	 *
+	 * @param bounds - pointer to the fine grid bounds array, (width+2)*(height+2) cells
+	 */
+	void restrictBounds(const bool* bounds);
+
+	/**
+	 * Runs V-cycles until the largest residual drops below tolerance times the largest
+	 * right hand side value, or maxIterations V-cycles have been run. Boundary cells and
+	 * walls of x are filled so that the solution has zero gradient across them.
+	 *
+	 * @param x             - pointer to the fine grid solution, (width+2)*(height+2) cells
+	 * @param b             - pointer to the fine grid right hand side, (width+2)*(height+2) cells
+	 * @param tolerance     - residual reduction to stop at
+	 * @param maxIterations - maximum number of V-cycles
+	 * @return              - number of V-cycles run
+	 */
+	int solve(float* x, const float* b, float tolerance, int maxIterations);
+
+	/**
+	 * Accessor: returns the residual left by the last solve(), relative to its largest
+	 * right hand side value.
+	 */
+	float getResidual();
+
+	/**
+	 * Accessor: returns the number of levels, including the fine grid.
+	 */
+	int getLevelCount();
+
+protected:
+	/**
+	 * One level of the hierarchy. All arrays include a ring of buffer cells, which are
+	 * marked solid.
+	 */
+	struct Level
+	{
+		int w;                         // cells per row, without buffer cells
+		int h;                         // rows, without buffer cells
+		vector<float>         e;       // solution (correction on coarse levels)
+		vector<float>         r;       // right hand side
+		vector<float>         wx;      // weight of the face between (i,j) and (i+1,j)
+		vector<float>         wy;      // weight of the face between (i,j) and (i,j+1)
+		vector<float>         invDiag; // 1 / sum of the face weights, 0 for boundary cells
+		vector<unsigned char> solid;   // 1 if the cell is a boundary cell
+	};
+
+	int            width_;
+	int            height_;
+	float          residual_;
+	vector<Level>  levels_;
+	vector<int>    region_;       // fluid region of every fine cell, -1 for boundary cells
+	vector<int>    regionStack_;  // flood fill scratch
+	vector<double> regionSum_;    // per region mean of the right hand side
+	vector<double> regionOffset_; // per region mean of the solution
+	vector<int>    regionCount_;  // fluid cells per region
+
+	/**
+	 * Marks the coarse cells without open faces as boundary cells and calculates the 
+	 * inverse diagonal of a level from its face weights.
+	 *
+	 * @param l      - level index
+	 */
+	void finishLevel(int l);
+
+	/**
+	 * Labels the connected fluid regions of the fine grid into region_.
+	 */
+	void labelRegions();
+
+	/**
+	 * Smooths the solution on a level with red-black Gauss-Seidel.
+	 *
+	 * @param l      - level index
+	 * @param sweeps - number of red-black sweeps
+	 */
+	void smooth(int l, int sweeps);
+
+	/**
+	 * Returns the residual r - A*e of one cell of a level.
+	 *
+	 * @param level  - level
+	 * @param idx    - cell index, LX(level.w,i,j)
+	 */
+	float residualAt(const Level& level, int idx);
+
+	/**
+	 * Calculates the largest absolute residual r - A*e of a level.
+	 *
+	 * @param l      - level index
+	 */
+	float computeResidual(int l);
+
+	/**
+	 * Sums the residual of level l into the right hand side of level l+1. The residual
+	 * is calculated on the way, after the pre smoothing of the V-cycle.
+	 *
+	 * @param l      - level index
+	 */
+	void restrictResidual(int l);
+
+	/**
+	 * Bilinearly interpolates the correction of level l+1 and adds it to the solution
+	 * of level l.
+	 *
+	 * @param l      - level index
+	 */
+	void prolongCorrection(int l);
+
+	/**
+	 * Runs a V-cycle starting at level l. Expects r of level l to be set. Coarse levels
+	 * start from a zero correction, the fine level from its current solution.
+	 *
+	 * @param l      - level index
+	 */
+	void vCycle(int l);
+
+	/**
+	 * Copies b into the fine right hand side and subtracts the mean of every fluid region
+	 * from it, and from the fine solution. The pure Neumann problem only has a solution 
+	 * when its right hand side sums to zero in every region, and the solution is only 
+	 * defined up to a constant per region.
+	 *
+	 * @param b           - pointer to the fine grid right hand side, (width+2)*(height+2) cells
+	 * @param maxResidual - returns the largest absolute residual of the initial guess
+	 * @return            - largest absolute value left in the right hand side
+	 */
+	float loadRightHandSide(const float* b, float& maxResidual);
+
+	/**
+	 * Copies the fine solution into x, including boundary cells and walls.
+	 *
+	 * @param x      - pointer to the fine grid solution, (width+2)*(height+2) cells
+	 * @return       - largest absolute residual of the fine solution
+	 */
+	float writeSolution(float* x);
+};
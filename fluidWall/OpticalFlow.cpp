@@ -0,0 +1,263 @@
+/**
+ * @file      OpticalFlow.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "OpticalFlow.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <opencv2/video/tracking.hpp>
+
+
+
+OpticalFlow::OpticalFlow(void)
+{
+	mode_   = FLOW_DENSE;
+	levels_ = FLOW_MAX_LEVELS;
+	pyramidReady_ = false;
+	points_.reserve(FLOW_MAX_POINTS);
+	tracked_.reserve(FLOW_MAX_POINTS);
+	status_.reserve(FLOW_MAX_POINTS);
+	error_.reserve(FLOW_MAX_POINTS);
+}
+
+
+
+void OpticalFlow::setMode(FlowMode mode)
+{
+	mode_ = mode;
+}
+
+
+
+OpticalFlow::FlowMode OpticalFlow::getMode()
+{
+	return mode_;
+}
+
+
+
+void OpticalFlow::setPyramidLevels(int levels)
+{
+	levels = max(1, min(levels, (int)FLOW_MAX_LEVELS));
+	if (levels != levels_)
+		pyramidReady_ = false;
+	levels_ = levels;
+}
+
+
+
+int OpticalFlow::getPyramidLevels()
+{
+	return levels_;
+}
+
+
+
+Rect OpticalFlow::getLastRegion()
+{
+	return lastRegion_;
+}
+
+
+
+int OpticalFlow::getLastPointCount()
+{
+	return (int)points_.size();
+}
+
+
+
+void OpticalFlow::compute(const Mat& prev, const Mat& next, Mat& flow)
+{
+	//flow is zero wherever nothing is computed
+	flow.create(next.rows, next.cols, CV_32FC2);
+	flow.setTo(Scalar(0));
+	points_.clear();
+
+	if (mode_ == FLOW_SPARSE)
+		computeSparse(prev, next, flow);
+	else
+		computeDense(prev, next, flow);
+}
+
+
+
+Rect OpticalFlow::findRegion(const Mat& prev, const Mat& next, int margin)
+{
+	int left = prev.cols, right = -1, top = prev.rows, bottom = -1;
+
+	for (int y = 0; y < prev.rows; y++)
+	{
+		const uchar* prevRow = prev.ptr<uchar>(y);
+		const uchar* nextRow = next.ptr<uchar>(y);
+
+		//first and last nonzero pixel of this row
+		int x = 0;
+		while (x < prev.cols && !(prevRow[x] | nextRow[x]))
+			x++;
+		if (x == prev.cols)
+			continue;
+
+		int lastX = prev.cols - 1;
+		while (!(prevRow[lastX] | nextRow[lastX]))
+			lastX--;
+
+		left   = min(left, x);
+		right  = max(right, lastX);
+		top    = min(top, y);
+		bottom = y;
+	}
+
+	if (right < 0)
+		return Rect(0, 0, 0, 0);
+
+	left   = max(left - margin, 0);
+	top    = max(top - margin, 0);
+	right  = min(right + margin, prev.cols - 1);
+	bottom = min(bottom + margin, prev.rows - 1);
+	return Rect(left, top, right - left + 1, bottom - top + 1);
+}
+
+
+
+void OpticalFlow::computeDense(const Mat& prev, const Mat& next, Mat& flow)
+{
+	//Farneback builds its own pyramids, so the next sparse call cannot reuse one
+	pyramidReady_ = false;
+	lastRegion_ = findRegion(prev, next, FLOW_ROI_MARGIN);
+	if (lastRegion_.width == 0)
+		return;
+
+	//Farneback wants continuous images, so copy the region out; the region moves and 
+	//changes size every frame, the buffers behind it only when the image does
+	prevBuffer_.create(prev.rows, prev.cols, CV_8UC1);
+	nextBuffer_.create(next.rows, next.cols, CV_8UC1);
+	flowBuffer_.create(next.rows, next.cols, CV_32FC2);
+	prevRegion_ = Mat(lastRegion_.height, lastRegion_.width, CV_8UC1,  prevBuffer_.data);
+	nextRegion_ = Mat(lastRegion_.height, lastRegion_.width, CV_8UC1,  nextBuffer_.data);
+	flowRegion_ = Mat(lastRegion_.height, lastRegion_.width, CV_32FC2, flowBuffer_.data);
+
+	prev(lastRegion_).copyTo(prevRegion_);
+	next(lastRegion_).copyTo(nextRegion_);
+	calcOpticalFlowFarneback(prevRegion_, nextRegion_, flowRegion_, 0.5, levels_, 15, 3, 5, 1.2, 0);
+
+	Mat target = flow(lastRegion_);
+	flowRegion_.copyTo(target);
+}
+
+
+
+void OpticalFlow::computeSparse(const Mat& prev, const Mat& next, Mat& flow)
+{
+	//the pyramid of the last next image is the pyramid of this prev image if the caller 
+	//passes the same image again; comparing the pixels is far cheaper than rebuilding it
+	bool reusePyramid = pyramidReady_ && prev.isContinuous() && lastNext_.size() == prev.size() &&
+						!memcmp(lastNext_.data, prev.data, prev.total());
+	pyramidReady_ = false;
+
+	lastRegion_ = findRegion(prev, next, 0);
+	if (lastRegion_.width == 0)
+		return;
+
+	//silhouette pixels of prev with a background 4-neighbour, on a raster, off the border
+	int xBegin = max(lastRegion_.x, 1), xEnd = min(lastRegion_.x + lastRegion_.width,  prev.cols - 1);
+	int yBegin = max(lastRegion_.y, 1), yEnd = min(lastRegion_.y + lastRegion_.height, prev.rows - 1);
+	int edges  = 0;
+
+	for (int y = yBegin; y < yEnd; y += FLOW_EDGE_STEP)
+	{
+		const uchar* above = prev.ptr<uchar>(y - 1);
+		const uchar* row   = prev.ptr<uchar>(y);
+		const uchar* below = prev.ptr<uchar>(y + 1);
+
+		for (int x = xBegin; x < xEnd; x += FLOW_EDGE_STEP)
+		{
+			if (!row[x] || (row[x-1] && row[x+1] && above[x] && below[x]))
+				continue;
+
+			//reservoir sampling keeps an even spread when there are too many edge pixels
+			if (edges < FLOW_MAX_POINTS)
+				points_.push_back(Point2f((float)x, (float)y));
+			else {
+				int slot = rand() % (edges + 1);
+				if (slot < FLOW_MAX_POINTS)
+					points_[slot] = Point2f((float)x, (float)y);
+			}
+			edges++;
+		}
+	}
+
+	if (points_.empty())
+		return;
+
+	//the C interface takes caller owned pyramid buffers, (width + 8) * height / 3 bytes 
+	//hold levels 1 and up; both are filled on return unless marked ready
+	int count = (int)points_.size();
+	tracked_.resize(count);
+	status_.resize(count);
+	error_.resize(count);
+
+	CvMat prevImage = prev, nextImage = next;
+	CvMat prevPyramid, nextPyramid;
+	CvMat *prevPyramidArg = NULL, *nextPyramidArg = NULL;
+	if (levels_ > 1)
+	{
+		prevPyramid_.create(prev.rows / 3 + 1, prev.cols + 8, CV_8UC1);
+		nextPyramid_.create(prev.rows / 3 + 1, prev.cols + 8, CV_8UC1);
+		prevPyramid = prevPyramid_;
+		nextPyramid = nextPyramid_;
+		prevPyramidArg = &prevPyramid;
+		nextPyramidArg = &nextPyramid;
+	}
+
+	cvCalcOpticalFlowPyrLK(&prevImage, &nextImage, prevPyramidArg, nextPyramidArg, 
+						   (const CvPoint2D32f*)&points_[0], (CvPoint2D32f*)&tracked_[0], count, 
+						   cvSize(15, 15), levels_ - 1, (char*)&status_[0], &error_[0],
+						   cvTermCriteria(CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 20, 0.03),
+						   reusePyramid ? CV_LKFLOW_PYR_A_READY : 0);
+
+	//keep next and its pyramid for the following call, swapping headers does not allocate
+	if (next.isContinuous())
+	{
+		next.copyTo(lastNext_);
+		Mat swapped  = prevPyramid_;
+		prevPyramid_ = nextPyramid_;
+		nextPyramid_ = swapped;
+		pyramidReady_ = true;
+	}
+
+	//spread each tracked edge pixel's motion over its 3x3 neighbourhood
+	for (size_t p = 0; p < points_.size(); p++)
+	{
+		if (!status_[p])
+			continue;
+
+		Point2f motion = tracked_[p] - points_[p];
+		int x = (int)points_[p].x, y = (int)points_[p].y;
+
+		for (int j = y - 1; j <= y + 1; j++)
+		{
+			Point2f* flowRow = flow.ptr<Point2f>(j);
+			for (int i = x - 1; i <= x + 1; i++)
+				flowRow[i] = motion;
+		}
+	}
+}
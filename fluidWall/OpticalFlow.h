@@ -0,0 +1,111 @@
+/**
+ * @file      OpticalFlow.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+/**
+ * Optical flow between consecutive silhouette images, limited to where the silhouettes are.
+ *
+ * Pixels that are zero in both images cannot move, so their flow is zero:
+ * - FLOW_DENSE runs Farneback only inside the bounding box of both silhouettes, grown by
+ *   FLOW_ROI_MARGIN pixels so the window and pyramid still see the edges.
+ * - FLOW_SPARSE tracks the silhouette edge pixels of the previous image with pyramidal
+ *   Lucas-Kanade and writes each result into the 3x3 pixels around the edge pixel. Only
+ *   edges get flow, which is where emitSplashes() and the fluid look for it.
+ */
+class OpticalFlow
+{
+public:
+	enum FlowMode { FLOW_DENSE, FLOW_SPARSE };
+
+	const static int FLOW_ROI_MARGIN   = 16;	//pixels added around the silhouettes in dense mode
+	const static int FLOW_EDGE_STEP    = 2;		//raster step when picking edge pixels in sparse mode
+	const static int FLOW_MAX_POINTS   = 400;	//most edge pixels tracked in sparse mode
+	const static int FLOW_MAX_LEVELS   = 3;		//default pyramid levels, including the image itself
+
+	OpticalFlow(void);
+
+	/**
+	 * Selects the flow algorithm for subsequent calls to compute().
+	 */
+	void     setMode(FlowMode mode);
+	FlowMode getMode();
+
+	/**
+	 * Sets the number of pyramid levels both algorithms use, including the full size 
+	 * image. Fewer levels are cheaper but lose track of fast motion.
+	 *
+	 * @param levels   1 - FLOW_MAX_LEVELS
+	 */
+	void setPyramidLevels(int levels);
+	int  getPyramidLevels();
+
+	/**
+	 * Computes the flow from prev to next. In sparse mode, passing the last call's next 
+	 * image as prev reuses its pyramid instead of building it again.
+	 *
+	 * @param prev   previous image, CV_8UC1
+	 * @param next   current image, CV_8UC1, same size as prev
+	 * @param flow   receives the flow, CV_32FC2, same size as the images
+	 */
+	void compute(const Mat& prev, const Mat& next, Mat& flow);
+
+	/**
+	 * Accessors: return the region the last flow was computed in, and the number of edge
+	 * pixels tracked by the last sparse flow.
+	 */
+	Rect getLastRegion();
+	int  getLastPointCount();
+
+private:
+	FlowMode mode_;
+	int      levels_;
+	Rect     lastRegion_;
+
+	//buffers kept between frames so the steady state does not allocate; the region 
+	//images are continuous headers over the full image sized buffers
+	Mat             prevBuffer_, nextBuffer_, flowBuffer_;
+	Mat             prevRegion_, nextRegion_, flowRegion_;
+	vector<Point2f> points_, tracked_;
+	vector<uchar>   status_;
+	vector<float>   error_;
+
+	//pyramids for the sparse flow; after a sparse call prevPyramid_ holds the pyramid 
+	//of lastNext_, and pyramidReady_ says whether it can be used for the next prev image
+	Mat             prevPyramid_, nextPyramid_, lastNext_;
+	bool            pyramidReady_;
+
+	/**
+	 * Returns the bounding box of the nonzero pixels of both images, grown by margin and
+	 * clipped to the image. The box is empty if both images are zero.
+	 *
+	 * @param margin   pixels added on every side
+	 */
+	Rect findRegion(const Mat& prev, const Mat& next, int margin);
+
+	void computeDense (const Mat& prev, const Mat& next, Mat& flow);
+	void computeSparse(const Mat& prev, const Mat& next, Mat& flow);
+};
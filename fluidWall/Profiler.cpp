@@ -0,0 +1,243 @@
+/**
+ * @file      Profiler.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Profiler.h"
+#include <algorithm>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
+using namespace std;
+
+static const char* stageNames[PROFILE_STAGE_COUNT] =
+{
+	"kinect update", "load image", "optical flow",
+	"bounds", "emit splashes", "solver update", "diffuse", "advect", "project", "publish frame",
+	"draw density", "draw velocity", "draw bounds", "draw users", "draw frame"
+};
+
+static const ProfileGroup stageGroups[PROFILE_STAGE_COUNT] =
+{
+	PROFILE_CAPTURE, PROFILE_CAPTURE, PROFILE_CAPTURE,
+	PROFILE_SIMULATION, PROFILE_SIMULATION, PROFILE_SIMULATION, PROFILE_SIMULATION,
+	PROFILE_SIMULATION, PROFILE_SIMULATION, PROFILE_SIMULATION,
+	PROFILE_RENDER, PROFILE_RENDER, PROFILE_RENDER, PROFILE_RENDER, PROFILE_RENDER
+};
+
+
+
+Profiler& getProfiler()
+{
+	//created on first use, so solvers constructed during static initialization can time too
+	static Profiler profiler;
+	return profiler;
+}
+
+
+
+Profiler::Profiler(void)
+{
+	for (int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+		pending_[s] = 0;
+		hasRun_[s]  = false;
+		next_[s]    = 0;
+		count_[s]   = 0;
+	}
+	csv_        = NULL;
+	startTicks_ = getTicks();
+}
+
+
+
+Profiler::~Profiler(void)
+{
+	stopCsv();
+}
+
+
+
+void Profiler::add(ProfileStage stage, long long ticks)
+{
+	pending_[stage] += ticks;
+	hasRun_[stage]   = true;
+}
+
+
+
+void Profiler::commit(ProfileGroup group)
+{
+	const double toMilliseconds = 1000.0 / getTicksPerSecond();
+	double seconds = (getTicks() - startTicks_) / (double)getTicksPerSecond();
+
+	ScopedLock lock(lock_);
+	for (int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+		if (stageGroups[s] != group || !hasRun_[s])
+			continue;
+
+		float milliseconds = (float)(pending_[s] * toMilliseconds);
+		history_[s][next_[s]] = milliseconds;
+		next_[s] = (next_[s] + 1) % PROFILE_HISTORY;
+		if (count_[s] < PROFILE_HISTORY)
+			count_[s]++;
+
+		if (csv_)
+			fprintf(csv_, "%.6f,%s,%.4f\n", seconds, stageNames[s], milliseconds);
+
+		pending_[s] = 0;
+		hasRun_[s]  = false;
+	}
+}
+
+
+
+int Profiler::getPercentiles(ProfileStage stage, float& p50, float& p95, float& p99)
+{
+	float samples[PROFILE_HISTORY];
+	int   count;
+	{
+		ScopedLock lock(lock_);
+		count = count_[stage];
+		copy(history_[stage], history_[stage] + count, samples);
+	}
+
+	p50 = p95 = p99 = 0.0f;
+	if (count == 0)
+		return 0;
+
+	sort(samples, samples + count);
+	p50 = samples[(count - 1) * 50 / 100];
+	p95 = samples[(count - 1) * 95 / 100];
+	p99 = samples[(count - 1) * 99 / 100];
+	return count;
+}
+
+
+
+void Profiler::clear()
+{
+	ScopedLock lock(lock_);
+	for (int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+		next_[s]  = 0;
+		count_[s] = 0;
+	}
+}
+
+
+
+bool Profiler::startCsv(const char* path)
+{
+	ScopedLock lock(lock_);
+	if (csv_)
+		fclose(csv_);
+
+	csv_ = fopen(path, "w");
+	if (!csv_)
+		return false;
+
+	fprintf(csv_, "seconds,stage,milliseconds\n");
+	return true;
+}
+
+
+
+void Profiler::stopCsv()
+{
+	ScopedLock lock(lock_);
+	if (csv_)
+		fclose(csv_);
+	csv_ = NULL;
+}
+
+
+
+bool Profiler::isStreamingCsv()
+{
+	ScopedLock lock(lock_);
+	return csv_ != NULL;
+}
+
+
+
+void Profiler::addEvent(const char* name, float value)
+{
+	double seconds = (getTicks() - startTicks_) / (double)getTicksPerSecond();
+
+	ScopedLock lock(lock_);
+	if (csv_)
+		fprintf(csv_, "%.6f,%s,%.4f\n", seconds, name, value);
+}
+
+
+
+const char* Profiler::getStageName(ProfileStage stage)
+{
+	return stageNames[stage];
+}
+
+
+
+ProfileGroup Profiler::getStageGroup(ProfileStage stage)
+{
+	return stageGroups[stage];
+}
+
+
+
+#ifdef _WIN32
+
+long long Profiler::getTicks()
+{
+	LARGE_INTEGER ticks;
+	QueryPerformanceCounter(&ticks);
+	return ticks.QuadPart;
+}
+
+
+
+long long Profiler::getTicksPerSecond()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return frequency.QuadPart;
+}
+
+#else
+
+long long Profiler::getTicks()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+
+long long Profiler::getTicksPerSecond()
+{
+	return 1000000000LL;
+}
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ * @file      Profiler.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+#include <stdio.h>
+#include "Threading.h"
+
+/**
+ * Timed stages of the pipeline. Each stage belongs to the group of the thread it runs on.
+ */
+enum ProfileStage
+{
+	//capture thread
+	PROFILE_KINECT_UPDATE,
+	PROFILE_LOAD_IMAGE,
+	PROFILE_OPTICAL_FLOW,
+	//simulation thread
+	PROFILE_BOUNDS,
+	PROFILE_EMIT_SPLASHES,
+	PROFILE_SOLVER_UPDATE,
+	PROFILE_DIFFUSE,
+	PROFILE_ADVECT,
+	PROFILE_PROJECT,
+	PROFILE_PUBLISH,
+	//render thread
+	PROFILE_DRAW_DENSITY,
+	PROFILE_DRAW_VELOCITY,
+	PROFILE_DRAW_BOUNDS,
+	PROFILE_DRAW_USERS,
+	PROFILE_DRAW_FRAME,
+	PROFILE_STAGE_COUNT
+};
+
+enum ProfileGroup { PROFILE_CAPTURE, PROFILE_SIMULATION, PROFILE_RENDER };
+
+/**
+ * Collects the time spent in each pipeline stage per frame and keeps the last
+ * PROFILE_HISTORY frames of every stage for percentiles.
+ *
+ * ScopedTimer adds to the running total of a stage. Once per frame, the thread that owns a
+ * group calls commit(), which turns the totals of the group's stages into one sample each.
+ * Stages that did not run in a frame get no sample, so a stage that runs several times per
+ * frame (diffuse, advect) reports its sum and a stage that was skipped does not report 0.
+ * Samples can also be streamed to a CSV file, one "seconds,stage,milliseconds" line each.
+ * Events such as the decisions of the FrameGovernor go to the same file, with their value 
+ * in the last column.
+ *
+ * The running totals are only touched by the thread that owns the group; the histories
+ * and the CSV file are shared and guarded by a lock.
+ */
+class Profiler
+{
+public:
+	const static int PROFILE_HISTORY = 512;
+
+	Profiler(void);
+	~Profiler(void);
+
+	/**
+	 * Adds time to the running total of a stage.
+	 * @param stage   stage that ran
+	 * @param ticks   duration in getTicks() units
+	 */
+	void add(ProfileStage stage, long long ticks);
+
+	/**
+	 * Ends the frame of a group: records the totals of its stages that ran, then clears them.
+	 */
+	void commit(ProfileGroup group);
+
+	/**
+	 * Returns percentiles of the recorded samples of a stage in milliseconds.
+	 *
+	 * @return   number of samples used, 0 if the stage has not run yet
+	 */
+	int getPercentiles(ProfileStage stage, float& p50, float& p95, float& p99);
+
+	/**
+	 * Discards the recorded samples of all stages, e.g. between benchmark runs.
+	 */
+	void clear();
+
+	/**
+	 * Starts streaming samples to a CSV file, replacing its contents.
+	 * @return   false if the file could not be opened
+	 */
+	bool startCsv(const char* path);
+	void stopCsv();
+	bool isStreamingCsv();
+
+	/**
+	 * Writes a "seconds,name,value" line to the CSV file, if one is being written.
+	 * @param name    what happened, e.g. "governor simulation level"
+	 * @param value   new value of the setting
+	 */
+	void addEvent(const char* name, float value);
+
+	static const char*  getStageName(ProfileStage stage);
+	static ProfileGroup getStageGroup(ProfileStage stage);
+
+	/**
+	 * Returns a high resolution timestamp, and the number of timestamp units per second.
+	 */
+	static long long getTicks();
+	static long long getTicksPerSecond();
+
+private:
+	long long pending_[PROFILE_STAGE_COUNT];  // running totals, owned by the group's thread
+	bool      hasRun_[PROFILE_STAGE_COUNT];
+
+	Mutex lock_;  // guards everything below
+	float history_[PROFILE_STAGE_COUNT][PROFILE_HISTORY];  // milliseconds, ring buffers
+	int   next_[PROFILE_STAGE_COUNT];
+	int   count_[PROFILE_STAGE_COUNT];
+	FILE* csv_;
+	long long startTicks_;
+
+	Profiler(const Profiler&);
+	Profiler& operator=(const Profiler&);
+};
+
+/**
+ * Returns the profiler shared by all pipeline stages.
+ */
+Profiler& getProfiler();
+
+/**
+ * Adds the lifetime of the object to the running total of a stage.
+ */
+class ScopedTimer
+{
+public:
+	ScopedTimer(ProfileStage stage) : stage_(stage), start_(Profiler::getTicks()) {}
+	~ScopedTimer(void) { getProfiler().add(stage_, Profiler::getTicks() - start_); }
+
+private:
+	ProfileStage stage_;
+	long long    start_;
+};
@@ -0,0 +1,109 @@
+/**
+ * @file      SimulationClock.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "SimulationClock.h"
+#include "Profiler.h"
+
+
+
+SimulationClock::SimulationClock(float stepsPerSecond, int maxCatchUp)
+{
+	stepTicks_  = (long long)(Profiler::getTicksPerSecond() / stepsPerSecond);
+	maxCatchUp_ = maxCatchUp;
+	reset();
+}
+
+
+
+void SimulationClock::reset()
+{
+	stateTicks_   = Profiler::getTicks();
+	dueSteps_     = 0;
+	skippedSteps_ = 0;
+}
+
+
+
+void SimulationClock::beginFrame()
+{
+	long long behind = Profiler::getTicks() - stateTicks_;
+	int       due    = (int)(behind / stepTicks_);
+
+	if (due > maxCatchUp_) {
+		skippedSteps_ += due - maxCatchUp_;
+		stateTicks_   += (long long)(due - maxCatchUp_) * stepTicks_;
+		due            = maxCatchUp_;
+	}
+	dueSteps_ = due;
+}
+
+
+
+bool SimulationClock::nextStep()
+{
+	if (dueSteps_ == 0)
+		return false;
+
+	dueSteps_--;
+	stateTicks_ += stepTicks_;
+	return true;
+}
+
+
+
+int SimulationClock::getMillisecondsToNextStep()
+{
+	long long left = stateTicks_ + stepTicks_ - Profiler::getTicks();
+	if (left <= 0)
+		return 0;
+	long long ticksPerSecond = Profiler::getTicksPerSecond();
+	return (int)((left * 1000 + ticksPerSecond - 1) / ticksPerSecond);
+}
+
+
+
+long long SimulationClock::getStateTicks()
+{
+	return stateTicks_;
+}
+
+
+
+long long SimulationClock::getStepTicks()
+{
+	return stepTicks_;
+}
+
+
+
+float SimulationClock::getBlendFactor(long long stateTicks)
+{
+	float t = (float)(Profiler::getTicks() - stateTicks) / stepTicks_;
+	return t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+}
+
+
+
+int SimulationClock::getSkippedSteps()
+{
+	return skippedSteps_;
+}
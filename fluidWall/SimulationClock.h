@@ -0,0 +1,93 @@
+/**
+ * @file      SimulationClock.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+/**
+ * Fixed timestep clock: tells the simulation how many steps of 1 / stepsPerSecond seconds
+ * real time has moved on, so the fluid moves at the same speed however fast the machine 
+ * draws or how often the Kinect delivers.
+ *
+ * Real time that has not made up a whole step yet is carried over to the next frame. When
+ * the simulation falls more than maxCatchUp steps behind, e.g. while the window is dragged,
+ * the steps over that are skipped instead of run, so a slow frame does not make the next 
+ * one slower.
+ *
+ * Times are in Profiler::getTicks() units. getStateTicks() is the real time the newest 
+ * simulation state belongs to, which is always a little before now; a renderer that 
+ * blends the two newest states by getBlendFactor() shows the fluid one step late, but
+ * moving smoothly between steps.
+ */
+class SimulationClock
+{
+public:
+	/**
+	 * @param stepsPerSecond   simulation steps per second of real time
+	 * @param maxCatchUp       most steps run per frame, see beginFrame()
+	 */
+	SimulationClock(float stepsPerSecond, int maxCatchUp);
+
+	/**
+	 * Starts counting from now, with no steps owed.
+	 */
+	void reset();
+
+	/**
+	 * Starts a frame: works out the steps that are due and skips those over maxCatchUp.
+	 */
+	void beginFrame();
+
+	/**
+	 * Takes one of the steps that were due at beginFrame().
+	 * @return   false if there are none left
+	 */
+	bool nextStep();
+
+	/**
+	 * Returns the milliseconds until the next step is due, rounded up, 0 if one is due already.
+	 */
+	int getMillisecondsToNextStep();
+
+	long long getStateTicks();
+	long long getStepTicks();
+
+	/**
+	 * Returns how far to blend from the state before a state to the state itself to show
+	 * the fluid one step late: 0 for the older state, 1 for the newer. Only reads the step
+	 * length, so the render thread may call it while the simulation thread steps.
+	 *
+	 * @param stateTicks   getStateTicks() of the newer state
+	 */
+	float getBlendFactor(long long stateTicks);
+
+	/**
+	 * Accessor: returns the number of steps skipped since reset().
+	 */
+	int getSkippedSteps();
+
+private:
+	long long stepTicks_;
+	long long stateTicks_;  // real time of the newest state
+	int       maxCatchUp_;
+	int       dueSteps_;    // left in this frame
+	int       skippedSteps_;
+};
@@ -0,0 +1,314 @@
+/**
+ * @file      Threading.cpp
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Threading.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
+	#include <time.h>
+	#include <errno.h>
+	#include <sys/time.h>
+#endif
+
+
+
+#ifdef _WIN32
+
+long atomicExchange(volatile long* target, long value)
+{
+	return InterlockedExchange(target, value);
+}
+
+
+
+void sleepMilliseconds(int milliseconds)
+{
+	Sleep(milliseconds);
+}
+
+
+
+Mutex::Mutex(void)
+{
+	CRITICAL_SECTION* section = new CRITICAL_SECTION;
+	InitializeCriticalSection(section);
+	handle_ = section;
+}
+
+
+
+Mutex::~Mutex(void)
+{
+	DeleteCriticalSection((CRITICAL_SECTION*)handle_);
+	delete (CRITICAL_SECTION*)handle_;
+}
+
+
+
+void Mutex::lock()
+{
+	EnterCriticalSection((CRITICAL_SECTION*)handle_);
+}
+
+
+
+void Mutex::unlock()
+{
+	LeaveCriticalSection((CRITICAL_SECTION*)handle_);
+}
+
+
+
+Event::Event(void)
+{
+	handle_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+
+
+Event::~Event(void)
+{
+	CloseHandle((HANDLE)handle_);
+}
+
+
+
+void Event::signal()
+{
+	SetEvent((HANDLE)handle_);
+}
+
+
+
+bool Event::wait(int milliseconds)
+{
+	return WaitForSingleObject((HANDLE)handle_, milliseconds) == WAIT_OBJECT_0;
+}
+
+
+
+unsigned __stdcall Thread::entry(void* thread)
+{
+	Thread* self = (Thread*)thread;
+	self->function_(self->argument_);
+	return 0;
+}
+
+
+
+bool Thread::start(Function function, void* argument)
+{
+	if(handle_)
+		return false;
+
+	function_ = function;
+	argument_ = argument;
+	handle_   = (void*)_beginthreadex(NULL, 0, entry, this, 0, NULL);
+	return handle_ != NULL;
+}
+
+
+
+void Thread::join()
+{
+	if(!handle_)
+		return;
+
+	WaitForSingleObject((HANDLE)handle_, INFINITE);
+	CloseHandle((HANDLE)handle_);
+	handle_ = NULL;
+}
+
+#else
+
+long atomicExchange(volatile long* target, long value)
+{
+	__sync_synchronize();
+	return __sync_lock_test_and_set(target, value);
+}
+
+
+
+void sleepMilliseconds(int milliseconds)
+{
+	timespec duration = { milliseconds / 1000, (milliseconds % 1000) * 1000000L };
+	nanosleep(&duration, NULL);
+}
+
+
+
+Mutex::Mutex(void)
+{
+	pthread_mutex_t* mutex = new pthread_mutex_t;
+	pthread_mutex_init(mutex, NULL);
+	handle_ = mutex;
+}
+
+
+
+Mutex::~Mutex(void)
+{
+	pthread_mutex_destroy((pthread_mutex_t*)handle_);
+	delete (pthread_mutex_t*)handle_;
+}
+
+
+
+void Mutex::lock()
+{
+	pthread_mutex_lock((pthread_mutex_t*)handle_);
+}
+
+
+
+void Mutex::unlock()
+{
+	pthread_mutex_unlock((pthread_mutex_t*)handle_);
+}
+
+
+
+//condition variable, its mutex and the signaled flag
+struct EventState
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t  condition;
+	bool            signaled;
+};
+
+
+
+Event::Event(void)
+{
+	EventState* state = new EventState;
+	pthread_mutex_init(&state->mutex, NULL);
+	pthread_cond_init(&state->condition, NULL);
+	state->signaled = false;
+	handle_ = state;
+}
+
+
+
+Event::~Event(void)
+{
+	EventState* state = (EventState*)handle_;
+	pthread_cond_destroy(&state->condition);
+	pthread_mutex_destroy(&state->mutex);
+	delete state;
+}
+
+
+
+void Event::signal()
+{
+	EventState* state = (EventState*)handle_;
+	pthread_mutex_lock(&state->mutex);
+	state->signaled = true;
+	pthread_cond_signal(&state->condition);
+	pthread_mutex_unlock(&state->mutex);
+}
+
+
+
+bool Event::wait(int milliseconds)
+{
+	EventState* state = (EventState*)handle_;
+
+	timeval  now;
+	timespec deadline;
+	gettimeofday(&now, NULL);
+	long nanoseconds  = now.tv_usec * 1000L + (milliseconds % 1000) * 1000000L;
+	deadline.tv_sec   = now.tv_sec + milliseconds / 1000 + nanoseconds / 1000000000L;
+	deadline.tv_nsec  = nanoseconds % 1000000000L;
+
+	pthread_mutex_lock(&state->mutex);
+	int result = 0;
+	while(!state->signaled && result != ETIMEDOUT)
+		result = pthread_cond_timedwait(&state->condition, &state->mutex, &deadline);
+	bool signaled   = state->signaled;
+	state->signaled = false;
+	pthread_mutex_unlock(&state->mutex);
+
+	return signaled;
+}
+
+
+
+void* Thread::entry(void* thread)
+{
+	Thread* self = (Thread*)thread;
+	self->function_(self->argument_);
+	return NULL;
+}
+
+
+
+bool Thread::start(Function function, void* argument)
+{
+	if(handle_)
+		return false;
+
+	function_ = function;
+	argument_ = argument;
+
+	pthread_t* thread = new pthread_t;
+	if(pthread_create(thread, NULL, entry, this) != 0) {
+		delete thread;
+		return false;
+	}
+	handle_ = thread;
+	return true;
+}
+
+
+
+void Thread::join()
+{
+	if(!handle_)
+		return;
+
+	pthread_join(*(pthread_t*)handle_, NULL);
+	delete (pthread_t*)handle_;
+	handle_ = NULL;
+}
+
+#endif
+
+
+
+Thread::Thread(void)
+{
+	handle_   = NULL;
+	function_ = NULL;
+	argument_ = NULL;
+}
+
+
+
+Thread::~Thread(void)
+{
+	join();
+}
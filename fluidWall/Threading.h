@@ -0,0 +1,197 @@
+/**
+ * @file      Threading.h
+ * @author    Austin Hines <futurelightstudios@gmail.com>
+ * @copyright 2011 Austin Hines, Naureen Mahmood, and Texas A&M Dept. of Visualization
+ * @version	  1.0.0
+ *
+ * Minimal thread, lock and event wrappers for the Fluid Wall pipeline, plus a lock-free
+ * triple buffer that hands the newest frame from one thread to another. Uses the Win32 API
+ * on Windows and pthreads elsewhere.
+ *
+ * This file is part of Fluid Wall. You can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Fluid Wall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Fluid Wall. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+/**
+ * Atomically stores value in target and returns the previous value. Acts as a full
+ * memory barrier.
+ */
+long atomicExchange(volatile long* target, long value);
+
+/**
+ * Suspends the calling thread.
+ * @param milliseconds   time to sleep
+ */
+void sleepMilliseconds(int milliseconds);
+
+
+
+/**
+ * Non-recursive mutual exclusion lock.
+ */
+class Mutex
+{
+public:
+	Mutex(void);
+	~Mutex(void);
+
+	void lock();
+	void unlock();
+
+private:
+	void* handle_;
+
+	Mutex(const Mutex&);
+	Mutex& operator=(const Mutex&);
+};
+
+
+
+/**
+ * Holds a Mutex for the lifetime of the object.
+ */
+class ScopedLock
+{
+public:
+	ScopedLock(Mutex& mutex) : mutex_(mutex) { mutex_.lock(); }
+	~ScopedLock(void)                        { mutex_.unlock(); }
+
+private:
+	Mutex& mutex_;
+
+	ScopedLock(const ScopedLock&);
+	ScopedLock& operator=(const ScopedLock&);
+};
+
+
+
+/**
+ * Auto-reset event: signal() wakes one waiting thread, or the next thread that waits.
+ */
+class Event
+{
+public:
+	Event(void);
+	~Event(void);
+
+	void signal();
+
+	/**
+	 * Waits until the event is signaled or the timeout expires.
+	 * @param milliseconds   longest time to wait
+	 * @return               true if the event was signaled
+	 */
+	bool wait(int milliseconds);
+
+private:
+	void* handle_;
+
+	Event(const Event&);
+	Event& operator=(const Event&);
+};
+
+
+
+/**
+ * Runs a function on a new thread.
+ */
+class Thread
+{
+public:
+	typedef void (*Function)(void* argument);
+
+	Thread(void);
+	~Thread(void);  // joins the thread if it is still running
+
+	/**
+	 * Starts the thread.
+	 * @return   false if the thread could not be created or is already running
+	 */
+	bool start(Function function, void* argument);
+
+	/**
+	 * Waits for the thread function to return.
+	 */
+	void join();
+
+private:
+	void*    handle_;
+	Function function_;
+	void*    argument_;
+
+#ifdef _WIN32
+	static unsigned __stdcall entry(void* thread);
+#else
+	static void* entry(void* thread);
+#endif
+
+	Thread(const Thread&);
+	Thread& operator=(const Thread&);
+};
+
+
+
+/**
+ * Lock-free single producer / single consumer hand-off of the newest value.
+ *
+ * The producer fills getWriteSlot() and calls publish(); the consumer calls update() and
+ * reads getReadSlot(). Each side owns one of the three slots at all times and the third
+ * holds the newest published value, so neither side ever waits for the other. Values that
+ * the consumer did not pick up in time are overwritten by newer ones. Slots are reused, so
+ * values that keep their buffers (cv::Mat, vector) do not reallocate once they are sized.
+ */
+template <class T>
+class TripleBuffer
+{
+public:
+	TripleBuffer(void) : write_(0), read_(1), middle_(2) {}
+
+	/**
+	 * Producer: returns the slot to fill. The contents are the value published three
+	 * calls to publish() ago.
+	 */
+	T& getWriteSlot() { return slots_[write_]; }
+
+	/**
+	 * Producer: makes the write slot the newest value and takes another slot to write.
+	 */
+	void publish() { write_ = atomicExchange(&middle_, write_ | FRESH) & INDEX; }
+
+	/**
+	 * Consumer: if a new value was published since the last update, makes it the read slot.
+	 * @return   true if the read slot changed
+	 */
+	bool update()
+	{
+		if(!(middle_ & FRESH))
+			return false;
+		read_ = atomicExchange(&middle_, read_) & INDEX;
+		return true;
+	}
+
+	/**
+	 * Consumer: returns the newest value picked up by update().
+	 */
+	T& getReadSlot() { return slots_[read_]; }
+
+private:
+	enum { INDEX = 3, FRESH = 4 };
+
+	T             slots_[3];
+	long          write_;   // owned by the producer
+	long          read_;    // owned by the consumer
+	volatile long middle_;  // index of the newest value, FRESH until the consumer takes it
+};
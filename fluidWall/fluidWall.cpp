@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <iostream>
 #include <ctype.h>
 
@@ -45,7 +46,17 @@
 
 #include "FluidSolver.h"
 #include "FluidSolverMultiUser.h"
-#include "KinectController.h"
+#include "GpuFluidSolver.h"
+#include "KinectArray.h"
+#include "Threading.h"
+#include "OpticalFlow.h"
+#include "FieldRenderer.h"
+#include "ColorMap.h"
+#include "Profiler.h"
+#include "FrameGovernor.h"
+#include "SimulationClock.h"
+#include "HaloExchange.h"
+#include "AllocationCounter.h"
 
 static const char* VERSION = "1.0.1 BETA";
 
@@ -62,18 +73,30 @@ static const char* VERSION = "1.0.1 BETA";
 #define DEBUG 0
 
 // macros 
-#define ROW_WIDTH N+2
+#define ROW_WIDTH gridWidth+2
 #define IX(i, j) ((i) + (ROW_WIDTH) * (j))
-#define FOR_EACH_CELL for(i = 1; i <= N; i++) { for(j = 1; j <= N; j++) {
+#define FOR_EACH_CELL for(i = 1; i <= gridWidth; i++) { for(j = 1; j <= gridHeight; j++) {
 #define END_FOR }}
 #define SWAP(x0, x) { float* tmp = x0; x0 = x; x = tmp; }
 
 
 ///// constants
 const static int   N_DEF           = 128;
+const static int   GRID_ROWS[]     = { 48, 64, 96, 128, 192, 256 };	//resolutions selectable at runtime
+const static int   GRID_ROW_COUNT  = sizeof(GRID_ROWS) / sizeof(GRID_ROWS[0]);
 const static float FLOW_SCALAR     = 0.1;
 const static int   NUM_SPLASH_ROWS = 80;
 const static float BG_OFFSET	   = 0.1;
+const static float DENSITY_RAMP_MAX = 4.0f;	//densities above this all get the brightest color
+const static float FRAME_BUDGET_MS  = 16.6f;	//simulation and flow time per frame the governor aims for
+const static float VORTICITY_CONFINEMENT = 1.0f;	//swirl strength switched on with the 'n' key
+const static float BUOYANCY         = 0.2f;	//lift per unit of density switched on with the 'h' key
+const static float SNAPSHOT_VELOCITY_BLEND = 0.5f;	//share of the old solver's velocity a mode switch carries over
+const static char* const PROFILE_CSV_FILE = "fluidwall_profile.csv";
+const static char* const RECORDING_FILE   = "fluidwall_session.fwkr";
+static const char* replayPath = NULL;	//recording played back instead of the Kinect, see main()
+static int kinectCount = 1;				//Kinects side by side in front of the wall, see main()
+const static int   TILE_HALO_TIMEOUT = 20;	//ms a tile waits for its neighbor's halo before using the last one
 
 using namespace std;
 using namespace cv; 
@@ -86,20 +109,53 @@ typedef struct {
 	int userNo;
 } Emitter;
 
+typedef struct {float R, G, B;} RGBType;
+typedef struct {float H, S, V;} HSVType;
+
+/**
+ * Kinect images resized to the simulation grid, produced by the capture thread.
+ * flow is all zeros when hasFlow is false.
+ */
+typedef struct {
+	Mat  depth;    // CV_8UC1 silhouettes, one pixel per cell of the grid at capture time
+	Mat  users;    // CV_8UC1 user ids, same size
+	Mat  flow;     // CV_32FC2 optical flow from the previous depth image, same size
+	bool hasFlow;
+	float flowTime; // milliseconds spent computing the flow
+} CaptureFrame;
+
+/**
+ * Everything the render thread draws, produced by the simulation thread. The arrays are 
+ * (width+2)*(height+2) cells in IX order, for the grid size at the time of the step.
+ */
+typedef struct {
+	int                   width, height;  // grid size without buffer cells
+	long long             stateTicks;     // SimulationClock time of the step
+	vector<unsigned char> colors;  // RGBA8 density colors of cells 1 - width+1 by 1 - height+1
+	vector<unsigned char> prevColors;  // colors of the step before, empty if it had another size
+	vector<float>         u, v;    // only filled when velocity is displayed
+	vector<unsigned char> bounds;  // RGBA8 bounds image of cells 0 - width by 0 - height
+	Mat                   users;   // user ids of the capture frame that was simulated
+	char                  governorStatus[2][FrameGovernor::DESCRIPTION_SIZE];  // for the timing overlay
+} RenderFrame;
+
 // =============================================================================
 // GLOBAL VARIABLES
 // =============================================================================
 
 FluidSolver *solver; 
+FluidSolver *cpuSolver;
+GpuFluidSolver *gpuSolver = NULL;    //created on demand, needs the GLUT window's context
 FluidSolverMultiUser *userSolver;
 bool useUserSolver = false;
+static FluidSolver::Snapshot cpuSnapshot, userSnapshot;	//fluid of the solver that is not running, see switchSolver()
+static int tilesAcross = 1;               //> 1 if this window is one tile of a wall, see main()
+static HaloLink* tileLinks[EDGE_COUNT];   //neighboring tiles, NULL for the outer walls
+GLuint boundsTexture = 0;            //simulation sized depth image for the GPU solver
 
 #if USE_KINECT
-KinectController *kinect;
+KinectArray *kinect;
 
-Mat depthMatrix;
-Mat usersMatrix;
-Mat usersMatrixResize;
 
 GLfloat Colors[][3] =                     // user colors for fluid emission
 {
@@ -120,7 +176,7 @@ GLfloat Colors[][3] =                     // user colors for fluid emission
 
 GLfloat ColorsWhiteBG[][3] =               // user colors for fluid emission
 {
-	{0.02f,0.02f,0.02f},
+	{1.0f,1.0f,1.0f},
 	{0.0f,1.0f,1.0f},
 	{0.5f,1.0f,0.0f},
 	{1.0f,0.5f,0.0f},
@@ -134,7 +190,9 @@ GLfloat ColorsWhiteBG[][3] =               // user colors for fluid emission
 	{1.0f,1.0f,1.0f}
 };
 
-const static int MAX_USERS               = 6;
+const static int MAX_USERS               = 12;	//at most one color per user in Colors and ColorsWhiteBG
+//halves move half the bytes of floats and keep up with them where F16C converts them, slower without it
+const static FluidSolverMultiUser::DensityStorage USER_DENSITY_STORAGE = FluidSolverMultiUser::DENSITY_HALF;
 const static int ITERATIONS_BEFORE_RESET = 10000;
 const static int INIT_DEPTH	             = 3000;
 const static int INIT_MOTOR	             = 10000;
@@ -143,20 +201,48 @@ const static int DEF_WINDOW_SIZE		 = 512;
 #endif
 
 //particle system variables
-static int N;
+static int gridWidth, gridHeight;		//simulation grid, changed by resizeGrid()
+static int baseGridRow;					//GRID_ROWS entry selected with '[' and ']', before the governor
+static volatile int requestedGridRows = 0;	//grid the governor asked for, applied by the render thread
 static float force  = 5.0f;
 static float source = 20.0f;
-static int MAX_EMITTERS = 200;
+const static int MAX_EMITTERS = 200;
+static int maxEmitters = MAX_EMITTERS;	//live emitter cap, lowered by the governor
 
-static bool useFlow;					//use optical flow
-vector<Emitter> emitters(MAX_EMITTERS);
+static volatile bool useFlow;			//use optical flow
+static volatile bool useSparseFlow = false;	//track silhouette edges instead of dense flow
+static volatile int  flowLevels    = OpticalFlow::FLOW_MAX_LEVELS;	//pyramid levels, set by the governor
+OpticalFlow opticalFlow;				//used by the capture thread only
+FrameGovernor governor(FRAME_BUDGET_MS);	//simulation thread, under simLock
+
+//emitter pool: the live emitters are packed into the front numEmitters slots, the rest are free
+static Emitter emitters[MAX_EMITTERS];
+static int     numEmitters = 0;
+static vector<FluidSolver::Splat> emitterSplats(MAX_EMITTERS);	//one per live emitter, rebuilt each frame
 
 //OpenCV
 VideoCapture cap = NULL; //capture img from webcam
 
-Mat image;
-Mat flow; //optical flow matrix
-Mat flowImg, prevFlowImg;
+//pipeline: capture thread -> simulation thread -> GLUT render thread
+static const int   CAPTURE_RETRY_DELAY  = 100;    //ms the capture thread waits after a failed frame
+static const float SIM_STEPS_PER_SECOND = 60.0f;  //fixed simulation rate, whatever the display does
+static const int   SIM_MAX_CATCH_UP     = 4;      //most steps per frame, the rest are skipped
+
+TripleBuffer<CaptureFrame> captureFrames;
+TripleBuffer<RenderFrame>  renderFrames;
+FieldRenderer              fieldRenderer;  //render thread only
+ColorMap                   colorMap;       //density to texel colors, simulation thread only
+SimulationClock simClock(SIM_STEPS_PER_SECOND, SIM_MAX_CATCH_UP);  //stepped under simLock
+Mutex        simLock;             //held while the solvers, emitters or modes are used
+Mutex        kinectLock;          //held while the KinectArray is used
+Thread       captureThread;
+Thread       simThread;
+volatile bool pipelineRunning = false;
+
+//heap allocations of each pipeline thread, indexed by ProfileGroup; zero once they have reached a steady state
+static const int     PIPELINE_THREADS = 3;
+static volatile long frameAllocations[PIPELINE_THREADS] = { 0, 0, 0 };	//during the last frame
+static volatile long allocatingFrames[PIPELINE_THREADS] = { 0, 0, 0 };	//frames that allocated at all
 
 //OpenGL
 static int win_id;
@@ -166,6 +252,7 @@ static int omx, omy, mx, my;
 
 //display flags
 static int dvel, dbound, dusers;
+static bool dprofile = false;			//stage timing overlay
 
 //mode change variables
 bool autoChangeMode = false;
@@ -173,13 +260,15 @@ bool useWhiteBackground = false;
 int mode = 0;
 int max_mode = 0;
 int iterations = 0;
-int iterations_per_mode = 500; //frames per mode
+int iterations_per_mode = 1000; //simulation steps per mode, SIM_STEPS_PER_SECOND per second
 
 //forward method declarations
 static void changeMode(int newMode);
 static void open_glut_window ( void );
 static void initOpenGl();
 static void toggleFullscreen();
+static void stopPipeline();
+static void initColorMap();
 
 
 /*
@@ -198,7 +287,57 @@ static void clearData(void)
 	else
 		solver->reset();
 
-	emitters.clear();
+	//the idle solver starts from scratch, too
+	cpuSnapshot  = FluidSolver::Snapshot();
+	userSnapshot = FluidSolver::Snapshot();
+	numEmitters = 0;
+}
+
+/**
+ * Hands the fluid over between the single density and the multi-user solver after 
+ * useUserSolver changed. The solver that stops keeps a half precision snapshot and frees
+ * its fields; the one that starts continues from its own snapshot, with part of the other
+ * one's velocity blended in so the motion carries across the switch. Densities cannot be
+ * mapped between the solvers, and the GPU solver's textures are not snapshotted, so it 
+ * starts from scratch. Bounds are set again by the next capture frame.
+ */
+static void switchSolver()
+{
+	FluidSolver*           from         = useUserSolver ? solver : userSolver;
+	FluidSolver*           to           = useUserSolver ? userSolver : solver;
+	FluidSolver::Snapshot& fromSnapshot = useUserSolver ? cpuSnapshot : userSnapshot;
+	FluidSolver::Snapshot& toSnapshot   = useUserSolver ? userSnapshot : cpuSnapshot;
+
+	if(from != gpuSolver) {
+		from->saveSnapshot(fromSnapshot, true);
+		from->releaseFields();
+	}
+
+	if(to == gpuSolver || toSnapshot.isEmpty())
+		to->reset();
+	else
+		to->restoreSnapshot(toSnapshot);
+	if(to != gpuSolver && from != gpuSolver)
+		to->restoreSnapshot(fromSnapshot, SNAPSHOT_VELOCITY_BLEND);
+
+	//emitters carry user numbers of the old mode
+	numEmitters = 0;
+}
+
+/**
+ * Connects both CPU solvers to the neighboring tiles of the wall, if this window is a tile.
+ * Both solvers share a link; only the one of the current mode updates, and both tiles 
+ * have to be in the same mode, since a halo with a different number of channels is
+ * refused (see tryChangeMode()).
+ */
+static void linkTiles()
+{
+	for (int e = 0; e < EDGE_COUNT; e++) {
+		cpuSolver->setEdgeLink((TileEdge)e, tileLinks[e]);
+		userSolver->setEdgeLink((TileEdge)e, tileLinks[e]);
+	}
+	cpuSolver->setWallWidth(tilesAcross > 1 ? gridWidth * tilesAcross : 0);
+	userSolver->setWallWidth(tilesAcross > 1 ? gridWidth * tilesAcross : 0);
 }
 
 /**
@@ -207,17 +346,23 @@ static void clearData(void)
  */
 static int allocateData ( void )
 {
-	solver = new FluidSolver(N_DEF, 0.1f, 0.00f, 0.0f);
+	solver = cpuSolver = new FluidSolver(N_DEF, 0.1f, 0.00f, 0.0f);
 	userSolver = new FluidSolverMultiUser(MAX_USERS, N_DEF,0.1f, 0.00f, 0.0f);
-	kinect = new KinectController(MAX_USERS, ITERATIONS_BEFORE_RESET, INIT_DEPTH, INIT_MOTOR);
-	emitters.reserve(MAX_EMITTERS);
-	for(int i = 0; i < MAX_EMITTERS; i++) {
-		Emitter newEmit = {Point(0, 0), Point2f(0, 0), 1, 2, 1, 0};
-		emitters.push_back(newEmit);
-	}
-
-	N = N_DEF;
-	flow = Mat::zeros(N, N, CV_32FC2);
+	solver->setLinearSolver(FluidSolver::RED_BLACK_GAUSS_SEIDEL);
+	userSolver->setLinearSolver(FluidSolver::RED_BLACK_GAUSS_SEIDEL);
+	cout<<"Solver kernels: "<<getInstructionSetName(solver->getInstructionSet())<<endl;
+	kinect = new KinectArray(kinectCount, MAX_USERS, ITERATIONS_BEFORE_RESET, INIT_DEPTH, INIT_MOTOR, replayPath);
+	numEmitters = 0;
+	initColorMap();
+
+	gridWidth = gridHeight = N_DEF;
+	linkTiles();
+	kinect->setOutputSize(gridWidth, gridHeight, true);
+	//the first mode runs the single density solver, switchSolver() lays the other one out
+	userSolver->releaseFields();
+	userSolver->setDensityStorage(USER_DENSITY_STORAGE);
+	for(baseGridRow = 0; baseGridRow < GRID_ROW_COUNT - 1 && GRID_ROWS[baseGridRow] < N_DEF; baseGridRow++)
+		;
 
 	useFlow = true;
 
@@ -242,6 +387,10 @@ static int allocateData ( void )
  */
 void cleanupExit()
 {
+	stopPipeline();
+	kinect->stopRecording();	//writes the frame index of a running recording
+	delete kinect;				//stops the threads of the Kinects
+	kinect = NULL;
 	if (glutGameModeGet(GLUT_GAME_MODE_ACTIVE))
 		glutLeaveGameMode();
 	exit(0);
@@ -264,11 +413,11 @@ static void getForcesFromMouse(FluidSolver* flSolver)
 	bool noButtonsPressed = !mouse_down[0] && !mouse_down[2] && !mouse_down[1];
 	if (noButtonsPressed) return;
 
-	// determine mouse position on the fluid grid by divide screenspace by N gridspaces
-	x = (int)((         mx  / (float)win_x) * N + 1);
-	y = (int)(((win_y - my) / (float)win_y) * N + 1);
+	// determine mouse position on the fluid grid by divide screenspace by the grid size
+	x = (int)((         mx  / (float)win_x) * gridWidth  + 1);
+	y = (int)(((win_y - my) / (float)win_y) * gridHeight + 1);
 
-	bool isMouseOutsideFluidGrid = (x < 1) || (x > N) || (y < 1) || (y > N);
+	bool isMouseOutsideFluidGrid = (x < 1) || (x > gridWidth) || (y < 1) || (y > gridHeight);
 	if (isMouseOutsideFluidGrid) return;
 
 	if (mouse_down[0]) {	//left mouse button
@@ -295,48 +444,41 @@ static void getForcesFromMouse(FluidSolver* flSolver)
 
 /**
  * Loads texture kinect, or webcam and flips image
- * horizontally and vertically. Upon output, image contains user silhouettes.
- * 
- * usersMatrixResize = NxN matrix. 
+ * horizontally and vertically. Upon output, the frame contains user silhouettes and
+ * user ids resized to the simulation grid. Runs on the capture thread.
+ *
+ * The KinectController does the flips and the resize while it reads the camera buffers,
+ * see allocateData().
+ *
+ * @param capture	Frame to fill
  */
-int loadImage() {
+int loadImage(CaptureFrame& capture) {
 	// TODO: clean up redundant names since we are now only supporting kinect input
-	Mat frame, flippedFrame, flippedUsersMatrix;
-	Mat frameResize = Mat::zeros(N, N, CV_8UC1);
+	ScopedTimer timer(PROFILE_LOAD_IMAGE);
 
 	#if USE_WEBCAM
-		Mat threshImg, webcamImage;
+		Mat threshImg, webcamImage, frame;
 
 		cap >> webcamImage;
 		cvtColor(webcamImage, threshImg, CV_BGR2GRAY);
 		threshold(threshImg, frame, 180, 200, CV_THRESH_BINARY_INV);
 	#endif
 
-	// depth tracking
-	kinect->update();
-	depthMatrix = kinect->getDepthMat();
-	depthMatrix.copyTo(frame);
-	
-	if(frame.empty()) {
-		cout<<"ERROR: Cannot load frame"<<endl;
-        return -1;
+	// depth tracking; the controller already delivers flipped, grid sized images, copied while 
+	// its buffers are still valid
+	ScopedLock lock(kinectLock);
+	{
+		ScopedTimer kinectTimer(PROFILE_KINECT_UPDATE);
+		kinect->update();
 	}
 
-	// Process image, resize to simulation size.
-	flip( frame, flippedFrame, 0 ); 
-	resize(flippedFrame,frameResize,frameResize.size(),0,0,INTER_CUBIC);
-	image = frameResize;
-
-	// Copy filtered image for optical flow to use.
-	frameResize.copyTo(flowImg);
-
-	if(useUserSolver) {
-		// Process UserID matrix.
-		usersMatrix = kinect->getUsersMat();
-		flip(usersMatrix, flippedUsersMatrix,0);
-		resize(flippedUsersMatrix, usersMatrixResize, frameResize.size(), 0, 0, INTER_CUBIC);
-		//imshow("Users", usersMatrixResize*100);
+	if(kinect->getDepthMat().empty()) {
+		cout<<"ERROR: Cannot load frame"<<endl;
+		return -1;
 	}
+	kinect->getDepthMat().copyTo(capture.depth);
+	kinect->getUsersMat().copyTo(capture.users);
+	//imshow("Users", capture.users*100);
 	
     return 0;
 }
@@ -347,16 +489,157 @@ int loadImage() {
  */
 static void defineBoundsFromImage(FluidSolver* flSolver, Mat &img)
 {
-    for( int y = 0; y < img.rows; y++ )
-        for( int x = 0; x < img.cols; x++ ) {
+	ScopedTimer timer(PROFILE_BOUNDS);
 
-			uchar &pixelVal = img.at<uchar>(y, x);
-			//add + 1 to coordinates because fluid matrix indicies range from 1 - N
-			if( pixelVal > 0)
-				flSolver->setBoundAt(x, y, true);
-			else
-				flSolver->setBoundAt(x, y, false);
-        }
+	//pixel (x, y) becomes cell (x + 1, y + 1) because fluid matrix indicies start at 1
+	flSolver->setBoundsFromMask(img.ptr<uchar>(0), img.step, img.cols, img.rows);
+}
+
+
+/**
+ * Uploads the image into boundsTexture and lets the GPU solver take its bounds from there,
+ * instead of setting every cell through setBoundAt().
+ */
+static void defineBoundsFromTexture(GpuFluidSolver* flSolver, Mat &img)
+{
+	ScopedTimer timer(PROFILE_BOUNDS);
+
+	if(!boundsTexture) {
+		glGenTextures(1, &boundsTexture);
+		glBindTexture(GL_TEXTURE_2D, boundsTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+	else
+		glBindTexture(GL_TEXTURE_2D, boundsTexture);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, img.cols, img.rows, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, img.data);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	flSolver->setBoundsTexture(boundsTexture);
+}
+
+
+/**
+ * Switches the single density simulation between the CPU and the GPU solver. The GPU 
+ * solver is created the first time it is selected.
+ */
+static void toggleGpuSolver()
+{
+	if(solver == gpuSolver) {
+		solver = cpuSolver;
+	}
+	else {
+		if(!gpuSolver) {
+			if(tilesAcross > 1) {
+				cout<<"GPU solver cannot exchange halos with the other tiles of the wall"<<endl;
+				return;
+			}
+			if(!GpuFluidSolver::isSupported()) {
+				cout<<"GPU solver is not supported by this OpenGL driver"<<endl;
+				return;
+			}
+			gpuSolver = new GpuFluidSolver(gridWidth, gridHeight, 0.1f, 0.00f, 0.0f);
+			gpuSolver->setSolverIterations(governor.getSettings().solverIterations);
+		}
+		if(gpuSolver->isValid())
+			solver = gpuSolver;
+	}
+	//the CPU solver is idle while the GPU one runs; reset() lays it out again
+	if(solver == gpuSolver)
+		cpuSolver->releaseFields();
+	if(!useUserSolver)
+		solver->reset();
+	cout<<"GPU Solver: "<<(solver == gpuSolver)<<endl;
+}
+
+
+/**
+ * Deletes the GPU solver and its textures. Must be called before the OpenGL context
+ * goes away.
+ */
+static void releaseGpuSolver()
+{
+	if(solver == gpuSolver) {
+		solver = cpuSolver;
+		if(!useUserSolver)
+			solver->reset();
+	}
+	delete gpuSolver;
+	gpuSolver = NULL;
+
+	if(boundsTexture)
+		glDeleteTextures(1, &boundsTexture);
+	boundsTexture = 0;
+}
+
+
+/**
+ * Changes the simulation resolution without restarting. The grid gets the given number of 
+ * rows and as many cells per row as keep the cells square in the window. The solvers 
+ * resample their fields, and the Kinect delivers images of the new size from its next 
+ * frame on; frames captured at the old size are skipped by simulateFrame(). 
+ *
+ * Runs on the render thread, because the GPU solver resizes its textures in the window's
+ * context.
+ * The caller must hold simLock.
+ *
+ * @param rows	number of rows of the new grid
+ */
+static void resizeGrid(int rows)
+{
+	if(win_x <= 0 || win_y <= 0)
+		return;
+
+	int cols = max(1, (rows * win_x + win_y / 2) / win_y);
+	if(cols == gridWidth && rows == gridHeight)
+		return;
+
+	gridWidth  = cols;
+	gridHeight = rows;
+	cpuSolver->resize(cols, rows);
+	userSolver->resize(cols, rows);
+	if(gpuSolver)
+		gpuSolver->resize(cols, rows);
+	linkTiles();
+	numEmitters = 0;
+	{
+		ScopedLock kinectGuard(kinectLock);
+		kinect->setOutputSize(cols, rows, true);
+	}
+	cout<<"Grid: "<<cols<<" x "<<rows<<endl;
+}
+
+
+/**
+ * Returns the number of rows of the grid selected with '[' and ']', lowered by as many 
+ * resolutions as the frame governor asks for.
+ */
+static int getGovernedGridRows()
+{
+	return GRID_ROWS[max(0, baseGridRow - governor.getSettings().gridStepsDown)];
+}
+
+
+/**
+ * Hands the frame governor's settings to the solvers, the capture thread and the emitters.
+ * A different grid size is only requested, because resizeGrid() has to run on the render
+ * thread. The caller must hold simLock.
+ */
+static void applyGovernorSettings()
+{
+	const FrameGovernor::Settings& settings = governor.getSettings();
+
+	cpuSolver->setSolverIterations(settings.solverIterations);
+	userSolver->setSolverIterations(settings.solverIterations);
+	if(gpuSolver)
+		gpuSolver->setSolverIterations(settings.solverIterations);
+	flowLevels  = settings.flowLevels;
+	maxEmitters = settings.maxEmitters;
+
+	int rows = getGovernedGridRows();
+	requestedGridRows = (rows != gridHeight) ? rows : 0;
 }
 
 
@@ -384,100 +667,95 @@ void drawOptFlowMap(const Mat& flow, Mat& cflowmap, int step,
 
 
 /**
- * Translates optical flow into velocity values. Flow values are 
- * rounded with cvRound to eliminate noise. Results are added directly into FluidSolver.
+ * Computes the optical flow between the previous and the current depth image of the
+ * capture thread. Flow values are added to the FluidSolver by the simulation thread.
+ *
+ * @param capture		Frame whose depth image is the current image; receives the flow
+ * @param prevFlowImg	Depth image of the previous frame, replaced by the current one
  */
-static void computeOpticalFlow(FluidSolver* flSolver, Mat& flow)
+static void computeOpticalFlow(CaptureFrame& capture, Mat& prevFlowImg)
 {
-	Mat cflow;
+	ScopedTimer timer(PROFILE_OPTICAL_FLOW);
+	long long start = Profiler::getTicks();
 
-	if(prevFlowImg.data) 
+	//no flow across a change of the grid size
+	capture.hasFlow = useFlow && prevFlowImg.data && 
+					  prevFlowImg.cols == capture.depth.cols && prevFlowImg.rows == capture.depth.rows;
+	if(capture.hasFlow) 
 	{
-		calcOpticalFlowFarneback(prevFlowImg, flowImg, flow, 0.5, 3, 15, 3, 5, 1.2, 0);
+		opticalFlow.setMode(useSparseFlow ? OpticalFlow::FLOW_SPARSE : OpticalFlow::FLOW_DENSE);
+		opticalFlow.setPyramidLevels(flowLevels);
+		opticalFlow.compute(prevFlowImg, capture.depth, capture.flow);
 		#if DEBUG 
+			Mat cflow;
 			cvtColor(prevFlowImg, cflow, CV_GRAY2BGR);
-			drawOptFlowMap(flow, cflow, 16, 1.5, CV_RGB(0, 255, 0));
+			drawOptFlowMap(capture.flow, cflow, 16, 1.5, CV_RGB(0, 255, 0));
 			imshow("flow", cflow);
 		#endif
-
-		for(int y = 1; y < N; y++)
-			for(int x = 1; x < N; x++)
-			{
-				const Point2f& fxy = flow.at<Point2f>(y, x);
-				flSolver->addHorzVelocityAt(x, y, FLOW_SCALAR * fxy.x);
-				flSolver->addVertVelocityAt(x, y, FLOW_SCALAR * fxy.y);
-			}
+	}
+	else {
+		capture.flow.create(capture.depth.size(), CV_32FC2);
+		capture.flow.setTo(Scalar(0));
 	}
 
-	std::swap(prevFlowImg, flowImg);
+	capture.depth.copyTo(prevFlowImg);
+	capture.flowTime = (Profiler::getTicks() - start) * 1000.0f / Profiler::getTicksPerSecond();
 }
 
 /**
- * Iterates through Emitters vector and adds forces to fluid simulation for each emitter.
- * Also kills emitters that have expired.
- * @param e		- Reference to a vector containing Emitters to render.
+ * Adds forces and densities to the fluid simulation for each live emitter in one batch.
+ * Also kills emitters that have expired, by moving the last live emitter into their slot.
+ * @param flSolver	- Fluid Solver to add the emitters to
  */
-static void renderEmitters(FluidSolver* flSolver, vector<Emitter> &e)
+static void renderEmitters(FluidSolver* flSolver)
 {
-	//TODO: convert emitters to fixed array. Bug being caught in loop right now.
+	int nSplats = 0;
 	int i = 0;
-	while (i < e.size()) {
+	while (i < numEmitters) {
+		Emitter& e = emitters[i];
 
-		bool emitterHasExpired = (e[i].lifespan - e[i].life_elapsed == 0);
+		bool emitterHasExpired = (e.life_elapsed >= e.lifespan);
 		if(emitterHasExpired) {
-			e.erase(e.begin() + i);
+			e = emitters[--numEmitters];
+			continue;
 		}
-		else {
 
-			Point lowerCoord, upperCoord;
-
-			//calculate scalar for temporal falloff overlifespan
-			float lifescalar = (e[i].lifespan - e[i].life_elapsed) / e[i].lifespan;
-
-			//prevent radius from referencing cells outside simulation matrix
-			//TODO: clean up line breaks here
-			lowerCoord.y = (e[i].center.y - e[i].radius) < 1 ? 1 : (e[i].center.y - e[i].radius);
-			lowerCoord.x = (e[i].center.x - e[i].radius) < 1 ? 1 : (e[i].center.x - e[i].radius);
-			upperCoord.y = (e[i].center.y + e[i].radius) > N ? N : (e[i].center.y + e[i].radius);
-			upperCoord.x = (e[i].center.x + e[i].radius) > N ? N : (e[i].center.x + e[i].radius);
-
-			for(int y = lowerCoord.y; y <= upperCoord.y; y++)
-				for(int x = lowerCoord.x; x <= upperCoord.x; x++) {
-					//calculate falloff from center
-					float vscalar = fabs(y - e[i].center.y) / e[i].radius;
-					float uscalar = fabs(x - e[i].center.x) / e[i].radius;
-					float dscalar = (vscalar+uscalar) / 2;
-					
-					float horzVel = e[i].vel.x * uscalar;
-					float vertVel = e[i].vel.y * vscalar;
-					float density = source * dscalar * lifescalar;
-
-					flSolver->addHorzVelocityAt(x, y, horzVel);
-					flSolver->addVertVelocityAt(x, y, vertVel);
-
-					if(useUserSolver) 
-						userSolver->addDensityAt(e[i].userNo, x, y, density);
-					else
-						flSolver->addDensityAt(x, y, density);
-				}
-			e[i].life_elapsed++;
-			i++;
-		}
+		//calculate scalar for temporal falloff overlifespan
+		float lifescalar = (float)(e.lifespan - e.life_elapsed) / e.lifespan;
+
+		FluidSolver::Splat& splat = emitterSplats[nSplats++];
+		splat.centerX = (int)e.center.x;
+		splat.centerY = (int)e.center.y;
+		splat.radius  = e.radius;
+		splat.u       = e.vel.x;
+		splat.v       = e.vel.y;
+		splat.density = source * lifescalar;
+		splat.userNo  = e.userNo;
+
+		e.life_elapsed++;
+		i++;
 	}
+
+	if(nSplats > 0)
+		flSolver->addSplats(&emitterSplats[0], nSplats);
 }
 
 
 
 /**
- * Creates an emitter object with given properties.
+ * Creates an emitter object with given properties. Does nothing if maxEmitters emitters 
+ * are alive.
  */
 static void createEmitterAt(int center_x, int center_y, float force_u, float force_v, int lifespan, int radius, int userNo = 1)
 {
+	if(numEmitters >= maxEmitters)
+		return;
+
 	Emitter newEmit = {Point(center_x, center_y), Point2f(force_u, force_v), lifespan, 0, radius, userNo};
-	emitters.push_back(newEmit);
+	emitters[numEmitters++] = newEmit;
 
 	#if DEBUG
-		cout<<"Emitter created: "<<emitters.size()<<endl;
+		cout<<"Emitter created: "<<numEmitters<<endl;
 	#endif
 }
 
@@ -487,12 +765,18 @@ static void createEmitterAt(int center_x, int center_y, float force_u, float for
  * Creates emitter objects based on optical flow velocity. If vertical velocity is negative at boundaries,
  * an emitter is created. An emission threshold prevents negative velocities due to noise from creating 
  * emitters. In the call tree, we assume this function is called after computeOpticalFlow.
+ * The simulation steps faster than the Kinect captures, so a capture frame only creates
+ * emitters (or pushes at the silhouette sides) once; the live emitters render every step.
  *
- * @param flsolver	Fulid Solver to emit splashes into
- * @param flow		Reference to a matrix containing optical flow velocities.
+ * @param flsolver		Fulid Solver to emit splashes into
+ * @param flow			Reference to a matrix containing optical flow velocities.
+ * @param users			Reference to a matrix containing the user id of each pixel.
+ * @param isNewCapture	True on the first step that sees this capture frame.
  */
-static void emitSplashes(FluidSolver* flSolver, Mat &flow)
+static void emitSplashes(FluidSolver* flSolver, const Mat &flow, const Mat &users, bool isNewCapture)
 {
+	ScopedTimer timer(PROFILE_EMIT_SPLASHES);
+
 	//precondition: optical flow has been calculated
 	float fu, fv;
 	fu = fv = 0.0;
@@ -501,33 +785,36 @@ static void emitSplashes(FluidSolver* flSolver, Mat &flow)
 	int velocityEmissionThreshold = -0.05; //creates emitters based on velocity emission
 
 	if(useFlow) {
-		// Only look for emitters in splash rows.
-		for( int j = 1; j < NUM_SPLASH_ROWS; j++) { 
-			for(int i = 1; i <= N; i++) {
+		if(isNewCapture) {
+			// Only look for emitters in splash rows.
+			for( int j = 1; j < min(NUM_SPLASH_ROWS, gridHeight); j++) { 
+				for(int i = 1; i <= gridWidth; i++) {
 													
-				bool vertBoundChangesToYes = !flSolver->isBoundAt(i, j) && flSolver->isBoundAt(i, j+1);
-				if(vertBoundChangesToYes) { 
-					const Point2f& opticalFlowVelocity = flow.at<Point2f>(i, j);
-					fu = .8 *  opticalFlowVelocity.x;
-					fv = .8 *  opticalFlowVelocity.y;
-
-					if(opticalFlowVelocity.y < velocityEmissionThreshold) 
-						if(useUserSolver) {
-							int userNo = usersMatrixResize.at<uchar>(i, j+1);
-							createEmitterAt(i, j-1, fu, fv, 6, 3, userNo);
-						}
-						else
-							createEmitterAt(i, j-1, fu, fv, 6, 3, 1);
+					bool vertBoundChangesToYes = !flSolver->isBoundAt(i, j) && flSolver->isBoundAt(i, j+1);
+					if(vertBoundChangesToYes) { 
+						//cell (i, j) was set from pixel (i - 1, j - 1)
+						const Point2f& opticalFlowVelocity = flow.at<Point2f>(j - 1, i - 1);
+						fu = .8 *  opticalFlowVelocity.x;
+						fv = .8 *  opticalFlowVelocity.y;
+
+						if(opticalFlowVelocity.y < velocityEmissionThreshold) 
+							if(useUserSolver) {
+								int userNo = users.at<uchar>(j, i - 1);
+								createEmitterAt(i, j-1, fu, fv, 6, 3, userNo);
+							}
+							else
+								createEmitterAt(i, j-1, fu, fv, 6, 3, 1);
+					}
 				}
 			}
 		}
-		renderEmitters(flSolver, emitters);
+		renderEmitters(flSolver);
 	}
-	else {
+	else if(isNewCapture) {
 		// TODO: move this code into a separate function?
 		// emit splashes on either side of whole silhouette
-		for (int j = 1; j <= N; j++) { 
-			for (int i = 1; i <= N; i++) {
+		for (int j = 1; j <= gridHeight; j++) { 
+			for (int i = 1; i <= gridWidth; i++) {
 				bool horzBoundChangesToYes = !flSolver->isBoundAt(i, j) && flSolver->isBoundAt(i+1, j);
 				bool horzBoundChangesToNo  = flSolver->isBoundAt(i, j) && !flSolver->isBoundAt(i+1, j);
 
@@ -556,9 +843,8 @@ static void emitSplashes(FluidSolver* flSolver, Mat &flow)
  */
 static void changeMode(int newMode)
 {
+	bool wasUserSolver = useUserSolver;
 	mode = newMode;
-	//we have changed modes, initialize new modes
-	clearData();
 	switch(newMode)
 	{
 		case 0:
@@ -602,15 +888,30 @@ static void changeMode(int newMode)
 			cout<<"Changing to mode 3: White background"<<endl;
 			break;
 	}
+
+	//modes with the same solver just continue its fluid
+	if(useUserSolver != wasUserSolver)
+		switchSolver();
 }
 
 
 
 /**
- * Tries to change the mode if iterations have reached iterations_per_mode.
+ * Tries to change the mode if iterations have reached iterations_per_mode. Called once
+ * per simulation step, so modes last the same time on every machine. Tiles of a wall 
+ * take the mode from the step their links agree on, so they all switch at the same step;
+ * a tile in another mode would get halos with the wrong number of channels.
  */
 static void tryChangeMode()
 {
+	HaloLink* link = tileLinks[EDGE_LEFT] ? tileLinks[EDGE_LEFT] : tileLinks[EDGE_RIGHT];
+	if(autoChangeMode && link) {
+		int tileMode = (link->getStep() / iterations_per_mode) % (max_mode + 1);
+		if(tileMode != mode)
+			changeMode(tileMode);
+		return;
+	}
+
 	if(autoChangeMode && (iterations > iterations_per_mode))
 	{
 		iterations = 0;
@@ -634,66 +935,37 @@ static void tryChangeMode()
 
 /**
  * Draws fluid velocity vectors in OpenGL.
- * @param flSolver	FluidSolver containing the velocity to draw.
+ * @param frame	Render frame containing the velocity to draw.
  *
  */
-static void drawVelocity(FluidSolver* flSolver)
+static void drawVelocity(const RenderFrame& frame)
 {
-	int i, j;
-	float x, y, h;
-
-	h = 1.0f / N;
-
+	ScopedTimer timer(PROFILE_DRAW_VELOCITY);
 	glColor3f(1.0f, 1.0f, 1.0f);
 	glLineWidth(1.0f);
 
-	glBegin(GL_LINES);
-		for (i = 1; i <= N; i++) {
-			x = (i - 0.5f) * h;
-
-			for (j = 1; j <= N; j++) {
-				y = (j - 0.5f) * h;
-				glVertex2f(x, y);
-				glVertex2f(x + flSolver->getHorzVelocityAt(i,j), 
-					       y + flSolver->getVertVelocityAt(i,j));
-			}
-		}
-	glEnd();
+	fieldRenderer.drawVelocity(&frame.u[0], &frame.v[0], frame.width, frame.height);
 }
 
 
 /**
  * Draws bounding cells in OpenGL.
- * @param flSolver	FluidSolver containing the bounds to draw.
+ * @param frame	Render frame containing the bounds to draw.
  *
  */
-static void drawBounds(FluidSolver* flSolver)
+static void drawBounds(const RenderFrame& frame)
 {
-	int i, j;
-	float x, y, h;
-	h = 1.0f / N; //calculate unit length of each cell
-
-	glBegin(GL_QUADS);
-		for (i = 0; i <= N; i++) {
-			x = i * h;
-			for (j = 0; j <= N; j++) {
-				y = j * h;
-
-				if(flSolver->isBoundAt(i,j)) {
-					glColor3f (0.30f, 0.30f, 0.30f); glVertex2f (x,   y);
-					glColor3f (0.30f, 0.30f, 0.30f); glVertex2f (x+h, y);
-					glColor3f (0.30f, 0.30f, 0.30f); glVertex2f (x+h, y+h);
-					glColor3f (0.30f, 0.30f, 0.30f); glVertex2f (x,   y+h);
-				}
-			}
-		}
-	glEnd();
+	ScopedTimer timer(PROFILE_DRAW_BOUNDS);
+	//calculate unit length of each cell
+	float hx = 1.0f / frame.width;
+	float hy = 1.0f / frame.height;
+
+	//cell (i, j) covers [i*hx, (i+1)*hx] x [j*hy, (j+1)*hy]
+	fieldRenderer.drawImage(FieldRenderer::LAYER_BOUNDS, &frame.bounds[0], frame.width+1, frame.height+1, 
+							0.0f, 0.0f, (frame.width+1) * hx, (frame.height+1) * hy, 0.0f, false);
 }
 
 
-typedef struct {float R, G, B;} RGBType;
-typedef struct {float H, S, V;} HSVType;
-
 #define RETURN_RGB(r, g, b) {RGB.R = r; RGB.G = g; RGB.B = b; return RGB;}
 #define RETURN_HSV(h, s, v) {HSV.H = h; HSV.S = s; HSV.V = v; return HSV;}
 #define UNDEFINED -1
@@ -732,97 +1004,123 @@ RGBType HSV_to_RGB( HSVType HSV )
 }
 
 
-#if USE_KINECT
 /**
- *  Computes the weighted color of all the user densities at a particular 
- *  pixel coordinate.
- *  @param x	x-coordinate 
- *  @param y	y-coordinate
+ *  Precomputes the single density color ramp: the HSV color with the density hue and
+ *  saturation for values of 0 to DENSITY_RAMP_MAX.
  */
-RGBType getWeightedColor(int x, int y)
+static void initColorMap()
 {
-	RGBType RGB;
-	float R, G, B;
-	R=G=B=0;
-
-	for(int i = 0; i < MAX_USERS; i++) {
-		float densityVal = userSolver->getDensityAt(i, x, y);
-		
-		if(useWhiteBackground) {
-			R += ColorsWhiteBG[i][0] * densityVal;
-			G += ColorsWhiteBG[i][1] * densityVal;
-			B += ColorsWhiteBG[i][2] * densityVal;
-		}
-		else {
-			R += Colors[i][0] * densityVal;
-			G += Colors[i][1] * densityVal;
-			B += Colors[i][2] * densityVal;
-		}
-	} 
+	static float ramp[ColorMap::COLOR_MAP_SIZE][3];
+	float hue = 3.25;
+	float sat = 1.0;
 
-	RGB.R = R; RGB.B = B; RGB.G = G; 
-	return RGB;
+	for(int k = 0; k < ColorMap::COLOR_MAP_SIZE; k++) {
+		HSVType hsv = {hue, sat, k * DENSITY_RAMP_MAX / (ColorMap::COLOR_MAP_SIZE - 1)};
+		RGBType rgb = HSV_to_RGB(hsv);
+		ramp[k][0] = rgb.R; ramp[k][1] = rgb.G; ramp[k][2] = rgb.B;
+	}
+	colorMap.setRamp(ramp, DENSITY_RAMP_MAX);
 }
-#endif
 
 
 
 /**
- * Render density grids as OpenGL quads with vertex shading.
+ * Blends two RGBA8 images of the same size into a third.
+ * @param weight	0 gives from, 1 gives to
+ */
+static void blendColors(const vector<unsigned char>& from, const vector<unsigned char>& to, float weight, 
+						vector<unsigned char>& blended)
+{
+	int w = (int)(weight * 256.0f + 0.5f);	//8 bit fixed point, 256 is all of to
+
+	blended.resize(from.size());
+	for (size_t k = 0; k < from.size(); k++)
+		blended[k] = (unsigned char)(from[k] + (((to[k] - from[k]) * w) >> 8));
+}
+
+
+
+/**
+ * Stores a color as an opaque RGBA8 texel, clamping each channel to [0, 1] like glColor3f.
+ */
+static inline void packColor(const RGBType& rgb, unsigned char* texel)
+{
+	float channels[3] = { rgb.R, rgb.G, rgb.B };
+	for (int c = 0; c < 3; c++) {
+		float value = channels[c] < 0.0f ? 0.0f : (channels[c] > 1.0f ? 1.0f : channels[c]);
+		texel[c] = (unsigned char)(value * 255.0f + 0.5f);
+	}
+	texel[3] = 255;
+}
+
+
+
+/**
+ * Computes the color of every cell that drawDensity() interpolates between.
  *
  * @param flSolver	fluid solver 
+ * @param colors	receives an RGBA8 image of cells 1 - width+1 by 1 - height+1, cell (i, j) 
+ *					at texel (i-1, j-1)
  */
-static void drawDensity ( FluidSolver* flSolver )
+static void computeDensityColors ( FluidSolver* flSolver, vector<unsigned char>& colors )
 {
+	static vector<float> values;  //one row of densities or user densities, kept between frames
 	int i, j;
-	float x, y, h;
-	RGBType rgb00, rgb10, rgb11, rgb01;
-	float	d00,   d10,   d11,   d01;
-	float hue = 3.25;
-	float sat = 1.0;
-	h = 1.0f/N;
+	int rowTexels = gridWidth+1;
 
-	
-	glBegin ( GL_QUADS );
-		for ( i=1 ; i<=N ; i++ ) 
+	colors.resize(4 * rowTexels * (gridHeight+1));
+	unsigned char* texel = &colors[0];
+
+	if(useUserSolver) {
+		//render density color for each point based on blending user values
+		colorMap.setPalette(useWhiteBackground ? ColorsWhiteBG : Colors, MAX_USERS);
+		values.resize(rowTexels * MAX_USERS);
+
+		for ( j=1 ; j<=gridHeight+1 ; j++, texel += 4 * rowTexels ) {
+			userSolver->getUserDensities(1, j, rowTexels, &values[0]);
+			colorMap.mixUsers(&values[0], rowTexels, MAX_USERS, texel);
+		}
+	}
+	else {
+		values.resize(rowTexels);
+		for ( j=1 ; j<=gridHeight+1 ; j++, texel += 4 * rowTexels ) 
 		{
-			x = (i-0.5f)*h;
-			for ( j=1 ; j<=N ; j++ ) 
-			{
-				y = (j-0.5f)*h;
-
-				if(useUserSolver) {
-					//render density color for each point based on blending user values
-					rgb00 = getWeightedColor(i,j);
-					rgb10 = getWeightedColor(i+1,j);
-					rgb11 = getWeightedColor(i+1,j+1);
-					rgb01 = getWeightedColor(i,j+1);
-				}
-				else {
-					//if a cell is a bounds cell, do not apply a background offset
-					d00 = flSolver->isBoundAt(i,j)     ? 0 : BG_OFFSET + flSolver->getDensityAt(i,j);
-					d10 = flSolver->isBoundAt(i+1,j)   ? 0 : BG_OFFSET + flSolver->getDensityAt(i+1,j);
-					d11 = flSolver->isBoundAt(i+1,j+1) ? 0 : BG_OFFSET + flSolver->getDensityAt(i+1,j+1); 
-					d01 = flSolver->isBoundAt(i,j+1)   ? 0 : BG_OFFSET + flSolver->getDensityAt(i,j+1); 
-
-					//hsv to rgb using the density in the cell
-					HSVType hsv00 = {hue, sat, d00};
-					rgb00 = HSV_to_RGB(hsv00);
-					HSVType hsv10 = {hue, sat, d10};
-					rgb10 = HSV_to_RGB(hsv10);
-					HSVType hsv11 = {hue, sat, d11};
-					rgb11 = HSV_to_RGB(hsv11);
-					HSVType hsv01 = {hue, sat, d01};
-					rgb01 = HSV_to_RGB(hsv01);
-				}
+			//if a cell is a bounds cell, do not apply a background offset
+			for ( i=1 ; i<=gridWidth+1 ; i++ )
+				values[i-1] = flSolver->isBoundAt(i,j) ? 0 : BG_OFFSET + flSolver->getDensityAt(i,j);
 
-				glColor3f (rgb00.R, rgb00.G, rgb00.B); glVertex2f ( x,   y   );
-				glColor3f (rgb10.R, rgb10.G, rgb10.B); glVertex2f ( x+h, y   );
-				glColor3f (rgb11.R, rgb11.G, rgb11.B); glVertex2f ( x+h, y+h );
-				glColor3f (rgb01.R, rgb01.G, rgb01.B); glVertex2f ( x,   y+h );
-			}
+			colorMap.mapValues(&values[0], rowTexels, texel);
 		}
-	glEnd ();
+	}
+}
+
+
+
+/**
+ * Renders the density colors as one bilinearly filtered textured quad. Cell (i, j) is 
+ * centered at ((i-0.5)hx, (j-0.5)hy), so the quad ends on the centers of the border cells.
+ *
+ * The colors are blended between the frame's step and the one before by how far the clock
+ * has moved on, so the fluid moves smoothly when the display runs faster than the steps.
+ *
+ * @param frame	Render frame containing the cell colors
+ */
+static void drawDensity ( const RenderFrame& frame )
+{
+	ScopedTimer timer(PROFILE_DRAW_DENSITY);
+	static vector<unsigned char> blended;  //render thread only, kept between frames
+	float hx = 1.0f/frame.width;
+	float hy = 1.0f/frame.height;
+
+	const unsigned char* colors = &frame.colors[0];
+	float weight = simClock.getBlendFactor(frame.stateTicks);
+	if(!frame.prevColors.empty() && weight < 1.0f) {
+		blendColors(frame.prevColors, frame.colors, weight, blended);
+		colors = &blended[0];
+	}
+
+	fieldRenderer.drawImage(FieldRenderer::LAYER_DENSITY, colors, frame.width+1, frame.height+1, 
+							0.5f * hx, 0.5f * hy, (frame.width+0.5f) * hx, (frame.height+0.5f) * hy, 0.5f, true);
 }
 
 
@@ -830,45 +1128,123 @@ static void drawDensity ( FluidSolver* flSolver )
 #if USE_KINECT
 /**
  * Draws user silhouettes in unique colors per user in OpenGL. 
- * Uses the usersMatrix from kinect.
+ * Uses the user ids of the capture frame that was simulated.
  *
+ * @param frame	Render frame containing the user ids
  */
-static void drawUsers(void)
+static void drawUsers(const RenderFrame& frame)
 {
-	int i, j;
-	float x, y, h;
-	int d00, index;
+	ScopedTimer timer(PROFILE_DRAW_USERS);
+	static vector<unsigned char> userImage;  //kept so the image is not reallocated every frame
+
+	if(frame.users.empty())
+		return;
 
-	h = 1.0f/N;
+	const int cols = frame.users.cols, rows = frame.users.rows;
+	float hx = 1.0f/frame.width;
+	float hy = 1.0f/frame.height;
 
-	glBegin ( GL_QUADS );
-		for ( i=0 ; i<=N ; i++ ) 
+	//pixel (i, j) covers [i*hx, (i+1)*hx] x [j*hy, (j+1)*hy], background pixels stay transparent
+	userImage.resize(4 * cols * rows);
+	unsigned char* texel = &userImage[0];
+	for ( int j=0 ; j<rows ; j++ ) 
+	{
+		const uchar* row = frame.users.ptr<uchar>(j);
+		for ( int i=0 ; i<cols ; i++, texel += 4 ) 
 		{
-			x = i*h;
-			for ( j=0 ; j<=N ; j++ ) 
-			{
-				y = j*h;
-				index = j * N + i;
-				d00 = usersMatrixResize.data[index];		
-				
-				if(d00 != 0) {
-					GLfloat R = Colors[d00][0];
-					GLfloat G = Colors[d00][1];
-					GLfloat B = Colors[d00][2];
-
-					//cout<<"found a color for user: "<<d00<<": ("<<R<<", "<<G<<", "<<B<<")"<<endl;
-
-					glColor3f ( R, G, B ); glVertex2f ( x, y );
-					glColor3f ( R, G, B ); glVertex2f ( x+h, y );
-					glColor3f ( R, G, B ); glVertex2f ( x+h, y+h );
-					glColor3f ( R, G, B ); glVertex2f ( x, y+h );
-				}
+			int d00 = row[i];
+			if(d00 != 0 && d00 < MAX_USERS) {
+				RGBType rgb = { Colors[d00][0], Colors[d00][1], Colors[d00][2] };
+				packColor(rgb, texel);
 			}
+			else
+				texel[0] = texel[1] = texel[2] = texel[3] = 0;
 		}
-	glEnd ();
+	}
 
+	fieldRenderer.drawImage(FieldRenderer::LAYER_USERS, &userImage[0], cols, rows, 
+							0.0f, 0.0f, cols * hx, rows * hy, 0.0f, false);
 }
 #endif
+
+
+
+/**
+ * Draws one line of overlay text with its lower left corner at (x, y).
+ */
+static void drawText(float x, float y, const char* text)
+{
+	glRasterPos2f(x, y);
+	for (const char* c = text; *c; c++)
+		glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+}
+
+
+/**
+ * Draws the p50 / p95 / p99 time of every pipeline stage in the upper left corner, over
+ * the last Profiler::PROFILE_HISTORY frames of each stage, followed by the state of the 
+ * frame governor when the frame was simulated.
+ *
+ * @param frame	Render frame containing the governor state
+ */
+static void drawProfile(const RenderFrame& frame)
+{
+	float lineHeight = 15.0f / win_y;
+	float y          = 1.0f - lineHeight;
+	char  line[80];
+
+	glColor3f(1.0f, 1.0f, 0.3f);
+
+	sprintf(line, "%-16s %7s %7s %7s ms%s", "stage", "p50", "p95", "p99", 
+			getProfiler().isStreamingCsv() ? "  [csv]" : "");
+	drawText(0.01f, y, line);
+
+	for (int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+		float p50, p95, p99;
+		ProfileStage stage = (ProfileStage)s;
+		if(!getProfiler().getPercentiles(stage, p50, p95, p99))
+			continue;
+
+		//the solver steps are part of the solver update
+		bool isSolverStep = (stage == PROFILE_DIFFUSE || stage == PROFILE_ADVECT || stage == PROFILE_PROJECT);
+		sprintf(line, "%s%-*s %7.2f %7.2f %7.2f", isSolverStep ? "  " : "", isSolverStep ? 14 : 16, 
+				Profiler::getStageName(stage), p50, p95, p99);
+
+		y -= lineHeight;
+		drawText(0.01f, y, line);
+	}
+
+	for (int k = 0; k < 2; k++) {
+		y -= lineHeight;
+		drawText(0.01f, y, frame.governorStatus[k]);
+	}
+
+	sprintf(line, "heap allocations: capture %ld, simulation %ld, render %ld", frameAllocations[PROFILE_CAPTURE], 
+			frameAllocations[PROFILE_SIMULATION], frameAllocations[PROFILE_RENDER]);
+	y -= lineHeight;
+	drawText(0.01f, y, line);
+	sprintf(line, "frames that allocated: %ld, %ld, %ld", allocatingFrames[PROFILE_CAPTURE], 
+			allocatingFrames[PROFILE_SIMULATION], allocatingFrames[PROFILE_RENDER]);
+	y -= lineHeight;
+	drawText(0.01f, y, line);
+}
+
+
+
+/**
+ * Records the heap allocations a pipeline thread made during its last frame, for the 
+ * timing overlay.
+ *
+ * @param group			pipeline thread
+ * @param allocations	scope of the frame
+ */
+static void countFrameAllocations(ProfileGroup group, const AllocationScope& allocations)
+{
+	long count = allocations.getCount();
+	frameAllocations[group] = count;
+	if(count > 0)
+		allocatingFrames[group]++;
+}
 ////////////////////////////////////////////////////////////////////////
 
 /*
@@ -886,21 +1262,67 @@ static void drawUsers(void)
  */
 static void key_func ( unsigned char key, int x, int y )
 {
+	//escape key, before taking the lock the simulation thread has to finish with
+	if(key == 27) {
+		cleanupExit();
+		return;
+	}
+
+	//settings and solvers must not change in the middle of a simulation step
+	ScopedLock lock(simLock);
+
 	switch ( key )
 	{
 		case 'c':
 		case 'C':
 			clearData();
 			break;
-		case 27 : //escape key
-			cleanupExit();
-			break;
 		case 'f':
 		case 'F':
 			//toggle optical flow
 			useFlow = !useFlow;
 			cout<<"Optical Flow: "<<useFlow<<endl;
 			break;
+		case 'l':
+		case 'L':
+			//toggle dense / sparse optical flow
+			useSparseFlow = !useSparseFlow;
+			cout<<"Sparse Optical Flow: "<<useSparseFlow<<endl;
+			break;
+		case 't':
+		case 'T':
+			//toggle stage timing overlay
+			dprofile = !dprofile;
+			break;
+		case 'e':
+		case 'E':
+			//toggle streaming stage timings to a CSV file
+			if(getProfiler().isStreamingCsv()) {
+				getProfiler().stopCsv();
+				cout<<"Stopped writing "<<PROFILE_CSV_FILE<<endl;
+			}
+			else if(getProfiler().startCsv(PROFILE_CSV_FILE))
+				cout<<"Writing stage timings to "<<PROFILE_CSV_FILE<<endl;
+			else
+				cout<<"Could not open "<<PROFILE_CSV_FILE<<endl;
+			break;
+		case 'r':
+		case 'R':
+			//toggle recording the Kinect frames for replay
+			{
+				ScopedLock kinectGuard(kinectLock);
+				if(kinect->isRecording()) {
+					kinect->stopRecording();
+					cout<<"Stopped recording "<<RECORDING_FILE<<endl;
+				}
+				else if(kinect->isPlayingBack())
+					cout<<"Cannot record while playing back a recording"<<endl;
+				else if(kinect->startRecording(RECORDING_FILE))
+					cout<<"Recording Kinect frames to "<<RECORDING_FILE<<endl;
+				else
+					cout<<"Could not open "<<RECORDING_FILE<<endl;
+			}
+			break;
 		case 'v':
 		case 'V':
 			dvel = !dvel;
@@ -910,6 +1332,102 @@ static void key_func ( unsigned char key, int x, int y )
 		case 'B':
 			dbound = !dbound;
 			break;
+		case 'g':
+		case 'G':
+			//toggle red-black (multithreaded) / lexicographic Gauss-Seidel
+			if(cpuSolver->getLinearSolver() == FluidSolver::RED_BLACK_GAUSS_SEIDEL) {
+				cpuSolver->setLinearSolver(FluidSolver::GAUSS_SEIDEL);
+				userSolver->setLinearSolver(FluidSolver::GAUSS_SEIDEL);
+			}
+			else {
+				cpuSolver->setLinearSolver(FluidSolver::RED_BLACK_GAUSS_SEIDEL);
+				userSolver->setLinearSolver(FluidSolver::RED_BLACK_GAUSS_SEIDEL);
+			}
+			cout<<"Red-Black Gauss-Seidel: "<<(cpuSolver->getLinearSolver() == FluidSolver::RED_BLACK_GAUSS_SEIDEL)<<endl;
+			break;
+		case 'm':
+		case 'M':
+			//toggle multigrid / fixed relaxation pressure solver
+			if(cpuSolver->getPressureSolver() == FluidSolver::PRESSURE_MULTIGRID) {
+				cpuSolver->setPressureSolver(FluidSolver::PRESSURE_RELAXATION);
+				userSolver->setPressureSolver(FluidSolver::PRESSURE_RELAXATION);
+			}
+			else {
+				cpuSolver->setPressureSolver(FluidSolver::PRESSURE_MULTIGRID);
+				userSolver->setPressureSolver(FluidSolver::PRESSURE_MULTIGRID);
+			}
+			cout<<"Multigrid Pressure Solver: "<<(cpuSolver->getPressureSolver() == FluidSolver::PRESSURE_MULTIGRID)<<endl;
+			break;
+		case 'a':
+		case 'A':
+			//toggle MacCormack / semi-Lagrangian advection
+			if(cpuSolver->getAdvectionScheme() == FluidSolver::ADVECT_MACCORMACK) {
+				cpuSolver->setAdvectionScheme(FluidSolver::ADVECT_SEMI_LAGRANGIAN);
+				userSolver->setAdvectionScheme(FluidSolver::ADVECT_SEMI_LAGRANGIAN);
+			}
+			else {
+				cpuSolver->setAdvectionScheme(FluidSolver::ADVECT_MACCORMACK);
+				userSolver->setAdvectionScheme(FluidSolver::ADVECT_MACCORMACK);
+			}
+			cout<<"MacCormack Advection: "<<(cpuSolver->getAdvectionScheme() == FluidSolver::ADVECT_MACCORMACK)<<endl;
+			break;
+		case 'n':
+		case 'N':
+			//toggle vorticity confinement
+			{
+				float strength = cpuSolver->getVorticityConfinement() > 0.0f ? 0.0f : VORTICITY_CONFINEMENT;
+				cpuSolver->setVorticityConfinement(strength);
+				userSolver->setVorticityConfinement(strength);
+				cout<<"Vorticity Confinement: "<<(strength > 0.0f)<<endl;
+			}
+			break;
+		case 'h':
+		case 'H':
+			//toggle buoyancy of the single color fluid
+			cpuSolver->setBuoyancy(cpuSolver->getBuoyancy() != 0.0f ? 0.0f : BUOYANCY);
+			cout<<"Buoyancy: "<<(cpuSolver->getBuoyancy() != 0.0f)<<endl;
+			break;
+		case 'p':
+		case 'P':
+			toggleGpuSolver();
+			break;
+		case '[':
+		case ']':
+			//next coarser / finer grid resolution, the governor may still keep it coarser
+			if(key == ']' && baseGridRow < GRID_ROW_COUNT - 1)
+				baseGridRow++;
+			else if(key == '[' && baseGridRow > 0)
+				baseGridRow--;
+			resizeGrid(getGovernedGridRows());
+			requestedGridRows = 0;
+			break;
+		case 'j':
+		case 'J':
+			//toggle the frame governor; off restores the full quality settings
+			if(tilesAcross > 1) {
+				cout<<"Frame Governor: tiles of a wall need the same settings, so it stays off"<<endl;
+				break;
+			}
+			governor.setEnabled(!governor.isEnabled());
+			applyGovernorSettings();
+			cout<<"Frame Governor: "<<governor.isEnabled()<<endl;
+			break;
+		case 'x':
+		case 'X':
+			//toggle SIMD / scalar reference kernels
+			if(cpuSolver->getInstructionSet() != INSTRUCTIONS_SCALAR) {
+				cpuSolver->setInstructionSet(INSTRUCTIONS_SCALAR);
+				userSolver->setInstructionSet(INSTRUCTIONS_SCALAR);
+				colorMap.setInstructionSet(INSTRUCTIONS_SCALAR);
+			}
+			else {
+				cpuSolver->setInstructionSet(selectFluidKernels().instructionSet);
+				userSolver->setInstructionSet(selectFluidKernels().instructionSet);
+				colorMap.setInstructionSet(detectInstructionSet());
+			}
+			cout<<"Solver kernels: "<<getInstructionSetName(cpuSolver->getInstructionSet())<<endl;
+			cout<<"Color kernels: "<<getInstructionSetName(colorMap.getInstructionSet())<<endl;
+			break;
 		case '1': //single color fluid
 			changeMode(0);
 			break;
@@ -933,24 +1451,24 @@ static void key_func ( unsigned char key, int x, int y )
 			cout<<"Draw Users: "<<dusers<<endl;
 			break;
 		case 'w':
-			kinect->setMotorAngle(50);
+			{ ScopedLock kinectGuard(kinectLock); kinect->setMotorAngle(50); }
 			break;
 		case 's':
-			kinect->setMotorAngle(-50);
+			{ ScopedLock kinectGuard(kinectLock); kinect->setMotorAngle(-50); }
 			break;
 		case ' ':
-			kinect->resetMotorAngle();
+			{ ScopedLock kinectGuard(kinectLock); kinect->resetMotorAngle(); }
 			break;
 		case '+':
-			kinect->reset();
+			{ ScopedLock kinectGuard(kinectLock); kinect->reset(); }
 			break;
 		case 'o':
 		case 'O':
-			kinect->setDepth(+200);
+			{ ScopedLock kinectGuard(kinectLock); kinect->setDepth(+200); }
 			break;
 		case 'k':
 		case 'K':
-			kinect->setDepth (-200);
+			{ ScopedLock kinectGuard(kinectLock); kinect->setDepth (-200); }
 			break;
 
 		#endif
@@ -1011,6 +1529,10 @@ static void reshape_func ( int width, int height )
 
 	win_x = width;
 	win_y = height;
+
+	//keep the cells square in the new window shape
+	ScopedLock lock(simLock);
+	resizeGrid(gridHeight);
 }
 
 
@@ -1056,42 +1578,268 @@ static void post_display ( void )
 
 
 /**
- *  Draws OpenGL polygons that represent the fluid simulation. Also calles
- *  methods that trigger simulation steps. Most of the behavior of the 
- *  program is defined in this method. 
+ * Returns true while the simulation has to run on the render thread, because the GPU
+ * solver needs the GLUT window's OpenGL context.
+ */
+static bool isSimulatingOnRenderThread()
+{
+	return !useUserSolver && solver == gpuSolver;
+}
+
+
+
+/**
+ * Copies what the render thread needs from the solver into the next render frame and
+ * publishes it.
  *
+ * @param flSolver	fluid solver that was just updated
+ * @param users		user ids of the capture frame that was simulated
  */
-static void drawFunction ( void )
+static void publishRenderFrame(FluidSolver* flSolver, const Mat& users)
 {
+	ScopedTimer timer(PROFILE_PUBLISH);
+	static vector<unsigned char> lastColors;  //colors of the previous step
+	RenderFrame& frame = renderFrames.getWriteSlot();
+	int i, j;
+
+	frame.width      = gridWidth;
+	frame.height     = gridHeight;
+	frame.stateTicks = simClock.getStateTicks();
+	computeDensityColors(flSolver, frame.colors);
+
+	//drawDensity() blends from the previous step, unless the grid was resized since
+	if(lastColors.size() == frame.colors.size())
+		frame.prevColors = lastColors;
+	else
+		frame.prevColors.clear();
+	lastColors = frame.colors;
+
+	//bound cells in gray, the rest transparent
+	frame.bounds.resize(4 * (gridWidth+1) * (gridHeight+1));
+	unsigned char* texel = &frame.bounds[0];
+	for (j = 0; j <= gridHeight; j++)
+		for (i = 0; i <= gridWidth; i++, texel += 4) {
+			bool isBound = flSolver->isBoundAt(i,j);
+			texel[0] = texel[1] = texel[2] = isBound ? 77 : 0;  //0.30f
+			texel[3] = isBound ? 255 : 0;
+		}
+
+	if(dvel) {
+		frame.u.resize((gridWidth+2) * (gridHeight+2));
+		frame.v.resize((gridWidth+2) * (gridHeight+2));
+		for (j = 1; j <= gridHeight; j++)
+			for (i = 1; i <= gridWidth; i++) {
+				frame.u[IX(i,j)] = flSolver->getHorzVelocityAt(i,j);
+				frame.v[IX(i,j)] = flSolver->getVertVelocityAt(i,j);
+			}
+	}
+
+	users.copyTo(frame.users);
+	governor.describe(frame.governorStatus[0]);
+	governor.describeSettings(frame.governorStatus[1]);
+	renderFrames.publish();
+}
+
+
+
+/**
+ * Runs one simulation step on the newest capture frame and publishes the result.
+ * A capture frame's bounds and flow are used by the first step after it arrived.
+ * The caller must hold simLock.
+ */
+static void simulateFrame()
+{
+	AllocationScope allocations;
+	long long    start = Profiler::getTicks();
 	FluidSolver* flSolver;
-	bool dispUsr = useUserSolver && dusers;
+
+	//a mode change releases the fields of the solver it leaves
+	tryChangeMode();
 
 	if(useUserSolver)
 		flSolver = userSolver;
 	else 
 		flSolver = solver;
 
-	tryChangeMode();
-	pre_display();
-		loadImage();
+	//flow is only added once per capture frame, the bounds are kept until the next one
+	bool isNewCapture = captureFrames.update();
+	CaptureFrame& capture = captureFrames.getReadSlot();
 
-		defineBoundsFromImage          (flSolver, image);
-		getForcesFromMouse             (flSolver);
-		if(useFlow)  computeOpticalFlow(flSolver, flow);
-		emitSplashes                   (flSolver, flow);
+	//frames captured before a resizeGrid() do not match the cells any more
+	if(capture.depth.cols != gridWidth || capture.depth.rows != gridHeight) {
+		capture.depth.release();
+		capture.users.release();
+		isNewCapture = false;
+	}
 
+	if(!capture.depth.empty()) {
+		if(flSolver == gpuSolver)
+			defineBoundsFromTexture(gpuSolver, capture.depth);
+		else if(isNewCapture)
+			defineBoundsFromImage  (flSolver, capture.depth);
+	}
+	getForcesFromMouse(flSolver);
+	if(isNewCapture && useFlow && capture.hasFlow) {
+		//same pixel to cell mapping as defineBoundsFromImage()
+		flSolver->addVelocityFromFlow(capture.flow.ptr<float>(0), capture.flow.step, 
+									  capture.flow.cols, capture.flow.rows, FLOW_SCALAR);
+	}
+	if(!capture.depth.empty())
+		emitSplashes(flSolver, capture.flow, capture.users, isNewCapture);
+
+	{
+		ScopedTimer timer(PROFILE_SOLVER_UPDATE);
 		if(useUserSolver)
 			userSolver->update();
 		else
 			solver->update();
+	}
+
+	publishRenderFrame(flSolver, capture.users);
+	getProfiler().commit(PROFILE_SIMULATION);
+
+	//the governor judges the work of the step and the flow, not the wait for the Kinect
+	float milliseconds = (Profiler::getTicks() - start) * 1000.0f / Profiler::getTicksPerSecond();
+	bool  changed      = governor.addSimulationFrame(milliseconds);
+	if(isNewCapture && capture.hasFlow && governor.addCaptureFrame(capture.flowTime))
+		changed = true;
+	if(changed)
+		applyGovernorSettings();
+	countFrameAllocations(PROFILE_SIMULATION, allocations);
+}
+
+
+
+/**
+ * Runs the simulation steps that simClock says are due. The caller must hold simLock.
+ */
+static void runDueSteps()
+{
+	simClock.beginFrame();
+	while(simClock.nextStep())
+		simulateFrame();
+}
+
+
+
+/**
+ * Capture thread: waits for Kinect frames, resizes them, computes the optical flow and
+ * hands them to the simulation thread.
+ */
+static void captureLoop(void*)
+{
+	Mat prevFlowImg;
+
+	while(pipelineRunning) {
+		AllocationScope allocations;
+		CaptureFrame& capture = captureFrames.getWriteSlot();
+		if(loadImage(capture) != 0) {
+			getProfiler().commit(PROFILE_CAPTURE);
+			countFrameAllocations(PROFILE_CAPTURE, allocations);
+			sleepMilliseconds(CAPTURE_RETRY_DELAY);
+			continue;
+		}
+
+		computeOpticalFlow(capture, prevFlowImg);
+		getProfiler().commit(PROFILE_CAPTURE);
+		captureFrames.publish();
+		countFrameAllocations(PROFILE_CAPTURE, allocations);
+	}
+}
+
+
 
+/**
+ * Simulation thread: steps the solvers SIM_STEPS_PER_SECOND times per second, taking the
+ * newest capture frame at each step, and sleeps until the next step is due.
+ */
+static void simulationLoop(void*)
+{
+	while(pipelineRunning) {
+		int wait;
+		{
+			ScopedLock lock(simLock);
+			if(pipelineRunning && !isSimulatingOnRenderThread())
+				runDueSteps();
+			wait = simClock.getMillisecondsToNextStep();
+		}
+		//at least a millisecond, so the loop does not spin while the render thread simulates
+		sleepMilliseconds(max(wait, 1));
+	}
+}
+
+
+
+/**
+ * Starts the capture and simulation threads.
+ */
+static void startPipeline()
+{
+	pipelineRunning = true;
+	simClock.reset();
+	captureThread.start(captureLoop, NULL);
+	simThread.start(simulationLoop, NULL);
+}
 
-		if(dvel)     drawVelocity(flSolver);
-		else		 drawDensity(flSolver);
 
-		if(dbound)   drawBounds(flSolver);
-		if(dispUsr)  drawUsers();
-	post_display();
+
+/**
+ * Stops the capture and simulation threads and waits for them to finish.
+ */
+static void stopPipeline()
+{
+	pipelineRunning = false;
+	simThread.join();
+	captureThread.join();
+}
+
+
+
+/**
+ *  Draws OpenGL polygons that represent the fluid simulation. The simulation itself runs
+ *  on the simulation thread; this only draws its newest render frame, so the display is
+ *  never held up by the Kinect. Most of the behavior of the program is defined in 
+ *  simulateFrame().
+ *
+ */
+static void drawFunction ( void )
+{
+	AllocationScope allocations;  //includes the steps simulated on this thread
+	bool dispUsr = useUserSolver && dusers;
+
+	{
+		ScopedTimer timer(PROFILE_DRAW_FRAME);
+
+		//grid sizes asked for by the governor, the GPU solver is recreated in this context
+		if(requestedGridRows) {
+			ScopedLock lock(simLock);
+			if(requestedGridRows)
+				resizeGrid(requestedGridRows);
+			requestedGridRows = 0;
+		}
+
+		if(isSimulatingOnRenderThread()) {
+			ScopedLock lock(simLock);
+			if(isSimulatingOnRenderThread())
+				runDueSteps();
+		}
+
+		renderFrames.update();
+		const RenderFrame& frame = renderFrames.getReadSlot();
+
+		pre_display();
+			if(!frame.colors.empty()) {
+				if(dvel && !frame.u.empty()) drawVelocity(frame);
+				else		                 drawDensity(frame);
+
+				if(dbound)   drawBounds(frame);
+				if(dispUsr)  drawUsers(frame);
+			}
+			if(dprofile && !frame.colors.empty()) drawProfile(frame);
+		post_display();
+	}
+	getProfiler().commit(PROFILE_RENDER);
+	countFrameAllocations(PROFILE_RENDER, allocations);
 }
 
 
@@ -1127,6 +1875,11 @@ static void initOpenGl()
 static void toggleFullscreen()
 {
 	bool fullscreen = glutGameModeGet(GLUT_GAME_MODE_ACTIVE);
+
+	//textures do not survive the switch to another window's context
+	releaseGpuSolver();
+	fieldRenderer.release();
+
 	if(fullscreen) {
 		win_x = win_y = DEF_WINDOW_SIZE;
 		glutLeaveGameMode();
@@ -1183,8 +1936,28 @@ int main ( int argc, char ** argv )
 {
 	glutInit ( &argc, argv);
 
-	if ( argc != 1 && argc != 6 ) {
+	if ( argc == 3 && strcmp(argv[1], "-replay") == 0 ) {
+		replayPath = argv[2];
+	}
+	else if ( argc == 3 && strcmp(argv[1], "-kinects") == 0 ) {
+		kinectCount = max(1, min(atoi(argv[2]), (int)KinectArray::MAX_SENSORS));
+	}
+	else if ( argc == 6 && strcmp(argv[1], "-tile") == 0 ) {
+		//the left link receives on port and the right one on port + 1, so every tile of 
+		//the wall can be started with the same port
+		tilesAcross = max(2, atoi(argv[2]));
+		int port    = atoi(argv[3]);
+		if ( strcmp(argv[4], "-") != 0 )
+			tileLinks[EDGE_LEFT]  = new UdpHaloLink(port, argv[4], port + 1, TILE_HALO_TIMEOUT);
+		if ( strcmp(argv[5], "-") != 0 )
+			tileLinks[EDGE_RIGHT] = new UdpHaloLink(port + 1, argv[5], port, TILE_HALO_TIMEOUT);
+		governor.setEnabled(false);
+	}
+	else if ( argc != 1 && argc != 6 ) {
 		fprintf ( stderr, "usage : %s N dt diff visc force source\n", argv[0] );
+		fprintf ( stderr, "    or: %s -replay recording\n", argv[0] );
+		fprintf ( stderr, "    or: %s -kinects count\n", argv[0] );
+		fprintf ( stderr, "    or: %s -tile tiles port leftHost rightHost\n", argv[0] );
 		fprintf ( stderr, "where:\n" );\
 		fprintf ( stderr, "\t N      : grid resolution\n" );
 		fprintf ( stderr, "\t dt     : time step\n" );
@@ -1192,6 +1965,11 @@ int main ( int argc, char ** argv )
 		fprintf ( stderr, "\t visc   : viscosity of the fluid\n" );
 		fprintf ( stderr, "\t force  : scales the mouse movement that generate a force\n" );
 		fprintf ( stderr, "\t source : amount of density that will be deposited\n" );
+		fprintf ( stderr, "\t recording : Kinect frames recorded with the 'r' key, played back in a loop\n" );
+		fprintf ( stderr, "\t count  : Kinects side by side, each covers an equal slice of the wall (at most %d)\n", KinectArray::MAX_SENSORS );
+		fprintf ( stderr, "\t tiles  : number of windows side by side that simulate one wall together\n" );
+		fprintf ( stderr, "\t port   : UDP port of the left neighbor's halo, port + 1 is the right one's\n" );
+		fprintf ( stderr, "\t leftHost, rightHost : neighboring tiles, '-' for the edge of the wall\n" );
 		exit ( 1 );
 	}
 
@@ -1201,12 +1979,26 @@ int main ( int argc, char ** argv )
 	printf ( "\t Add bounds with the middle mouse button\n" );
 	printf ( "\t Add velocities with the left mouse button and dragging the mouse\n" );
 	printf ( "\t Toggle use of optical flow with the 'f' key.\n" );
+	printf ( "\t Toggle dense / sparse (edge tracking) optical flow with the 'l' key.\n" );
+	printf ( "\t Toggle red-black (multithreaded) Gauss-Seidel with the 'g' key.\n" );
+	printf ( "\t Toggle multigrid pressure solver with the 'm' key.\n" );
+	printf ( "\t Toggle SIMD / scalar solver kernels with the 'x' key.\n" );
+	printf ( "\t Toggle MacCormack (sharper) advection with the 'a' key.\n" );
+	printf ( "\t Toggle vorticity confinement (livelier swirls) with the 'n' key.\n" );
+	printf ( "\t Toggle buoyancy (rising fluid, single color modes) with the 'h' key.\n" );
+	printf ( "\t Toggle GPU solver (single color modes) with the 'p' key.\n" );
+	printf ( "\t Decrease / increase the grid resolution with the '[' and ']' keys.\n" );
+	printf ( "\t Toggle the frame governor (%.1f ms budget) with the 'j' key.\n", FRAME_BUDGET_MS );
+	if ( tilesAcross > 1 )
+		printf ( "\t Tile of a %d window wall: keep the window size, grid and modes of all tiles the same.\n", tilesAcross );
 	printf ( "\t Clear the simulation with the 'c' key\n" );
 	printf ( " DISPLAY:\n");
 	printf ( "\t Toggle fullscreen mode with the 'q' key.\n" );
 	printf ( "\t Toggle density/velocity display with the 'v' key.\n" );
 	printf ( "\t Toggle bounds display with the 'b' key.\n" );
 	printf ( "\t Toggle users display with the 'u' key.\n" );
+	printf ( "\t Toggle stage timing overlay with the 't' key.\n" );
+	printf ( "\t Toggle writing stage timings to %s with the 'e' key.\n", PROFILE_CSV_FILE );
 	printf ( " MODES:\n");
 	printf ( "\t '0' key: Toggle Automatic Mode Change.\n" );
 	printf ( "\t '1' key: Switch to mode 1: Single user, blue fluid.\n" );
@@ -1219,7 +2011,8 @@ int main ( int argc, char ** argv )
 	printf ( "\t Reset Kinect motor angle with the SPACEBAR key.\n" );
 	printf ( "\t Increase Kinect depth thrshold angle with the 'o' key.\n" );
 	printf ( "\t Decrease Kinect depth thrshold angle with the 'k' key.\n" );
-	printf ( "\t Reset the Kinect with the + key \n\n" );
+	printf ( "\t Reset the Kinect with the + key \n" );
+	printf ( "\t Toggle recording the (first) Kinect's frames to %s with the 'r' key.\n\n", RECORDING_FILE );
 	printf ( " Quit with the 'ESC' key.\n" );
 
 	dvel = false;
@@ -1236,5 +2029,6 @@ int main ( int argc, char ** argv )
 
 	open_glut_window();
 
+	startPipeline();
 	glutMainLoop();
 }
\ No newline at end of file